@@ -100,6 +100,7 @@ struct camqp_config_s {
   char *postfix;
   char escape_char;
   unsigned int graphite_flags;
+  format_graphite_cache_t *graphite_cache;
 
   /* subscribe only */
   char *exchange_type;
@@ -167,6 +168,7 @@ static void camqp_config_free(void *ptr) /* {{{ */
   sfree(conf->routing_key);
   sfree(conf->prefix);
   sfree(conf->postfix);
+  format_graphite_cache_destroy(conf->graphite_cache);
 
   sfree(conf);
 } /* }}} void camqp_config_free */
@@ -792,11 +794,15 @@ static int camqp_write(const data_set_t *ds, const value_list_t *vl, /* {{{ */
   camqp_config_t *conf = user_data->data;
   char routing_key[6 * DATA_MAX_NAME_LEN];
   char buffer[8192];
+  char const *payload = buffer;
+  json_buffer_t json;
   int status;
 
   if ((ds == NULL) || (vl == NULL) || (conf == NULL))
     return EINVAL;
 
+  json_buffer_init(&json);
+
   if (conf->routing_key != NULL) {
     sstrncpy(routing_key, conf->routing_key, sizeof(routing_key));
   } else {
@@ -821,16 +827,23 @@ static int camqp_write(const data_set_t *ds, const value_list_t *vl, /* {{{ */
       return status;
     }
   } else if (conf->format == CAMQP_FORMAT_JSON) {
-    size_t bfree = sizeof(buffer);
-    size_t bfill = 0;
-
-    format_json_initialize(buffer, &bfill, &bfree);
-    format_json_value_list(buffer, &bfill, &bfree, ds, vl, conf->store_rates);
-    format_json_finalize(buffer, &bfill, &bfree);
+    /* Value lists are not limited by the size of `buffer' in this format. */
+    status = json_buffer_append(&json, "[", 1);
+    if (status == 0)
+      status = format_json_value_list_object(&json, ds, vl, conf->store_rates);
+    if (status == 0)
+      status = json_buffer_append(&json, "]", 1);
+    if (status != 0) {
+      ERROR("amqp plugin: Formatting JSON failed with status %i.", status);
+      json_buffer_free(&json);
+      return status;
+    }
+    payload = json.ptr;
   } else if (conf->format == CAMQP_FORMAT_GRAPHITE) {
-    status =
-        format_graphite(buffer, sizeof(buffer), ds, vl, conf->prefix,
-                        conf->postfix, conf->escape_char, conf->graphite_flags);
+    status = format_graphite_cached(conf->graphite_cache, buffer,
+                                    sizeof(buffer), ds, vl, conf->prefix,
+                                    conf->postfix, conf->escape_char,
+                                    conf->graphite_flags);
     if (status != 0) {
       ERROR("amqp plugin: format_graphite failed with status %i.", status);
       return status;
@@ -841,9 +854,10 @@ static int camqp_write(const data_set_t *ds, const value_list_t *vl, /* {{{ */
   }
 
   pthread_mutex_lock(&conf->lock);
-  status = camqp_write_locked(conf, buffer, routing_key);
+  status = camqp_write_locked(conf, payload, routing_key);
   pthread_mutex_unlock(&conf->lock);
 
+  json_buffer_free(&json);
   return status;
 } /* }}} int camqp_write */
 
@@ -1083,6 +1097,11 @@ static int camqp_config_connection(oconfig_item_t *ci, /* {{{ */
 
   if (publish) {
     char cbname[128];
+
+    /* If this fails, metric paths are simply built for every value list. */
+    if (conf->format == CAMQP_FORMAT_GRAPHITE)
+      conf->graphite_cache = format_graphite_cache_create();
+
     ssnprintf(cbname, sizeof(cbname), "amqp/%s", conf->name);
 
     status = plugin_register_write(cbname, camqp_write,
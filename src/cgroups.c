@@ -24,66 +24,154 @@
 #include "collectd.h"
 
 #include "plugin.h"
+#include "utils/avltree/avltree.h"
 #include "utils/common/common.h"
 #include "utils/ignorelist/ignorelist.h"
 #include "utils/mount/mount.h"
 
-static char const *config_keys[] = {"CGroup", "IgnoreSelected"};
+#include <sys/inotify.h>
+#include <sys/resource.h>
+
+#define CG_BUFFER_SIZE 65536
+#define CG_READ_CHUNK 16
+
+static char const *config_keys[] = {"CGroup", "IgnoreSelected", "ReadThreads"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static ignorelist_t *il_cgroup;
-
-__attribute__((nonnull(1))) __attribute__((nonnull(2))) static void
-cgroups_submit_one(char const *plugin_instance, char const *type_instance,
-                   value_t value) {
+static int read_threads = 1;
+
+/* Files read for each cgroup. The first one is read in the cgroup v1
+ * "cpuacct" hierarchy, the others in the unified (v2) hierarchy. */
+enum {
+  CG_FILE_CPUACCT_STAT = 0,
+  CG_FILE_CPU_STAT,
+  CG_FILE_MEMORY_STAT,
+  CG_FILE_IO_STAT,
+  CG_FILE_CPU_PRESSURE,
+  CG_FILE_MEMORY_PRESSURE,
+  CG_FILE_IO_PRESSURE,
+  CG_FILE_MAX,
+};
+
+static char const *const cg_file_names[CG_FILE_MAX] = {
+    [CG_FILE_CPUACCT_STAT] = "cpuacct.stat",
+    [CG_FILE_CPU_STAT] = "cpu.stat",
+    [CG_FILE_MEMORY_STAT] = "memory.stat",
+    [CG_FILE_IO_STAT] = "io.stat",
+    [CG_FILE_CPU_PRESSURE] = "cpu.pressure",
+    [CG_FILE_MEMORY_PRESSURE] = "memory.pressure",
+    [CG_FILE_IO_PRESSURE] = "io.pressure",
+};
+
+/* Values of cg_group_t.fds which are not file descriptors. */
+#define CG_FD_CLOSED (-1)
+#define CG_FD_MISSING (-2)
+
+typedef struct {
+  char *path;
+  /* The plugin instance: the basename of path in the cpuacct hierarchy. In
+   * the unified hierarchy names repeat at different levels, so the path below
+   * the mount point is used there, with '/' replaced by '-'. */
+  char *name;
+  bool ignored;
+
+  /* The files are kept open and re-read with pread(2), see cg_read_file. */
+  int fds[CG_FILE_MAX];
+
+  bool seen;
+  bool gone;
+} cg_group_t;
+
+typedef struct {
+  char *path;
+  int depth;
+} cg_dir_t;
+
+/* The hierarchy being read. In the cpuacct hierarchy only cgroups two levels
+ * below the mount point are read, in the unified hierarchy all of them. */
+static char *cg_root;
+static int cg_version;
+static int cg_min_depth;
+static int cg_max_depth;
+
+/* Path -> cg_group_t */
+static c_avl_tree_t *cg_groups;
+
+/* New and removed cgroups are noticed with inotify. If that is not possible
+ * the hierarchy is scanned on every read. */
+static int cg_inotify_fd = -1;
+/* Watch descriptor -> cg_dir_t */
+static c_avl_tree_t *cg_watches;
+static bool cg_rescan = true;
+
+/* Open files count against a budget so that other plugins are left enough
+ * file descriptors. Files above the budget are opened on every read. */
+static pthread_mutex_t cg_fds_lock = PTHREAD_MUTEX_INITIALIZER;
+static long cg_fds_num;
+static long cg_fds_max;
+
+static uint64_t cg_usec_per_tick = 10000;
+
+__attribute__((nonnull(1))) __attribute__((nonnull(2)))
+__attribute__((nonnull(3))) static void
+cgroups_submit(char const *plugin_instance, char const *type,
+               char const *type_instance, value_t *values,
+               size_t values_len) {
   value_list_t vl = VALUE_LIST_INIT;
 
-  vl.values = &value;
-  vl.values_len = 1;
+  vl.values = values;
+  vl.values_len = values_len;
   sstrncpy(vl.plugin, "cgroups", sizeof(vl.plugin));
   sstrncpy(vl.plugin_instance, plugin_instance, sizeof(vl.plugin_instance));
-  sstrncpy(vl.type, "cpu", sizeof(vl.type));
+  sstrncpy(vl.type, type, sizeof(vl.type));
   sstrncpy(vl.type_instance, type_instance, sizeof(vl.type_instance));
 
   plugin_dispatch_values(&vl);
-} /* void cgroups_submit_one */
+} /* void cgroups_submit */
 
 /*
- * This callback reads the user/system CPU time for each cgroup.
+ * Parsing the cgroup files
  */
-static int read_cpuacct_procs(const char *dirname, char const *cgroup_name,
-                              void *user_data) {
-  char abs_path[PATH_MAX];
-  struct stat statbuf;
-  char buf[1024];
-  int status;
-
-  FILE *fh;
-
-  if (ignorelist_match(il_cgroup, cgroup_name))
-    return 0;
-
-  snprintf(abs_path, sizeof(abs_path), "%s/%s", dirname, cgroup_name);
-
-  status = lstat(abs_path, &statbuf);
-  if (status != 0) {
-    ERROR("cgroups plugin: stat (\"%s\") failed.", abs_path);
-    return -1;
-  }
-
-  /* We are only interested in directories, so skip everything else. */
-  if (!S_ISDIR(statbuf.st_mode))
-    return 0;
-
-  snprintf(abs_path, sizeof(abs_path), "%s/%s/cpuacct.stat", dirname,
-           cgroup_name);
-  fh = fopen(abs_path, "r");
-  if (fh == NULL) {
-    ERROR("cgroups plugin: fopen (\"%s\") failed: %s", abs_path, STRERRNO);
-    return -1;
-  }
-
-  while (fgets(buf, sizeof(buf), fh) != NULL) {
+#define CG_UNIT_NONE 0
+/* Microseconds to USER_HZ ticks, the unit of cpuacct.stat. */
+#define CG_UNIT_USEC_TICKS 1
+#define CG_UNIT_USEC_MS 2
+
+typedef struct {
+  char const *key;
+  char const *type;
+  char const *type_instance;
+  int ds_type;
+  int unit;
+} cg_key_t;
+
+static cg_key_t const cg_cpu_keys[] = {
+    {"user_usec", "cpu", "user", DS_TYPE_DERIVE, CG_UNIT_USEC_TICKS},
+    {"system_usec", "cpu", "system", DS_TYPE_DERIVE, CG_UNIT_USEC_TICKS},
+    {"nr_throttled", "operations", "throttled", DS_TYPE_DERIVE, CG_UNIT_NONE},
+    {"throttled_usec", "total_time_in_ms", "throttled", DS_TYPE_DERIVE,
+     CG_UNIT_USEC_MS},
+};
+
+static cg_key_t const cg_memory_keys[] = {
+    {"anon", "memory", "anon", DS_TYPE_GAUGE, CG_UNIT_NONE},
+    {"file", "memory", "file", DS_TYPE_GAUGE, CG_UNIT_NONE},
+    {"kernel_stack", "memory", "kernel_stack", DS_TYPE_GAUGE, CG_UNIT_NONE},
+    {"pagetables", "memory", "pagetables", DS_TYPE_GAUGE, CG_UNIT_NONE},
+    {"slab", "memory", "slab", DS_TYPE_GAUGE, CG_UNIT_NONE},
+    {"sock", "memory", "sock", DS_TYPE_GAUGE, CG_UNIT_NONE},
+    {"shmem", "memory", "shmem", DS_TYPE_GAUGE, CG_UNIT_NONE},
+    {"pgfault", "vmpage_action", "fault", DS_TYPE_DERIVE, CG_UNIT_NONE},
+    {"pgmajfault", "vmpage_action", "majfault", DS_TYPE_DERIVE, CG_UNIT_NONE},
+};
+
+/* read_cpuacct_stat reads the user/system CPU time of a v1 cgroup. */
+static void read_cpuacct_stat(cg_group_t const *g, char *buffer) {
+  char *saveptr = NULL;
+
+  for (char *line = strtok_r(buffer, "\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\n", &saveptr)) {
     char *fields[8];
     int numfields = 0;
     char *key;
@@ -100,8 +188,7 @@ static int read_cpuacct_procs(const char *dirname, char const *cgroup_name,
      *   user 12345
      *   system 23456
      */
-    strstripnewline(buf);
-    numfields = strsplit(buf, fields, STATIC_ARRAY_SIZE(fields));
+    numfields = strsplit(line, fields, STATIC_ARRAY_SIZE(fields));
     if (numfields != 2)
       continue;
 
@@ -114,50 +201,670 @@ static int read_cpuacct_procs(const char *dirname, char const *cgroup_name,
     if (key[key_len - 1] == ':')
       key[key_len - 1] = '\0';
 
-    status = parse_value(fields[1], &value, DS_TYPE_DERIVE);
-    if (status != 0)
+    if (parse_value(fields[1], &value, DS_TYPE_DERIVE) != 0)
       continue;
 
-    cgroups_submit_one(cgroup_name, key, value);
+    cgroups_submit(g->name, "cpu", key, &value, 1);
   }
+} /* void read_cpuacct_stat */
 
-  fclose(fh);
-  return 0;
-} /* int read_cpuacct_procs */
+/* read_keys reads flat "key value" files, such as cpu.stat and memory.stat.
+ */
+static void read_keys(cg_group_t const *g, char *buffer, cg_key_t const *keys,
+                      size_t keys_num) {
+  char *saveptr = NULL;
+
+  for (char *line = strtok_r(buffer, "\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\n", &saveptr)) {
+    char *fields[4];
+    if (strsplit(line, fields, STATIC_ARRAY_SIZE(fields)) != 2)
+      continue;
+
+    cg_key_t const *k = NULL;
+    for (size_t i = 0; i < keys_num; i++) {
+      if (strcmp(fields[0], keys[i].key) == 0) {
+        k = keys + i;
+        break;
+      }
+    }
+    if (k == NULL)
+      continue;
+
+    char *endptr = NULL;
+    errno = 0;
+    uint64_t raw = (uint64_t)strtoull(fields[1], &endptr, 10);
+    if ((errno != 0) || (endptr == fields[1]))
+      continue;
+
+    if (k->unit == CG_UNIT_USEC_TICKS)
+      raw /= cg_usec_per_tick;
+    else if (k->unit == CG_UNIT_USEC_MS)
+      raw /= 1000;
+
+    value_t value;
+    if (k->ds_type == DS_TYPE_GAUGE)
+      value.gauge = (gauge_t)raw;
+    else
+      value.derive = (derive_t)raw;
+
+    cgroups_submit(g->name, k->type, k->type_instance, &value, 1);
+  }
+} /* void read_keys */
+
+/* read_io_stat reads the I/O of a cgroup, summed up over all devices:
+ *
+ *   8:0 rbytes=1 wbytes=2 rios=3 wios=4 dbytes=0 dios=0
+ */
+static void read_io_stat(cg_group_t const *g, char *buffer) {
+  derive_t rbytes = 0, wbytes = 0, rios = 0, wios = 0;
+  char *saveptr = NULL;
+
+  for (char *line = strtok_r(buffer, "\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\n", &saveptr)) {
+    char *fields[16];
+    int numfields = strsplit(line, fields, STATIC_ARRAY_SIZE(fields));
+
+    for (int i = 1; i < numfields; i++) {
+      char *value = strchr(fields[i], '=');
+      if (value == NULL)
+        continue;
+      *value = 0;
+      value++;
+
+      derive_t *sum = NULL;
+      if (strcmp("rbytes", fields[i]) == 0)
+        sum = &rbytes;
+      else if (strcmp("wbytes", fields[i]) == 0)
+        sum = &wbytes;
+      else if (strcmp("rios", fields[i]) == 0)
+        sum = &rios;
+      else if (strcmp("wios", fields[i]) == 0)
+        sum = &wios;
+      else
+        continue;
+
+      *sum += (derive_t)strtoull(value, NULL, 10);
+    }
+  }
+
+  value_t octets[] = {{.derive = rbytes}, {.derive = wbytes}};
+  value_t ops[] = {{.derive = rios}, {.derive = wios}};
+  cgroups_submit(g->name, "disk_octets", "", octets,
+                 STATIC_ARRAY_SIZE(octets));
+  cgroups_submit(g->name, "disk_ops", "", ops, STATIC_ARRAY_SIZE(ops));
+} /* void read_io_stat */
+
+/* read_pressure reads the total stall time from a pressure stall information
+ * file:
+ *
+ *   some avg10=0.00 avg60=0.00 avg300=0.00 total=12345
+ *   full avg10=0.00 avg60=0.00 avg300=0.00 total=6789
+ */
+static void read_pressure(cg_group_t const *g, char *buffer,
+                          char const *resource) {
+  char *saveptr = NULL;
+
+  for (char *line = strtok_r(buffer, "\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\n", &saveptr)) {
+    char *fields[8];
+    int numfields = strsplit(line, fields, STATIC_ARRAY_SIZE(fields));
+    if (numfields < 2)
+      continue;
+
+    char const *total = NULL;
+    for (int i = 1; i < numfields; i++)
+      if (strncmp("total=", fields[i], strlen("total=")) == 0)
+        total = fields[i] + strlen("total=");
+    if (total == NULL)
+      continue;
+
+    char type_instance[DATA_MAX_NAME_LEN];
+    ssnprintf(type_instance, sizeof(type_instance), "pressure-%s-%s",
+              resource, fields[0]);
+
+    value_t value = {.derive = (derive_t)(strtoull(total, NULL, 10) / 1000)};
+    cgroups_submit(g->name, "total_time_in_ms", type_instance, &value, 1);
+  }
+} /* void read_pressure */
+
+/*
+ * Reading the cgroups
+ */
+static bool cg_fd_reserve(void) {
+  bool ok = false;
+
+  pthread_mutex_lock(&cg_fds_lock);
+  if (cg_fds_num < cg_fds_max) {
+    cg_fds_num++;
+    ok = true;
+  }
+  pthread_mutex_unlock(&cg_fds_lock);
+
+  return ok;
+} /* bool cg_fd_reserve */
+
+static void cg_fd_release(void) {
+  pthread_mutex_lock(&cg_fds_lock);
+  cg_fds_num--;
+  pthread_mutex_unlock(&cg_fds_lock);
+} /* void cg_fd_release */
+
+/* cg_read_file reads one of the cgroup's files into buffer. The file is kept
+ * open if the budget allows; cgroup files are re-generated when read from
+ * offset zero. Returns the number of bytes read, or -1 and sets errno. */
+static ssize_t cg_read_file(cg_group_t *g, int file, char *buffer,
+                            size_t buffer_size) {
+  int fd = g->fds[file];
+  bool cached = (fd >= 0);
+
+  if (fd == CG_FD_MISSING) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  if (fd == CG_FD_CLOSED) {
+    char path[PATH_MAX];
+    ssnprintf(path, sizeof(path), "%s/%s", g->path, cg_file_names[file]);
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      /* The controller is not enabled for this cgroup. */
+      if (errno == ENOENT)
+        g->fds[file] = CG_FD_MISSING;
+      return -1;
+    }
+
+    cached = cg_fd_reserve();
+    if (cached)
+      g->fds[file] = fd;
+  }
+
+  ssize_t len = pread(fd, buffer, buffer_size - 1, 0);
+  int status = errno;
+  if (cached && (len < 0)) {
+    g->fds[file] = CG_FD_CLOSED;
+    cg_fd_release();
+  }
+  if (!cached || (len < 0))
+    close(fd);
+  if (len < 0) {
+    errno = status;
+    return -1;
+  }
+
+  buffer[len] = 0;
+  return len;
+} /* ssize_t cg_read_file */
+
+static void cg_read_group(cg_group_t *g, char *buffer, size_t buffer_size) {
+  for (int file = 0; file < CG_FILE_MAX; file++) {
+    if (g->fds[file] == CG_FD_MISSING)
+      continue;
+
+    if (cg_read_file(g, file, buffer, buffer_size) < 0) {
+      /* ENODEV: The cgroup has been removed. */
+      if (errno == ENODEV) {
+        g->gone = true;
+        return;
+      }
+      if (errno != ENOENT)
+        ERROR("cgroups plugin: Reading \"%s/%s\" failed: %s", g->path,
+              cg_file_names[file], STRERRNO);
+      continue;
+    }
+
+    switch (file) {
+    case CG_FILE_CPUACCT_STAT:
+      read_cpuacct_stat(g, buffer);
+      break;
+    case CG_FILE_CPU_STAT:
+      read_keys(g, buffer, cg_cpu_keys, STATIC_ARRAY_SIZE(cg_cpu_keys));
+      break;
+    case CG_FILE_MEMORY_STAT:
+      read_keys(g, buffer, cg_memory_keys, STATIC_ARRAY_SIZE(cg_memory_keys));
+      break;
+    case CG_FILE_IO_STAT:
+      read_io_stat(g, buffer);
+      break;
+    case CG_FILE_CPU_PRESSURE:
+      read_pressure(g, buffer, "cpu");
+      break;
+    case CG_FILE_MEMORY_PRESSURE:
+      read_pressure(g, buffer, "memory");
+      break;
+    case CG_FILE_IO_PRESSURE:
+      read_pressure(g, buffer, "io");
+      break;
+    }
+  }
+} /* void cg_read_group */
+
+/* The cgroups are read by up to `ReadThreads' threads, each taking
+ * CG_READ_CHUNK cgroups at a time. */
+typedef struct {
+  cg_group_t **groups;
+  size_t groups_num;
+  size_t next;
+  pthread_mutex_t lock;
+} cg_read_queue_t;
+
+static void *cg_read_thread(void *arg) {
+  cg_read_queue_t *q = arg;
+
+  char *buffer = malloc(CG_BUFFER_SIZE);
+  if (buffer == NULL)
+    return NULL;
+
+  while (42) {
+    pthread_mutex_lock(&q->lock);
+    size_t begin = q->next;
+    size_t end = begin + CG_READ_CHUNK;
+    if (end > q->groups_num)
+      end = q->groups_num;
+    q->next = end;
+    pthread_mutex_unlock(&q->lock);
+
+    if (begin >= end)
+      break;
+
+    for (size_t i = begin; i < end; i++)
+      cg_read_group(q->groups[i], buffer, CG_BUFFER_SIZE);
+  }
+
+  free(buffer);
+  return NULL;
+} /* void *cg_read_thread */
+
+static void cg_read_groups(cg_group_t **groups, size_t groups_num) {
+  cg_read_queue_t q = {
+      .groups = groups,
+      .groups_num = groups_num,
+  };
+  pthread_mutex_init(&q.lock, NULL);
+
+  size_t threads_max = (size_t)read_threads - 1;
+  if (threads_max > groups_num / CG_READ_CHUNK)
+    threads_max = groups_num / CG_READ_CHUNK;
+
+  pthread_t *threads = NULL;
+  size_t threads_num = 0;
+  if (threads_max > 0)
+    threads = calloc(threads_max, sizeof(*threads));
+  while ((threads != NULL) && (threads_num < threads_max)) {
+    if (plugin_thread_create(threads + threads_num, cg_read_thread, &q,
+                             "cgroups read") != 0)
+      break;
+    threads_num++;
+  }
+
+  cg_read_thread(&q);
+  for (size_t i = 0; i < threads_num; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+
+  pthread_mutex_destroy(&q.lock);
+} /* void cg_read_groups */
 
 /*
- * Gets called for every file/folder in /sys/fs/cgroup/cpu,cpuacct (or
- * wherever cpuacct is mounted on the system). Calls walk_directory with the
- * read_cpuacct_procs callback on every folder it finds, such as "system".
+ * Keeping track of the cgroups
  */
-static int read_cpuacct_root(const char *dirname, const char *filename,
-                             void *user_data) {
-  char abs_path[PATH_MAX];
-  struct stat statbuf;
-  int status;
+static void cg_group_destroy(cg_group_t *g) {
+  if (g == NULL)
+    return;
+
+  for (int file = 0; file < CG_FILE_MAX; file++) {
+    if (g->fds[file] < 0)
+      continue;
+    close(g->fds[file]);
+    cg_fd_release();
+  }
+  free(g->path);
+  free(g->name);
+  free(g);
+} /* void cg_group_destroy */
+
+static void cg_group_add(char const *path) {
+  cg_group_t *g = NULL;
+
+  if (c_avl_get(cg_groups, path, (void *)&g) == 0) {
+    g->seen = true;
+    return;
+  }
+
+  g = calloc(1, sizeof(*g));
+  if (g == NULL)
+    return;
+  g->path = strdup(path);
+  if (cg_version == 1)
+    g->name = strdup(strrchr(path, '/') + 1);
+  else
+    g->name = strdup(path + strlen(cg_root) + 1);
+  if ((g->path == NULL) || (g->name == NULL)) {
+    free(g->path);
+    free(g->name);
+    free(g);
+    return;
+  }
+  for (char *ptr = g->name; *ptr != 0; ptr++)
+    if (*ptr == '/')
+      *ptr = '-';
+  g->ignored = ignorelist_match(il_cgroup, g->name) != 0;
+  g->seen = true;
+
+  for (int file = 0; file < CG_FILE_MAX; file++) {
+    if ((cg_version == 1) == (file == CG_FILE_CPUACCT_STAT))
+      g->fds[file] = CG_FD_CLOSED;
+    else
+      g->fds[file] = CG_FD_MISSING;
+  }
+
+  if (c_avl_insert(cg_groups, g->path, g) != 0)
+    cg_group_destroy(g);
+} /* void cg_group_add */
+
+static void cg_group_remove(char const *path) {
+  cg_group_t *g = NULL;
+
+  if (c_avl_remove(cg_groups, path, NULL, (void *)&g) == 0)
+    cg_group_destroy(g);
+} /* void cg_group_remove */
+
+static int cg_wd_compare(void const *a, void const *b) {
+  intptr_t wd_a = (intptr_t)a;
+  intptr_t wd_b = (intptr_t)b;
+  return (wd_a > wd_b) - (wd_a < wd_b);
+} /* int cg_wd_compare */
+
+static void cg_watches_destroy(void) {
+  if (cg_watches != NULL) {
+    void *wd;
+    cg_dir_t *d;
+    while (c_avl_pick(cg_watches, &wd, (void *)&d) == 0) {
+      free(d->path);
+      free(d);
+    }
+    c_avl_destroy(cg_watches);
+    cg_watches = NULL;
+  }
+
+  if (cg_inotify_fd >= 0) {
+    close(cg_inotify_fd);
+    cg_inotify_fd = -1;
+  }
+} /* void cg_watches_destroy */
+
+static void cg_watch_add(char const *path, int depth) {
+  if (cg_inotify_fd < 0)
+    return;
+
+  int wd = inotify_add_watch(cg_inotify_fd, path,
+                             IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                 IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW);
+  if (wd < 0) {
+    if ((errno == ENOSPC) || (errno == ENOMEM)) {
+      WARNING("cgroups plugin: The inotify watch limit "
+              "(fs.inotify.max_user_watches) has been reached. The cgroup "
+              "hierarchy will be scanned on every read.");
+      cg_watches_destroy();
+    }
+    return;
+  }
+
+  cg_dir_t *d = NULL;
+  if (c_avl_get(cg_watches, (void *)(intptr_t)wd, (void *)&d) == 0) {
+    if (strcmp(d->path, path) == 0)
+      return;
+    c_avl_remove(cg_watches, (void *)(intptr_t)wd, NULL, NULL);
+    free(d->path);
+    free(d);
+  }
+
+  d = calloc(1, sizeof(*d));
+  if (d == NULL)
+    return;
+  d->path = strdup(path);
+  d->depth = depth;
+  if ((d->path == NULL) ||
+      (c_avl_insert(cg_watches, (void *)(intptr_t)wd, d) != 0)) {
+    free(d->path);
+    free(d);
+  }
+} /* void cg_watch_add */
+
+/* cg_scan adds the cgroup at path, which is depth levels below the mount
+ * point, and everything below it. */
+static int cg_scan(char const *path, int depth) {
+  if (depth >= cg_min_depth)
+    cg_group_add(path);
+  if (depth >= cg_max_depth)
+    return 0;
 
-  snprintf(abs_path, sizeof(abs_path), "%s/%s", dirname, filename);
+  /* The watch is added first so that no cgroup created in between is
+   * missed. */
+  cg_watch_add(path, depth);
 
-  status = lstat(abs_path, &statbuf);
-  if (status != 0) {
-    ERROR("cgroups plugin: stat (%s) failed.", abs_path);
+  DIR *dh = opendir(path);
+  if (dh == NULL) {
+    if (errno != ENOENT)
+      ERROR("cgroups plugin: Cannot open \"%s\": %s", path, STRERRNO);
     return -1;
   }
 
-  if (S_ISDIR(statbuf.st_mode)) {
-    status = walk_directory(abs_path, read_cpuacct_procs,
-                            /* user_data = */ NULL,
-                            /* include_hidden = */ 0);
-    return status;
+  struct dirent *ent;
+  while ((ent = readdir(dh)) != NULL) {
+    if (ent->d_name[0] == '.')
+      continue;
+
+    if (ent->d_type == DT_UNKNOWN) {
+      struct stat statbuf;
+      if ((fstatat(dirfd(dh), ent->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) !=
+           0) ||
+          !S_ISDIR(statbuf.st_mode))
+        continue;
+    } else if (ent->d_type != DT_DIR) {
+      continue;
+    }
+
+    char child[PATH_MAX];
+    if (ssnprintf(child, sizeof(child), "%s/%s", path, ent->d_name) >=
+        (int)sizeof(child))
+      continue;
+    cg_scan(child, depth + 1);
   }
 
+  closedir(dh);
   return 0;
-}
+} /* int cg_scan */
+
+static int cg_rescan_all(void) {
+  c_avl_iterator_t *iter = c_avl_get_iterator(cg_groups);
+  char *path;
+  cg_group_t *g;
+  while (c_avl_iterator_next(iter, (void *)&path, (void *)&g) == 0)
+    g->seen = false;
+  c_avl_iterator_destroy(iter);
+
+  if (cg_scan(cg_root, 0) != 0)
+    return -1;
+
+  /* Remove the cgroups which are gone. */
+  cg_group_t **gone = calloc((size_t)c_avl_size(cg_groups) + 1, sizeof(*gone));
+  if (gone == NULL)
+    return -1;
+
+  size_t gone_num = 0;
+  iter = c_avl_get_iterator(cg_groups);
+  while (c_avl_iterator_next(iter, (void *)&path, (void *)&g) == 0)
+    if (!g->seen)
+      gone[gone_num++] = g;
+  c_avl_iterator_destroy(iter);
+
+  for (size_t i = 0; i < gone_num; i++)
+    cg_group_remove(gone[i]->path);
+  free(gone);
+
+  return 0;
+} /* int cg_rescan_all */
+
+/* cg_handle_events processes the pending inotify events. */
+static void cg_handle_events(void) {
+  char buffer[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  while (cg_inotify_fd >= 0) {
+    ssize_t len = read(cg_inotify_fd, buffer, sizeof(buffer));
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN) {
+        ERROR("cgroups plugin: Reading inotify events failed: %s", STRERRNO);
+        cg_watches_destroy();
+      }
+      return;
+    }
+
+    struct inotify_event *ev;
+    for (char *ptr = buffer; ptr < buffer + len;
+         ptr += sizeof(*ev) + ev->len) {
+      ev = (struct inotify_event *)ptr;
+
+      if (ev->mask & IN_Q_OVERFLOW) {
+        cg_rescan = true;
+        continue;
+      }
+
+      cg_dir_t *d = NULL;
+      if (c_avl_get(cg_watches, (void *)(intptr_t)ev->wd, (void *)&d) != 0)
+        continue;
+
+      if (ev->mask & IN_IGNORED) {
+        /* The mount point itself is gone. */
+        if (d->depth == 0)
+          cg_rescan = true;
+        c_avl_remove(cg_watches, (void *)(intptr_t)ev->wd, NULL, NULL);
+        free(d->path);
+        free(d);
+        continue;
+      }
+
+      if (!(ev->mask & IN_ISDIR) || (ev->len == 0) || (ev->name[0] == '.'))
+        continue;
+
+      /* Renamed cgroups may have children, whose paths change as well. */
+      if (ev->mask & (IN_MOVED_FROM | IN_MOVED_TO)) {
+        cg_rescan = true;
+        continue;
+      }
+
+      char child[PATH_MAX];
+      if (ssnprintf(child, sizeof(child), "%s/%s", d->path, ev->name) >=
+          (int)sizeof(child))
+        continue;
+
+      if (ev->mask & IN_CREATE)
+        cg_scan(child, d->depth + 1);
+      else if (ev->mask & IN_DELETE)
+        cg_group_remove(child);
+
+      /* Adding a watch may have failed, see cg_watch_add. */
+      if (cg_inotify_fd < 0)
+        return;
+    }
+  }
+} /* void cg_handle_events */
+
+static void cg_hierarchy_reset(void) {
+  cg_watches_destroy();
+
+  if (cg_groups != NULL) {
+    char *path;
+    cg_group_t *g;
+    while (c_avl_pick(cg_groups, (void *)&path, (void *)&g) == 0)
+      cg_group_destroy(g);
+    c_avl_destroy(cg_groups);
+    cg_groups = NULL;
+  }
+
+  sfree(cg_root);
+  cg_rescan = true;
+} /* void cg_hierarchy_reset */
+
+/* cg_hierarchy_find looks for the cgroup v1 hierarchy with the cpuacct
+ * controller and uses the unified hierarchy if there is none. On systems
+ * with both, the cgroups usually show up in both, so only one is read. */
+static int cg_hierarchy_find(void) {
+  cu_mount_t *mnt_list = NULL;
+
+  if (cu_mount_getlist(&mnt_list) == NULL) {
+    ERROR("cgroups plugin: cu_mount_getlist failed.");
+    return -1;
+  }
+
+  for (cu_mount_t *mnt_ptr = mnt_list; mnt_ptr != NULL;
+       mnt_ptr = mnt_ptr->next) {
+    /* Find the cgroup mountpoint which contains the cpuacct
+     * controller. It doesn't make sense to check other cpuacct
+     * mount-points (if any), they contain the same data. */
+    if ((strcmp(mnt_ptr->type, "cgroup") == 0) &&
+        cu_mount_checkoption(mnt_ptr->options, "cpuacct", /* full = */ 1)) {
+      sfree(cg_root);
+      cg_root = strdup(mnt_ptr->dir);
+      cg_version = 1;
+      cg_min_depth = 2;
+      cg_max_depth = 2;
+      break;
+    }
+
+    if ((strcmp(mnt_ptr->type, "cgroup2") == 0) && (cg_root == NULL)) {
+      cg_root = strdup(mnt_ptr->dir);
+      cg_version = 2;
+      cg_min_depth = 1;
+      cg_max_depth = INT_MAX;
+    }
+  }
+
+  cu_mount_freelist(mnt_list);
+
+  if (cg_root == NULL) {
+    WARNING("cgroups plugin: Unable to find cgroup "
+            "mount-point with the \"cpuacct\" option or a \"cgroup2\" "
+            "mount-point.");
+    return -1;
+  }
+
+  cg_groups = c_avl_create((int (*)(const void *, const void *))strcmp);
+  cg_watches = c_avl_create(cg_wd_compare);
+  if ((cg_groups == NULL) || (cg_watches == NULL)) {
+    cg_hierarchy_reset();
+    return -1;
+  }
+
+  cg_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (cg_inotify_fd < 0) {
+    WARNING("cgroups plugin: inotify_init1 failed: %s. The cgroup hierarchy "
+            "will be scanned on every read.",
+            STRERRNO);
+    cg_watches_destroy();
+  }
+
+  cg_rescan = true;
+  return 0;
+} /* int cg_hierarchy_find */
 
 static int cgroups_init(void) {
   if (il_cgroup == NULL)
     il_cgroup = ignorelist_create(1);
 
+  long ticks = sysconf(_SC_CLK_TCK);
+  if (ticks > 0)
+    cg_usec_per_tick = 1000000 / (uint64_t)ticks;
+
+  /* Leave at least half of the file descriptors to the rest of the daemon. */
+  struct rlimit rl;
+  cg_fds_max = 512;
+  if ((getrlimit(RLIMIT_NOFILE, &rl) == 0) && (rl.rlim_cur != RLIM_INFINITY))
+    cg_fds_max = (long)(rl.rlim_cur / 2);
+
   return 0;
 }
 
@@ -174,51 +881,70 @@ static int cgroups_config(const char *key, const char *value) {
     else
       ignorelist_set_invert(il_cgroup, 1);
     return 0;
+  } else if (strcasecmp(key, "ReadThreads") == 0) {
+    int tmp = atoi(value);
+    if (tmp < 1) {
+      ERROR("cgroups plugin: `ReadThreads' must be at least 1.");
+      return 1;
+    }
+    read_threads = tmp;
+    return 0;
   }
 
   return -1;
 }
 
 static int cgroups_read(void) {
-  cu_mount_t *mnt_list = NULL;
-  bool cgroup_found = false;
-
-  if (cu_mount_getlist(&mnt_list) == NULL) {
-    ERROR("cgroups plugin: cu_mount_getlist failed.");
+  if ((cg_root == NULL) && (cg_hierarchy_find() != 0))
     return -1;
+
+  cg_handle_events();
+  if (cg_rescan || (cg_inotify_fd < 0)) {
+    cg_rescan = false;
+    if (cg_rescan_all() != 0) {
+      /* Look for the mount point again on the next read. */
+      cg_hierarchy_reset();
+      return -1;
+    }
   }
 
-  for (cu_mount_t *mnt_ptr = mnt_list; mnt_ptr != NULL;
-       mnt_ptr = mnt_ptr->next) {
-    /* Find the cgroup mountpoint which contains the cpuacct
-     * controller. */
-    if ((strcmp(mnt_ptr->type, "cgroup") != 0) ||
-        !cu_mount_checkoption(mnt_ptr->options, "cpuacct", /* full = */ 1))
-      continue;
+  int groups_num = c_avl_size(cg_groups);
+  cg_group_t **groups = calloc((size_t)groups_num + 1, sizeof(*groups));
+  if (groups == NULL)
+    return -1;
 
-    walk_directory(mnt_ptr->dir, read_cpuacct_root,
-                   /* user_data = */ NULL,
-                   /* include_hidden = */ 0);
-    cgroup_found = true;
-    /* It doesn't make sense to check other cpuacct mount-points
-     * (if any), they contain the same data. */
-    break;
-  }
+  size_t num = 0;
+  c_avl_iterator_t *iter = c_avl_get_iterator(cg_groups);
+  char *path;
+  cg_group_t *g;
+  while (c_avl_iterator_next(iter, (void *)&path, (void *)&g) == 0)
+    if (!g->ignored)
+      groups[num++] = g;
+  c_avl_iterator_destroy(iter);
 
-  cu_mount_freelist(mnt_list);
+  cg_read_groups(groups, num);
 
-  if (!cgroup_found) {
-    WARNING("cgroups plugin: Unable to find cgroup "
-            "mount-point with the \"cpuacct\" option.");
-    return -1;
-  }
+  /* Removed cgroups are usually noticed by inotify first. */
+  for (size_t i = 0; i < num; i++)
+    if (groups[i]->gone)
+      cg_group_remove(groups[i]->path);
 
+  free(groups);
   return 0;
 } /* int cgroup_read */
 
+static int cgroups_shutdown(void) {
+  cg_hierarchy_reset();
+  ignorelist_free(il_cgroup);
+  il_cgroup = NULL;
+
+  return 0;
+} /* int cgroups_shutdown */
+
 void module_register(void) {
   plugin_register_config("cgroups", cgroups_config, config_keys,
                          config_keys_num);
   plugin_register_init("cgroups", cgroups_init);
   plugin_register_read("cgroups", cgroups_read);
+  plugin_register_shutdown("cgroups", cgroups_shutdown);
 } /* void module_register */
@@ -528,7 +528,9 @@ static int putval(lcc_connection_t *c, int argc, char **argv) {
       assert(values_len >= 1);
       vl.values_len = values_len;
 
-      status = lcc_putval(c, &vl);
+      /* The value lists are pipelined; errors reported by the daemon are
+       * collected by lcc_flush_responses() below. */
+      status = lcc_putval_async(c, &vl);
       if (status != 0) {
         fprintf(stderr, "ERROR: %s\n", lcc_strerror(c));
         return -1;
@@ -536,6 +538,11 @@ static int putval(lcc_connection_t *c, int argc, char **argv) {
     }
   }
 
+  if (lcc_flush_responses(c) != 0) {
+    fprintf(stderr, "ERROR: %s\n", lcc_strerror(c));
+    return -1;
+  }
+
   if (values_len == 0) {
     fprintf(stderr, "ERROR: putval: Missing value list(s).\n");
     return -1;
@@ -130,7 +130,7 @@ static mach_msg_type_number_t cpu_list_len;
 /* #endif PROCESSOR_CPU_LOAD_INFO */
 
 #elif defined(KERNEL_LINUX)
-/* no variables needed */
+static procfile_t *pf_stat;
 /* #endif KERNEL_LINUX */
 
 #elif defined(HAVE_LIBKSTAT)
@@ -638,18 +638,22 @@ static int cpu_read(void) {
 
 #elif defined(KERNEL_LINUX) /* {{{ */
   int cpu;
-  FILE *fh;
-  char buf[1024];
+  char *buf;
+  char *ptr;
 
   char *fields[11];
   int numfields;
 
-  if ((fh = fopen("/proc/stat", "r")) == NULL) {
-    ERROR("cpu plugin: fopen (/proc/stat) failed: %s", STRERRNO);
+  if ((pf_stat == NULL) &&
+      ((pf_stat = procfile_create("/proc/stat")) == NULL))
+    return -1;
+
+  if ((ptr = procfile_read(pf_stat)) == NULL) {
+    ERROR("cpu plugin: Reading /proc/stat failed: %s", STRERRNO);
     return -1;
   }
 
-  while (fgets(buf, 1024, fh) != NULL) {
+  while ((buf = next_line(&ptr)) != NULL) {
     if (strncmp(buf, "cpu", 3))
       continue;
     if ((buf[3] < '0') || (buf[3] > '9'))
@@ -711,7 +715,6 @@ static int cpu_read(void) {
     cpu_stage(cpu, COLLECTD_CPU_STATE_USER, (derive_t)user_value, now);
     cpu_stage(cpu, COLLECTD_CPU_STATE_NICE, (derive_t)nice_value, now);
   }
-  fclose(fh);
   /* }}} #endif defined(KERNEL_LINUX) */
 
 #elif defined(HAVE_LIBKSTAT) /* {{{ */
@@ -907,8 +910,19 @@ static int cpu_read(void) {
   return 0;
 }
 
+#if KERNEL_LINUX
+static int cpu_shutdown(void) {
+  procfile_destroy(pf_stat);
+  pf_stat = NULL;
+  return 0;
+} /* int cpu_shutdown */
+#endif
+
 void module_register(void) {
   plugin_register_init("cpu", init);
   plugin_register_config("cpu", cpu_config, config_keys, config_keys_num);
   plugin_register_read("cpu", cpu_read);
+#if KERNEL_LINUX
+  plugin_register_shutdown("cpu", cpu_shutdown);
+#endif
 } /* void module_register */
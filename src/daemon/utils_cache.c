@@ -28,9 +28,11 @@
 
 #include "collectd.h"
 
+#include "configfile.h"
 #include "plugin.h"
 #include "utils/avltree/avltree.h"
 #include "utils/common/common.h"
+#include "utils/gorilla/gorilla.h"
 #include "utils/metadata/meta_data.h"
 #include "utils_cache.h"
 
@@ -66,6 +68,9 @@ typedef struct cache_entry_s {
   size_t history_index; /* points to the next position to write to. */
   size_t history_length;
 
+  /* Compressed history of `values_gauge', see the "CacheHistory" option. */
+  gorilla_t *ring;
+
   meta_data_t *meta;
   unsigned long callbacks_mask;
 } cache_entry_t;
@@ -80,6 +85,8 @@ struct uc_iter_s {
 static c_avl_tree_t *cache_tree;
 static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
+static cdtime_t history_retention;
+
 static int cache_compare(const cache_entry_t *a, const cache_entry_t *b) {
 #if COLLECT_DEBUG
   assert((a != NULL) && (b != NULL));
@@ -121,6 +128,7 @@ static void cache_free(cache_entry_t *ce) {
   sfree(ce->values_gauge);
   sfree(ce->values_raw);
   sfree(ce->history);
+  gorilla_destroy(ce->ring);
   if (ce->meta != NULL) {
     meta_data_destroy(ce->meta);
     ce->meta = NULL;
@@ -139,6 +147,16 @@ static void uc_check_range(const data_set_t *ds, cache_entry_t *ce) {
   }
 } /* void uc_check_range */
 
+static void uc_append_ring(cache_entry_t *ce, cdtime_t time) {
+  if (ce->ring == NULL)
+    return;
+
+  int status = gorilla_append(ce->ring, time, ce->values_gauge);
+  if (status != 0)
+    DEBUG("utils_cache: gorilla_append (%s) failed with status %i.", ce->name,
+          status);
+} /* void uc_append_ring */
+
 static int uc_insert(const data_set_t *ds, const value_list_t *vl,
                      const char *key) {
   /* `cache_lock' has been locked by `uc_update' */
@@ -201,6 +219,13 @@ static int uc_insert(const data_set_t *ds, const value_list_t *vl,
   ce->interval = vl->interval;
   ce->state = STATE_UNKNOWN;
 
+  if (history_retention > 0) {
+    ce->ring = gorilla_create(ce->values_num, history_retention);
+    if (ce->ring == NULL)
+      WARNING("uc_insert: Allocating the history of %s failed.", key);
+    uc_append_ring(ce, vl->time);
+  }
+
   if (vl->meta != NULL) {
     ce->meta = meta_data_clone(vl->meta);
   }
@@ -220,6 +245,8 @@ int uc_init(void) {
     cache_tree =
         c_avl_create((int (*)(const void *, const void *))cache_compare);
 
+  history_retention = global_option_get_time("CacheHistory", 0);
+
   return 0;
 } /* int uc_init */
 
@@ -411,6 +438,8 @@ int uc_update(const data_set_t *ds, const value_list_t *vl) {
   /* Prune invalid gauge data */
   uc_check_range(ds, ce);
 
+  uc_append_ring(ce, vl->time);
+
   ce->last_time = vl->time;
   ce->last_update = cdtime();
   ce->interval = vl->interval;
@@ -670,6 +699,99 @@ int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number) {
   return 0;
 } /* int uc_get_names */
 
+/* Maximum number of cache entries examined while holding the cache lock in
+ * uc_foreach_name(). */
+#define UC_NAMES_CHUNK_SIZE 1024
+
+int uc_foreach_name(uc_name_callback_t callback, void *user_data) {
+  char last[sizeof(((cache_entry_t *)0)->name)] = "";
+  bool first = true;
+
+  size_t offsets[UC_NAMES_CHUNK_SIZE];
+  cdtime_t times[UC_NAMES_CHUNK_SIZE];
+  char *buffer = NULL;
+  size_t buffer_size = 0;
+
+  int status = 0;
+
+  if (callback == NULL)
+    return EINVAL;
+
+  while (status == 0) {
+    c_avl_iterator_t *iter;
+    char *key = NULL;
+    cache_entry_t *value;
+    size_t examined = 0;
+    size_t number = 0;
+    size_t buffer_len = 0;
+    bool done = false;
+
+    pthread_mutex_lock(&cache_lock);
+
+    /* Resume after the last entry of the previous chunk. The tree may have
+     * changed in the meantime, so the position is looked up by name. */
+    if (first)
+      iter = c_avl_get_iterator(cache_tree);
+    else
+      iter = c_avl_get_iterator_after(cache_tree, last);
+    if (iter == NULL) {
+      pthread_mutex_unlock(&cache_lock);
+      status = ENOMEM;
+      break;
+    }
+
+    while (examined < UC_NAMES_CHUNK_SIZE) {
+      if (c_avl_iterator_next(iter, (void *)&key, (void *)&value) != 0) {
+        done = true;
+        break;
+      }
+      examined++;
+
+      /* remove missing values when list values */
+      if (value->state == STATE_MISSING)
+        continue;
+
+      size_t len = strlen(key) + 1;
+      if (buffer_len + len > buffer_size) {
+        size_t new_size = (buffer_size == 0) ? 65536 : 2 * buffer_size;
+        while (buffer_len + len > new_size)
+          new_size *= 2;
+
+        char *tmp = realloc(buffer, new_size);
+        if (tmp == NULL) {
+          ERROR("uc_foreach_name: realloc failed.");
+          status = ENOMEM;
+          break;
+        }
+        buffer = tmp;
+        buffer_size = new_size;
+      }
+
+      memcpy(buffer + buffer_len, key, len);
+      offsets[number] = buffer_len;
+      times[number] = value->last_time;
+      buffer_len += len;
+      number++;
+    }
+
+    if (!done && (key != NULL))
+      sstrncpy(last, key, sizeof(last));
+
+    c_avl_iterator_destroy(iter);
+    pthread_mutex_unlock(&cache_lock);
+
+    for (size_t i = 0; (status == 0) && (i < number); i++)
+      status = callback(buffer + offsets[i], times[i], user_data);
+
+    if (done)
+      break;
+    first = false;
+  }
+
+  sfree(buffer);
+  return status;
+} /* int uc_foreach_name */
+
 int uc_get_state(const data_set_t *ds, const value_list_t *vl) {
   char name[6 * DATA_MAX_NAME_LEN];
   cache_entry_t *ce = NULL;
@@ -787,6 +909,164 @@ int uc_get_history(const data_set_t *ds, const value_list_t *vl,
   return uc_get_history_by_name(name, ret_history, num_steps, num_ds);
 } /* int uc_get_history */
 
+typedef struct {
+  cdtime_t *times;
+  gauge_t *values;
+  size_t num;
+  size_t size;
+} uc_range_t;
+
+static int uc_range_cb(cdtime_t time, gauge_t const *values, size_t values_num,
+                       void *user_data) {
+  uc_range_t *r = user_data;
+
+  /* The ring never returns more samples than it holds. */
+  if (r->num >= r->size)
+    return -1;
+
+  r->times[r->num] = time;
+  memcpy(r->values + (r->num * values_num), values,
+         sizeof(*values) * values_num);
+  r->num++;
+
+  return 0;
+} /* int uc_range_cb */
+
+int uc_get_history_range_by_name(const char *name, cdtime_t begin,
+                                 cdtime_t end, cdtime_t **ret_times,
+                                 gauge_t **ret_values, size_t *ret_num,
+                                 size_t *ret_values_num) {
+  cache_entry_t *ce = NULL;
+
+  if ((ret_times == NULL) || (ret_values == NULL) || (ret_num == NULL) ||
+      (ret_values_num == NULL))
+    return -EINVAL;
+
+  pthread_mutex_lock(&cache_lock);
+
+  if (c_avl_get(cache_tree, name, (void *)&ce) != 0) {
+    pthread_mutex_unlock(&cache_lock);
+    return -ENOENT;
+  }
+
+  if (ce->ring == NULL) {
+    pthread_mutex_unlock(&cache_lock);
+    return -ENOTSUP;
+  }
+
+  uc_range_t r = {.size = gorilla_size(ce->ring)};
+  if (r.size > 0) {
+    r.times = calloc(r.size, sizeof(*r.times));
+    r.values = calloc(r.size * ce->values_num, sizeof(*r.values));
+    if ((r.times == NULL) || (r.values == NULL)) {
+      pthread_mutex_unlock(&cache_lock);
+      sfree(r.times);
+      sfree(r.values);
+      return -ENOMEM;
+    }
+  }
+
+  int status = 0;
+  if (r.size > 0)
+    status = gorilla_foreach(ce->ring, begin, end, uc_range_cb, &r);
+  size_t values_num = ce->values_num;
+
+  pthread_mutex_unlock(&cache_lock);
+
+  if (status != 0) {
+    sfree(r.times);
+    sfree(r.values);
+    return (status < 0) ? status : -status;
+  }
+
+  *ret_times = r.times;
+  *ret_values = r.values;
+  *ret_num = r.num;
+  *ret_values_num = values_num;
+
+  return 0;
+} /* int uc_get_history_range_by_name */
+
+static int uc_stats_cb(cdtime_t __attribute__((unused)) time,
+                       gauge_t const *values, size_t values_num,
+                       void *user_data) {
+  uc_history_stats_t *stats = user_data;
+
+  for (size_t i = 0; i < values_num; i++) {
+    if (isnan(values[i]))
+      continue;
+
+    if ((stats[i].num == 0) || (values[i] < stats[i].min))
+      stats[i].min = values[i];
+    if ((stats[i].num == 0) || (values[i] > stats[i].max))
+      stats[i].max = values[i];
+    /* Keep the running sum in `average' until all samples are seen. */
+    stats[i].average += values[i];
+    stats[i].num++;
+  }
+
+  return 0;
+} /* int uc_stats_cb */
+
+int uc_get_history_stats_by_name(const char *name, cdtime_t begin,
+                                 cdtime_t end, uc_history_stats_t *ret_stats,
+                                 size_t num_ds) {
+  cache_entry_t *ce = NULL;
+
+  if (ret_stats == NULL)
+    return -EINVAL;
+
+  pthread_mutex_lock(&cache_lock);
+
+  if (c_avl_get(cache_tree, name, (void *)&ce) != 0) {
+    pthread_mutex_unlock(&cache_lock);
+    return -ENOENT;
+  }
+
+  if (((size_t)ce->values_num) != num_ds) {
+    pthread_mutex_unlock(&cache_lock);
+    return -EINVAL;
+  }
+
+  if (ce->ring == NULL) {
+    pthread_mutex_unlock(&cache_lock);
+    return -ENOTSUP;
+  }
+
+  memset(ret_stats, 0, sizeof(*ret_stats) * num_ds);
+  int status = gorilla_foreach(ce->ring, begin, end, uc_stats_cb, ret_stats);
+
+  pthread_mutex_unlock(&cache_lock);
+
+  if (status != 0)
+    return (status < 0) ? status : -status;
+
+  for (size_t i = 0; i < num_ds; i++) {
+    if (ret_stats[i].num == 0) {
+      ret_stats[i].min = NAN;
+      ret_stats[i].max = NAN;
+      ret_stats[i].average = NAN;
+    } else {
+      ret_stats[i].average /= (gauge_t)ret_stats[i].num;
+    }
+  }
+
+  return 0;
+} /* int uc_get_history_stats_by_name */
+
+int uc_get_history_stats(const data_set_t *ds, const value_list_t *vl,
+                         cdtime_t begin, cdtime_t end,
+                         uc_history_stats_t *ret_stats) {
+  char name[6 * DATA_MAX_NAME_LEN];
+
+  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
+    ERROR("utils_cache: uc_get_history_stats: FORMAT_VL failed.");
+    return -1;
+  }
+
+  return uc_get_history_stats_by_name(name, begin, end, ret_stats, ds->ds_num);
+} /* int uc_get_history_stats */
+
 int uc_get_hits(const data_set_t *ds, const value_list_t *vl) {
   char name[6 * DATA_MAX_NAME_LEN];
   cache_entry_t *ce = NULL;
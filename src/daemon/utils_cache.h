@@ -50,6 +50,25 @@ value_t *uc_get_value(const data_set_t *ds, const value_list_t *vl);
 size_t uc_get_size(void);
 int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number);
 
+/*
+ * NAME
+ *   uc_foreach_name
+ *
+ * DESCRIPTION
+ *   Calls `callback' with the name and time of every cache entry, in the order
+ *   of the names. Unlike `uc_get_names', the cache lock is only held while a
+ *   chunk of entries is copied, and never while `callback' runs. Entries added
+ *   or removed during the iteration may or may not be reported; no entry is
+ *   reported twice.
+ *
+ * RETURN VALUE
+ *   Zero upon success, the non-zero return value of `callback' if it stopped
+ *   the iteration, or an errno-style error code.
+ */
+typedef int (*uc_name_callback_t)(const char *name, cdtime_t time,
+                                  void *user_data);
+int uc_foreach_name(uc_name_callback_t callback, void *user_data);
+
 int uc_get_state(const data_set_t *ds, const value_list_t *vl);
 int uc_set_state(const data_set_t *ds, const value_list_t *vl, int state);
 int uc_get_hits(const data_set_t *ds, const value_list_t *vl);
@@ -63,6 +82,38 @@ int uc_get_history(const data_set_t *ds, const value_list_t *vl,
 int uc_get_history_by_name(const char *name, gauge_t *ret_history,
                            size_t num_steps, size_t num_ds);
 
+/*
+ * Compressed history interface
+ *
+ * These functions query the history kept when the "CacheHistory" option is
+ * set. They return -ENOTSUP if the history is disabled. `begin' and `end'
+ * limit the returned samples to the given time range (inclusive); an `end' of
+ * zero means "up to the newest sample".
+ */
+typedef struct {
+  gauge_t min;
+  gauge_t max;
+  gauge_t average;
+  /* Number of samples which are not NaN. */
+  size_t num;
+} uc_history_stats_t;
+
+/* Returns the samples in the time range, oldest first. `ret_values' holds
+ * `ret_values_num' gauges per sample. Both arrays have to be freed by the
+ * caller. */
+int uc_get_history_range_by_name(const char *name, cdtime_t begin,
+                                 cdtime_t end, cdtime_t **ret_times,
+                                 gauge_t **ret_values, size_t *ret_num,
+                                 size_t *ret_values_num);
+/* Fills `ret_stats', which must hold `num_ds' elements, with the minimum,
+ * maximum and average of each data source in the time range. */
+int uc_get_history_stats_by_name(const char *name, cdtime_t begin,
+                                 cdtime_t end, uc_history_stats_t *ret_stats,
+                                 size_t num_ds);
+int uc_get_history_stats(const data_set_t *ds, const value_list_t *vl,
+                         cdtime_t begin, cdtime_t end,
+                         uc_history_stats_t *ret_stats);
+
 /*
  * Iterator interface
  */
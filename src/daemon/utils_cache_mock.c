@@ -44,6 +44,10 @@ int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number) {
   return ENOTSUP;
 }
 
+int uc_foreach_name(uc_name_callback_t callback, void *user_data) {
+  return ENOTSUP;
+}
+
 int uc_get_value_by_name(const char *name, value_t **ret_values,
                          size_t *ret_values_num) {
   return ENOTSUP;
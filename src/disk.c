@@ -85,6 +85,10 @@ static bool use_bsd_name;
 #elif KERNEL_LINUX
 typedef struct diskstats {
   char *name;
+#if HAVE_LIBUDEV_H
+  /* Name looked up with the "UdevNameAttr" attribute, if any. */
+  char *alt_name;
+#endif
 
   /* This overflows in roughly 1361 years */
   unsigned int poll_count;
@@ -111,6 +115,8 @@ typedef struct diskstats {
 } diskstats_t;
 
 static diskstats_t *disklist;
+
+static procfile_t *pf_diskstats;
 /* #endif KERNEL_LINUX */
 #elif KERNEL_FREEBSD
 static struct gmesh geom_tree;
@@ -294,6 +300,8 @@ static int disk_init(void) {
 
 static int disk_shutdown(void) {
 #if KERNEL_LINUX
+  procfile_destroy(pf_diskstats);
+  pf_diskstats = NULL;
 #if HAVE_LIBUDEV_H
   if (handle_udev != NULL)
     udev_unref(handle_udev);
@@ -361,6 +369,69 @@ static counter_t disk_calc_time_incr(counter_t delta_time,
 
   return (counter_t)(avg_time_incr + .5);
 }
+
+/* disk_parse_line parses a line of /proc/diskstats in place. The numbers are
+ * stored in "fields" at the same position strsplit() would have put them; the
+ * device name, the third field, is returned in "ret_name". Returns the number
+ * of fields or -1 if the line is malformed. */
+static int disk_parse_line(char *line, char **ret_name, derive_t *fields,
+                           int fields_num) {
+  char *ptr = line;
+  int num = 0;
+
+  *ret_name = NULL;
+  while (num < fields_num) {
+    while ((*ptr == ' ') || (*ptr == '\t'))
+      ptr++;
+    if (*ptr == 0)
+      break;
+
+    if (num == 2) {
+      *ret_name = ptr;
+      while ((*ptr != 0) && (*ptr != ' ') && (*ptr != '\t'))
+        ptr++;
+      if (*ptr != 0)
+        *(ptr++) = 0;
+      fields[num++] = 0;
+      continue;
+    }
+
+    if (!isdigit((unsigned char)*ptr))
+      return -1;
+
+    uint64_t value = 0;
+    while (isdigit((unsigned char)*ptr)) {
+      value = 10 * value + (uint64_t)(*ptr - '0');
+      ptr++;
+    }
+    fields[num++] = (derive_t)value;
+  }
+
+  if (*ret_name == NULL)
+    return -1;
+  return num;
+} /* int disk_parse_line */
+
+/* disk_lookup returns the entry for "name". /proc/diskstats lists the devices
+ * in the same order every time, so the search starts behind the previous
+ * match, which "cursor" points to. */
+static diskstats_t *disk_lookup(char const *name, diskstats_t **cursor) {
+  for (diskstats_t *ds = *cursor; ds != NULL; ds = ds->next) {
+    if (strcmp(name, ds->name) == 0) {
+      *cursor = ds->next;
+      return ds;
+    }
+  }
+
+  for (diskstats_t *ds = disklist; ds != *cursor; ds = ds->next) {
+    if (strcmp(name, ds->name) == 0) {
+      *cursor = ds->next;
+      return ds;
+    }
+  }
+
+  return NULL;
+} /* diskstats_t *disk_lookup */
 #endif
 
 #if HAVE_LIBUDEV_H
@@ -694,10 +765,10 @@ static int disk_read(void) {
   geom_stats_snapshot_free(snap);
 
 #elif KERNEL_LINUX
-  FILE *fh;
-  char buffer[1024];
+  char *buffer;
+  char *ptr;
 
-  char *fields[32];
+  derive_t fields[32];
   static unsigned int poll_count = 0;
 
   derive_t read_sectors = 0;
@@ -715,27 +786,28 @@ static int disk_read(void) {
   int is_disk = 0;
 
   diskstats_t *ds, *pre_ds;
+  diskstats_t *cursor = disklist;
 
-  if ((fh = fopen("/proc/diskstats", "r")) == NULL) {
-    ERROR("disk plugin: fopen(\"/proc/diskstats\"): %s", STRERRNO);
+  if ((pf_diskstats == NULL) &&
+      ((pf_diskstats = procfile_create("/proc/diskstats")) == NULL))
+    return -1;
+
+  if ((ptr = procfile_read(pf_diskstats)) == NULL) {
+    ERROR("disk plugin: Reading \"/proc/diskstats\" failed: %s", STRERRNO);
     return -1;
   }
 
   poll_count++;
-  while (fgets(buffer, sizeof(buffer), fh) != NULL) {
-    int numfields = strsplit(buffer, fields, 32);
+  while ((buffer = next_line(&ptr)) != NULL) {
+    char *disk_name;
+    int numfields = disk_parse_line(buffer, &disk_name, fields,
+                                    STATIC_ARRAY_SIZE(fields));
 
     /* need either 7 fields (partition) or at least 14 fields */
     if ((numfields != 7) && (numfields < 14))
       continue;
 
-    char *disk_name = fields[2];
-
-    for (ds = disklist, pre_ds = disklist; ds != NULL;
-         pre_ds = ds, ds = ds->next)
-      if (strcmp(disk_name, ds->name) == 0)
-        break;
-
+    ds = disk_lookup(disk_name, &cursor);
     if (ds == NULL) {
       if ((ds = calloc(1, sizeof(*ds))) == NULL)
         continue;
@@ -745,37 +817,42 @@ static int disk_read(void) {
         continue;
       }
 
+      for (pre_ds = disklist; (pre_ds != NULL) && (pre_ds->next != NULL);
+           pre_ds = pre_ds->next)
+        /* nop */;
+
       if (pre_ds == NULL)
         disklist = ds;
       else
         pre_ds->next = ds;
+      cursor = NULL;
     }
 
     is_disk = 0;
     if (numfields == 7) {
       /* Kernel 2.6, Partition */
-      read_ops = atoll(fields[3]);
-      read_sectors = atoll(fields[4]);
-      write_ops = atoll(fields[5]);
-      write_sectors = atoll(fields[6]);
+      read_ops = fields[3];
+      read_sectors = fields[4];
+      write_ops = fields[5];
+      write_sectors = fields[6];
     } else {
       assert(numfields >= 14);
-      read_ops = atoll(fields[3]);
-      write_ops = atoll(fields[7]);
+      read_ops = fields[3];
+      write_ops = fields[7];
 
-      read_sectors = atoll(fields[5]);
-      write_sectors = atoll(fields[9]);
+      read_sectors = fields[5];
+      write_sectors = fields[9];
 
       is_disk = 1;
-      read_merged = atoll(fields[4]);
-      read_time = atoll(fields[6]);
-      write_merged = atoll(fields[8]);
-      write_time = atoll(fields[10]);
+      read_merged = fields[4];
+      read_time = fields[6];
+      write_merged = fields[8];
+      write_time = fields[10];
 
-      in_progress = atof(fields[11]);
+      in_progress = (gauge_t)fields[11];
 
-      io_time = atof(fields[12]);
-      weighted_time = atof(fields[13]);
+      io_time = fields[12];
+      weighted_time = fields[13];
     }
 
     {
@@ -867,22 +944,17 @@ static int disk_read(void) {
     char *output_name = disk_name;
 
 #if HAVE_LIBUDEV_H
-    char *alt_name = NULL;
-    if (conf_udev_name_attr != NULL) {
-      alt_name =
+    /* Asking udev is expensive, so the name is only looked up until it is
+     * found. */
+    if ((conf_udev_name_attr != NULL) && (ds->alt_name == NULL))
+      ds->alt_name =
           disk_udev_attr_name(handle_udev, disk_name, conf_udev_name_attr);
-      if (alt_name != NULL)
-        output_name = alt_name;
-    }
+    if (ds->alt_name != NULL)
+      output_name = ds->alt_name;
 #endif
 
-    if (ignorelist_match(ignorelist, output_name) != 0) {
-#if HAVE_LIBUDEV_H
-      /* release udev-based alternate name, if allocated */
-      sfree(alt_name);
-#endif
+    if (ignorelist_match(ignorelist, output_name) != 0)
       continue;
-    }
 
     if ((ds->read_bytes != 0) || (ds->write_bytes != 0))
       disk_submit(output_name, "disk_octets", ds->read_bytes, ds->write_bytes);
@@ -902,12 +974,7 @@ static int disk_read(void) {
       if (ds->has_io_time)
         submit_io_time(output_name, io_time, weighted_time);
     } /* if (is_disk) */
-
-#if HAVE_LIBUDEV_H
-    /* release udev-based alternate name, if allocated */
-    sfree(alt_name);
-#endif
-  } /* while (fgets (buffer, sizeof (buffer), fh) != NULL) */
+  } /* while ((buffer = next_line(&ptr)) != NULL) */
 
   /* Remove disks that have disappeared from diskstats */
   for (ds = disklist, pre_ds = disklist; ds != NULL;) {
@@ -929,9 +996,11 @@ static int disk_read(void) {
 
     DEBUG("disk plugin: Disk %s disappeared.", missing_ds->name);
     free(missing_ds->name);
+#if HAVE_LIBUDEV_H
+    free(missing_ds->alt_name);
+#endif
     free(missing_ds);
   }
-  fclose(fh);
   /* #endif defined(KERNEL_LINUX) */
 
 #elif HAVE_LIBKSTAT
@@ -21,6 +21,9 @@
  *   Florian octo Forster <octo at collectd.org>
  **/
 
+/* _GNU_SOURCE is needed in Linux to use statx */
+#define _GNU_SOURCE
+
 #include "collectd.h"
 
 #include "plugin.h"
@@ -32,10 +35,19 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#if KERNEL_LINUX
+#include "utils/avltree/avltree.h"
+
+#include <sys/inotify.h>
+#endif
+
 #define FC_RECURSIVE 1
 #define FC_HIDDEN 2
 #define FC_REGULAR 4
 
+struct fc_watch_s;
+typedef struct fc_watch_s fc_watch_t;
+
 struct fc_directory_conf_s {
   char *path;
   char *plugin_name;
@@ -57,13 +69,27 @@ struct fc_directory_conf_s {
 
   /* Helper for the recursive functions */
   time_t now;
+
+  /* Incremental mode */
+  bool incremental;
+  fc_watch_t *watch;
 };
 typedef struct fc_directory_conf_s fc_directory_conf_t;
 
 static fc_directory_conf_t **directories;
 static size_t directories_num;
 
+static int read_threads = 1;
+
+#if KERNEL_LINUX
+static void fc_watch_destroy(fc_directory_conf_t const *dir, fc_watch_t *w);
+#endif
+
 static void fc_free_dir(fc_directory_conf_t *dir) {
+#if KERNEL_LINUX
+  fc_watch_destroy(dir, dir->watch);
+#endif
+
   sfree(dir->path);
   sfree(dir->plugin_name);
   sfree(dir->instance);
@@ -113,7 +139,9 @@ static void fc_submit_dir(const fc_directory_conf_t *dir) {
  *     FilesSizeType "bytes"
  *     FilesCountType "files"
  *     TypeInstance "instance"
+ *     Incremental false
  *   </Directory>
+ *   ReadThreads 1
  * </Plugin>
  *
  * Collect:
@@ -366,7 +394,14 @@ static int fc_config_add_dir(oconfig_item_t *ci) {
       status = cf_util_get_string(option, &dir->files_num_type);
     else if (strcasecmp("TypeInstance", option->key) == 0)
       status = cf_util_get_string(option, &dir->type_instance);
-    else {
+    else if (strcasecmp("Incremental", option->key) == 0) {
+#if KERNEL_LINUX
+      status = cf_util_get_boolean(option, &dir->incremental);
+#else
+      WARNING("filecount plugin: The `Incremental' option is only supported "
+              "on Linux and will be ignored.");
+#endif
+    } else {
       WARNING("filecount plugin: fc_config_add_dir: "
               "Option `%s' not allowed here.",
               option->key);
@@ -431,7 +466,16 @@ static int fc_config(oconfig_item_t *ci) {
     oconfig_item_t *child = ci->children + i;
     if (strcasecmp("Directory", child->key) == 0)
       fc_config_add_dir(child);
-    else {
+    else if (strcasecmp("ReadThreads", child->key) == 0) {
+      int tmp = read_threads;
+      if (cf_util_get_int(child, &tmp) != 0)
+        continue;
+      if (tmp < 1) {
+        WARNING("filecount plugin: `ReadThreads' must be at least 1.");
+        continue;
+      }
+      read_threads = tmp;
+    } else {
       WARNING("filecount plugin: Ignoring unknown config option `%s'.",
               child->key);
     }
@@ -449,77 +493,692 @@ static int fc_init(void) {
   return 0;
 } /* int fc_init */
 
-static int fc_read_dir_callback(const char *dirname, const char *filename,
-                                void *user_data) {
-  fc_directory_conf_t *dir = user_data;
-  char abs_path[PATH_MAX];
-  struct stat statbuf;
 
-  if (dir == NULL)
+/* fc_file_selected returns true if a file with the given attributes is
+ * counted. The size and mtime are only used for regular files. */
+static bool fc_file_selected(fc_directory_conf_t const *dir,
+                             char const *filename, mode_t mode, off_t size,
+                             time_t mtime) {
+  if ((dir->options & FC_REGULAR) && !S_ISREG(mode))
+    return false;
+
+  if ((dir->name != NULL) && (fnmatch(dir->name, filename, /* flags = */ 0)))
+    return false;
+
+  if (!S_ISREG(mode))
+    return true;
+
+  if (dir->mtime != 0) {
+    time_t limit = dir->now;
+
+    if (dir->mtime < 0)
+      limit += dir->mtime;
+    else
+      limit -= dir->mtime;
+
+    if (((dir->mtime < 0) && (mtime < limit)) ||
+        ((dir->mtime > 0) && (mtime > limit)))
+      return false;
+  }
+
+  if (dir->size != 0) {
+    off_t limit;
+
+    if (dir->size < 0)
+      limit = (off_t)((-1) * dir->size);
+    else
+      limit = (off_t)dir->size;
+
+    if (((dir->size < 0) && (size > limit)) ||
+        ((dir->size > 0) && (size < limit)))
+      return false;
+  }
+
+  return true;
+} /* bool fc_file_selected */
+
+/* fc_stat returns the type, size and mtime of a file without following
+ * symlinks. On Linux statx is used to only request these fields. */
+static int fc_stat(int dirfd, char const *filename, mode_t *ret_mode,
+                   off_t *ret_size, time_t *ret_mtime) {
+#if KERNEL_LINUX && defined(STATX_TYPE)
+  struct statx stx;
+
+  if (statx(dirfd, filename, AT_SYMLINK_NOFOLLOW,
+            STATX_TYPE | STATX_SIZE | STATX_MTIME, &stx) == 0) {
+    *ret_mode = (mode_t)stx.stx_mode;
+    *ret_size = (off_t)stx.stx_size;
+    *ret_mtime = (time_t)stx.stx_mtime.tv_sec;
+    return 0;
+  } else if (errno != ENOSYS) {
+    return -1;
+  }
+#endif
+
+  struct stat statbuf;
+  if (fstatat(dirfd, filename, &statbuf, AT_SYMLINK_NOFOLLOW) != 0)
     return -1;
 
-  snprintf(abs_path, sizeof(abs_path), "%s/%s", dirname, filename);
+  *ret_mode = statbuf.st_mode;
+  *ret_size = statbuf.st_size;
+  *ret_mtime = statbuf.st_mtime;
+  return 0;
+} /* int fc_stat */
 
-  int status = lstat(abs_path, &statbuf);
-  if (status != 0) {
-    ERROR("filecount plugin: stat (%s) failed.", abs_path);
+/*
+ * Walking the directory
+ *
+ * The directories below dir->path are kept in a queue shared by up to
+ * `ReadThreads' threads. Each thread adds up the files it sees and the totals
+ * are combined once the queue is empty and all threads are idle. Files are
+ * only stat'ed if the directory entry's type is not enough to count them.
+ */
+typedef struct {
+  fc_directory_conf_t *dir;
+  bool need_stat;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  char **queue;
+  size_t queue_num;
+  size_t queue_size;
+  size_t busy;
+
+  uint64_t files_num;
+  uint64_t files_size;
+} fc_walk_t;
+
+static int fc_walk_push(fc_walk_t *walk, char const *path) {
+  char *copy = strdup(path);
+  if (copy == NULL)
+    return ENOMEM;
+
+  pthread_mutex_lock(&walk->lock);
+  if (walk->queue_num >= walk->queue_size) {
+    size_t size = (walk->queue_size == 0) ? 64 : 2 * walk->queue_size;
+    char **tmp = realloc(walk->queue, size * sizeof(*walk->queue));
+    if (tmp == NULL) {
+      pthread_mutex_unlock(&walk->lock);
+      free(copy);
+      return ENOMEM;
+    }
+    walk->queue = tmp;
+    walk->queue_size = size;
+  }
+  walk->queue[walk->queue_num] = copy;
+  walk->queue_num++;
+  pthread_cond_signal(&walk->cond);
+  pthread_mutex_unlock(&walk->lock);
+
+  return 0;
+} /* int fc_walk_push */
+
+/* fc_walk_dir counts the files in a single directory and queues its
+ * subdirectories. */
+static int fc_walk_dir(fc_walk_t *walk, char const *path, uint64_t *files_num,
+                       uint64_t *files_size) {
+  fc_directory_conf_t *dir = walk->dir;
+
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    ERROR("filecount plugin: Cannot open '%s': %s", path, STRERRNO);
     return -1;
   }
 
-  if (S_ISDIR(statbuf.st_mode) && (dir->options & FC_RECURSIVE)) {
-    status = walk_directory(
-        abs_path, fc_read_dir_callback, dir,
-        /* include hidden = */ (dir->options & FC_HIDDEN) ? 1 : 0);
-    return status;
-  } else if ((dir->options & FC_REGULAR) && !S_ISREG(statbuf.st_mode)) {
+  DIR *dh = fdopendir(fd);
+  if (dh == NULL) {
+    ERROR("filecount plugin: Cannot open '%s': %s", path, STRERRNO);
+    close(fd);
+    return -1;
+  }
+
+  struct dirent *ent;
+  while ((ent = readdir(dh)) != NULL) {
+    char const *name = ent->d_name;
+    mode_t mode = 0;
+    off_t size = 0;
+    time_t mtime = 0;
+    bool have_stat = false;
+
+    if (name[0] == '.') {
+      if (!(dir->options & FC_HIDDEN))
+        continue;
+      if ((name[1] == 0) || ((name[1] == '.') && (name[2] == 0)))
+        continue;
+    }
+
+#ifdef DT_UNKNOWN
+    if (ent->d_type != DT_UNKNOWN)
+      mode = DTTOIF(ent->d_type);
+#endif
+    if (mode == 0) {
+      if (fc_stat(dirfd(dh), name, &mode, &size, &mtime) != 0) {
+        ERROR("filecount plugin: stat (%s/%s) failed.", path, name);
+        continue;
+      }
+      have_stat = true;
+    }
+
+    if (S_ISDIR(mode) && (dir->options & FC_RECURSIVE)) {
+      char abs_path[PATH_MAX];
+
+      if (ssnprintf(abs_path, sizeof(abs_path), "%s/%s", path, name) >=
+          (int)sizeof(abs_path)) {
+        ERROR("filecount plugin: Path too long: %s/%s", path, name);
+        continue;
+      }
+      if (fc_walk_push(walk, abs_path) != 0)
+        ERROR("filecount plugin: Queueing \"%s\" failed.", abs_path);
+      continue;
+    }
+
+    if (S_ISREG(mode) && walk->need_stat && !have_stat) {
+      /* Skip the stat for files the name filter excludes anyway. */
+      if ((dir->name != NULL) && (fnmatch(dir->name, name, /* flags = */ 0)))
+        continue;
+      if (fc_stat(dirfd(dh), name, &mode, &size, &mtime) != 0) {
+        ERROR("filecount plugin: stat (%s/%s) failed.", path, name);
+        continue;
+      }
+    }
+
+    if (!fc_file_selected(dir, name, mode, size, mtime))
+      continue;
+
+    (*files_num)++;
+    if (S_ISREG(mode))
+      *files_size += (uint64_t)size;
+  }
+
+  closedir(dh);
+  return 0;
+} /* int fc_walk_dir */
+
+static void *fc_walk_thread(void *arg) {
+  fc_walk_t *walk = arg;
+  uint64_t files_num = 0;
+  uint64_t files_size = 0;
+
+  pthread_mutex_lock(&walk->lock);
+  while (42) {
+    while ((walk->queue_num == 0) && (walk->busy > 0))
+      pthread_cond_wait(&walk->cond, &walk->lock);
+    if (walk->queue_num == 0)
+      break;
+
+    walk->queue_num--;
+    char *path = walk->queue[walk->queue_num];
+    walk->busy++;
+    pthread_mutex_unlock(&walk->lock);
+
+    fc_walk_dir(walk, path, &files_num, &files_size);
+    free(path);
+
+    pthread_mutex_lock(&walk->lock);
+    walk->busy--;
+    if ((walk->busy == 0) && (walk->queue_num == 0))
+      pthread_cond_broadcast(&walk->cond);
+  }
+
+  walk->files_num += files_num;
+  walk->files_size += files_size;
+  pthread_mutex_unlock(&walk->lock);
+
+  return NULL;
+} /* void *fc_walk_thread */
+
+static int fc_walk(fc_directory_conf_t *dir) {
+  fc_walk_t walk = {
+      .dir = dir,
+      .need_stat = (dir->files_size_type != NULL) || (dir->mtime != 0) ||
+                   (dir->size != 0),
+  };
+  int status;
+
+  pthread_mutex_init(&walk.lock, NULL);
+  pthread_cond_init(&walk.cond, NULL);
+
+  /* The top directory is read first so that failing to open it is an error.
+   */
+  status = fc_walk_dir(&walk, dir->path, &walk.files_num, &walk.files_size);
+
+  if (status == 0) {
+    /* No other thread runs yet, so the queue can be read without the lock.
+     */
+    size_t threads_max = (size_t)read_threads - 1;
+    if (threads_max > walk.queue_num)
+      threads_max = walk.queue_num;
+
+    pthread_t *threads = NULL;
+    size_t threads_num = 0;
+
+    if (threads_max > 0)
+      threads = calloc(threads_max, sizeof(*threads));
+    while ((threads != NULL) && (threads_num < threads_max)) {
+      if (plugin_thread_create(threads + threads_num, fc_walk_thread, &walk,
+                               "filecount") != 0)
+        break;
+      threads_num++;
+    }
+
+    fc_walk_thread(&walk);
+    for (size_t i = 0; i < threads_num; i++)
+      pthread_join(threads[i], NULL);
+    free(threads);
+  }
+
+  for (size_t i = 0; i < walk.queue_num; i++)
+    free(walk.queue[i]);
+  free(walk.queue);
+  pthread_cond_destroy(&walk.cond);
+  pthread_mutex_destroy(&walk.lock);
+
+  dir->files_num = walk.files_num;
+  dir->files_size = walk.files_size;
+  return status;
+} /* int fc_walk */
+
+#if KERNEL_LINUX
+/*
+ * Incremental mode
+ *
+ * Every directory below dir->path is watched with inotify and the attributes
+ * of all files are kept in memory. Reading the directory only processes the
+ * events received since the last read. The totals are updated as files come
+ * and go, unless `MTime' is set: whether a file is counted then depends on
+ * the current time and all files are checked on every read.
+ */
+#define FC_WATCH_MASK                                                          \
+  (IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_DELETE_SELF |       \
+   IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO | IN_DONT_FOLLOW |   \
+   IN_EXCL_UNLINK | IN_ONLYDIR)
+
+typedef struct fc_node_s fc_node_t;
+
+typedef struct {
+  mode_t mode;
+  off_t size;
+  time_t mtime;
+  /* Set for watched subdirectories. */
+  fc_node_t *node;
+} fc_file_t;
+
+struct fc_node_s {
+  int wd;
+  char *path;
+  char *name;
+  fc_node_t *parent;
+  /* File name -> fc_file_t */
+  c_avl_tree_t *files;
+};
+
+struct fc_watch_s {
+  int fd;
+  fc_node_t *root;
+  /* Watch descriptor -> fc_node_t */
+  c_avl_tree_t *nodes;
+
+  uint64_t files_num;
+  uint64_t files_size;
+};
+
+static int fc_wd_compare(void const *a, void const *b) {
+  intptr_t wd_a = (intptr_t)a;
+  intptr_t wd_b = (intptr_t)b;
+  return (wd_a > wd_b) - (wd_a < wd_b);
+} /* int fc_wd_compare */
+
+static void fc_watch_account(fc_directory_conf_t const *dir, fc_watch_t *w,
+                             char const *name, fc_file_t const *f, int sign) {
+  if (f->node != NULL)
+    return;
+  if (S_ISDIR(f->mode) && (dir->options & FC_RECURSIVE))
+    return;
+  if (!fc_file_selected(dir, name, f->mode, f->size, f->mtime))
+    return;
+
+  uint64_t size = S_ISREG(f->mode) ? (uint64_t)f->size : 0;
+  if (sign > 0) {
+    w->files_num++;
+    w->files_size += size;
+  } else {
+    w->files_num--;
+    w->files_size -= size;
+  }
+} /* void fc_watch_account */
+
+/* fc_watch_free_node forgets about a directory and everything below it. */
+static void fc_watch_free_node(fc_directory_conf_t const *dir, fc_watch_t *w,
+                               fc_node_t *node) {
+  char *name;
+  fc_file_t *f;
+
+  while (c_avl_pick(node->files, (void *)&name, (void *)&f) == 0) {
+    if (f->node != NULL)
+      fc_watch_free_node(dir, w, f->node);
+    else
+      fc_watch_account(dir, w, name, f, -1);
+    free(name);
+    free(f);
+  }
+  c_avl_destroy(node->files);
+
+  /* Fails if the directory is already gone, which is fine. */
+  inotify_rm_watch(w->fd, node->wd);
+  c_avl_remove(w->nodes, (void *)(intptr_t)node->wd, NULL, NULL);
+
+  free(node->path);
+  free(node->name);
+  free(node);
+} /* void fc_watch_free_node */
+
+static void fc_watch_remove(fc_directory_conf_t const *dir, fc_watch_t *w,
+                            fc_node_t *node, char const *name) {
+  char *key;
+  fc_file_t *f;
+
+  if (c_avl_remove(node->files, name, (void *)&key, (void *)&f) != 0)
+    return;
+
+  if (f->node != NULL)
+    fc_watch_free_node(dir, w, f->node);
+  else
+    fc_watch_account(dir, w, key, f, -1);
+
+  free(key);
+  free(f);
+} /* void fc_watch_remove */
+
+static int fc_watch_update(fc_directory_conf_t const *dir, fc_watch_t *w,
+                           fc_node_t *node, char const *name);
+
+/* fc_watch_add_node watches the directory "path" and reads its contents.
+ * Returns ENOSPC if the inotify watch limit has been reached and zero
+ * otherwise, even if the directory could not be watched. */
+static int fc_watch_add_node(fc_directory_conf_t const *dir, fc_watch_t *w,
+                             fc_node_t *parent, char const *name,
+                             char const *path, fc_node_t **ret_node) {
+  *ret_node = NULL;
+
+  /* The watch is added before reading the directory so that no file created
+   * in between is missed. */
+  int wd = inotify_add_watch(w->fd, path, FC_WATCH_MASK);
+  if (wd < 0) {
+    int status = errno;
+    if ((status == ENOSPC) || (status == ENOMEM))
+      return ENOSPC;
+    if (status != ENOENT)
+      ERROR("filecount plugin: Watching '%s' failed: %s", path, STRERRNO);
     return 0;
   }
 
-  if (dir->name != NULL) {
-    status = fnmatch(dir->name, filename, /* flags = */ 0);
-    if (status != 0)
+  /* The directory is watched already. Either it has been moved and the event
+   * for its old name is still pending, or it is reachable twice, e.g.
+   * through a bind mount. In the first case the old entry is dropped and the
+   * directory read again. */
+  fc_node_t *old = NULL;
+  if (c_avl_get(w->nodes, (void *)(intptr_t)wd, (void *)&old) == 0) {
+    for (fc_node_t *n = parent; n != NULL; n = n->parent)
+      if (n == old)
+        return 0;
+    if (old->parent == NULL)
       return 0;
+
+    fc_watch_remove(dir, w, old->parent, old->name);
+    wd = inotify_add_watch(w->fd, path, FC_WATCH_MASK);
+    if (wd < 0)
+      return ((errno == ENOSPC) || (errno == ENOMEM)) ? ENOSPC : 0;
   }
 
-  if (!S_ISREG(statbuf.st_mode)) {
-    dir->files_num++;
+  fc_node_t *node = calloc(1, sizeof(*node));
+  if (node == NULL)
+    return ENOMEM;
+  node->wd = wd;
+  node->parent = parent;
+  node->path = strdup(path);
+  node->name = strdup(name);
+  node->files = c_avl_create((int (*)(const void *, const void *))strcmp);
+  if ((node->path == NULL) || (node->name == NULL) || (node->files == NULL) ||
+      (c_avl_insert(w->nodes, (void *)(intptr_t)wd, node) != 0)) {
+    inotify_rm_watch(w->fd, wd);
+    if (node->files != NULL)
+      c_avl_destroy(node->files);
+    free(node->path);
+    free(node->name);
+    free(node);
+    return ENOMEM;
+  }
+  *ret_node = node;
+
+  DIR *dh = opendir(path);
+  if (dh == NULL) {
+    if (errno != ENOENT)
+      ERROR("filecount plugin: Cannot open '%s': %s", path, STRERRNO);
     return 0;
   }
 
-  if (dir->mtime != 0) {
-    time_t mtime = dir->now;
+  struct dirent *ent;
+  int status = 0;
+  while ((status == 0) && ((ent = readdir(dh)) != NULL)) {
+    if ((strcmp(ent->d_name, ".") == 0) || (strcmp(ent->d_name, "..") == 0))
+      continue;
+    status = fc_watch_update(dir, w, node, ent->d_name);
+  }
 
-    if (dir->mtime < 0)
-      mtime += dir->mtime;
-    else
-      mtime -= dir->mtime;
+  closedir(dh);
+  return status;
+} /* int fc_watch_add_node */
 
-    DEBUG("filecount plugin: Only collecting files that were touched %s %u.",
-          (dir->mtime < 0) ? "after" : "before", (unsigned int)mtime);
+/* fc_watch_update (re-)reads the attributes of a single file. */
+static int fc_watch_update(fc_directory_conf_t const *dir, fc_watch_t *w,
+                           fc_node_t *node, char const *name) {
+  char path[PATH_MAX];
+  mode_t mode;
+  off_t size;
+  time_t mtime;
 
-    if (((dir->mtime < 0) && (statbuf.st_mtime < mtime)) ||
-        ((dir->mtime > 0) && (statbuf.st_mtime > mtime)))
+  if ((name[0] == '.') && !(dir->options & FC_HIDDEN))
+    return 0;
+
+  if (ssnprintf(path, sizeof(path), "%s/%s", node->path, name) >=
+      (int)sizeof(path)) {
+    ERROR("filecount plugin: Path too long: %s/%s", node->path, name);
+    return 0;
+  }
+
+  if (fc_stat(AT_FDCWD, path, &mode, &size, &mtime) != 0) {
+    if (errno != ENOENT)
+      ERROR("filecount plugin: stat (%s) failed.", path);
+    fc_watch_remove(dir, w, node, name);
+    return 0;
+  }
+
+  fc_file_t *f = NULL;
+  if (c_avl_get(node->files, name, (void *)&f) == 0) {
+    if (S_ISDIR(f->mode) == S_ISDIR(mode)) {
+      fc_watch_account(dir, w, name, f, -1);
+      f->mode = mode;
+      f->size = size;
+      f->mtime = mtime;
+      fc_watch_account(dir, w, name, f, +1);
       return 0;
+    }
+    /* Replaced by a file of a different type. */
+    fc_watch_remove(dir, w, node, name);
   }
 
-  if (dir->size != 0) {
-    off_t size;
+  f = calloc(1, sizeof(*f));
+  char *key = strdup(name);
+  if ((f == NULL) || (key == NULL) || (c_avl_insert(node->files, key, f))) {
+    free(f);
+    free(key);
+    return ENOMEM;
+  }
+  f->mode = mode;
+  f->size = size;
+  f->mtime = mtime;
+
+  if (S_ISDIR(mode) && (dir->options & FC_RECURSIVE)) {
+    int status = fc_watch_add_node(dir, w, node, key, path, &f->node);
+    if ((status == 0) && (f->node == NULL))
+      fc_watch_account(dir, w, key, f, +1);
+    return status;
+  }
 
-    if (dir->size < 0)
-      size = (off_t)((-1) * dir->size);
-    else
-      size = (off_t)dir->size;
+  fc_watch_account(dir, w, key, f, +1);
+  return 0;
+} /* int fc_watch_update */
+
+static void fc_watch_destroy(fc_directory_conf_t const *dir, fc_watch_t *w) {
+  if (w == NULL)
+    return;
+
+  if (w->root != NULL)
+    fc_watch_free_node(dir, w, w->root);
+  if (w->nodes != NULL)
+    c_avl_destroy(w->nodes);
+  if (w->fd >= 0)
+    close(w->fd);
+  free(w);
+} /* void fc_watch_destroy */
+
+static fc_watch_t *fc_watch_create(fc_directory_conf_t *dir, int *ret_status) {
+  fc_watch_t *w = calloc(1, sizeof(*w));
+  if (w == NULL) {
+    *ret_status = ENOMEM;
+    return NULL;
+  }
 
-    if (((dir->size < 0) && (statbuf.st_size > size)) ||
-        ((dir->size > 0) && (statbuf.st_size < size)))
-      return 0;
+  w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  w->nodes = c_avl_create(fc_wd_compare);
+  if ((w->fd < 0) || (w->nodes == NULL)) {
+    *ret_status = (w->fd < 0) ? errno : ENOMEM;
+    fc_watch_destroy(dir, w);
+    return NULL;
+  }
+
+  *ret_status = fc_watch_add_node(dir, w, NULL, "", dir->path, &w->root);
+  if ((*ret_status != 0) || (w->root == NULL)) {
+    fc_watch_destroy(dir, w);
+    return NULL;
   }
 
-  dir->files_num++;
-  dir->files_size += (uint64_t)statbuf.st_size;
+  return w;
+} /* fc_watch_t *fc_watch_create */
+
+/* fc_watch_events processes all pending events. Returns ECANCELED if the
+ * directory has to be read from scratch. */
+static int fc_watch_events(fc_directory_conf_t *dir, fc_watch_t *w) {
+  char buffer[65536]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  while (42) {
+    ssize_t len = read(w->fd, buffer, sizeof(buffer));
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN)
+        return 0;
+      ERROR("filecount plugin: Reading inotify events failed: %s", STRERRNO);
+      return errno;
+    }
+
+    struct inotify_event *ev;
+    for (char *ptr = buffer; ptr < buffer + len;
+         ptr += sizeof(*ev) + ev->len) {
+      ev = (struct inotify_event *)ptr;
+
+      if (ev->mask & IN_Q_OVERFLOW) {
+        DEBUG("filecount plugin: inotify queue overflow for %s.", dir->path);
+        return ECANCELED;
+      }
+
+      fc_node_t *node = NULL;
+      if (c_avl_get(w->nodes, (void *)(intptr_t)ev->wd, (void *)&node) != 0)
+        continue;
+
+      /* Subdirectories are taken care of by the events of their parent. */
+      if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+        if (node == w->root)
+          return ECANCELED;
+        continue;
+      }
+
+      if (ev->len == 0)
+        continue;
+
+      int status = 0;
+      if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+        fc_watch_remove(dir, w, node, ev->name);
+      else
+        status = fc_watch_update(dir, w, node, ev->name);
+      if (status != 0)
+        return status;
+    }
+  }
+} /* int fc_watch_events */
+
+static void fc_watch_count(fc_directory_conf_t *dir, fc_node_t *node) {
+  c_avl_iterator_t *iter = c_avl_get_iterator(node->files);
+  char *name;
+  fc_file_t *f;
+
+  while (c_avl_iterator_next(iter, (void *)&name, (void *)&f) == 0) {
+    if (f->node != NULL) {
+      fc_watch_count(dir, f->node);
+      continue;
+    }
+    if (S_ISDIR(f->mode) && (dir->options & FC_RECURSIVE))
+      continue;
+    if (!fc_file_selected(dir, name, f->mode, f->size, f->mtime))
+      continue;
+
+    dir->files_num++;
+    if (S_ISREG(f->mode))
+      dir->files_size += (uint64_t)f->size;
+  }
+  c_avl_iterator_destroy(iter);
+} /* void fc_watch_count */
+
+static int fc_watch_read(fc_directory_conf_t *dir) {
+  int status = 0;
+
+  if (dir->watch != NULL) {
+    status = fc_watch_events(dir, dir->watch);
+    if (status != 0) {
+      fc_watch_destroy(dir, dir->watch);
+      dir->watch = NULL;
+    }
+  }
+
+  if (dir->watch == NULL) {
+    dir->watch = fc_watch_create(dir, &status);
+    if (status == ENOSPC) {
+      WARNING("filecount plugin: Watching \"%s\" exceeds the inotify watch "
+              "limit (fs.inotify.max_user_watches). Falling back to walking "
+              "the directory on every read.",
+              dir->path);
+      dir->incremental = false;
+      return fc_walk(dir);
+    }
+    if (dir->watch == NULL) {
+      ERROR("filecount plugin: Watching \"%s\" failed.", dir->path);
+      return -1;
+    }
+  }
+
+  if (dir->mtime != 0) {
+    dir->files_num = 0;
+    dir->files_size = 0;
+    fc_watch_count(dir, dir->watch->root);
+  } else {
+    dir->files_num = dir->watch->files_num;
+    dir->files_size = dir->watch->files_size;
+  }
 
   return 0;
-} /* int fc_read_dir_callback */
+} /* int fc_watch_read */
+#endif /* KERNEL_LINUX */
 
 static int fc_read_dir(fc_directory_conf_t *dir) {
   dir->files_num = 0;
@@ -528,11 +1187,15 @@ static int fc_read_dir(fc_directory_conf_t *dir) {
   if (dir->mtime != 0)
     dir->now = time(NULL);
 
-  int status =
-      walk_directory(dir->path, fc_read_dir_callback, dir,
-                     /* include hidden */ (dir->options & FC_HIDDEN) ? 1 : 0);
+  int status;
+#if KERNEL_LINUX
+  if (dir->incremental)
+    status = fc_watch_read(dir);
+  else
+#endif
+    status = fc_walk(dir);
   if (status != 0) {
-    WARNING("filecount plugin: walk_directory (%s) failed.", dir->path);
+    WARNING("filecount plugin: Reading \"%s\" failed.", dir->path);
     return -1;
   }
 
@@ -548,8 +1211,18 @@ static int fc_read(void) {
   return 0;
 } /* int fc_read */
 
+static int fc_shutdown(void) {
+  for (size_t i = 0; i < directories_num; i++)
+    fc_free_dir(directories[i]);
+  sfree(directories);
+  directories_num = 0;
+
+  return 0;
+} /* int fc_shutdown */
+
 void module_register(void) {
   plugin_register_complex_config("filecount", fc_config);
   plugin_register_init("filecount", fc_init);
   plugin_register_read("filecount", fc_read);
+  plugin_register_shutdown("filecount", fc_shutdown);
 } /* void module_register */
@@ -27,8 +27,11 @@
  **/
 
 #include <google/protobuf/util/time_util.h>
+#include <grpc++/alarm.h>
 #include <grpc++/grpc++.h>
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <queue>
@@ -72,26 +75,145 @@ struct Listener {
 static std::vector<Listener> listeners;
 static grpc::string default_addr("0.0.0.0:50051");
 
+static size_t worker_threads_num = 4;
+static size_t batch_size = 64;
+static int max_concurrent_streams;
+static bool report_stats;
+
+/* Values received on a PutValues stream are dispatched at the latest after
+ * this time, even if the batch is not full. */
+static const std::chrono::milliseconds batch_flush_interval(100);
+
+/* Per-RPC statistics, dispatched by c_grpc_read() if "ReportStats" is set. */
+struct RpcStats {
+  derive_t requests;
+  derive_t values;
+  cdtime_t latency_sum;
+  uint64_t latency_num;
+};
+static RpcStats put_values_stats;
+static RpcStats query_values_stats;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * helper functions
  */
 
-static bool ident_matches(const value_list_t *vl, const value_list_t *matcher) {
-  if (fnmatch(matcher->host, vl->host, 0))
-    return false;
+static void rpc_stats_record(RpcStats *stats, cdtime_t start, size_t values) {
+  cdtime_t latency = cdtime() - start;
+
+  pthread_mutex_lock(&stats_lock);
+  stats->requests++;
+  stats->values += (derive_t)values;
+  stats->latency_sum += latency;
+  stats->latency_num++;
+  pthread_mutex_unlock(&stats_lock);
+} /* rpc_stats_record */
+
+/* IdentField is one field of an identifier. It points into the identifier
+ * string rather than holding a copy. */
+struct IdentField {
+  const char *ptr;
+  size_t len;
+};
 
-  if (fnmatch(matcher->plugin, vl->plugin, 0))
-    return false;
-  if (fnmatch(matcher->plugin_instance, vl->plugin_instance, 0))
+/* ident_split splits an identifier, as returned by uc_iterator_next(), into
+ * host, plugin, plugin instance, type and type instance, following the rules
+ * of parse_identifier(). */
+static bool ident_split(const char *name, IdentField fields[5]) {
+  const char *plugin = strchr(name, '/');
+  if (plugin == NULL)
     return false;
+  plugin++;
 
-  if (fnmatch(matcher->type, vl->type, 0))
-    return false;
-  if (fnmatch(matcher->type_instance, vl->type_instance, 0))
+  const char *type = strchr(plugin, '/');
+  if (type == NULL)
     return false;
+  type++;
+
+  fields[0] = {name, (size_t)(plugin - 1 - name)};
+
+  size_t plugin_len = (size_t)(type - 1 - plugin);
+  const char *dash = (const char *)memchr(plugin, '-', plugin_len);
+  if (dash != NULL) {
+    fields[1] = {plugin, (size_t)(dash - plugin)};
+    fields[2] = {dash + 1, (size_t)(plugin + plugin_len - (dash + 1))};
+  } else {
+    fields[1] = {plugin, plugin_len};
+    fields[2] = {"", 0};
+  }
+
+  size_t type_len = strlen(type);
+  dash = (const char *)memchr(type, '-', type_len);
+  if (dash != NULL) {
+    fields[3] = {type, (size_t)(dash - type)};
+    fields[4] = {dash + 1, (size_t)(type + type_len - (dash + 1))};
+  } else {
+    fields[3] = {type, type_len};
+    fields[4] = {"", 0};
+  }
 
   return true;
-} /* ident_matches */
+} /* ident_split */
+
+/* IdentMatcher matches identifiers against the shell wildcard patterns of a
+ * QueryValues request. It works on the identifier string directly, so only
+ * matching identifiers are parsed into a value list. Patterns without
+ * wildcards are compared as strings and "*" matches without any comparison;
+ * fnmatch(3) is only used for the remaining patterns. */
+class IdentMatcher final {
+public:
+  explicit IdentMatcher(const value_list_t *match) {
+    const char *patterns[5] = {match->host, match->plugin,
+                               match->plugin_instance, match->type,
+                               match->type_instance};
+
+    for (size_t i = 0; i < 5; i++) {
+      patterns_[i] = patterns[i];
+      if (patterns_[i] == "*")
+        kinds_[i] = Kind::Any;
+      else if (strpbrk(patterns[i], "*?[\\") == NULL)
+        kinds_[i] = Kind::Literal;
+      else
+        kinds_[i] = Kind::Pattern;
+    }
+  }
+
+  bool Matches(const char *name) const {
+    IdentField fields[5];
+    if (!ident_split(name, fields))
+      return false;
+
+    for (size_t i = 0; i < 5; i++) {
+      switch (kinds_[i]) {
+      case Kind::Any:
+        break;
+      case Kind::Literal:
+        if ((fields[i].len != patterns_[i].size()) ||
+            (memcmp(fields[i].ptr, patterns_[i].data(), fields[i].len) != 0))
+          return false;
+        break;
+      case Kind::Pattern: {
+        char buffer[DATA_MAX_NAME_LEN];
+        size_t len = std::min(fields[i].len, sizeof(buffer) - 1);
+        memcpy(buffer, fields[i].ptr, len);
+        buffer[len] = '\0';
+        if (fnmatch(patterns_[i].c_str(), buffer, 0))
+          return false;
+        break;
+      }
+      }
+    }
+
+    return true;
+  }
+
+private:
+  enum class Kind { Any, Literal, Pattern };
+
+  grpc::string patterns_[5];
+  Kind kinds_[5];
+}; /* class IdentMatcher */
 
 static grpc::string read_file(const char *filename) {
   std::ifstream f;
@@ -238,14 +360,20 @@ static grpc::Status marshal_meta_data(meta_data_t *meta,
 
 static grpc::Status unmarshal_meta_data(const grpcMetadata &rpc_metadata,
                                         meta_data_t **md_out) {
+  /* Most value lists don't carry any metadata. */
+  if (rpc_metadata.empty()) {
+    *md_out = nullptr;
+    return grpc::Status::OK;
+  }
+
   *md_out = meta_data_create();
   if (*md_out == nullptr) {
     return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED,
                         grpc::string("failed to create metadata list"));
   }
-  for (auto kv : rpc_metadata) {
+  for (auto const &kv : rpc_metadata) {
     auto k = kv.first.c_str();
-    auto v = kv.second;
+    auto const &v = kv.second;
 
     // The meta_data collection individually allocates copies of the keys and
     // string values for each entry, so it's safe for us to pass a reference
@@ -329,8 +457,12 @@ static grpc::Status marshal_value_list(const value_list_t *vl,
   return grpc::Status::OK;
 } /* marshal_value_list */
 
+/* unmarshal_value_list unmarshals msg into vl. The values are appended to
+ * "values" instead of being allocated for each value list; vl->values is left
+ * NULL and has to be pointed at them once "values" stops growing. */
 static grpc::Status unmarshal_value_list(const collectd::types::ValueList &msg,
-                                         value_list_t *vl) {
+                                         value_list_t *vl,
+                                         std::vector<value_t> *values) {
   vl->time = NS_TO_CDTIME_T(TimeUtil::TimestampToNanoseconds(msg.time()));
   vl->interval =
       NS_TO_CDTIME_T(TimeUtil::DurationToNanoseconds(msg.interval()));
@@ -343,35 +475,24 @@ static grpc::Status unmarshal_value_list(const collectd::types::ValueList &msg,
   if (!status.ok())
     return status;
 
-  value_t *values = NULL;
-  size_t values_len = 0;
-
-  status = grpc::Status::OK;
-  for (auto v : msg.values()) {
-    value_t *val =
-        (value_t *)realloc(values, (values_len + 1) * sizeof(*values));
-    if (!val) {
-      status = grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED,
-                            grpc::string("failed to allocate values array"));
-      break;
-    }
+  size_t offset = values->size();
+  values->reserve(offset + (size_t)msg.values_size());
 
-    values = val;
-    val = values + values_len;
-    values_len++;
+  for (auto const &v : msg.values()) {
+    value_t val;
 
     switch (v.value_case()) {
     case collectd::types::Value::ValueCase::kCounter:
-      val->counter = counter_t(v.counter());
+      val.counter = counter_t(v.counter());
       break;
     case collectd::types::Value::ValueCase::kGauge:
-      val->gauge = gauge_t(v.gauge());
+      val.gauge = gauge_t(v.gauge());
       break;
     case collectd::types::Value::ValueCase::kDerive:
-      val->derive = derive_t(v.derive());
+      val.derive = derive_t(v.derive());
       break;
     case collectd::types::Value::ValueCase::kAbsolute:
-      val->absolute = absolute_t(v.absolute());
+      val.absolute = absolute_t(v.absolute());
       break;
     default:
       status = grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
@@ -381,72 +502,155 @@ static grpc::Status unmarshal_value_list(const collectd::types::ValueList &msg,
 
     if (!status.ok())
       break;
+    values->push_back(val);
   }
-  if (status.ok()) {
-    vl->values = values;
-    vl->values_len = values_len;
-  } else {
+
+  if (!status.ok()) {
+    values->resize(offset);
     meta_data_destroy(vl->meta);
-    free(values);
+    vl->meta = nullptr;
+    return status;
   }
 
-  return status;
+  vl->values = nullptr;
+  vl->values_len = values->size() - offset;
+  return grpc::Status::OK;
 } /* unmarshal_value_list() */
 
+/* ValueListBatch collects the value lists received on a PutValues stream, so
+ * that they can be dispatched together. The values of all value lists share
+ * one buffer, which is kept for the next batch. */
+class ValueListBatch final {
+public:
+  ~ValueListBatch() { Clear(); }
+
+  grpc::Status Add(const collectd::types::ValueList &msg) {
+    value_list_t vl = {0};
+    auto status = unmarshal_value_list(msg, &vl, &values_);
+    if (!status.ok())
+      return status;
+
+    value_lists_.push_back(vl);
+    return grpc::Status::OK;
+  }
+
+  size_t Size() const { return value_lists_.size(); }
+
+  /* Dispatch dispatches all value lists in the batch and empties it.
+   * Dispatching stops at the first error. */
+  grpc::Status Dispatch() {
+    size_t offset = 0;
+    for (auto &vl : value_lists_) {
+      vl.values = values_.data() + offset;
+      offset += vl.values_len;
+
+      if (plugin_dispatch_values(&vl) != 0) {
+        Clear();
+        return grpc::Status(
+            grpc::StatusCode::INTERNAL,
+            grpc::string("failed to enqueue values for writing"));
+      }
+    }
+
+    Clear();
+    return grpc::Status::OK;
+  }
+
+private:
+  void Clear() {
+    for (auto &vl : value_lists_)
+      meta_data_destroy(vl.meta);
+    value_lists_.clear();
+    values_.clear();
+  }
+
+  std::vector<value_list_t> value_lists_;
+  std::vector<value_t> values_;
+}; /* class ValueListBatch */
+
 /*
  * Collectd service
+ *
+ * The service uses gRPC's asynchronous API. Every call is a small state
+ * machine which is advanced by the worker thread owning the call's completion
+ * queue. Each queue is served by exactly one thread, so the events of one call
+ * never race with each other.
  */
-class CollectdImpl : public collectd::Collectd::Service {
+class Call {
 public:
-  grpc::Status
-  QueryValues(grpc::ServerContext *ctx, QueryValuesRequest const *req,
-              grpc::ServerWriter<QueryValuesResponse> *writer) override {
-    value_list_t match;
-    auto status = unmarshal_ident(req->identifier(), &match, false);
-    if (!status.ok()) {
-      return status;
-    }
+  virtual ~Call() = default;
 
-    std::queue<value_list_t> value_lists;
-    status = this->queryValuesRead(&match, &value_lists);
-    if (status.ok()) {
-      status = this->queryValuesWrite(ctx, writer, &value_lists);
-    }
+  /* Proceed is called with the result of the call's pending operation. */
+  virtual void Proceed(bool ok) = 0;
+};
+
+class QueryValuesCall final : public Call {
+public:
+  QueryValuesCall(Collectd::AsyncService *service,
+                  grpc::ServerCompletionQueue *cq)
+      : service_(service), cq_(cq), writer_(&ctx_) {
+    service_->RequestQueryValues(&ctx_, &req_, &writer_, cq_, cq_, this);
+  }
 
-    while (!value_lists.empty()) {
-      auto vl = value_lists.front();
-      value_lists.pop();
+  ~QueryValuesCall() {
+    while (!value_lists_.empty()) {
+      auto vl = value_lists_.front();
+      value_lists_.pop();
       sfree(vl.values);
       meta_data_destroy(vl.meta);
     }
-
-    return status;
   }
 
-  grpc::Status PutValues(grpc::ServerContext *ctx,
-                         grpc::ServerReader<PutValuesRequest> *reader,
-                         PutValuesResponse *res) override {
-    PutValuesRequest req;
-
-    while (reader->Read(&req)) {
-      value_list_t vl = {0};
-      auto status = unmarshal_value_list(req.value_list(), &vl);
-      if (!status.ok())
-        return status;
+  void Proceed(bool ok) override {
+    switch (state_) {
+    case State::Create: {
+      if (!ok) { /* shutting down */
+        delete this;
+        return;
+      }
+      /* Keep a call waiting for the next request. */
+      new QueryValuesCall(service_, cq_);
 
-      if (plugin_dispatch_values(&vl))
-        return grpc::Status(
-            grpc::StatusCode::INTERNAL,
-            grpc::string("failed to enqueue values for writing"));
+      start_ = cdtime();
+      auto status = Query();
+      if (!status.ok()) {
+        Finish(status);
+        return;
+      }
+      WriteNext();
+      return;
     }
 
-    res->Clear();
-    return grpc::Status::OK;
+    case State::Write:
+      if (!ok) { /* the client has gone away */
+        delete this;
+        return;
+      }
+      sent_++;
+      WriteNext();
+      return;
+
+    case State::Finish:
+      if (report_stats)
+        rpc_stats_record(&query_values_stats, start_, sent_);
+      delete this;
+      return;
+    }
   }
 
 private:
-  grpc::Status queryValuesRead(value_list_t const *match,
-                               std::queue<value_list_t> *value_lists) {
+  enum class State { Create, Write, Finish };
+
+  /* Query copies all matching value lists from the cache. The cache is locked
+   * while it is iterated, so nothing is written to the client before the
+   * iteration has finished. */
+  grpc::Status Query() {
+    value_list_t match = {0};
+    auto status = unmarshal_ident(req_.identifier(), &match, false);
+    if (!status.ok())
+      return status;
+    IdentMatcher matcher(&match);
+
     uc_iter_t *iter;
     if ((iter = uc_get_iterator()) == NULL) {
       return grpc::Status(
@@ -454,18 +658,18 @@ private:
           grpc::string("failed to query values: cannot create iterator"));
     }
 
-    grpc::Status status = grpc::Status::OK;
     char *name = NULL;
     while (uc_iterator_next(iter, &name) == 0) {
-      value_list_t vl;
+      if (!matcher.Matches(name))
+        continue;
+
+      value_list_t vl = {0};
       if (parse_identifier_vl(name, &vl) != 0) {
         status = grpc::Status(grpc::StatusCode::INTERNAL,
                               grpc::string("failed to parse identifier"));
         break;
       }
 
-      if (!ident_matches(&vl, match))
-        continue;
       if (uc_iterator_get_time(iter, &vl.time) < 0) {
         status =
             grpc::Status(grpc::StatusCode::INTERNAL,
@@ -484,49 +688,207 @@ private:
         break;
       }
       if (uc_iterator_get_meta(iter, &vl.meta) < 0) {
+        sfree(vl.values);
         status =
             grpc::Status(grpc::StatusCode::INTERNAL,
                          grpc::string("failed to retrieve value metadata"));
+        break;
       }
 
-      value_lists->push(vl);
-    } // while (uc_iterator_next(iter, &name) == 0)
+      value_lists_.push(vl);
+    } /* while (uc_iterator_next(iter, &name) == 0) */
 
     uc_iterator_destroy(iter);
     return status;
   }
 
-  grpc::Status queryValuesWrite(grpc::ServerContext *ctx,
-                                grpc::ServerWriter<QueryValuesResponse> *writer,
-                                std::queue<value_list_t> *value_lists) {
-    while (!value_lists->empty()) {
-      auto vl = value_lists->front();
-      QueryValuesResponse res;
-      res.Clear();
+  /* WriteNext sends the next value list or finishes the call if there are
+   * none left. Only one write may be pending at any time. */
+  void WriteNext() {
+    if (value_lists_.empty()) {
+      Finish(grpc::Status::OK);
+      return;
+    }
+
+    auto vl = value_lists_.front();
+    value_lists_.pop();
+
+    res_.Clear();
+    auto status = marshal_value_list(&vl, res_.mutable_value_list());
+    sfree(vl.values);
+    meta_data_destroy(vl.meta);
+    if (!status.ok()) {
+      Finish(status);
+      return;
+    }
+
+    state_ = State::Write;
+    writer_.Write(res_, this);
+  }
+
+  void Finish(grpc::Status const &status) {
+    state_ = State::Finish;
+    writer_.Finish(status, this);
+  }
+
+  Collectd::AsyncService *service_;
+  grpc::ServerCompletionQueue *cq_;
+
+  grpc::ServerContext ctx_;
+  QueryValuesRequest req_;
+  QueryValuesResponse res_;
+  grpc::ServerAsyncWriter<QueryValuesResponse> writer_;
+
+  State state_ = State::Create;
+  std::queue<value_list_t> value_lists_;
+  cdtime_t start_ = 0;
+  size_t sent_ = 0;
+}; /* class QueryValuesCall */
+
+class PutValuesCall final : public Call {
+public:
+  PutValuesCall(Collectd::AsyncService *service,
+                grpc::ServerCompletionQueue *cq)
+      : service_(service), cq_(cq), reader_(&ctx_), flush_tag_(this) {
+    service_->RequestPutValues(&ctx_, &reader_, cq_, cq_, this);
+  }
+
+  void Proceed(bool ok) override {
+    switch (state_) {
+    case State::Create:
+      if (!ok) { /* shutting down */
+        delete this;
+        return;
+      }
+      /* Keep a call waiting for the next request. */
+      new PutValuesCall(service_, cq_);
+
+      start_ = cdtime();
+      state_ = State::Read;
+      reader_.Read(&req_, this);
+      return;
+
+    case State::Read: {
+      if (!ok) { /* the client is done sending */
+        Finish(batch_.Dispatch());
+        return;
+      }
 
-      auto status = marshal_value_list(&vl, res.mutable_value_list());
+      auto status = batch_.Add(req_.value_list());
       if (!status.ok()) {
-        return status;
+        /* Values received before the broken one are still dispatched. */
+        batch_.Dispatch();
+        Finish(status);
+        return;
+      }
+      received_++;
+
+      if (batch_.Size() >= batch_size) {
+        status = batch_.Dispatch();
+      } else if (!flush_pending_) {
+        flush_pending_ = true;
+        flush_alarm_.Set(cq_,
+                         std::chrono::system_clock::now() + batch_flush_interval,
+                         &flush_tag_);
       }
 
-      if (!writer->Write(res)) {
-        return grpc::Status::CANCELLED;
+      if (status.ok())
+        status = flush_status_;
+      if (!status.ok()) {
+        Finish(status);
+        return;
       }
 
-      value_lists->pop();
-      sfree(vl.values);
+      /* Only one read is pending at any time. A client sending faster than
+       * values can be dispatched is slowed down by gRPC's flow control. */
+      reader_.Read(&req_, this);
+      return;
     }
 
-    return grpc::Status::OK;
+    case State::Finish:
+      if (report_stats)
+        rpc_stats_record(&put_values_stats, start_, received_);
+      state_ = State::Done;
+      DeleteIfDone();
+      return;
+
+    case State::Done:
+      return;
+    }
   }
-};
+
+private:
+  enum class State { Create, Read, Finish, Done };
+
+  /* FlushTag is the tag of the flush alarm. It forwards the event to the call
+   * it belongs to. */
+  class FlushTag final : public Call {
+  public:
+    explicit FlushTag(PutValuesCall *call) : call_(call) {}
+    void Proceed(bool ok) override { call_->Flush(ok); }
+
+  private:
+    PutValuesCall *call_;
+  };
+
+  /* Flush dispatches the batch once the flush interval has passed, so that
+   * values sent on an otherwise idle stream are not held back. */
+  void Flush(bool ok) {
+    flush_pending_ = false;
+
+    if (state_ == State::Read && ok) {
+      auto status = batch_.Dispatch();
+      /* The read which is pending reports the error. */
+      if (!status.ok() && flush_status_.ok())
+        flush_status_ = status;
+    }
+
+    DeleteIfDone();
+  }
+
+  void Finish(grpc::Status const &status) {
+    state_ = State::Finish;
+    if (flush_pending_)
+      flush_alarm_.Cancel();
+
+    if (status.ok())
+      reader_.Finish(res_, status, this);
+    else
+      reader_.FinishWithError(status, this);
+  }
+
+  /* The call may only be deleted once both the call and the alarm are done. */
+  void DeleteIfDone() {
+    if ((state_ == State::Done) && !flush_pending_)
+      delete this;
+  }
+
+  Collectd::AsyncService *service_;
+  grpc::ServerCompletionQueue *cq_;
+
+  grpc::ServerContext ctx_;
+  PutValuesRequest req_;
+  PutValuesResponse res_;
+  grpc::ServerAsyncReader<PutValuesResponse, PutValuesRequest> reader_;
+
+  State state_ = State::Create;
+  ValueListBatch batch_;
+  grpc::Status flush_status_;
+
+  grpc::Alarm flush_alarm_;
+  FlushTag flush_tag_;
+  bool flush_pending_ = false;
+
+  cdtime_t start_ = 0;
+  size_t received_ = 0;
+}; /* class PutValuesCall */
 
 /*
  * gRPC server implementation
  */
 class CollectdServer final {
 public:
-  void Start() {
+  int Start() {
     auto auth = grpc::InsecureServerCredentials();
 
     grpc::ServerBuilder builder;
@@ -550,16 +912,77 @@ public:
       }
     }
 
+    if (max_concurrent_streams > 0)
+      builder.AddChannelArgument(GRPC_ARG_MAX_CONCURRENT_STREAMS,
+                                 max_concurrent_streams);
+
     builder.RegisterService(&collectd_service_);
+    for (size_t i = 0; i < worker_threads_num; i++)
+      cqs_.push_back(builder.AddCompletionQueue());
 
     server_ = builder.BuildAndStart();
+    if (!server_) {
+      ERROR("grpc: Starting the server failed.");
+      return -1;
+    }
+
+    for (auto &cq : cqs_) {
+      new PutValuesCall(&collectd_service_, cq.get());
+      new QueryValuesCall(&collectd_service_, cq.get());
+    }
+
+    for (auto &cq : cqs_) {
+      pthread_t tid;
+      int status = plugin_thread_create(&tid, Worker, cq.get(), "grpc worker");
+      if (status != 0) {
+        ERROR("grpc: Starting a worker thread failed with status %d.", status);
+        return -1;
+      }
+      workers_.push_back(tid);
+    }
+
+    return 0;
   } /* Start() */
 
-  void Shutdown() { server_->Shutdown(); } /* Shutdown() */
+  void Shutdown() {
+    if (server_) {
+      /* Streams may be kept open by clients indefinitely. Give in-flight
+       * calls a moment to finish, then cancel them. */
+      server_->Shutdown(std::chrono::system_clock::now() +
+                        std::chrono::seconds(2));
+    }
+
+    for (auto &cq : cqs_)
+      cq->Shutdown();
+
+    for (auto tid : workers_)
+      pthread_join(tid, NULL);
+
+    /* Drain the queues whose worker thread could not be started. */
+    for (size_t i = workers_.size(); i < cqs_.size(); i++)
+      Worker(cqs_[i].get());
+
+    workers_.clear();
+  } /* Shutdown() */
 
 private:
-  CollectdImpl collectd_service_;
+  static void *Worker(void *arg) {
+    auto cq = static_cast<grpc::ServerCompletionQueue *>(arg);
+
+    void *tag;
+    bool ok;
+    while (cq->Next(&tag, &ok))
+      static_cast<Call *>(tag)->Proceed(ok);
 
+    return NULL;
+  } /* Worker() */
+
+  Collectd::AsyncService collectd_service_;
+  std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_;
+  std::vector<pthread_t> workers_;
+
+  /* Destroyed first: the server has to go away before its queues and the
+   * service. */
   std::unique_ptr<grpc::Server> server_;
 }; /* class CollectdServer */
 
@@ -767,9 +1190,30 @@ static int c_grpc_config(oconfig_item_t *ci) {
     } else if (!strcasecmp("Server", child->key)) {
       if (c_grpc_config_server(child))
         return -1;
-    }
-
-    else {
+    } else if (!strcasecmp("WorkerThreads", child->key)) {
+      int n = 0;
+      if (cf_util_get_int(child, &n) || (n < 1)) {
+        ERROR("grpc: Option `%s` expects a positive integer.", child->key);
+        return -1;
+      }
+      worker_threads_num = (size_t)n;
+    } else if (!strcasecmp("BatchSize", child->key)) {
+      int n = 0;
+      if (cf_util_get_int(child, &n) || (n < 1)) {
+        ERROR("grpc: Option `%s` expects a positive integer.", child->key);
+        return -1;
+      }
+      batch_size = (size_t)n;
+    } else if (!strcasecmp("MaxConcurrentStreams", child->key)) {
+      if (cf_util_get_int(child, &max_concurrent_streams) ||
+          (max_concurrent_streams < 0)) {
+        ERROR("grpc: Option `%s` expects a non-negative integer.", child->key);
+        return -1;
+      }
+    } else if (!strcasecmp("ReportStats", child->key)) {
+      if (cf_util_get_boolean(child, &report_stats))
+        return -1;
+    } else {
       WARNING("grpc: Option `%s` not allowed here.", child->key);
     }
   }
@@ -777,6 +1221,52 @@ static int c_grpc_config(oconfig_item_t *ci) {
   return 0;
 } /* c_grpc_config() */
 
+static void c_grpc_submit(char const *type, char const *type_instance,
+                          value_t value) {
+  value_list_t vl = {0};
+
+  vl.values = &value;
+  vl.values_len = 1;
+  sstrncpy(vl.plugin, "grpc", sizeof(vl.plugin));
+  sstrncpy(vl.type, type, sizeof(vl.type));
+  sstrncpy(vl.type_instance, type_instance, sizeof(vl.type_instance));
+
+  plugin_dispatch_values(&vl);
+} /* c_grpc_submit() */
+
+static void c_grpc_submit_stats(char const *method, RpcStats const *stats) {
+  gauge_t latency = NAN;
+  if (stats->latency_num > 0)
+    latency = CDTIME_T_TO_DOUBLE(stats->latency_sum) /
+              (gauge_t)stats->latency_num;
+
+  value_t value;
+
+  value.derive = stats->requests;
+  c_grpc_submit("total_requests", method, value);
+  value.derive = stats->values;
+  c_grpc_submit("total_values", method, value);
+  value.gauge = latency;
+  c_grpc_submit("duration", method, value);
+} /* c_grpc_submit_stats() */
+
+/* c_grpc_read dispatches the number of calls and values per RPC and the
+ * average call duration since the last read. */
+static int c_grpc_read(void) {
+  pthread_mutex_lock(&stats_lock);
+  RpcStats put_values = put_values_stats;
+  RpcStats query_values = query_values_stats;
+  put_values_stats.latency_sum = 0;
+  put_values_stats.latency_num = 0;
+  query_values_stats.latency_sum = 0;
+  query_values_stats.latency_num = 0;
+  pthread_mutex_unlock(&stats_lock);
+
+  c_grpc_submit_stats("PutValues", &put_values);
+  c_grpc_submit_stats("QueryValues", &query_values);
+  return 0;
+} /* c_grpc_read() */
+
 static int c_grpc_init(void) {
   server = new CollectdServer();
   if (!server) {
@@ -784,7 +1274,16 @@ static int c_grpc_init(void) {
     return -1;
   }
 
-  server->Start();
+  if (server->Start() != 0) {
+    server->Shutdown();
+    delete server;
+    server = nullptr;
+    return -1;
+  }
+
+  if (report_stats)
+    plugin_register_read("grpc", c_grpc_read);
+
   return 0;
 } /* c_grpc_init() */
 
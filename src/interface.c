@@ -25,6 +25,7 @@
 #include "collectd.h"
 
 #include "plugin.h"
+#include "utils/avltree/avltree.h"
 #include "utils/common/common.h"
 #include "utils/ignorelist/ignorelist.h"
 
@@ -55,6 +56,12 @@
 #include <sys/protosw.h>
 #endif
 
+#if KERNEL_LINUX
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#endif
+
 /*
  * Various people have reported problems with `getifaddrs' and varying versions
  * of `glibc'. That's why it's disabled by default. Since more statistics are
@@ -85,6 +92,7 @@ static const char *config_keys[] = {
     "Interface",
     "IgnoreSelected",
     "ReportInactive",
+    "UseNetlink",
 };
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
@@ -103,6 +111,32 @@ static int numif;
 static bool unique_name;
 #endif /* HAVE_LIBKSTAT */
 
+#if KERNEL_LINUX
+static procfile_t *pf_netdev;
+
+typedef struct {
+  int index;
+  char name[IFNAMSIZ];
+} if_name_t;
+
+static bool use_netlink;
+static int nl_sock = -1;
+static uint32_t nl_seq;
+/* Large enough for the biggest message the kernel sends in a dump. */
+static char nl_buffer[32768];
+
+/* RTM_GETSTATS only reports the interface index, so the names are looked up
+ * here. The tree is filled from a link dump and then kept up to date by the
+ * link notifications the socket subscribes to. */
+static c_avl_tree_t *nl_names;
+static bool nl_names_valid;
+#ifdef RTM_GETSTATS
+static bool nl_have_getstats = true;
+#else
+static bool nl_have_getstats;
+#endif
+#endif /* KERNEL_LINUX */
+
 static int interface_config(const char *key, const char *value) {
   if (ignorelist == NULL)
     ignorelist = ignorelist_create(/* invert = */ 1);
@@ -124,6 +158,13 @@ static int interface_config(const char *key, const char *value) {
     WARNING("interface plugin: the \"UniqueName\" option is only valid on "
             "Solaris.");
 #endif /* HAVE_LIBKSTAT */
+  } else if (strcasecmp(key, "UseNetlink") == 0) {
+#if KERNEL_LINUX
+    use_netlink = IS_TRUE(value);
+#else
+    WARNING("interface plugin: the \"UseNetlink\" option is only valid on "
+            "Linux.");
+#endif /* KERNEL_LINUX */
   } else {
     return -1;
   }
@@ -178,10 +219,274 @@ static void if_submit(const char *dev, const char *type, derive_t rx,
   plugin_dispatch_values(&vl);
 } /* void if_submit */
 
+#if KERNEL_LINUX
+static int if_name_compare(const void *a, const void *b) {
+  int ia = *(const int *)a;
+  int ib = *(const int *)b;
+
+  return (ia > ib) - (ia < ib);
+} /* int if_name_compare */
+
+static void if_names_clear(void) {
+  void *key;
+  void *value;
+
+  if (nl_names == NULL)
+    return;
+
+  while (c_avl_pick(nl_names, &key, &value) == 0)
+    free(value);
+} /* void if_names_clear */
+
+static void if_submit_stats64(const char *device,
+                              struct rtnl_link_stats64 const *stats) {
+  if (!report_inactive && (stats->rx_packets == 0) &&
+      (stats->tx_packets == 0))
+    return;
+
+  /* Use the same sums as /proc/net/dev. */
+  if_submit(device, "if_packets", stats->rx_packets, stats->tx_packets);
+  if_submit(device, "if_octets", stats->rx_bytes, stats->tx_bytes);
+  if_submit(device, "if_errors", stats->rx_errors, stats->tx_errors);
+  if_submit(device, "if_dropped", stats->rx_dropped + stats->rx_missed_errors,
+            stats->tx_dropped);
+} /* void if_submit_stats64 */
+
+/* if_handle_link handles a RTM_NEWLINK or RTM_DELLINK message, which is either
+ * part of a link dump or a notification. The interface name is remembered and,
+ * if "submit" is true, the IFLA_STATS64 counters are dispatched. */
+static void if_handle_link(struct nlmsghdr const *nlh, bool submit) {
+  struct ifinfomsg *ifm = NLMSG_DATA(nlh);
+  struct rtnl_link_stats64 stats = {0};
+  bool have_stats = false;
+  char const *device = NULL;
+  int len = IFLA_PAYLOAD(nlh);
+
+  for (struct rtattr *rta = IFLA_RTA(ifm); RTA_OK(rta, len);
+       rta = RTA_NEXT(rta, len)) {
+    if (rta->rta_type == IFLA_IFNAME) {
+      device = RTA_DATA(rta);
+    } else if (rta->rta_type == IFLA_STATS64) {
+      /* Older kernels send a shorter struct. */
+      size_t size = RTA_PAYLOAD(rta);
+      if (size > sizeof(stats))
+        size = sizeof(stats);
+      memcpy(&stats, RTA_DATA(rta), size);
+      have_stats = true;
+    }
+  }
+
+  if_name_t *n = NULL;
+  c_avl_get(nl_names, &ifm->ifi_index, (void *)&n);
+  if (nlh->nlmsg_type == RTM_DELLINK) {
+    if (n != NULL) {
+      c_avl_remove(nl_names, &ifm->ifi_index, NULL, NULL);
+      free(n);
+    }
+    return;
+  }
+
+  if (device == NULL)
+    return;
+
+  if (n != NULL) {
+    sstrncpy(n->name, device, sizeof(n->name));
+  } else if ((n = calloc(1, sizeof(*n))) != NULL) {
+    n->index = ifm->ifi_index;
+    sstrncpy(n->name, device, sizeof(n->name));
+    if (c_avl_insert(nl_names, &n->index, n) != 0)
+      free(n);
+  }
+
+  if (submit && have_stats)
+    if_submit_stats64(device, &stats);
+} /* void if_handle_link */
+
+#ifdef RTM_GETSTATS
+static void if_handle_stats(struct nlmsghdr const *nlh) {
+  struct if_stats_msg *ifsm = NLMSG_DATA(nlh);
+  int index = (int)ifsm->ifindex;
+  if_name_t *n = NULL;
+
+  if (c_avl_get(nl_names, &index, (void *)&n) != 0) {
+    /* Missed the notification; the names are dumped again on the next read. */
+    nl_names_valid = false;
+    return;
+  }
+
+  int len = NLMSG_PAYLOAD(nlh, sizeof(*ifsm));
+  for (struct rtattr *rta =
+           (struct rtattr *)((char *)ifsm + NLMSG_ALIGN(sizeof(*ifsm)));
+       RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+    if (rta->rta_type != IFLA_STATS_LINK_64)
+      continue;
+
+    struct rtnl_link_stats64 stats = {0};
+    size_t size = RTA_PAYLOAD(rta);
+    if (size > sizeof(stats))
+      size = sizeof(stats);
+    memcpy(&stats, RTA_DATA(rta), size);
+
+    if_submit_stats64(n->name, &stats);
+  }
+} /* void if_handle_stats */
+#endif /* RTM_GETSTATS */
+
+static int if_netlink_open(void) {
+  struct sockaddr_nl sa = {
+      .nl_family = AF_NETLINK,
+      .nl_groups = RTMGRP_LINK,
+  };
+
+  if ((nl_names == NULL) &&
+      ((nl_names = c_avl_create(if_name_compare)) == NULL)) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  nl_sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (nl_sock < 0)
+    return -1;
+
+  if (bind(nl_sock, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+    int status = errno;
+    close(nl_sock);
+    nl_sock = -1;
+    errno = status;
+    return -1;
+  }
+
+  nl_names_valid = false;
+  return 0;
+} /* int if_netlink_open */
+
+/* if_netlink_dump sends the dump request "req" and handles the replies until
+ * the dump is done. Link notifications received in between update the
+ * interface names. */
+static int if_netlink_dump(struct nlmsghdr *req) {
+  struct sockaddr_nl sa = {.nl_family = AF_NETLINK};
+
+  req->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  req->nlmsg_seq = ++nl_seq;
+
+  if (sendto(nl_sock, req, req->nlmsg_len, 0, (struct sockaddr *)&sa,
+             sizeof(sa)) < 0)
+    return -1;
+
+  while (42) {
+    struct iovec iov = {.iov_base = nl_buffer, .iov_len = sizeof(nl_buffer)};
+    struct msghdr msg = {
+        .msg_name = &sa,
+        .msg_namelen = sizeof(sa),
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+    };
+
+    ssize_t status = recvmsg(nl_sock, &msg, 0);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == ENOBUFS) {
+        /* Notifications were lost. */
+        nl_names_valid = false;
+        continue;
+      }
+      return -1;
+    } else if ((status == 0) || (msg.msg_flags & MSG_TRUNC)) {
+      errno = EMSGSIZE;
+      return -1;
+    }
+
+    int len = (int)status;
+    for (struct nlmsghdr *nlh = (struct nlmsghdr *)nl_buffer;
+         NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+      /* Notifications have a sequence number of zero. Other replies are left
+       * over from a dump that was aborted. */
+      bool is_reply = (nlh->nlmsg_seq == req->nlmsg_seq);
+
+      if (is_reply && (nlh->nlmsg_type == NLMSG_DONE))
+        return 0;
+
+      if (is_reply && (nlh->nlmsg_type == NLMSG_ERROR)) {
+        struct nlmsgerr *err = NLMSG_DATA(nlh);
+        errno = -err->error;
+        return -1;
+      }
+
+      if ((nlh->nlmsg_type == RTM_NEWLINK) || (nlh->nlmsg_type == RTM_DELLINK))
+        if_handle_link(nlh, is_reply && !nl_have_getstats);
+#ifdef RTM_GETSTATS
+      else if (is_reply && (nlh->nlmsg_type == RTM_NEWSTATS))
+        if_handle_stats(nlh);
+#endif
+    }
+  }
+} /* int if_netlink_dump */
+
+/* interface_read_netlink reads the counters with a RTM_GETSTATS dump, which
+ * costs much less than formatting and parsing /proc/net/dev. Kernels before
+ * 4.7 only report them as part of the link dump. */
+static int interface_read_netlink(void) {
+  if (!nl_names_valid || !nl_have_getstats) {
+    struct {
+      struct nlmsghdr nlh;
+      struct ifinfomsg ifm;
+    } req = {
+        .nlh =
+            {
+                .nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+                .nlmsg_type = RTM_GETLINK,
+            },
+        .ifm = {.ifi_family = AF_UNSPEC},
+    };
+
+    if_names_clear();
+    nl_names_valid = true;
+    if (if_netlink_dump(&req.nlh) != 0) {
+      nl_names_valid = false;
+      return -1;
+    }
+
+    if (!nl_have_getstats)
+      return 0;
+  }
+
+#ifdef RTM_GETSTATS
+  struct {
+    struct nlmsghdr nlh;
+    struct if_stats_msg ifsm;
+  } req = {
+      .nlh =
+          {
+              .nlmsg_len = NLMSG_LENGTH(sizeof(struct if_stats_msg)),
+              .nlmsg_type = RTM_GETSTATS,
+          },
+      .ifsm =
+          {
+              .family = AF_UNSPEC,
+              .filter_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64),
+          },
+  };
+
+  if (if_netlink_dump(&req.nlh) == 0)
+    return 0;
+  if ((errno != EOPNOTSUPP) && (errno != EINVAL))
+    return -1;
+
+  INFO("interface plugin: The kernel does not support RTM_GETSTATS. Reading "
+       "the counters from the link dump instead.");
+  nl_have_getstats = false;
+  return interface_read_netlink();
+#else
+  return 0;
+#endif /* RTM_GETSTATS */
+} /* int interface_read_netlink */
+#endif /* KERNEL_LINUX */
+
 static int interface_read(void) {
 #if KERNEL_LINUX
-  FILE *fh;
-  char buffer[1024];
+  char *buffer;
+  char *ptr;
   derive_t incoming, outgoing;
   char *device;
 
@@ -189,12 +494,37 @@ static int interface_read(void) {
   char *fields[16];
   int numfields;
 
-  if ((fh = fopen("/proc/net/dev", "r")) == NULL) {
-    WARNING("interface plugin: fopen: %s", STRERRNO);
+  if (use_netlink && (nl_sock < 0)) {
+    if (if_netlink_open() != 0) {
+      ERROR("interface plugin: Opening a netlink socket failed: %s. "
+            "Falling back to /proc/net/dev.",
+            STRERRNO);
+      use_netlink = false;
+    }
+  }
+
+  if (use_netlink) {
+    if (interface_read_netlink() != 0) {
+      WARNING("interface plugin: Reading link statistics over netlink "
+              "failed: %s",
+              STRERRNO);
+      close(nl_sock);
+      nl_sock = -1;
+      return -1;
+    }
+    return 0;
+  }
+
+  if ((pf_netdev == NULL) &&
+      ((pf_netdev = procfile_create("/proc/net/dev")) == NULL))
+    return -1;
+
+  if ((ptr = procfile_read(pf_netdev)) == NULL) {
+    WARNING("interface plugin: Reading /proc/net/dev failed: %s", STRERRNO);
     return -1;
   }
 
-  while (fgets(buffer, 1024, fh) != NULL) {
+  while ((buffer = next_line(&ptr)) != NULL) {
     if (!(dummy = strchr(buffer, ':')))
       continue;
     dummy[0] = '\0';
@@ -231,8 +561,6 @@ static int interface_read(void) {
     outgoing = atoll(fields[11]);
     if_submit(device, "if_dropped", incoming, outgoing);
   }
-
-  fclose(fh);
   /* #endif KERNEL_LINUX */
 
 #elif HAVE_GETIFADDRS
@@ -389,6 +717,21 @@ static int interface_read(void) {
   return 0;
 } /* int interface_read */
 
+#if KERNEL_LINUX
+static int interface_shutdown(void) {
+  procfile_destroy(pf_netdev);
+  pf_netdev = NULL;
+  if (nl_sock >= 0) {
+    close(nl_sock);
+    nl_sock = -1;
+  }
+  if_names_clear();
+  c_avl_destroy(nl_names);
+  nl_names = NULL;
+  return 0;
+} /* int interface_shutdown */
+#endif /* KERNEL_LINUX */
+
 void module_register(void) {
   plugin_register_config("interface", interface_config, config_keys,
                          config_keys_num);
@@ -396,4 +739,7 @@ void module_register(void) {
   plugin_register_init("interface", interface_init);
 #endif
   plugin_register_read("interface", interface_read);
+#if KERNEL_LINUX
+  plugin_register_shutdown("interface", interface_shutdown);
+#endif
 } /* void module_register */
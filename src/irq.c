@@ -47,6 +47,10 @@ static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static ignorelist_t *ignorelist;
 
+#if KERNEL_LINUX
+static procfile_t *pf_interrupts;
+#endif /* KERNEL_LINUX */
+
 /*
  * Private functions
  */
@@ -85,8 +89,8 @@ static void irq_submit(const char *irq_name, derive_t value) {
 
 #if KERNEL_LINUX
 static int irq_read(void) {
-  FILE *fh;
-  char buffer[1024];
+  char *buffer;
+  char *ptr;
   int cpu_count;
   char *fields[256];
 
@@ -97,23 +101,25 @@ static int irq_read(void) {
    * 1:     102553     158669     218062      70587   IO-APIC-edge      i8042
    * 8:          0          0          0          1   IO-APIC-edge      rtc0
    */
-  fh = fopen("/proc/interrupts", "r");
-  if (fh == NULL) {
-    ERROR("irq plugin: fopen (/proc/interrupts): %s", STRERRNO);
+  if ((pf_interrupts == NULL) &&
+      ((pf_interrupts = procfile_create("/proc/interrupts")) == NULL))
+    return -1;
+
+  if ((ptr = procfile_read(pf_interrupts)) == NULL) {
+    ERROR("irq plugin: Reading /proc/interrupts failed: %s", STRERRNO);
     return -1;
   }
 
   /* Get CPU count from the first line */
-  if (fgets(buffer, sizeof(buffer), fh) != NULL) {
+  if ((buffer = next_line(&ptr)) != NULL) {
     cpu_count = strsplit(buffer, fields, STATIC_ARRAY_SIZE(fields));
   } else {
     ERROR("irq plugin: unable to get CPU count from first line "
           "of /proc/interrupts");
-    fclose(fh);
     return -1;
   }
 
-  while (fgets(buffer, sizeof(buffer), fh) != NULL) {
+  while ((buffer = next_line(&ptr)) != NULL) {
     char *irq_name;
     size_t irq_name_len;
     derive_t irq_value;
@@ -170,10 +176,14 @@ static int irq_read(void) {
     irq_submit(irq_name, irq_value);
   }
 
-  fclose(fh);
-
   return 0;
 } /* int irq_read */
+
+static int irq_shutdown(void) {
+  procfile_destroy(pf_interrupts);
+  pf_interrupts = NULL;
+  return 0;
+} /* int irq_shutdown */
 #endif /* KERNEL_LINUX */
 
 #if KERNEL_NETBSD
@@ -227,4 +237,7 @@ static int irq_read(void) {
 void module_register(void) {
   plugin_register_config("irq", irq_config, config_keys, config_keys_num);
   plugin_register_read("irq", irq_read);
+#if KERNEL_LINUX
+  plugin_register_shutdown("irq", irq_shutdown);
+#endif
 } /* void module_register */
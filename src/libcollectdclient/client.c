@@ -104,12 +104,26 @@
     snprintf((c)->errbuf, sizeof((c)->errbuf), __VA_ARGS__);                   \
   } while (0)
 
+/* Maximum number of pipelined PUTVAL commands whose responses have not been
+ * read. The responses are small, so this stays well below the socket buffer
+ * size and the daemon never blocks writing them. */
+#define LCC_PENDING_MAX 128
+
+/* Maximum number of lines sent with a single BATCH command. */
+#define LCC_BATCH_MAX 1024
+
 /*
  * Types
  */
 struct lcc_connection_s {
   FILE *fh;
   char errbuf[2048];
+
+  /* Number of pipelined commands whose responses have not been read yet. */
+  size_t pending;
+  /* Number of pipelined commands which failed and the first error message. */
+  size_t failed;
+  char failed_msg[1024];
 };
 
 struct lcc_response_s {
@@ -358,6 +372,38 @@ static int lcc_receive(lcc_connection_t *c, /* {{{ */
   return 0;
 } /* }}} int lcc_receive */
 
+/* lcc_receive_pending reads the responses of all pipelined commands. Failures
+ * are recorded in the connection and reported by lcc_flush_responses().
+ * All responses are read before anything new is written, because switching
+ * the stream from reading to writing discards buffered input. */
+static int lcc_receive_pending(lcc_connection_t *c) /* {{{ */
+{
+  if (c->pending == 0)
+    return 0;
+
+  if (fflush(c->fh) != 0) {
+    lcc_set_errno(c, errno);
+    return -1;
+  }
+
+  while (c->pending > 0) {
+    lcc_response_t res = {0};
+
+    if (lcc_receive(c, &res) != 0)
+      return -1;
+    c->pending--;
+
+    if (res.status != 0) {
+      if (c->failed == 0)
+        snprintf(c->failed_msg, sizeof(c->failed_msg), "%s", res.message);
+      c->failed++;
+    }
+    lcc_response_free(&res);
+  }
+
+  return 0;
+} /* }}} int lcc_receive_pending */
+
 static int lcc_sendreceive(lcc_connection_t *c, /* {{{ */
                            const char *command, lcc_response_t *ret_res) {
   lcc_response_t res = {0};
@@ -368,6 +414,10 @@ static int lcc_sendreceive(lcc_connection_t *c, /* {{{ */
     return -1;
   }
 
+  status = lcc_receive_pending(c);
+  if (status != 0)
+    return status;
+
   status = lcc_send(c, command);
   if (status != 0)
     return status;
@@ -717,16 +767,16 @@ int lcc_getval(lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
   return 0;
 } /* }}} int lcc_getval */
 
-int lcc_putval(lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
-{
+static int lcc_format_putval(lcc_connection_t *c, /* {{{ */
+                             const lcc_value_list_t *vl, char *ret,
+                             size_t ret_size) {
   char ident_str[6 * LCC_NAME_LEN];
   char ident_esc[12 * LCC_NAME_LEN];
   char command[1024] = "";
-  lcc_response_t res;
   int status;
 
-  if ((c == NULL) || (vl == NULL) || (vl->values_len < 1) ||
-      (vl->values == NULL) || (vl->values_types == NULL)) {
+  if ((vl == NULL) || (vl->values_len < 1) || (vl->values == NULL) ||
+      (vl->values_types == NULL)) {
     lcc_set_errno(c, EINVAL);
     return -1;
   }
@@ -762,6 +812,25 @@ int lcc_putval(lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
 
   } /* for (i = 0; i < vl->values_len; i++) */
 
+  snprintf(ret, ret_size, "%s", command);
+  return 0;
+} /* }}} int lcc_format_putval */
+
+int lcc_putval(lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
+{
+  char command[1024];
+  lcc_response_t res;
+  int status;
+
+  if (c == NULL) {
+    lcc_set_errno(c, EINVAL);
+    return -1;
+  }
+
+  status = lcc_format_putval(c, vl, command, sizeof(command));
+  if (status != 0)
+    return status;
+
   status = lcc_sendreceive(c, command, &res);
   if (status != 0)
     return status;
@@ -776,6 +845,177 @@ int lcc_putval(lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
   return 0;
 } /* }}} int lcc_putval */
 
+int lcc_putval_async(lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
+{
+  char command[1024];
+  int status;
+
+  if (c == NULL) {
+    lcc_set_errno(c, EINVAL);
+    return -1;
+  }
+
+  if (c->fh == NULL) {
+    lcc_set_errno(c, EBADF);
+    return -1;
+  }
+
+  status = lcc_format_putval(c, vl, command, sizeof(command));
+  if (status != 0)
+    return status;
+
+  lcc_tracef("send:    --> %s\n", command);
+
+  /* The command is written to the stream's buffer only; it is sent once the
+   * buffer is full or the responses are collected. */
+  if (fprintf(c->fh, "%s\r\n", command) < 0) {
+    lcc_set_errno(c, errno);
+    return -1;
+  }
+  c->pending++;
+
+  if (c->pending >= LCC_PENDING_MAX)
+    return lcc_receive_pending(c);
+
+  return 0;
+} /* }}} int lcc_putval_async */
+
+int lcc_flush_responses(lcc_connection_t *c) /* {{{ */
+{
+  int status;
+
+  if (c == NULL) {
+    lcc_set_errno(c, EINVAL);
+    return -1;
+  }
+
+  if (c->fh == NULL) {
+    lcc_set_errno(c, EBADF);
+    return -1;
+  }
+
+  status = lcc_receive_pending(c);
+  if (status != 0)
+    return status;
+
+  if (c->failed > 0) {
+    LCC_SET_ERRSTR(c, "%zu pipelined command%s failed. Server error: %s",
+                   c->failed, (c->failed == 1) ? "" : "s", c->failed_msg);
+    c->failed = 0;
+    return -1;
+  }
+
+  return 0;
+} /* }}} int lcc_flush_responses */
+
+/* lcc_send_batch sends one BATCH command with the value lists in vls and
+ * reads its response. */
+static int lcc_send_batch(lcc_connection_t *c, /* {{{ */
+                          const lcc_value_list_t *vls, size_t vls_num) {
+  char *buffer = NULL;
+  size_t buffer_len = 0;
+  size_t buffer_size = 0;
+  lcc_response_t res = {0};
+  int status;
+
+  /* Format all lines first, so that an invalid value list does not leave the
+   * daemon waiting for the rest of a batch. */
+  for (size_t i = 0; i < vls_num; i++) {
+    char command[1024];
+
+    status = lcc_format_putval(c, vls + i, command, sizeof(command));
+    if (status != 0) {
+      free(buffer);
+      return status;
+    }
+
+    size_t command_len = strlen(command);
+    if (buffer_size - buffer_len < command_len + 3) {
+      size_t new_size = (buffer_size == 0) ? 4096 : 2 * buffer_size;
+      while (new_size - buffer_len < command_len + 3)
+        new_size *= 2;
+
+      char *tmp = realloc(buffer, new_size);
+      if (tmp == NULL) {
+        free(buffer);
+        lcc_set_errno(c, ENOMEM);
+        return -1;
+      }
+      buffer = tmp;
+      buffer_size = new_size;
+    }
+
+    memcpy(buffer + buffer_len, command, command_len);
+    memcpy(buffer + buffer_len + command_len, "\r\n", 2);
+    buffer_len += command_len + 2;
+  }
+
+  lcc_tracef("send:    --> BATCH %zu\n", vls_num);
+
+  if ((fprintf(c->fh, "BATCH %zu\r\n", vls_num) < 0) ||
+      (fwrite(buffer, 1, buffer_len, c->fh) != buffer_len) ||
+      (fflush(c->fh) != 0)) {
+    lcc_set_errno(c, errno);
+    free(buffer);
+    return -1;
+  }
+  free(buffer);
+
+  status = lcc_receive(c, &res);
+  if (status != 0)
+    return status;
+
+  /* Daemons without support for BATCH reject the header and handle the
+   * following lines as individual PUTVAL commands. */
+  if ((res.status != 0) &&
+      (strncmp(res.message, "Unknown command", strlen("Unknown command")) ==
+       0)) {
+    lcc_response_free(&res);
+    c->pending += vls_num;
+    return lcc_flush_responses(c);
+  }
+
+  if (res.status != 0) {
+    LCC_SET_ERRSTR(c, "Server error: %s", res.message);
+    lcc_response_free(&res);
+    return -1;
+  }
+
+  lcc_response_free(&res);
+  return 0;
+} /* }}} int lcc_send_batch */
+
+int lcc_putval_batch(lcc_connection_t *c, /* {{{ */
+                     const lcc_value_list_t *vls, size_t vls_num) {
+  int status;
+
+  if ((c == NULL) || ((vls == NULL) && (vls_num > 0))) {
+    lcc_set_errno(c, EINVAL);
+    return -1;
+  }
+
+  if (c->fh == NULL) {
+    lcc_set_errno(c, EBADF);
+    return -1;
+  }
+
+  status = lcc_receive_pending(c);
+  if (status != 0)
+    return status;
+
+  for (size_t offset = 0; offset < vls_num; offset += LCC_BATCH_MAX) {
+    size_t num = vls_num - offset;
+    if (num > LCC_BATCH_MAX)
+      num = LCC_BATCH_MAX;
+
+    status = lcc_send_batch(c, vls + offset, num);
+    if (status != 0)
+      return status;
+  }
+
+  return 0;
+} /* }}} int lcc_putval_batch */
+
 int lcc_flush(lcc_connection_t *c, const char *plugin, /* {{{ */
               lcc_identifier_t *ident, int timeout) {
   char command[1024] = "";
@@ -0,0 +1,294 @@
+/**
+ * collectd - src/libcollectdclient/client_test.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ **/
+
+#include "collectd/client.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define VALUES_NUM 20000
+
+/* A minimal stand-in for the unixsock plugin. It answers PUTVAL and BATCH
+ * commands on a single connection and records what it received. */
+typedef struct {
+  int listen_fd;
+  bool support_batch;
+
+  size_t putval_num;
+  size_t batch_num;
+  double values_sum;
+} server_t;
+
+static int server_putval(server_t *s, char const *line, FILE *fh,
+                         bool respond) {
+  if (strncasecmp(line, "PUTVAL ", strlen("PUTVAL ")) != 0) {
+    if (respond)
+      fprintf(fh, "-1 Unknown command: %s\n", line);
+    return -1;
+  }
+
+  s->putval_num++;
+
+  char const *value = strrchr(line, ':');
+  if (value != NULL)
+    s->values_sum += strtod(value + 1, NULL);
+
+  if (strstr(line, "/fail") != NULL) {
+    if (respond)
+      fprintf(fh, "-1 Parse error: failure requested.\n");
+    return -1;
+  }
+
+  if (respond)
+    fprintf(fh, "0 Success: 1 value has been dispatched.\n");
+  return 0;
+}
+
+static void *server_thread(void *arg) {
+  server_t *s = arg;
+
+  int fd = accept(s->listen_fd, NULL, NULL);
+  if (fd < 0)
+    return (void *)1;
+
+  FILE *fhin = fdopen(fd, "r");
+  FILE *fhout = fdopen(dup(fd), "w");
+  if ((fhin == NULL) || (fhout == NULL))
+    return (void *)1;
+
+  char line[1024];
+  while (fgets(line, sizeof(line), fhin) != NULL) {
+    line[strcspn(line, "\r\n")] = '\0';
+
+    if (s->support_batch &&
+        (strncasecmp(line, "BATCH ", strlen("BATCH ")) == 0)) {
+      size_t num = (size_t)strtoul(line + strlen("BATCH "), NULL, 10);
+      size_t failed = 0;
+
+      s->batch_num++;
+      for (size_t i = 0; i < num; i++) {
+        if (fgets(line, sizeof(line), fhin) == NULL)
+          break;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (server_putval(s, line, fhout, /* respond = */ false) != 0)
+          failed++;
+      }
+
+      if (failed == 0)
+        fprintf(fhout, "0 Success: %zu values have been dispatched.\n", num);
+      else
+        fprintf(fhout, "-1 %zu of %zu lines failed.\n", failed, num);
+    } else {
+      server_putval(s, line, fhout, /* respond = */ true);
+    }
+    fflush(fhout);
+  }
+
+  fclose(fhin);
+  fclose(fhout);
+  return NULL;
+}
+
+typedef int (*send_func_t)(lcc_connection_t *, lcc_value_list_t *, size_t);
+
+static int send_sync(lcc_connection_t *c, lcc_value_list_t *vls, size_t num) {
+  for (size_t i = 0; i < num; i++)
+    if (lcc_putval(c, vls + i) != 0)
+      return -1;
+  return 0;
+}
+
+static int send_async(lcc_connection_t *c, lcc_value_list_t *vls, size_t num) {
+  for (size_t i = 0; i < num; i++)
+    if (lcc_putval_async(c, vls + i) != 0)
+      return -1;
+  return lcc_flush_responses(c);
+}
+
+static int send_batch(lcc_connection_t *c, lcc_value_list_t *vls, size_t num) {
+  return lcc_putval_batch(c, vls, num);
+}
+
+static char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+/* run starts a server, sends num value lists using send and returns the status
+ * of send. The server's counters are returned in ret_server. */
+static int run(char const *name, send_func_t send, lcc_value_list_t *vls,
+               size_t num, bool support_batch, server_t *ret_server) {
+  struct sockaddr_un sa = {.sun_family = AF_UNIX};
+  server_t s = {.support_batch = support_batch};
+  pthread_t tid;
+
+  unlink(socket_path);
+  snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", socket_path);
+
+  s.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((s.listen_fd < 0) ||
+      (bind(s.listen_fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) ||
+      (listen(s.listen_fd, 1) != 0)) {
+    fprintf(stderr, "%s: creating the socket failed: %s\n", name,
+            strerror(errno));
+    return -1;
+  }
+
+  if (pthread_create(&tid, NULL, server_thread, &s) != 0) {
+    fprintf(stderr, "%s: pthread_create failed\n", name);
+    return -1;
+  }
+
+  lcc_connection_t *c = NULL;
+  if (lcc_connect(socket_path, &c) != 0) {
+    fprintf(stderr, "%s: lcc_connect failed\n", name);
+    return -1;
+  }
+
+  struct timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  int status = send(c, vls, num);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  if (status != 0)
+    printf("%s: %s\n", name, lcc_strerror(c));
+
+  LCC_DESTROY(c);
+  pthread_join(tid, NULL);
+  close(s.listen_fd);
+  unlink(socket_path);
+
+  double duration = (double)(end.tv_sec - begin.tv_sec) +
+                    (double)(end.tv_nsec - begin.tv_nsec) / 1e9;
+  printf("%-6s %6zu values in %.3f s (%.0f values/s)\n", name, num, duration,
+         (duration > 0) ? (double)num / duration : 0.0);
+
+  *ret_server = s;
+  return status;
+}
+
+static lcc_value_list_t *make_values(size_t num, value_t *values,
+                                     int *values_types) {
+  lcc_value_list_t *vls = calloc(num, sizeof(*vls));
+  if (vls == NULL)
+    return NULL;
+
+  for (size_t i = 0; i < num; i++) {
+    values[i].gauge = (double)i;
+    values_types[i] = LCC_TYPE_GAUGE;
+
+    vls[i] = (lcc_value_list_t)LCC_VALUE_LIST_INIT;
+    vls[i].values = values + i;
+    vls[i].values_types = values_types + i;
+    vls[i].values_len = 1;
+    vls[i].interval = 10.0;
+    snprintf(vls[i].identifier.plugin, sizeof(vls[i].identifier.plugin),
+             "test");
+    snprintf(vls[i].identifier.type, sizeof(vls[i].identifier.type), "gauge");
+    snprintf(vls[i].identifier.type_instance,
+             sizeof(vls[i].identifier.type_instance), "%zu", i % 100);
+  }
+
+  return vls;
+}
+
+static int check(char const *name, int status, int want_status,
+                 server_t const *s, size_t want_putval) {
+  double want_sum = (double)want_putval * (double)(want_putval - 1) / 2.0;
+
+  if ((status != 0) != (want_status != 0)) {
+    fprintf(stderr, "%s: status = %d, want %d\n", name, status, want_status);
+    return -1;
+  }
+  if (s->putval_num != want_putval) {
+    fprintf(stderr, "%s: server received %zu values, want %zu\n", name,
+            s->putval_num, want_putval);
+    return -1;
+  }
+  if (s->values_sum != want_sum) {
+    fprintf(stderr, "%s: sum of values = %g, want %g\n", name, s->values_sum,
+            want_sum);
+    return -1;
+  }
+  return 0;
+}
+
+int main(void) {
+  static value_t values[VALUES_NUM];
+  static int values_types[VALUES_NUM];
+  server_t s;
+  int ret = 0;
+
+  char dir[] = "/tmp/lcc_test.XXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    fprintf(stderr, "mkdtemp failed: %s\n", strerror(errno));
+    return 1;
+  }
+  snprintf(socket_path, sizeof(socket_path), "%s/sock", dir);
+
+  lcc_value_list_t *vls = make_values(VALUES_NUM, values, values_types);
+  if (vls == NULL)
+    return 1;
+
+  if (check("sync", run("sync", send_sync, vls, VALUES_NUM, true, &s), 0, &s,
+            VALUES_NUM) != 0)
+    ret = 1;
+  if (check("async", run("async", send_async, vls, VALUES_NUM, true, &s), 0,
+            &s, VALUES_NUM) != 0)
+    ret = 1;
+  if (check("batch", run("batch", send_batch, vls, VALUES_NUM, true, &s), 0,
+            &s, VALUES_NUM) != 0)
+    ret = 1;
+  if (s.batch_num != (VALUES_NUM + 1023) / 1024) {
+    fprintf(stderr, "batch: server received %zu batches\n", s.batch_num);
+    ret = 1;
+  }
+
+  /* Daemons without BATCH support handle the lines individually. */
+  if (check("old", run("old", send_batch, vls, VALUES_NUM, false, &s), 0, &s,
+            VALUES_NUM) != 0)
+    ret = 1;
+
+  /* Errors of pipelined commands are reported by lcc_flush_responses. */
+  snprintf(vls[42].identifier.plugin, sizeof(vls[42].identifier.plugin),
+           "fail");
+  if (check("async", run("async", send_async, vls, VALUES_NUM, true, &s), -1,
+            &s, VALUES_NUM) != 0)
+    ret = 1;
+  if (check("batch", run("batch", send_batch, vls, VALUES_NUM, true, &s), -1,
+            &s, 1024) != 0)
+    ret = 1;
+
+  free(vls);
+  rmdir(dir);
+  return ret;
+}
@@ -66,6 +66,23 @@ int lcc_getval(lcc_connection_t *c, lcc_identifier_t *ident,
 
 int lcc_putval(lcc_connection_t *c, const lcc_value_list_t *vl);
 
+/* lcc_putval_async sends a PUTVAL command without waiting for the response.
+ * Commands are pipelined and their responses are collected by
+ * lcc_flush_responses() or, implicitly, by the next synchronous call. Errors
+ * reported by the daemon are returned by lcc_flush_responses(). */
+int lcc_putval_async(lcc_connection_t *c, const lcc_value_list_t *vl);
+
+/* lcc_flush_responses sends all buffered commands and waits for their
+ * responses. Returns non-zero if any pipelined command failed since the last
+ * call; lcc_strerror() then describes the first failure. */
+int lcc_flush_responses(lcc_connection_t *c);
+
+/* lcc_putval_batch sends the value lists in vls using the BATCH command, which
+ * is answered with a single response. Daemons which do not support BATCH
+ * handle the lines as individual PUTVAL commands. */
+int lcc_putval_batch(lcc_connection_t *c, const lcc_value_list_t *vls,
+                     size_t vls_num);
+
 int lcc_flush(lcc_connection_t *c, const char *plugin, lcc_identifier_t *ident,
               int timeout);
 
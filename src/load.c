@@ -57,6 +57,10 @@
 
 static bool report_relative_load;
 
+#if KERNEL_LINUX
+static procfile_t *pf_loadavg;
+#endif
+
 static const char *config_keys[] = {"ReportRelative"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
@@ -110,39 +114,24 @@ static void load_submit(gauge_t snum, gauge_t mnum, gauge_t lnum) {
 }
 
 static int load_read(void) {
-#if defined(HAVE_GETLOADAVG)
-  double load[3];
-
-  if (getloadavg(load, 3) == 3)
-    load_submit(load[LOADAVG_1MIN], load[LOADAVG_5MIN], load[LOADAVG_15MIN]);
-  else {
-    WARNING("load: getloadavg failed: %s", STRERRNO);
-  }
-    /* #endif HAVE_GETLOADAVG */
-
-#elif defined(KERNEL_LINUX)
+#if defined(KERNEL_LINUX)
+  /* /proc/loadavg is kept open rather than calling getloadavg(3), which opens
+   * it on every call. */
   gauge_t snum, mnum, lnum;
-  FILE *loadavg;
-  char buffer[16];
+  char *buffer;
 
   char *fields[8];
   int numfields;
 
-  if ((loadavg = fopen("/proc/loadavg", "r")) == NULL) {
-    WARNING("load: fopen: %s", STRERRNO);
+  if ((pf_loadavg == NULL) &&
+      ((pf_loadavg = procfile_create("/proc/loadavg")) == NULL))
     return -1;
-  }
 
-  if (fgets(buffer, 16, loadavg) == NULL) {
-    WARNING("load: fgets: %s", STRERRNO);
-    fclose(loadavg);
+  if ((buffer = procfile_read(pf_loadavg)) == NULL) {
+    WARNING("load: Reading /proc/loadavg failed: %s", STRERRNO);
     return -1;
   }
 
-  if (fclose(loadavg)) {
-    WARNING("load: fclose: %s", STRERRNO);
-  }
-
   numfields = strsplit(buffer, fields, 8);
 
   if (numfields < 3)
@@ -155,6 +144,16 @@ static int load_read(void) {
   load_submit(snum, mnum, lnum);
   /* #endif KERNEL_LINUX */
 
+#elif defined(HAVE_GETLOADAVG)
+  double load[3];
+
+  if (getloadavg(load, 3) == 3)
+    load_submit(load[LOADAVG_1MIN], load[LOADAVG_5MIN], load[LOADAVG_15MIN]);
+  else {
+    WARNING("load: getloadavg failed: %s", STRERRNO);
+  }
+  /* #endif HAVE_GETLOADAVG */
+
 #elif HAVE_LIBSTATGRAB
   gauge_t snum, mnum, lnum;
   sg_load_stats *ls;
@@ -191,7 +190,18 @@ static int load_read(void) {
   return 0;
 }
 
+#if KERNEL_LINUX
+static int load_shutdown(void) {
+  procfile_destroy(pf_loadavg);
+  pf_loadavg = NULL;
+  return 0;
+} /* int load_shutdown */
+#endif
+
 void module_register(void) {
   plugin_register_config("load", load_config, config_keys, config_keys_num);
   plugin_register_read("load", load_read);
+#if KERNEL_LINUX
+  plugin_register_shutdown("load", load_shutdown);
+#endif
 } /* void module_register */
@@ -30,16 +30,9 @@
 
 #include "plugin.h"
 #include "utils/common/common.h"
+#include "utils/format_json/format_json.h"
 
 #include <sys/types.h>
-#include <yajl/yajl_common.h>
-#include <yajl/yajl_gen.h>
-#if HAVE_YAJL_YAJL_VERSION_H
-#include <yajl/yajl_version.h>
-#endif
-#if defined(YAJL_MAJOR) && (YAJL_MAJOR > 1)
-#define HAVE_YAJL_V2 1
-#endif
 
 #if COLLECT_DEBUG
 static int log_level = LOG_DEBUG;
@@ -72,58 +65,52 @@ static int log_logstash_config(const char *key, const char *value) {
   return 0;
 } /* int log_logstash_config (const char *, const char *) */
 
-static void log_logstash_print(yajl_gen g, int severity,
+/* Appends one "key":"value" pair, opening the object if it is empty. */
+static int log_logstash_add(json_buffer_t *b, char const *key,
+                            char const *value) {
+  int status;
+
+  status = json_buffer_append(b, (b->pos == 0) ? "{" : ",", 1);
+  if (status == 0)
+    status = json_buffer_append_string(b, key);
+  if (status == 0)
+    status = json_buffer_append(b, ":", 1);
+  if (status == 0)
+    status = json_buffer_append_string(b, value);
+
+  return status;
+} /* int log_logstash_add */
+
+static void log_logstash_print(json_buffer_t *b, int severity,
                                cdtime_t timestamp_time) {
   FILE *fh;
   bool do_close = false;
   struct tm timestamp_tm;
   char timestamp_str[64];
-  const unsigned char *buf;
-#if HAVE_YAJL_V2
-  size_t len;
-#else
-  unsigned int len;
-#endif
-
-  if (yajl_gen_string(g, (u_char *)"level", strlen("level")) !=
-      yajl_gen_status_ok)
-    goto err;
+  char const *level;
 
   switch (severity) {
   case LOG_ERR:
-    if (yajl_gen_string(g, (u_char *)"error", strlen("error")) !=
-        yajl_gen_status_ok)
-      goto err;
+    level = "error";
     break;
   case LOG_WARNING:
-    if (yajl_gen_string(g, (u_char *)"warning", strlen("warning")) !=
-        yajl_gen_status_ok)
-      goto err;
+    level = "warning";
     break;
   case LOG_NOTICE:
-    if (yajl_gen_string(g, (u_char *)"notice", strlen("notice")) !=
-        yajl_gen_status_ok)
-      goto err;
+    level = "notice";
     break;
   case LOG_INFO:
-    if (yajl_gen_string(g, (u_char *)"info", strlen("info")) !=
-        yajl_gen_status_ok)
-      goto err;
+    level = "info";
     break;
   case LOG_DEBUG:
-    if (yajl_gen_string(g, (u_char *)"debug", strlen("debug")) !=
-        yajl_gen_status_ok)
-      goto err;
+    level = "debug";
     break;
   default:
-    if (yajl_gen_string(g, (u_char *)"unknown", strlen("unknown")) !=
-        yajl_gen_status_ok)
-      goto err;
+    level = "unknown";
     break;
   }
 
-  if (yajl_gen_string(g, (u_char *)"@timestamp", strlen("@timestamp")) !=
-      yajl_gen_status_ok)
+  if (log_logstash_add(b, "level", level) != 0)
     goto err;
 
   gmtime_r(&CDTIME_T_TO_TIME_T(timestamp_time), &timestamp_tm);
@@ -135,15 +122,12 @@ static void log_logstash_print(yajl_gen g, int severity,
            &timestamp_tm);
   timestamp_str[sizeof(timestamp_str) - 1] = '\0';
 
-  if (yajl_gen_string(g, (u_char *)timestamp_str, strlen(timestamp_str)) !=
-      yajl_gen_status_ok)
+  if (log_logstash_add(b, "@timestamp", timestamp_str) != 0)
     goto err;
 
-  if (yajl_gen_map_close(g) != yajl_gen_status_ok)
+  if (json_buffer_append(b, "}", 1) != 0)
     goto err;
 
-  if (yajl_gen_get_buf(g, &buf, &len) != yajl_gen_status_ok)
-    goto err;
   pthread_mutex_lock(&file_lock);
 
   if (log_file == NULL) {
@@ -163,7 +147,7 @@ static void log_logstash_print(yajl_gen g, int severity,
     fprintf(stderr, "log_logstash plugin: fopen (%s) failed: %s\n", log_file,
             STRERRNO);
   } else {
-    fprintf(fh, "%s\n", buf);
+    fprintf(fh, "%s\n", b->ptr);
     if (do_close) {
       fclose(fh);
     } else {
@@ -171,153 +155,84 @@ static void log_logstash_print(yajl_gen g, int severity,
     }
   }
   pthread_mutex_unlock(&file_lock);
-  yajl_gen_free(g);
+  json_buffer_free(b);
   return;
 
 err:
-  yajl_gen_free(g);
+  json_buffer_free(b);
   fprintf(stderr, "Could not correctly generate JSON message\n");
   return;
 } /* void log_logstash_print */
 
 static void log_logstash_log(int severity, const char *msg,
                              user_data_t __attribute__((unused)) * user_data) {
+  json_buffer_t b;
+
   if (severity > log_level)
     return;
 
-#if HAVE_YAJL_V2
-  yajl_gen g = yajl_gen_alloc(NULL);
-#else
-  yajl_gen g = yajl_gen_alloc(&(yajl_gen_config){0}, NULL);
-#endif
-  if (g == NULL) {
-    fprintf(stderr, "Could not allocate JSON generator.\n");
+  json_buffer_init(&b);
+
+  if (log_logstash_add(&b, "message", msg) != 0) {
+    json_buffer_free(&b);
+    fprintf(stderr, "Could not generate JSON message preamble\n");
     return;
   }
 
-  if (yajl_gen_map_open(g) != yajl_gen_status_ok)
-    goto err;
-  if (yajl_gen_string(g, (u_char *)"message", strlen("message")) !=
-      yajl_gen_status_ok)
-    goto err;
-  if (yajl_gen_string(g, (u_char *)msg, strlen(msg)) != yajl_gen_status_ok)
-    goto err;
-
-  log_logstash_print(g, severity, cdtime());
-  return;
-err:
-  yajl_gen_free(g);
-  fprintf(stderr, "Could not generate JSON message preamble\n");
-  return;
-
+  log_logstash_print(&b, severity, cdtime());
 } /* void log_logstash_log (int, const char *) */
 
 static int log_logstash_notification(const notification_t *n,
                                      user_data_t __attribute__((unused)) *
                                          user_data) {
-  yajl_gen g;
-#if HAVE_YAJL_V2
-  g = yajl_gen_alloc(NULL);
-#else
-  yajl_gen_config conf = {};
+  json_buffer_t b;
+  char const *severity;
 
-  conf.beautify = 0;
-  g = yajl_gen_alloc(&conf, NULL);
-#endif
+  json_buffer_init(&b);
 
-  if (g == NULL) {
-    fprintf(stderr, "Could not allocate JSON generator.\n");
-    return 0;
-  }
+  if (log_logstash_add(&b, "message",
+                       (strlen(n->message) > 0)
+                           ? n->message
+                           : "notification without a message") != 0)
+    goto err;
 
-  if (yajl_gen_map_open(g) != yajl_gen_status_ok)
+  if ((strlen(n->host) > 0) && (log_logstash_add(&b, "host", n->host) != 0))
     goto err;
-  if (yajl_gen_string(g, (u_char *)"message", strlen("message")) !=
-      yajl_gen_status_ok)
+  if ((strlen(n->plugin) > 0) &&
+      (log_logstash_add(&b, "plugin", n->plugin) != 0))
     goto err;
-  if (strlen(n->message) > 0) {
-    if (yajl_gen_string(g, (u_char *)n->message, strlen(n->message)) !=
-        yajl_gen_status_ok)
-      goto err;
-  } else {
-    if (yajl_gen_string(g, (u_char *)"notification without a message",
-                        strlen("notification without a message")) !=
-        yajl_gen_status_ok)
-      goto err;
-  }
-
-  if (strlen(n->host) > 0) {
-    if (yajl_gen_string(g, (u_char *)"host", strlen("host")) !=
-        yajl_gen_status_ok)
-      goto err;
-    if (yajl_gen_string(g, (u_char *)n->host, strlen(n->host)) !=
-        yajl_gen_status_ok)
-      goto err;
-  }
-  if (strlen(n->plugin) > 0) {
-    if (yajl_gen_string(g, (u_char *)"plugin", strlen("plugin")) !=
-        yajl_gen_status_ok)
-      goto err;
-    if (yajl_gen_string(g, (u_char *)n->plugin, strlen(n->plugin)) !=
-        yajl_gen_status_ok)
-      goto err;
-  }
-  if (strlen(n->plugin_instance) > 0) {
-    if (yajl_gen_string(g, (u_char *)"plugin_instance",
-                        strlen("plugin_instance")) != yajl_gen_status_ok)
-      goto err;
-    if (yajl_gen_string(g, (u_char *)n->plugin_instance,
-                        strlen(n->plugin_instance)) != yajl_gen_status_ok)
-      goto err;
-  }
-  if (strlen(n->type) > 0) {
-    if (yajl_gen_string(g, (u_char *)"type", strlen("type")) !=
-        yajl_gen_status_ok)
-      goto err;
-    if (yajl_gen_string(g, (u_char *)n->type, strlen(n->type)) !=
-        yajl_gen_status_ok)
-      goto err;
-  }
-  if (strlen(n->type_instance) > 0) {
-    if (yajl_gen_string(g, (u_char *)"type_instance",
-                        strlen("type_instance")) != yajl_gen_status_ok)
-      goto err;
-    if (yajl_gen_string(g, (u_char *)n->type_instance,
-                        strlen(n->type_instance)) != yajl_gen_status_ok)
-      goto err;
-  }
-
-  if (yajl_gen_string(g, (u_char *)"severity", strlen("severity")) !=
-      yajl_gen_status_ok)
+  if ((strlen(n->plugin_instance) > 0) &&
+      (log_logstash_add(&b, "plugin_instance", n->plugin_instance) != 0))
+    goto err;
+  if ((strlen(n->type) > 0) && (log_logstash_add(&b, "type", n->type) != 0))
+    goto err;
+  if ((strlen(n->type_instance) > 0) &&
+      (log_logstash_add(&b, "type_instance", n->type_instance) != 0))
     goto err;
 
   switch (n->severity) {
   case NOTIF_FAILURE:
-    if (yajl_gen_string(g, (u_char *)"failure", strlen("failure")) !=
-        yajl_gen_status_ok)
-      goto err;
+    severity = "failure";
     break;
   case NOTIF_WARNING:
-    if (yajl_gen_string(g, (u_char *)"warning", strlen("warning")) !=
-        yajl_gen_status_ok)
-      goto err;
+    severity = "warning";
     break;
   case NOTIF_OKAY:
-    if (yajl_gen_string(g, (u_char *)"ok", strlen("ok")) != yajl_gen_status_ok)
-      goto err;
+    severity = "ok";
     break;
   default:
-    if (yajl_gen_string(g, (u_char *)"unknown", strlen("unknown")) !=
-        yajl_gen_status_ok)
-      goto err;
+    severity = "unknown";
     break;
   }
 
-  log_logstash_print(g, LOG_INFO, (n->time != 0) ? n->time : cdtime());
+  if (log_logstash_add(&b, "severity", severity) != 0)
+    goto err;
+
+  log_logstash_print(&b, LOG_INFO, (n->time != 0) ? n->time : cdtime());
   return 0;
 
 err:
-  yajl_gen_free(g);
+  json_buffer_free(&b);
   fprintf(stderr, "Could not correctly generate JSON notification\n");
   return 0;
 } /* int log_logstash_notification */
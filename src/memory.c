@@ -78,7 +78,7 @@ static int pagesize;
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-/* no global variables */
+static procfile_t *pf_meminfo;
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -316,8 +316,8 @@ static int memory_read_internal(value_list_t *vl) {
   /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-  FILE *fh;
-  char buffer[1024];
+  char *buffer;
+  char *ptr;
 
   char *fields[8];
   int numfields;
@@ -335,12 +335,16 @@ static int memory_read_internal(value_list_t *vl) {
   gauge_t mem_slab_reclaimable = 0;
   gauge_t mem_slab_unreclaimable = 0;
 
-  if ((fh = fopen("/proc/meminfo", "r")) == NULL) {
-    WARNING("memory: fopen: %s", STRERRNO);
+  if ((pf_meminfo == NULL) &&
+      ((pf_meminfo = procfile_create("/proc/meminfo")) == NULL))
+    return -1;
+
+  if ((ptr = procfile_read(pf_meminfo)) == NULL) {
+    WARNING("memory: Reading /proc/meminfo failed: %s", STRERRNO);
     return -1;
   }
 
-  while (fgets(buffer, sizeof(buffer), fh) != NULL) {
+  while ((buffer = next_line(&ptr)) != NULL) {
     gauge_t *val = NULL;
 
     if (strncasecmp(buffer, "MemTotal:", 9) == 0)
@@ -372,10 +376,6 @@ static int memory_read_internal(value_list_t *vl) {
     *val = 1024.0 * atof(fields[1]);
   }
 
-  if (fclose(fh)) {
-    WARNING("memory: fclose: %s", STRERRNO);
-  }
-
   if (mem_total < (mem_free + mem_buffered + mem_cached + mem_slab_total))
     return -1;
 
@@ -553,8 +553,19 @@ static int memory_read(void) /* {{{ */
   return memory_read_internal(&vl);
 } /* }}} int memory_read */
 
+#if KERNEL_LINUX
+static int memory_shutdown(void) {
+  procfile_destroy(pf_meminfo);
+  pf_meminfo = NULL;
+  return 0;
+} /* int memory_shutdown */
+#endif
+
 void module_register(void) {
   plugin_register_complex_config("memory", memory_config);
   plugin_register_init("memory", memory_init);
   plugin_register_read("memory", memory_read);
+#if KERNEL_LINUX
+  plugin_register_shutdown("memory", memory_shutdown);
+#endif
 } /* void module_register */
@@ -99,6 +99,14 @@
 #ifndef CONFIG_HZ
 #define CONFIG_HZ 100
 #endif
+
+#include "utils/avltree/avltree.h"
+
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/socket.h>
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS &&                                                  \
@@ -177,6 +185,7 @@
 typedef struct process_entry_s {
   unsigned long id;
   char name[PROCSTAT_NAME_LEN];
+  unsigned long long start_time;
 
   unsigned long num_proc;
   unsigned long num_lwp;
@@ -215,6 +224,8 @@ typedef struct process_entry_s {
   bool has_fd;
 
   bool has_maps;
+
+  bool has_status;
 } process_entry_t;
 
 typedef struct procstat_entry_s {
@@ -252,6 +263,7 @@ typedef struct procstat {
   char name[PROCSTAT_NAME_LEN];
 #if HAVE_REGEX_H
   regex_t *re;
+  char *re_str;
 #endif
 
   unsigned long num_proc;
@@ -303,6 +315,8 @@ static bool report_ctx_switch;
 static bool report_fd_num;
 static bool report_maps_num;
 static bool report_delay;
+static int read_threads = 1;
+static bool use_process_events;
 
 #if HAVE_THREAD_INFO
 static mach_port_t port_host_self;
@@ -315,6 +329,9 @@ static mach_msg_type_number_t pset_list_len;
 #elif KERNEL_LINUX
 static long pagesize_g;
 static void ps_fill_details(const procstat_t *ps, process_entry_t *entry);
+static int ps_match_init(void);
+static int ps_workers_start(void);
+static int ps_events_start(void);
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS &&                                                  \
@@ -344,6 +361,7 @@ int getargs(void *processBuffer, int bufferLen, char *argsBuffer, int argsLen);
 
 #if HAVE_LIBTASKSTATS
 static ts_t *taskstats_handle;
+static pthread_mutex_t taskstats_lock = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
 /* put name of process from config to list_head_g tree
@@ -394,6 +412,15 @@ static procstat_t *ps_list_register(const char *name, const char *regexp) {
       sfree(new);
       return NULL;
     }
+
+    new->re_str = strdup(regexp);
+    if (new->re_str == NULL) {
+      ERROR("processes plugin: ps_list_register: strdup failed.");
+      regfree(new->re);
+      sfree(new->re);
+      sfree(new);
+      return NULL;
+    }
   }
 #else
   if (regexp != NULL) {
@@ -415,7 +442,10 @@ static procstat_t *ps_list_register(const char *name, const char *regexp) {
               "All but the first setting will be "
               "ignored.");
 #if HAVE_REGEX_H
+      if (new->re != NULL)
+        regfree(new->re);
       sfree(new->re);
+      sfree(new->re_str);
 #endif
       sfree(new);
       return NULL;
@@ -515,92 +545,100 @@ static void ps_update_delay(procstat_t *out, procstat_entry_t *prev,
 }
 #endif
 
-/* add process entry to 'instances' of process 'name' (or refresh it) */
-static void ps_list_add(const char *name, const char *cmdline,
-                        process_entry_t *entry) {
+/* add process entry to 'instances' of the matching process 'ps' (or refresh
+ * it) */
+static void ps_list_add_one(procstat_t *ps, process_entry_t *entry) {
   procstat_entry_t *pse;
 
-  if (entry->id == 0)
-    return;
-
-  for (procstat_t *ps = list_head_g; ps != NULL; ps = ps->next) {
-    if ((ps_list_match(name, cmdline, ps)) == 0)
-      continue;
-
 #if KERNEL_LINUX
-    ps_fill_details(ps, entry);
+  ps_fill_details(ps, entry);
 #endif
 
-    for (pse = ps->instances; pse != NULL; pse = pse->next)
-      if ((pse->id == entry->id) || (pse->next == NULL))
-        break;
+  for (pse = ps->instances; pse != NULL; pse = pse->next)
+    if ((pse->id == entry->id) || (pse->next == NULL))
+      break;
 
-    if ((pse == NULL) || (pse->id != entry->id)) {
-      procstat_entry_t *new;
+  if ((pse == NULL) || (pse->id != entry->id)) {
+    procstat_entry_t *new;
 
-      new = calloc(1, sizeof(*new));
-      if (new == NULL)
-        return;
-      new->id = entry->id;
+    new = calloc(1, sizeof(*new));
+    if (new == NULL)
+      return;
+    new->id = entry->id;
 
-      if (pse == NULL)
-        ps->instances = new;
-      else
-        pse->next = new;
+    if (pse == NULL)
+      ps->instances = new;
+    else
+      pse->next = new;
 
-      pse = new;
-    }
+    pse = new;
+  }
 
-    pse->age = 0;
-
-    ps->num_proc += entry->num_proc;
-    ps->num_lwp += entry->num_lwp;
-    ps->num_fd += entry->num_fd;
-    ps->num_maps += entry->num_maps;
-    ps->vmem_size += entry->vmem_size;
-    ps->vmem_rss += entry->vmem_rss;
-    ps->vmem_data += entry->vmem_data;
-    ps->vmem_code += entry->vmem_code;
-    ps->stack_size += entry->stack_size;
-
-    if ((entry->io_rchar != -1) && (entry->io_wchar != -1)) {
-      ps_update_counter(&ps->io_rchar, &pse->io_rchar, entry->io_rchar);
-      ps_update_counter(&ps->io_wchar, &pse->io_wchar, entry->io_wchar);
-    }
+  pse->age = 0;
 
-    if ((entry->io_syscr != -1) && (entry->io_syscw != -1)) {
-      ps_update_counter(&ps->io_syscr, &pse->io_syscr, entry->io_syscr);
-      ps_update_counter(&ps->io_syscw, &pse->io_syscw, entry->io_syscw);
-    }
+  ps->num_proc += entry->num_proc;
+  ps->num_lwp += entry->num_lwp;
+  ps->num_fd += entry->num_fd;
+  ps->num_maps += entry->num_maps;
+  ps->vmem_size += entry->vmem_size;
+  ps->vmem_rss += entry->vmem_rss;
+  ps->vmem_data += entry->vmem_data;
+  ps->vmem_code += entry->vmem_code;
+  ps->stack_size += entry->stack_size;
 
-    if ((entry->io_diskr != -1) && (entry->io_diskw != -1)) {
-      ps_update_counter(&ps->io_diskr, &pse->io_diskr, entry->io_diskr);
-      ps_update_counter(&ps->io_diskw, &pse->io_diskw, entry->io_diskw);
-    }
+  if ((entry->io_rchar != -1) && (entry->io_wchar != -1)) {
+    ps_update_counter(&ps->io_rchar, &pse->io_rchar, entry->io_rchar);
+    ps_update_counter(&ps->io_wchar, &pse->io_wchar, entry->io_wchar);
+  }
 
-    if ((entry->cswitch_vol != -1) && (entry->cswitch_invol != -1)) {
-      ps_update_counter(&ps->cswitch_vol, &pse->cswitch_vol,
-                        entry->cswitch_vol);
-      ps_update_counter(&ps->cswitch_invol, &pse->cswitch_invol,
-                        entry->cswitch_invol);
-    }
+  if ((entry->io_syscr != -1) && (entry->io_syscw != -1)) {
+    ps_update_counter(&ps->io_syscr, &pse->io_syscr, entry->io_syscr);
+    ps_update_counter(&ps->io_syscw, &pse->io_syscw, entry->io_syscw);
+  }
 
-    ps_update_counter(&ps->vmem_minflt_counter, &pse->vmem_minflt_counter,
-                      entry->vmem_minflt_counter);
-    ps_update_counter(&ps->vmem_majflt_counter, &pse->vmem_majflt_counter,
-                      entry->vmem_majflt_counter);
+  if ((entry->io_diskr != -1) && (entry->io_diskw != -1)) {
+    ps_update_counter(&ps->io_diskr, &pse->io_diskr, entry->io_diskr);
+    ps_update_counter(&ps->io_diskw, &pse->io_diskw, entry->io_diskw);
+  }
 
-    ps_update_counter(&ps->cpu_user_counter, &pse->cpu_user_counter,
-                      entry->cpu_user_counter);
-    ps_update_counter(&ps->cpu_system_counter, &pse->cpu_system_counter,
-                      entry->cpu_system_counter);
+  if ((entry->cswitch_vol != -1) && (entry->cswitch_invol != -1)) {
+    ps_update_counter(&ps->cswitch_vol, &pse->cswitch_vol,
+                      entry->cswitch_vol);
+    ps_update_counter(&ps->cswitch_invol, &pse->cswitch_invol,
+                      entry->cswitch_invol);
+  }
+
+  ps_update_counter(&ps->vmem_minflt_counter, &pse->vmem_minflt_counter,
+                    entry->vmem_minflt_counter);
+  ps_update_counter(&ps->vmem_majflt_counter, &pse->vmem_majflt_counter,
+                    entry->vmem_majflt_counter);
+
+  ps_update_counter(&ps->cpu_user_counter, &pse->cpu_user_counter,
+                    entry->cpu_user_counter);
+  ps_update_counter(&ps->cpu_system_counter, &pse->cpu_system_counter,
+                    entry->cpu_system_counter);
 
 #if HAVE_LIBTASKSTATS
-    if (entry->has_delay)
-      ps_update_delay(ps, pse, entry);
+  if (entry->has_delay)
+    ps_update_delay(ps, pse, entry);
 #endif
+} /* void ps_list_add_one */
+
+#if !KERNEL_LINUX
+/* add process entry to 'instances' of process 'name' (or refresh it) */
+static void ps_list_add(const char *name, const char *cmdline,
+                        process_entry_t *entry) {
+  if (entry->id == 0)
+    return;
+
+  for (procstat_t *ps = list_head_g; ps != NULL; ps = ps->next) {
+    if ((ps_list_match(name, cmdline, ps)) == 0)
+      continue;
+
+    ps_list_add_one(ps, entry);
   }
 }
+#endif /* !KERNEL_LINUX */
 
 /* remove old entries from instances of processes in list_head_g */
 static void ps_list_reset(void) {
@@ -733,6 +771,27 @@ static int ps_config(oconfig_item_t *ci) {
 #else
       WARNING("processes plugin: The plugin has been compiled without support "
               "for the \"CollectDelayAccounting\" option.");
+#endif
+    } else if (strcasecmp(c->key, "ReadThreads") == 0) {
+#if KERNEL_LINUX
+      int tmp = read_threads;
+      if (cf_util_get_int(c, &tmp) != 0)
+        continue;
+      if (tmp < 1) {
+        ERROR("processes plugin: `ReadThreads' must be at least 1.");
+        continue;
+      }
+      read_threads = tmp;
+#else
+      WARNING("processes plugin: The \"ReadThreads\" option is only "
+              "supported on Linux and will be ignored.");
+#endif
+    } else if (strcasecmp(c->key, "UseProcessEvents") == 0) {
+#if KERNEL_LINUX
+      cf_util_get_boolean(c, &use_process_events);
+#else
+      WARNING("processes plugin: The \"UseProcessEvents\" option is only "
+              "supported on Linux and will be ignored.");
 #endif
     } else {
       ERROR("processes plugin: The `%s' configuration option is not "
@@ -780,6 +839,14 @@ static int ps_init(void) {
     }
   }
 #endif
+
+  if ((ps_match_init() != 0) || (ps_workers_start() != 0))
+    return -1;
+
+  if (use_process_events && (ps_events_start() != 0)) {
+    ERROR("processes plugin: Reading process events failed. "
+          "Falling back to scanning /proc.");
+  }
   /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS &&                                                  \
@@ -1229,7 +1296,10 @@ static int ps_delay(process_entry_t *ps) {
     return ENOTCONN;
   }
 
+  /* The taskstats handle is shared by all scanner threads. */
+  pthread_mutex_lock(&taskstats_lock);
   int status = ts_delay_by_tgid(taskstats_handle, (uint32_t)ps->id, &ps->delay);
+  pthread_mutex_unlock(&taskstats_lock);
   if (status == EPERM) {
     static c_complain_t c;
 #if defined(HAVE_SYS_CAPABILITY_H) && defined(CAP_NET_ADMIN)
@@ -1274,7 +1344,42 @@ static int ps_delay(process_entry_t *ps) {
 }
 #endif
 
+/* ps_read_cswitch reads the context switches of all threads of a process. In
+ * event mode this is a single taskstats request instead of one status file per
+ * thread. */
+static int ps_read_cswitch(process_entry_t *ps) {
+#if HAVE_LIBTASKSTATS
+  if (use_process_events && (taskstats_handle != NULL)) {
+    ts_cswitch_t cswitch = {0};
+
+    pthread_mutex_lock(&taskstats_lock);
+    int status =
+        ts_cswitch_by_tgid(taskstats_handle, (uint32_t)ps->id, &cswitch);
+    pthread_mutex_unlock(&taskstats_lock);
+    if (status == 0) {
+      ps->cswitch_vol = (derive_t)cswitch.voluntary;
+      ps->cswitch_invol = (derive_t)cswitch.involuntary;
+      return 0;
+    }
+  }
+#endif
+
+  return ps_read_tasks_status(ps);
+} /* int ps_read_cswitch */
+
 static void ps_fill_details(const procstat_t *ps, process_entry_t *entry) {
+  /* /proc/<pid>/status is only read for matched processes; zombies have no
+   * memory to report. */
+  if (entry->has_status == false) {
+    if ((entry->num_proc != 0) && (ps_read_status(entry->id, entry) != 0)) {
+      /* No VMem data */
+      entry->vmem_data = -1;
+      entry->vmem_code = -1;
+      DEBUG("ps_fill_details: did not get vmem data for pid %lu", entry->id);
+    }
+    entry->has_status = true;
+  }
+
   if (entry->has_io == false) {
     ps_read_io(entry);
     entry->has_io = true;
@@ -1282,7 +1387,7 @@ static void ps_fill_details(const procstat_t *ps, process_entry_t *entry) {
 
   if (ps->report_ctx_switch) {
     if (entry->has_cswitch == false) {
-      ps_read_tasks_status(entry);
+      ps_read_cswitch(entry);
       entry->has_cswitch = true;
     }
   }
@@ -1383,18 +1488,13 @@ static int ps_read_process(long pid, process_entry_t *ps, char *state) {
   }
 
   *state = fields[0][0];
+  ps->start_time = strtoull(fields[19], /* endptr = */ NULL, /* base = */ 10);
 
   if (*state == 'Z') {
     ps->num_lwp = 0;
     ps->num_proc = 0;
   } else {
     ps->num_lwp = strtoul(fields[17], /* endptr = */ NULL, /* base = */ 10);
-    if ((ps_read_status(pid, ps)) != 0) {
-      /* No VMem data */
-      ps->vmem_data = -1;
-      ps->vmem_code = -1;
-      DEBUG("ps_read_process: did not get vmem data for pid %li", pid);
-    }
     if (ps->num_lwp == 0)
       ps->num_lwp = 1;
     ps->num_proc = 1;
@@ -1449,9 +1549,10 @@ static int ps_read_process(long pid, process_entry_t *ps, char *state) {
   return 0;
 } /* int ps_read_process (...) */
 
-static int procs_running(void) {
+/* procs_count returns the value of the "procs_running" or "procs_blocked"
+ * line of /proc/stat. The id must include the trailing white space. */
+static int procs_count(char const *id) {
   char buffer[65536] = {};
-  char id[] = "procs_running "; /* white space terminated */
   char *running;
   char *endptr = NULL;
   long result = 0L;
@@ -1464,14 +1565,14 @@ static int procs_running(void) {
   }
 
   /* the data contains :
-   * the literal string 'procs_running',
+   * the literal string 'procs_running' or 'procs_blocked',
    * a whitespace
    * the number of running processes.
    * The parser does include the white-space character.
    */
   running = strstr(buffer, id);
   if (!running) {
-    WARNING("procs_running not found");
+    WARNING("%snot found", id);
     return -1;
   }
   running += strlen(id);
@@ -1612,6 +1713,921 @@ static int read_fork_rate(void) {
   ps_submit_fork_rate(value.derive);
   return 0;
 }
+
+/* The pids found in /proc are scanned by a pool of "read_threads" workers.
+ * Worker zero is the read thread itself. Each worker claims PS_SCAN_CHUNK pids
+ * at a time, reads their stat file, and only reads the remaining files of
+ * processes matching at least one Process or ProcessMatch entry. Matched
+ * entries are merged into list_head_g by the read thread afterwards. */
+#define PS_SCAN_CHUNK 64
+
+/* Processes are matched against the Process and ProcessMatch entries once in
+ * their lifetime. The result is cached by pid and start time and dropped when
+ * the name of the process changes or it is no longer found. */
+typedef struct {
+  unsigned long long start_time;
+  char *name;
+  procstat_t **matches;
+  size_t matches_num;
+  uint64_t generation;
+} ps_match_cache_t;
+
+typedef struct {
+  process_entry_t entry;
+  ps_match_cache_t *match;
+} ps_scan_match_t;
+
+typedef struct {
+  pthread_t thread;
+  bool thread_running;
+
+  /* CMDLINE_BUFFER_SIZE bytes, reused for all processes. */
+  char *cmdline;
+
+  ps_scan_match_t *matches;
+  size_t matches_num;
+  size_t matches_size;
+
+  int running;
+  int sleeping;
+  int zombies;
+  int stopped;
+  int paging;
+  int blocked;
+} ps_worker_t;
+
+static ps_worker_t *workers;
+static size_t workers_num;
+
+static pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scan_start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t scan_done_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t scan_generation;
+static size_t scan_busy;
+static bool scan_shutdown;
+
+static long *scan_pids;
+static size_t scan_pids_num;
+static size_t scan_pids_size;
+static size_t scan_next;
+static bool scan_need_cmdline;
+
+static pthread_mutex_t match_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static c_avl_tree_t *match_cache;
+static uint64_t match_generation;
+#if HAVE_REGEX_H
+/* All ProcessMatch expressions as one alternation. Processes not matching it
+ * need not be checked against the individual expressions. */
+static regex_t *match_combined;
+#endif
+
+static int ps_pid_compare(const void *a, const void *b) {
+  intptr_t x = (intptr_t)a;
+  intptr_t y = (intptr_t)b;
+
+  return (x > y) - (x < y);
+} /* int ps_pid_compare */
+
+static void ps_match_cache_free(ps_match_cache_t *mc) {
+  if (mc == NULL)
+    return;
+
+  sfree(mc->name);
+  sfree(mc->matches);
+  sfree(mc);
+} /* void ps_match_cache_free */
+
+/* ps_match_cache_drop forgets the match result of pid. */
+static void ps_match_cache_drop(long pid) {
+  void *key = (void *)(intptr_t)pid;
+  ps_match_cache_t *mc = NULL;
+
+  pthread_mutex_lock(&match_cache_lock);
+  if (c_avl_remove(match_cache, key, NULL, (void **)&mc) == 0)
+    ps_match_cache_free(mc);
+  pthread_mutex_unlock(&match_cache_lock);
+} /* void ps_match_cache_drop */
+
+/* ps_match_cache_sweep removes the processes which have not been seen during
+ * the current read. */
+static void ps_match_cache_sweep(void) {
+  c_avl_iterator_t *iter;
+  void **stale = NULL;
+  size_t stale_num = 0;
+  size_t stale_size = 0;
+  void *key;
+  ps_match_cache_t *mc;
+
+  iter = c_avl_get_iterator(match_cache);
+  while (c_avl_iterator_next(iter, &key, (void **)&mc) == 0) {
+    if (mc->generation == match_generation)
+      continue;
+
+    if (stale_num >= stale_size) {
+      size_t new_size = (stale_size == 0) ? 64 : 2 * stale_size;
+      void **tmp = realloc(stale, new_size * sizeof(*tmp));
+      if (tmp == NULL)
+        break;
+      stale = tmp;
+      stale_size = new_size;
+    }
+    stale[stale_num] = key;
+    stale_num++;
+  }
+  c_avl_iterator_destroy(iter);
+
+  for (size_t i = 0; i < stale_num; i++) {
+    if (c_avl_remove(match_cache, stale[i], NULL, (void **)&mc) == 0)
+      ps_match_cache_free(mc);
+  }
+  sfree(stale);
+} /* void ps_match_cache_sweep */
+
+/* ps_match_compute matches a process against all Process and ProcessMatch
+ * entries. */
+static ps_match_cache_t *ps_match_compute(ps_worker_t *w,
+                                          process_entry_t const *pse) {
+  char const *cmdline = NULL;
+  bool maybe_re = true;
+
+  ps_match_cache_t *mc = calloc(1, sizeof(*mc));
+  if (mc == NULL) {
+    ERROR("processes plugin: calloc failed.");
+    return NULL;
+  }
+  mc->start_time = pse->start_time;
+  mc->name = strdup(pse->name);
+  if (mc->name == NULL) {
+    ERROR("processes plugin: strdup failed.");
+    ps_match_cache_free(mc);
+    return NULL;
+  }
+
+  if (scan_need_cmdline)
+    cmdline = ps_get_cmdline(pse->id, (char *)pse->name, w->cmdline,
+                             CMDLINE_BUFFER_SIZE);
+
+#if HAVE_REGEX_H
+  if (match_combined != NULL) {
+    char const *str = cmdline;
+    if ((str == NULL) || (str[0] == 0))
+      str = pse->name;
+    maybe_re = (regexec(match_combined, str, /* nmatch = */ 0,
+                        /* pmatch = */ NULL, /* eflags = */ 0) == 0);
+  }
+#endif
+
+  for (procstat_t *ps = list_head_g; ps != NULL; ps = ps->next) {
+#if HAVE_REGEX_H
+    if ((ps->re != NULL) && !maybe_re)
+      continue;
+#endif
+    if (ps_list_match(pse->name, cmdline, ps) == 0)
+      continue;
+
+    procstat_t **tmp =
+        realloc(mc->matches, (mc->matches_num + 1) * sizeof(*tmp));
+    if (tmp == NULL) {
+      ERROR("processes plugin: realloc failed.");
+      ps_match_cache_free(mc);
+      return NULL;
+    }
+    mc->matches = tmp;
+    mc->matches[mc->matches_num] = ps;
+    mc->matches_num++;
+  }
+
+  return mc;
+} /* ps_match_cache_t *ps_match_compute */
+
+/* ps_match_get returns the entries matching a process, from the cache if the
+ * process has been seen before. */
+static ps_match_cache_t *ps_match_get(ps_worker_t *w,
+                                      process_entry_t const *pse) {
+  void *key = (void *)(intptr_t)pse->id;
+  ps_match_cache_t *mc = NULL;
+
+  pthread_mutex_lock(&match_cache_lock);
+  if (c_avl_get(match_cache, key, (void **)&mc) == 0) {
+    if ((mc->start_time != pse->start_time) ||
+        (strcmp(mc->name, pse->name) != 0)) {
+      c_avl_remove(match_cache, key, NULL, NULL);
+      ps_match_cache_free(mc);
+      mc = NULL;
+    } else {
+      mc->generation = match_generation;
+    }
+  }
+  pthread_mutex_unlock(&match_cache_lock);
+
+  if (mc != NULL)
+    return mc;
+
+  mc = ps_match_compute(w, pse);
+  if (mc == NULL)
+    return NULL;
+  mc->generation = match_generation;
+
+  pthread_mutex_lock(&match_cache_lock);
+  int status = c_avl_insert(match_cache, key, mc);
+  pthread_mutex_unlock(&match_cache_lock);
+  if (status != 0) {
+    ERROR("processes plugin: c_avl_insert failed.");
+    ps_match_cache_free(mc);
+    return NULL;
+  }
+
+  return mc;
+} /* ps_match_cache_t *ps_match_get */
+
+#if HAVE_REGEX_H
+/* ps_match_combine compiles match_combined. Expressions using back-references
+ * cannot be combined since the added groups would renumber them. */
+static void ps_match_combine(void) {
+  size_t len = 0;
+  size_t num = 0;
+
+  for (procstat_t *ps = list_head_g; ps != NULL; ps = ps->next) {
+    if (ps->re_str == NULL)
+      continue;
+
+    for (char const *c = strchr(ps->re_str, '\\'); c != NULL;
+         c = strchr(c + 2, '\\')) {
+      if (isdigit((int)c[1]))
+        return;
+      if (c[1] == 0)
+        break;
+    }
+
+    len += strlen(ps->re_str) + strlen("()|");
+    num++;
+  }
+
+  if (num < 2)
+    return;
+
+  char *str = malloc(len + 1);
+  if (str == NULL) {
+    ERROR("processes plugin: malloc failed.");
+    return;
+  }
+  str[0] = 0;
+
+  for (procstat_t *ps = list_head_g; ps != NULL; ps = ps->next) {
+    if (ps->re_str == NULL)
+      continue;
+    if (str[0] != 0)
+      strcat(str, "|");
+    strcat(str, "(");
+    strcat(str, ps->re_str);
+    strcat(str, ")");
+  }
+
+  match_combined = malloc(sizeof(*match_combined));
+  if (match_combined == NULL) {
+    ERROR("processes plugin: malloc failed.");
+  } else if (regcomp(match_combined, str, REG_EXTENDED | REG_NOSUB) != 0) {
+    DEBUG("processes plugin: Combining the ProcessMatch expressions failed.");
+    sfree(match_combined);
+  }
+  sfree(str);
+} /* void ps_match_combine */
+#endif
+
+static int ps_match_init(void) {
+  if (match_cache != NULL)
+    return 0;
+
+  match_cache = c_avl_create(ps_pid_compare);
+  if (match_cache == NULL) {
+    ERROR("processes plugin: c_avl_create failed.");
+    return -1;
+  }
+
+#if HAVE_REGEX_H
+  ps_match_combine();
+#endif
+  return 0;
+} /* int ps_match_init */
+
+static int ps_scan_add_match(ps_worker_t *w, process_entry_t const *entry,
+                             ps_match_cache_t *match) {
+  if (w->matches_num >= w->matches_size) {
+    size_t new_size = (w->matches_size == 0) ? 16 : 2 * w->matches_size;
+    ps_scan_match_t *tmp = realloc(w->matches, new_size * sizeof(*tmp));
+    if (tmp == NULL) {
+      ERROR("processes plugin: realloc failed.");
+      return ENOMEM;
+    }
+    w->matches = tmp;
+    w->matches_size = new_size;
+  }
+
+  w->matches[w->matches_num] = (ps_scan_match_t){
+      .entry = *entry,
+      .match = match,
+  };
+  w->matches_num++;
+  return 0;
+} /* int ps_scan_add_match */
+
+static void ps_scan_pid(ps_worker_t *w, long pid) {
+  process_entry_t pse = {.id = pid};
+  char state;
+
+  int status = ps_read_process(pid, &pse, &state);
+  if (status != 0) {
+    DEBUG("ps_read_process failed: %i", status);
+    return;
+  }
+
+  switch (state) {
+  case 'R':
+    w->running++;
+    break;
+  case 'S':
+    w->sleeping++;
+    break;
+  case 'D':
+    w->blocked++;
+    break;
+  case 'Z':
+    w->zombies++;
+    break;
+  case 'T':
+    w->stopped++;
+    break;
+  case 'W':
+    w->paging++;
+    break;
+  }
+
+  if (list_head_g == NULL)
+    return;
+
+  ps_match_cache_t *mc = ps_match_get(w, &pse);
+  if ((mc == NULL) || (mc->matches_num == 0))
+    return;
+
+  for (size_t i = 0; i < mc->matches_num; i++)
+    ps_fill_details(mc->matches[i], &pse);
+
+  ps_scan_add_match(w, &pse, mc);
+} /* void ps_scan_pid */
+
+static void ps_scan_run(ps_worker_t *w) {
+  while (42) {
+    size_t begin;
+    size_t end;
+
+    pthread_mutex_lock(&scan_lock);
+    begin = scan_next;
+    end = scan_pids_num;
+    if ((end - begin) > PS_SCAN_CHUNK)
+      end = begin + PS_SCAN_CHUNK;
+    scan_next = end;
+    pthread_mutex_unlock(&scan_lock);
+
+    if (begin >= end)
+      break;
+
+    for (size_t i = begin; i < end; i++)
+      ps_scan_pid(w, scan_pids[i]);
+  }
+} /* void ps_scan_run */
+
+static void *ps_worker_thread(void *arg) {
+  ps_worker_t *w = arg;
+  uint64_t generation = 0;
+
+  pthread_mutex_lock(&scan_lock);
+  while (42) {
+    while (!scan_shutdown && (scan_generation == generation))
+      pthread_cond_wait(&scan_start_cond, &scan_lock);
+    if (scan_shutdown)
+      break;
+    generation = scan_generation;
+    pthread_mutex_unlock(&scan_lock);
+
+    ps_scan_run(w);
+
+    pthread_mutex_lock(&scan_lock);
+    scan_busy--;
+    if (scan_busy == 0)
+      pthread_cond_signal(&scan_done_cond);
+  }
+  pthread_mutex_unlock(&scan_lock);
+
+  return NULL;
+} /* void *ps_worker_thread */
+
+static int ps_workers_start(void) {
+  if (workers != NULL)
+    return 0;
+
+  workers = calloc(read_threads, sizeof(*workers));
+  if (workers == NULL) {
+    ERROR("processes plugin: calloc failed.");
+    return ENOMEM;
+  }
+
+  for (int i = 0; i < read_threads; i++) {
+    workers[i].cmdline = malloc(CMDLINE_BUFFER_SIZE);
+    if (workers[i].cmdline == NULL) {
+      ERROR("processes plugin: malloc failed.");
+      break;
+    }
+
+    if (i > 0) {
+      int status = plugin_thread_create(&workers[i].thread, ps_worker_thread,
+                                        workers + i, "processes");
+      if (status != 0) {
+        ERROR("processes plugin: Starting a reader thread failed: %s",
+              STRERROR(status));
+        sfree(workers[i].cmdline);
+        break;
+      }
+      workers[i].thread_running = true;
+    }
+
+    workers_num++;
+  }
+
+  if (workers_num == 0) {
+    sfree(workers);
+    return -1;
+  }
+
+  if (workers_num < (size_t)read_threads)
+    WARNING("processes plugin: Using %" PRIsz " of %d reader threads.",
+            workers_num, read_threads);
+  return 0;
+} /* int ps_workers_start */
+
+static void ps_workers_stop(void) {
+  if (workers == NULL)
+    return;
+
+  pthread_mutex_lock(&scan_lock);
+  scan_shutdown = true;
+  pthread_cond_broadcast(&scan_start_cond);
+  pthread_mutex_unlock(&scan_lock);
+
+  for (size_t i = 0; i < workers_num; i++) {
+    if (workers[i].thread_running)
+      pthread_join(workers[i].thread, NULL);
+    sfree(workers[i].cmdline);
+    sfree(workers[i].matches);
+  }
+  sfree(workers);
+  workers_num = 0;
+
+  sfree(scan_pids);
+  scan_pids_num = 0;
+  scan_pids_size = 0;
+} /* void ps_workers_stop */
+
+static int ps_scan_pids_append(long pid) {
+  if (scan_pids_num >= scan_pids_size) {
+    size_t new_size = (scan_pids_size == 0) ? 1024 : 2 * scan_pids_size;
+    long *tmp = realloc(scan_pids, new_size * sizeof(*tmp));
+    if (tmp == NULL) {
+      ERROR("processes plugin: realloc failed.");
+      return ENOMEM;
+    }
+    scan_pids = tmp;
+    scan_pids_size = new_size;
+  }
+
+  scan_pids[scan_pids_num] = pid;
+  scan_pids_num++;
+  return 0;
+} /* int ps_scan_pids_append */
+
+/* ps_scan_pids collects the pids in /proc into scan_pids. */
+static int ps_scan_pids(void) {
+  struct dirent *ent;
+  DIR *proc;
+
+  if ((proc = opendir("/proc")) == NULL) {
+    ERROR("Cannot open `/proc': %s", STRERRNO);
+    return -1;
+  }
+
+  scan_pids_num = 0;
+  while ((ent = readdir(proc)) != NULL) {
+    long pid;
+
+    if (!isdigit(ent->d_name[0]))
+      continue;
+
+    if ((pid = atol(ent->d_name)) < 1)
+      continue;
+
+    if (ps_scan_pids_append(pid) != 0) {
+      closedir(proc);
+      return ENOMEM;
+    }
+  }
+
+  closedir(proc);
+  return 0;
+} /* int ps_scan_pids */
+
+/* ps_scan reads all processes in scan_pids using the worker pool and waits
+ * until all workers are done. */
+static void ps_scan(void) {
+  scan_need_cmdline = false;
+#if HAVE_REGEX_H
+  for (procstat_t *ps = list_head_g; ps != NULL; ps = ps->next)
+    if (ps->re != NULL)
+      scan_need_cmdline = true;
+#endif
+
+  match_generation++;
+
+  for (size_t i = 0; i < workers_num; i++) {
+    ps_worker_t *w = workers + i;
+
+    w->matches_num = 0;
+    w->running = w->sleeping = w->zombies = 0;
+    w->stopped = w->paging = w->blocked = 0;
+  }
+
+  pthread_mutex_lock(&scan_lock);
+  scan_next = 0;
+  scan_busy = workers_num - 1;
+  scan_generation++;
+  pthread_cond_broadcast(&scan_start_cond);
+  pthread_mutex_unlock(&scan_lock);
+
+  ps_scan_run(workers);
+
+  pthread_mutex_lock(&scan_lock);
+  while (scan_busy > 0)
+    pthread_cond_wait(&scan_done_cond, &scan_lock);
+  pthread_mutex_unlock(&scan_lock);
+} /* void ps_scan */
+
+/* With UseProcessEvents, a thread subscribes to the fork, exec, comm and exit
+ * events of the kernel's proc connector. Instead of all of /proc, a read only
+ * looks at the processes which matched during the previous read and those
+ * started, renamed or exec()ed since. If events are lost, the next read scans
+ * all of /proc again. */
+#define PS_EVENTS_MAX 1048576
+
+typedef struct {
+  long pid;
+  bool exited;
+} ps_event_t;
+
+static int ev_sock = -1;
+static int ev_pipe[2] = {-1, -1};
+static pthread_t ev_thread;
+static bool ev_thread_running;
+
+static pthread_mutex_t ev_lock = PTHREAD_MUTEX_INITIALIZER;
+static ps_event_t *ev_queue;
+static size_t ev_queue_num;
+static size_t ev_queue_size;
+static bool ev_lost = true;
+static bool ev_failed;
+
+/* Processes to read during the next interval. Only used by the read thread. */
+static c_avl_tree_t *ev_pids;
+
+static void ps_events_push(long pid, bool exited) {
+  pthread_mutex_lock(&ev_lock);
+
+  /* After losing events all of /proc is scanned anyway. */
+  if (ev_lost) {
+    pthread_mutex_unlock(&ev_lock);
+    return;
+  }
+
+  if (ev_queue_num >= ev_queue_size) {
+    size_t new_size = (ev_queue_size == 0) ? 1024 : 2 * ev_queue_size;
+    ps_event_t *tmp = NULL;
+
+    if (new_size <= PS_EVENTS_MAX)
+      tmp = realloc(ev_queue, new_size * sizeof(*tmp));
+    if (tmp == NULL) {
+      ev_lost = true;
+      ev_queue_num = 0;
+      pthread_mutex_unlock(&ev_lock);
+      return;
+    }
+    ev_queue = tmp;
+    ev_queue_size = new_size;
+  }
+
+  ev_queue[ev_queue_num] = (ps_event_t){.pid = pid, .exited = exited};
+  ev_queue_num++;
+
+  pthread_mutex_unlock(&ev_lock);
+} /* void ps_events_push */
+
+/* ps_events_handle returns non-zero if subscribing to the events failed. */
+static int ps_events_handle(struct proc_event const *ev) {
+  switch (ev->what) {
+  case PROC_EVENT_NONE:
+    if (ev->event_data.ack.err != 0) {
+      ERROR("processes plugin: Subscribing to process events failed: %s. "
+            "This requires the CAP_NET_ADMIN capability.",
+            STRERROR(ev->event_data.ack.err));
+      return -1;
+    }
+    break;
+  case PROC_EVENT_FORK:
+    /* New threads share the thread group of their parent. */
+    if (ev->event_data.fork.child_pid == ev->event_data.fork.child_tgid)
+      ps_events_push(ev->event_data.fork.child_tgid, false);
+    break;
+  case PROC_EVENT_EXEC:
+    ps_events_push(ev->event_data.exec.process_tgid, false);
+    break;
+  case PROC_EVENT_COMM:
+    ps_events_push(ev->event_data.comm.process_tgid, false);
+    break;
+  case PROC_EVENT_EXIT:
+    if (ev->event_data.exit.process_pid == ev->event_data.exit.process_tgid)
+      ps_events_push(ev->event_data.exit.process_tgid, true);
+    break;
+  default:
+    break;
+  }
+
+  return 0;
+} /* int ps_events_handle */
+
+static void *ps_events_thread(__attribute__((unused)) void *arg) {
+  char buffer[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+  struct pollfd fds[2] = {
+      {.fd = ev_sock, .events = POLLIN},
+      {.fd = ev_pipe[0], .events = POLLIN},
+  };
+
+  while (42) {
+    if (poll(fds, STATIC_ARRAY_SIZE(fds), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      ERROR("processes plugin: poll failed: %s", STRERRNO);
+      break;
+    }
+
+    /* ps_events_stop() wrote to the pipe. */
+    if (fds[1].revents != 0)
+      break;
+
+    int len = (int)recv(ev_sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (len < 0) {
+      if ((errno == EINTR) || (errno == EAGAIN))
+        continue;
+      if (errno == ENOBUFS) {
+        pthread_mutex_lock(&ev_lock);
+        ev_lost = true;
+        ev_queue_num = 0;
+        pthread_mutex_unlock(&ev_lock);
+        continue;
+      }
+      ERROR("processes plugin: Receiving process events failed: %s",
+            STRERRNO);
+      break;
+    }
+
+    int status = 0;
+    for (struct nlmsghdr *nlh = (struct nlmsghdr *)buffer;
+         (status == 0) && NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+      struct cn_msg *cn = NLMSG_DATA(nlh);
+      struct proc_event ev = {0};
+
+      if ((nlh->nlmsg_type != NLMSG_DONE) || (cn->id.idx != CN_IDX_PROC) ||
+          (cn->id.val != CN_VAL_PROC))
+        continue;
+
+      /* The event follows the 20 byte cn_msg header and is not aligned. */
+      memcpy(&ev, cn->data, (cn->len < sizeof(ev)) ? cn->len : sizeof(ev));
+      status = ps_events_handle(&ev);
+    }
+    if (status != 0)
+      break;
+  }
+
+  pthread_mutex_lock(&ev_lock);
+  ev_failed = true;
+  pthread_mutex_unlock(&ev_lock);
+
+  return NULL;
+} /* void *ps_events_thread */
+
+static int ps_events_subscribe(void) {
+  struct __attribute__((aligned(NLMSG_ALIGNTO))) {
+    struct nlmsghdr nl_hdr;
+    struct __attribute__((__packed__)) {
+      struct cn_msg cn_msg;
+      enum proc_cn_mcast_op cn_mcast;
+    };
+  } nlcn_msg;
+
+  memset(&nlcn_msg, 0, sizeof(nlcn_msg));
+  nlcn_msg.nl_hdr.nlmsg_len = sizeof(nlcn_msg);
+  nlcn_msg.nl_hdr.nlmsg_type = NLMSG_DONE;
+
+  nlcn_msg.cn_msg.id.idx = CN_IDX_PROC;
+  nlcn_msg.cn_msg.id.val = CN_VAL_PROC;
+  nlcn_msg.cn_msg.len = sizeof(enum proc_cn_mcast_op);
+  nlcn_msg.cn_mcast = PROC_CN_MCAST_LISTEN;
+
+  if (send(ev_sock, &nlcn_msg, sizeof(nlcn_msg), 0) < 0) {
+    ERROR("processes plugin: Subscribing to process events failed: %s",
+          STRERRNO);
+    return -1;
+  }
+
+  return 0;
+} /* int ps_events_subscribe */
+
+static void ps_events_stop(void) {
+  if (ev_thread_running) {
+    if (write(ev_pipe[1], "", 1) < 0)
+      ERROR("processes plugin: Waking the event thread failed: %s", STRERRNO);
+    pthread_join(ev_thread, NULL);
+    ev_thread_running = false;
+  }
+
+  if (ev_sock >= 0) {
+    close(ev_sock);
+    ev_sock = -1;
+  }
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(ev_pipe); i++) {
+    if (ev_pipe[i] >= 0) {
+      close(ev_pipe[i]);
+      ev_pipe[i] = -1;
+    }
+  }
+
+  if (ev_pids != NULL) {
+    c_avl_destroy(ev_pids);
+    ev_pids = NULL;
+  }
+  sfree(ev_queue);
+  ev_queue_num = 0;
+  ev_queue_size = 0;
+} /* void ps_events_stop */
+
+static int ps_events_start(void) {
+  struct sockaddr_nl sa = {
+      .nl_family = AF_NETLINK,
+      .nl_groups = CN_IDX_PROC,
+  };
+  int rcvbuf = 1024 * 1024;
+
+  if (ev_thread_running)
+    return 0;
+
+  ev_pids = c_avl_create(ps_pid_compare);
+  if (ev_pids == NULL) {
+    ERROR("processes plugin: c_avl_create failed.");
+    return -1;
+  }
+
+  ev_sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+  if (ev_sock < 0) {
+    ERROR("processes plugin: Opening the proc connector socket failed: %s",
+          STRERRNO);
+    ps_events_stop();
+    return -1;
+  }
+
+  /* Bursts of forks should not overflow the socket between two reads of the
+   * event thread. */
+  setsockopt(ev_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+  if (bind(ev_sock, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+    ERROR("processes plugin: Binding the proc connector socket failed: %s",
+          STRERRNO);
+    ps_events_stop();
+    return -1;
+  }
+
+  if ((ps_events_subscribe() != 0) || (pipe(ev_pipe) != 0)) {
+    ps_events_stop();
+    return -1;
+  }
+
+  int status =
+      plugin_thread_create(&ev_thread, ps_events_thread, NULL, "processes ev");
+  if (status != 0) {
+    ERROR("processes plugin: Starting the event thread failed: %s",
+          STRERROR(status));
+    ps_events_stop();
+    return -1;
+  }
+  ev_thread_running = true;
+
+  return 0;
+} /* int ps_events_start */
+
+/* ps_events_enabled returns true if reads should use the process events. */
+static bool ps_events_enabled(void) {
+  bool failed;
+
+  if (!use_process_events || !ev_thread_running)
+    return false;
+
+  pthread_mutex_lock(&ev_lock);
+  failed = ev_failed;
+  pthread_mutex_unlock(&ev_lock);
+
+  if (failed) {
+    ERROR("processes plugin: Process events are no longer received. "
+          "Falling back to scanning /proc.");
+    ps_events_stop();
+    return false;
+  }
+
+  return true;
+} /* bool ps_events_enabled */
+
+/* ps_events_pids applies the events received since the last read to ev_pids
+ * and copies ev_pids to scan_pids. If events have been lost, all pids in /proc
+ * are used instead. */
+static int ps_events_pids(void) {
+  ps_event_t *queue;
+  size_t queue_num;
+  bool lost;
+
+  pthread_mutex_lock(&ev_lock);
+  queue = ev_queue;
+  queue_num = ev_queue_num;
+  lost = ev_lost;
+  ev_queue = NULL;
+  ev_queue_num = 0;
+  ev_queue_size = 0;
+  ev_lost = false;
+  pthread_mutex_unlock(&ev_lock);
+
+  if (lost) {
+    sfree(queue);
+    return ps_scan_pids();
+  }
+
+  for (size_t i = 0; i < queue_num; i++) {
+    void *key = (void *)(intptr_t)queue[i].pid;
+
+    /* exec() keeps the start time, so the process needs to be matched again.
+     */
+    ps_match_cache_drop(queue[i].pid);
+
+    if (queue[i].exited) {
+      c_avl_remove(ev_pids, key, NULL, NULL);
+    } else if (c_avl_insert(ev_pids, key, NULL) < 0) {
+      ERROR("processes plugin: c_avl_insert failed.");
+      pthread_mutex_lock(&ev_lock);
+      ev_lost = true;
+      pthread_mutex_unlock(&ev_lock);
+    }
+  }
+  sfree(queue);
+
+  scan_pids_num = 0;
+
+  c_avl_iterator_t *iter = c_avl_get_iterator(ev_pids);
+  void *key;
+  void *value;
+  while (c_avl_iterator_next(iter, &key, &value) == 0) {
+    if (ps_scan_pids_append((long)(intptr_t)key) != 0) {
+      c_avl_iterator_destroy(iter);
+      return ENOMEM;
+    }
+  }
+  c_avl_iterator_destroy(iter);
+
+  return 0;
+} /* int ps_events_pids */
+
+/* ps_events_update keeps the processes which matched during this read in
+ * ev_pids. */
+static void ps_events_update(void) {
+  void *key;
+  void *value;
+
+  while (c_avl_pick(ev_pids, &key, &value) == 0)
+    ;
+
+  for (size_t i = 0; i < workers_num; i++) {
+    for (size_t j = 0; j < workers[i].matches_num; j++) {
+      key = (void *)(intptr_t)workers[i].matches[j].entry.id;
+      if (c_avl_insert(ev_pids, key, NULL) < 0) {
+        ERROR("processes plugin: c_avl_insert failed.");
+        pthread_mutex_lock(&ev_lock);
+        ev_lost = true;
+        pthread_mutex_unlock(&ev_lock);
+        return;
+      }
+    }
+  }
+} /* void ps_events_update */
 #endif /*KERNEL_LINUX */
 
 #if KERNEL_SOLARIS
@@ -2078,66 +3094,36 @@ static int ps_read(void) {
   int paging = 0;
   int blocked = 0;
 
-  struct dirent *ent;
-  DIR *proc;
-  long pid;
-
-  char cmdline[CMDLINE_BUFFER_SIZE];
-
-  int status;
-  process_entry_t pse;
-  char state;
+  bool events = ps_events_enabled();
 
-  running = sleeping = zombies = stopped = paging = blocked = 0;
   ps_list_reset();
 
-  if ((proc = opendir("/proc")) == NULL) {
-    ERROR("Cannot open `/proc': %s", STRERRNO);
+  if ((events ? ps_events_pids() : ps_scan_pids()) != 0)
     return -1;
-  }
 
-  while ((ent = readdir(proc)) != NULL) {
-    if (!isdigit(ent->d_name[0]))
-      continue;
+  ps_scan();
 
-    if ((pid = atol(ent->d_name)) < 1)
-      continue;
+  for (size_t i = 0; i < workers_num; i++) {
+    ps_worker_t *w = workers + i;
 
-    memset(&pse, 0, sizeof(pse));
-    pse.id = pid;
+    running += w->running;
+    sleeping += w->sleeping;
+    zombies += w->zombies;
+    stopped += w->stopped;
+    paging += w->paging;
+    blocked += w->blocked;
 
-    status = ps_read_process(pid, &pse, &state);
-    if (status != 0) {
-      DEBUG("ps_read_process failed: %i", status);
-      continue;
-    }
+    for (size_t j = 0; j < w->matches_num; j++) {
+      ps_scan_match_t *m = w->matches + j;
 
-    switch (state) {
-    case 'R':
-      running++;
-      break;
-    case 'S':
-      sleeping++;
-      break;
-    case 'D':
-      blocked++;
-      break;
-    case 'Z':
-      zombies++;
-      break;
-    case 'T':
-      stopped++;
-      break;
-    case 'W':
-      paging++;
-      break;
+      for (size_t k = 0; k < m->match->matches_num; k++)
+        ps_list_add_one(m->match->matches[k], &m->entry);
     }
-
-    ps_list_add(pse.name,
-                ps_get_cmdline(pid, pse.name, cmdline, sizeof(cmdline)), &pse);
   }
 
-  closedir(proc);
+  if (events)
+    ps_events_update();
+  ps_match_cache_sweep();
 
   /* get procs_running from /proc/stat
    * scanning /proc/stat AND computing other process stats takes too much time.
@@ -2147,14 +3133,21 @@ static int ps_read(void) {
    * stat(s).
    * The 'procs_running' number in /proc/stat on the other hand is more
    * accurate, and can be retrieved in a single 'read' call. */
-  running = procs_running();
+  running = procs_count("procs_running ");
 
-  ps_submit_state("running", running);
-  ps_submit_state("sleeping", sleeping);
-  ps_submit_state("zombies", zombies);
-  ps_submit_state("stopped", stopped);
-  ps_submit_state("paging", paging);
-  ps_submit_state("blocked", blocked);
+  /* In event mode only some processes are read, so the remaining states are
+   * unknown. */
+  if (events) {
+    ps_submit_state("running", running);
+    ps_submit_state("blocked", procs_count("procs_blocked "));
+  } else {
+    ps_submit_state("running", running);
+    ps_submit_state("sleeping", sleeping);
+    ps_submit_state("zombies", zombies);
+    ps_submit_state("stopped", stopped);
+    ps_submit_state("paging", paging);
+    ps_submit_state("blocked", blocked);
+  }
 
   for (procstat_t *ps_ptr = list_head_g; ps_ptr != NULL; ps_ptr = ps_ptr->next)
     ps_submit_proc_list(ps_ptr);
@@ -2885,8 +3878,35 @@ static int ps_read(void) {
   return 0;
 } /* int ps_read */
 
+#if KERNEL_LINUX
+static int ps_shutdown(void) {
+  ps_events_stop();
+  ps_workers_stop();
+
+  if (match_cache != NULL) {
+    void *key;
+    ps_match_cache_t *mc;
+
+    while (c_avl_pick(match_cache, &key, (void **)&mc) == 0)
+      ps_match_cache_free(mc);
+    c_avl_destroy(match_cache);
+    match_cache = NULL;
+  }
+#if HAVE_REGEX_H
+  if (match_combined != NULL) {
+    regfree(match_combined);
+    sfree(match_combined);
+  }
+#endif
+  return 0;
+} /* int ps_shutdown */
+#endif
+
 void module_register(void) {
   plugin_register_complex_config("processes", ps_config);
   plugin_register_init("processes", ps_init);
   plugin_register_read("processes", ps_read);
+#if KERNEL_LINUX
+  plugin_register_shutdown("processes", ps_shutdown);
+#endif
 } /* void module_register */
@@ -48,6 +48,9 @@ static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static ignorelist_t *values_list;
 
+static procfile_t *pf_snmp;
+static procfile_t *pf_netstat;
+
 /*
  * Functions
  */
@@ -72,10 +75,10 @@ static void submit(const char *protocol_name, const char *str_key,
   plugin_dispatch_values(&vl);
 } /* void submit */
 
-static int read_file(const char *path) {
-  FILE *fh;
-  char key_buffer[4096];
-  char value_buffer[4096];
+static int read_file(procfile_t **pf, const char *path) {
+  char *ptr;
+  char *key_buffer;
+  char *value_buffer;
   char *key_ptr;
   char *value_ptr;
   char *key_fields[256];
@@ -85,31 +88,25 @@ static int read_file(const char *path) {
   int status;
   int i;
 
-  fh = fopen(path, "r");
-  if (fh == NULL) {
-    ERROR("protocols plugin: fopen (%s) failed: %s.", path, STRERRNO);
+  if ((*pf == NULL) && ((*pf = procfile_create(path)) == NULL))
+    return -1;
+
+  ptr = procfile_read(*pf);
+  if (ptr == NULL) {
+    ERROR("protocols plugin: Reading %s failed: %s.", path, STRERRNO);
     return -1;
   }
 
   status = -1;
   while (42) {
-    clearerr(fh);
-    key_ptr = fgets(key_buffer, sizeof(key_buffer), fh);
-    if (key_ptr == NULL) {
-      if (feof(fh) != 0) {
-        status = 0;
-        break;
-      } else if (ferror(fh) != 0) {
-        ERROR("protocols plugin: Reading from %s failed.", path);
-        break;
-      } else {
-        ERROR("protocols plugin: fgets failed for an unknown reason.");
-        break;
-      }
-    } /* if (key_ptr == NULL) */
-
-    value_ptr = fgets(value_buffer, sizeof(value_buffer), fh);
-    if (value_ptr == NULL) {
+    key_buffer = next_line(&ptr);
+    if (key_buffer == NULL) {
+      status = 0;
+      break;
+    }
+
+    value_buffer = next_line(&ptr);
+    if (value_buffer == NULL) {
       ERROR("protocols plugin: read_file (%s): Could not read values line.",
             path);
       break;
@@ -166,8 +163,6 @@ static int read_file(const char *path) {
     } /* for (i = 0; i < key_fields_num; i++) */
   }   /* while (42) */
 
-  fclose(fh);
-
   return status;
 } /* int read_file */
 
@@ -175,11 +170,11 @@ static int protocols_read(void) {
   int status;
   int success = 0;
 
-  status = read_file(SNMP_FILE);
+  status = read_file(&pf_snmp, SNMP_FILE);
   if (status == 0)
     success++;
 
-  status = read_file(NETSTAT_FILE);
+  status = read_file(&pf_netstat, NETSTAT_FILE);
   if (status == 0)
     success++;
 
@@ -207,8 +202,17 @@ static int protocols_config(const char *key, const char *value) {
   return 0;
 } /* int protocols_config */
 
+static int protocols_shutdown(void) {
+  procfile_destroy(pf_snmp);
+  pf_snmp = NULL;
+  procfile_destroy(pf_netstat);
+  pf_netstat = NULL;
+  return 0;
+} /* int protocols_shutdown */
+
 void module_register(void) {
   plugin_register_config("protocols", protocols_config, config_keys,
                          config_keys_num);
   plugin_register_read("protocols", protocols_read);
+  plugin_register_shutdown("protocols", protocols_shutdown);
 } /* void module_register */
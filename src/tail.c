@@ -37,6 +37,7 @@
  *      Plugin "mail"
  *      Instance "exim"
  *      Interval 60
+ *      ReportBacklog false
  *	<Match>
  *	  Regex "S=([1-9][0-9]*)"
  *	  ExcludeRegex "U=root.*S="
@@ -58,13 +59,26 @@ struct ctail_config_match_s {
 };
 typedef struct ctail_config_match_s ctail_config_match_t;
 
+struct ctail_file_s {
+  cu_tail_match_t *tm;
+  char *plugin_name;
+  char *plugin_instance;
+  bool report_backlog;
+};
+typedef struct ctail_file_s ctail_file_t;
+
 static size_t tail_file_num;
 
 static int ctail_read(user_data_t *ud);
 
-static void ctail_match_free(void *arg) {
-  tail_match_destroy((cu_tail_match_t *)arg);
-} /* void ctail_match_free */
+static void ctail_file_free(void *arg) {
+  ctail_file_t *file = arg;
+
+  tail_match_destroy(file->tm);
+  sfree(file->plugin_name);
+  sfree(file->plugin_instance);
+  sfree(file);
+} /* void ctail_file_free */
 
 static int ctail_config_add_match_dstype(ctail_config_match_t *cm,
                                          oconfig_item_t *ci) {
@@ -217,6 +231,7 @@ static int ctail_config_add_file(oconfig_item_t *ci) {
   cdtime_t interval = 0;
   char *plugin_name = NULL;
   char *plugin_instance = NULL;
+  bool report_backlog = false;
   int num_matches = 0;
 
   if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_STRING)) {
@@ -241,6 +256,8 @@ static int ctail_config_add_file(oconfig_item_t *ci) {
       status = cf_util_get_string(option, &plugin_instance);
     else if (strcasecmp("Interval", option->key) == 0)
       cf_util_get_cdtime(option, &interval);
+    else if (strcasecmp("ReportBacklog", option->key) == 0)
+      status = cf_util_get_boolean(option, &report_backlog);
     else if (strcasecmp("Match", option->key) == 0) {
       status = ctail_config_add_match(tm, plugin_name, plugin_instance, option);
       if (status == 0)
@@ -255,22 +272,34 @@ static int ctail_config_add_file(oconfig_item_t *ci) {
       break;
   } /* for (i = 0; i < ci->children_num; i++) */
 
-  sfree(plugin_name);
-  sfree(plugin_instance);
-
   if (num_matches == 0) {
     ERROR("tail plugin: No (valid) matches found for file `%s'.",
           ci->values[0].value.string);
+    sfree(plugin_name);
+    sfree(plugin_instance);
     tail_match_destroy(tm);
     return -1;
   }
 
+  ctail_file_t *file = calloc(1, sizeof(*file));
+  if (file == NULL) {
+    ERROR("tail plugin: calloc failed.");
+    sfree(plugin_name);
+    sfree(plugin_instance);
+    tail_match_destroy(tm);
+    return -1;
+  }
+  file->tm = tm;
+  file->plugin_name = plugin_name;
+  file->plugin_instance = plugin_instance;
+  file->report_backlog = report_backlog;
+
   char str[255];
   snprintf(str, sizeof(str), "tail-%zu", tail_file_num++);
 
   plugin_register_complex_read(
       NULL, str, ctail_read, interval,
-      &(user_data_t){.data = tm, .free_func = ctail_match_free});
+      &(user_data_t){.data = file, .free_func = ctail_file_free});
 
   return 0;
 } /* int ctail_config_add_file */
@@ -289,15 +318,35 @@ static int ctail_config(oconfig_item_t *ci) {
   return 0;
 } /* int ctail_config */
 
+static void ctail_submit_backlog(ctail_file_t *file) {
+  value_list_t vl = VALUE_LIST_INIT;
+
+  vl.values = &(value_t){.gauge = (gauge_t)tail_match_backlog(file->tm)};
+  vl.values_len = 1;
+  sstrncpy(vl.plugin, (file->plugin_name != NULL) ? file->plugin_name : "tail",
+           sizeof(vl.plugin));
+  if (file->plugin_instance != NULL)
+    sstrncpy(vl.plugin_instance, file->plugin_instance,
+             sizeof(vl.plugin_instance));
+  sstrncpy(vl.type, "bytes", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "backlog", sizeof(vl.type_instance));
+
+  plugin_dispatch_values(&vl);
+} /* void ctail_submit_backlog */
+
 static int ctail_read(user_data_t *ud) {
+  ctail_file_t *file = ud->data;
   int status;
 
-  status = tail_match_read((cu_tail_match_t *)ud->data, 0);
+  status = tail_match_read(file->tm, 0);
   if (status != 0) {
     ERROR("tail plugin: tail_match_read failed.");
     return -1;
   }
 
+  if (file->report_backlog)
+    ctail_submit_backlog(file);
+
   return 0;
 } /* int ctail_read */
 
@@ -52,6 +52,7 @@ struct instance_definition_s {
   metric_definition_t **metric_list;
   size_t metric_list_len;
   ssize_t time_from;
+  bool report_backlog;
   struct instance_definition_s *next;
 };
 typedef struct instance_definition_s instance_definition_t;
@@ -205,6 +206,27 @@ static int tcsv_read_buffer(instance_definition_t *id, char *buffer,
   return 0;
 }
 
+static int tcsv_read_line(void *data, char *buf,
+                          __attribute__((unused)) int buflen) {
+  tcsv_read_buffer(data, buf, strlen(buf));
+  return 0;
+}
+
+static void tcsv_submit_backlog(instance_definition_t *id) {
+  value_list_t vl = VALUE_LIST_INIT;
+
+  vl.values = &(value_t){.gauge = (gauge_t)cu_tail_backlog(id->tail)};
+  vl.values_len = 1;
+  sstrncpy(vl.plugin, (id->plugin_name != NULL) ? id->plugin_name : "tail_csv",
+           sizeof(vl.plugin));
+  if (id->instance != NULL)
+    sstrncpy(vl.plugin_instance, id->instance, sizeof(vl.plugin_instance));
+  sstrncpy(vl.type, "bytes", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "backlog", sizeof(vl.type_instance));
+
+  plugin_dispatch_values(&vl);
+}
+
 static int tcsv_read(user_data_t *ud) {
   instance_definition_t *id;
   id = ud->data;
@@ -217,26 +239,19 @@ static int tcsv_read(user_data_t *ud) {
     }
   }
 
-  while (42) {
-    char buffer[1024];
-    size_t buffer_len;
-    int status;
-
-    status = cu_tail_readline(id->tail, buffer, (int)sizeof(buffer), 0);
-    if (status != 0) {
-      ERROR("tail_csv plugin: File \"%s\": cu_tail_readline failed "
-            "with status %i.",
-            id->path, status);
-      return -1;
-    }
-
-    buffer_len = strlen(buffer);
-    if (buffer_len == 0)
-      break;
-
-    tcsv_read_buffer(id, buffer, buffer_len);
+  char buffer[1024];
+  int status = cu_tail_read(id->tail, buffer, (int)sizeof(buffer),
+                            tcsv_read_line, id, /* force_rewind = */ false);
+  if (status != 0) {
+    ERROR("tail_csv plugin: File \"%s\": cu_tail_read failed "
+          "with status %i.",
+          id->path, status);
+    return -1;
   }
 
+  if (id->report_backlog)
+    tcsv_submit_backlog(id);
+
   return 0;
 }
 
@@ -475,6 +490,8 @@ static int tcsv_config_add_file(oconfig_item_t *ci) {
       status = cf_util_get_string(option, &id->plugin_name);
     else if (strcasecmp("FieldSeparator", option->key) == 0)
       status = tcsv_config_get_separator(option, &id->field_separator);
+    else if (strcasecmp("ReportBacklog", option->key) == 0)
+      status = cf_util_get_boolean(option, &id->report_backlog);
     else {
       WARNING("tail_csv plugin: Option `%s' not allowed here.", option->key);
       status = -1;
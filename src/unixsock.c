@@ -28,8 +28,10 @@
 
 #include "plugin.h"
 #include "utils/common/common.h"
+#include "utils_complain.h"
 
 #include "utils/cmds/flush.h"
+#include "utils/cmds/gethistory.h"
 #include "utils/cmds/getthreshold.h"
 #include "utils/cmds/getval.h"
 #include "utils/cmds/listval.h"
@@ -39,7 +41,9 @@
 #include <sys/stat.h>
 #include <sys/un.h>
 
+#include <fcntl.h>
 #include <grp.h>
+#include <poll.h>
 
 #ifndef UNIX_PATH_MAX
 #define UNIX_PATH_MAX sizeof(((struct sockaddr_un *)0)->sun_path)
@@ -47,12 +51,54 @@
 
 #define US_DEFAULT_PATH LOCALSTATEDIR "/run/" PACKAGE_NAME "-unixsock"
 
+/* Size of the per-connection input buffer, which limits the length of a
+ * command line. */
+#define US_BUFFER_SIZE 8192
+
+/* Writing a response to a client which does not read is given up after this
+ * long, so that one client cannot stall a worker thread indefinitely. */
+#define US_SEND_TIMEOUT 10
+
+/*
+ * Private data types
+ */
+typedef struct us_conn_s us_conn_t;
+struct us_conn_s {
+  int fd;
+  FILE *fh; /* responses, written to a dup of fd */
+
+  char buffer[US_BUFFER_SIZE];
+  size_t buffer_fill;
+  /* The rest of an overlong line is being skipped. */
+  bool discard;
+
+  /* Lines are part of a BATCH command. */
+  bool in_batch;
+  cmd_putval_batch_t batch;
+
+  us_conn_t *next;
+};
+
+/* Connections are distributed round-robin to a fixed number of worker
+ * threads, each of which poll()s all of its connections. */
+typedef struct {
+  pthread_t thread;
+
+  /* Connections handed over by the listening thread. */
+  pthread_mutex_t lock;
+  us_conn_t *new_conns;
+  /* Written to by the listening thread to wake the worker. */
+  int wakeup[2];
+} us_worker_t;
+
 /*
  * Private variables
  */
 /* valid configuration file keys */
-static const char *config_keys[] = {"SocketFile", "SocketGroup", "SocketPerms",
-                                    "DeleteSocket"};
+static const char *config_keys[] = {"SocketFile",    "SocketGroup",
+                                    "SocketPerms",   "DeleteSocket",
+                                    "WorkerThreads", "MaxConnections",
+                                    "ReportStats"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static int loop;
@@ -66,6 +112,18 @@ static bool delete_socket;
 
 static pthread_t listen_thread = (pthread_t)0;
 
+static size_t workers_num = 4;
+static us_worker_t *workers;
+static size_t max_connections = 256;
+static bool report_stats;
+static c_complain_t reject_complaint = C_COMPLAIN_INIT_STATIC;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t stats_connections;
+static derive_t stats_accepted;
+static derive_t stats_rejected;
+static derive_t stats_requests;
+
 /*
  * Functions
  */
@@ -158,130 +216,302 @@ static int us_open_socket(void) {
   return 0;
 } /* int us_open_socket */
 
-static void *us_handle_client(void *arg) {
-  int fdin;
-  int fdout;
-  FILE *fhin, *fhout;
-
-  fdin = *((int *)arg);
-  free(arg);
-  arg = NULL;
+static us_conn_t *us_conn_create(int fd) {
+  us_conn_t *conn = calloc(1, sizeof(*conn));
+  if (conn == NULL) {
+    ERROR("unixsock plugin: calloc failed.");
+    return NULL;
+  }
+  conn->fd = fd;
 
-  DEBUG("unixsock plugin: us_handle_client: Reading from fd #%i", fdin);
+  struct timeval tv = {.tv_sec = US_SEND_TIMEOUT};
+  if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0)
+    WARNING("unixsock plugin: setsockopt (SO_SNDTIMEO) failed: %s", STRERRNO);
 
-  fdout = dup(fdin);
+  int fdout = dup(fd);
   if (fdout < 0) {
     ERROR("unixsock plugin: dup failed: %s", STRERRNO);
-    close(fdin);
-    pthread_exit((void *)1);
+    free(conn);
+    return NULL;
   }
 
-  fhin = fdopen(fdin, "r");
-  if (fhin == NULL) {
+  /* Responses are buffered and flushed once all complete lines received in
+   * one read have been handled. */
+  conn->fh = fdopen(fdout, "w");
+  if (conn->fh == NULL) {
     ERROR("unixsock plugin: fdopen failed: %s", STRERRNO);
-    close(fdin);
     close(fdout);
-    pthread_exit((void *)1);
-    return (void *)1;
+    free(conn);
+    return NULL;
   }
 
-  fhout = fdopen(fdout, "w");
-  if (fhout == NULL) {
-    ERROR("unixsock plugin: fdopen failed: %s", STRERRNO);
-    fclose(fhin); /* this closes fdin as well */
-    close(fdout);
-    pthread_exit((void *)1);
-    return (void *)1;
+  return conn;
+} /* us_conn_t *us_conn_create */
+
+static void us_conn_destroy(us_conn_t *conn) {
+  if (conn == NULL)
+    return;
+
+  DEBUG("unixsock plugin: Closing connection on fd #%i", conn->fd);
+
+  fclose(conn->fh);
+  close(conn->fd);
+  free(conn);
+
+  pthread_mutex_lock(&stats_lock);
+  stats_connections--;
+  pthread_mutex_unlock(&stats_lock);
+} /* void us_conn_destroy */
+
+/* us_handle_line handles one command line. Returns non-zero if the connection
+ * should be closed. */
+static int us_handle_line(us_conn_t *conn, char *buffer) {
+  FILE *fhout = conn->fh;
+  char buffer_copy[US_BUFFER_SIZE];
+  char *fields[128];
+  int fields_num;
+
+  size_t len = strlen(buffer);
+  if ((len > 0) && (buffer[len - 1] == '\r'))
+    buffer[--len] = '\0';
+
+  if (conn->in_batch) {
+    if (cmd_putval_batch_line(&conn->batch, buffer)) {
+      cmd_error_handler_t err = {cmd_error_fh, fhout};
+      cmd_putval_batch_finish(&conn->batch, &err);
+      conn->in_batch = false;
+    }
+    return 0;
   }
 
-  /* change output buffer to line buffered mode */
-  if (setvbuf(fhout, NULL, _IOLBF, 0) != 0) {
-    ERROR("unixsock plugin: setvbuf failed: %s", STRERRNO);
-    fclose(fhin);
-    fclose(fhout);
-    pthread_exit((void *)1);
-    return (void *)0;
+  if (len == 0)
+    return 0;
+
+  sstrncpy(buffer_copy, buffer, sizeof(buffer_copy));
+
+  fields_num =
+      strsplit(buffer_copy, fields, sizeof(fields) / sizeof(fields[0]));
+  if (fields_num < 1) {
+    fprintf(fhout, "-1 Internal error\n");
+    return -1;
   }
 
-  while (42) {
-    char buffer[1024];
-    char buffer_copy[1024];
-    char *fields[128];
-    int fields_num;
+  if (strcasecmp(fields[0], "getval") == 0) {
+    cmd_handle_getval(fhout, buffer);
+  } else if (strcasecmp(fields[0], "gethistory") == 0) {
+    handle_gethistory(fhout, buffer);
+  } else if (strcasecmp(fields[0], "getthreshold") == 0) {
+    handle_getthreshold(fhout, buffer);
+  } else if (strcasecmp(fields[0], "putval") == 0) {
+    cmd_handle_putval(fhout, buffer);
+  } else if (strcasecmp(fields[0], "batch") == 0) {
+    cmd_error_handler_t err = {cmd_error_fh, fhout};
+    if (cmd_putval_batch_begin(&conn->batch, buffer, &err) == CMD_OK)
+      conn->in_batch = true;
+  } else if (strcasecmp(fields[0], "listval") == 0) {
+    cmd_handle_listval(fhout, buffer);
+  } else if (strcasecmp(fields[0], "putnotif") == 0) {
+    handle_putnotif(fhout, buffer);
+  } else if (strcasecmp(fields[0], "flush") == 0) {
+    cmd_handle_flush(fhout, buffer);
+  } else {
+    fprintf(fhout, "-1 Unknown command: %s\n", fields[0]);
+  }
 
-    errno = 0;
-    if (fgets(buffer, sizeof(buffer), fhin) == NULL) {
-      if ((errno == EINTR) || (errno == EAGAIN))
-        continue;
+  return 0;
+} /* int us_handle_line */
+
+/* us_conn_read reads the available input of a connection and handles all
+ * complete lines. Returns non-zero if the connection should be closed. */
+static int us_conn_read(us_conn_t *conn) {
+  /* Leave room for the terminating null byte. */
+  ssize_t status = read(conn->fd, conn->buffer + conn->buffer_fill,
+                        sizeof(conn->buffer) - 1 - conn->buffer_fill);
+  if (status < 0) {
+    if ((errno == EINTR) || (errno == EAGAIN))
+      return 0;
+    WARNING("unixsock plugin: failed to read from socket #%i: %s", conn->fd,
+            STRERRNO);
+    return -1;
+  }
+
+  bool eof = (status == 0);
+  conn->buffer_fill += (size_t)status;
 
-      if (errno != 0) {
-        WARNING("unixsock plugin: failed to read from socket #%i: %s",
-                fileno(fhin), STRERRNO);
+  char *begin = conn->buffer;
+  char *end = conn->buffer + conn->buffer_fill;
+  derive_t requests = 0;
+  int ret = 0;
+
+  char *newline;
+  while ((ret == 0) &&
+         ((newline = memchr(begin, '\n', (size_t)(end - begin))) != NULL)) {
+    *newline = '\0';
+    if (conn->discard)
+      conn->discard = false;
+    else
+      ret = us_handle_line(conn, begin);
+    requests++;
+    begin = newline + 1;
+  }
+
+  size_t remaining = (size_t)(end - begin);
+  if (ret != 0) {
+    remaining = 0;
+  } else if (eof) {
+    /* Handle a last line without a trailing newline. */
+    if ((remaining > 0) && !conn->discard) {
+      *end = '\0';
+      us_handle_line(conn, begin);
+      requests++;
+    }
+    remaining = 0;
+    ret = -1;
+  } else if (remaining == sizeof(conn->buffer) - 1) {
+    if (conn->in_batch) {
+      if (cmd_putval_batch_line(&conn->batch, NULL)) {
+        cmd_error_handler_t err = {cmd_error_fh, conn->fh};
+        cmd_putval_batch_finish(&conn->batch, &err);
+        conn->in_batch = false;
       }
-      break;
+    } else if (!conn->discard) {
+      fprintf(conn->fh, "-1 Line too long.\n");
     }
+    conn->discard = true;
+    requests++;
+    remaining = 0;
+  }
 
-    size_t len = strlen(buffer);
-    while ((len > 0) &&
-           ((buffer[len - 1] == '\n') || (buffer[len - 1] == '\r')))
-      buffer[--len] = '\0';
+  memmove(conn->buffer, begin, remaining);
+  conn->buffer_fill = remaining;
 
-    if (len == 0)
-      continue;
+  if (requests > 0) {
+    pthread_mutex_lock(&stats_lock);
+    stats_requests += requests;
+    pthread_mutex_unlock(&stats_lock);
+  }
 
-    sstrncpy(buffer_copy, buffer, sizeof(buffer_copy));
+  if (fflush(conn->fh) != 0) {
+    WARNING("unixsock plugin: failed to write to socket #%i: %s", conn->fd,
+            STRERRNO);
+    return -1;
+  }
 
-    fields_num =
-        strsplit(buffer_copy, fields, sizeof(fields) / sizeof(fields[0]));
-    if (fields_num < 1) {
-      fprintf(fhout, "-1 Internal error\n");
-      fclose(fhin);
-      fclose(fhout);
-      pthread_exit((void *)1);
-      return (void *)1;
+  return ret;
+} /* int us_conn_read */
+
+static void *us_worker_thread(void *arg) {
+  us_worker_t *w = arg;
+  us_conn_t **conns = NULL;
+  struct pollfd *fds = NULL;
+  size_t conns_num = 0;
+  size_t conns_size = 0;
+
+  while (loop != 0) {
+    /* Take over connections accepted since the last iteration. */
+    pthread_mutex_lock(&w->lock);
+    us_conn_t *new_conns = w->new_conns;
+    w->new_conns = NULL;
+    pthread_mutex_unlock(&w->lock);
+
+    while (new_conns != NULL) {
+      us_conn_t *conn = new_conns;
+      new_conns = conn->next;
+      conn->next = NULL;
+
+      if (conns_num >= conns_size) {
+        size_t new_size = (conns_size == 0) ? 16 : 2 * conns_size;
+        us_conn_t **tmp_conns = realloc(conns, new_size * sizeof(*conns));
+        struct pollfd *tmp_fds = realloc(fds, (new_size + 1) * sizeof(*fds));
+        if (tmp_conns != NULL)
+          conns = tmp_conns;
+        if (tmp_fds != NULL)
+          fds = tmp_fds;
+        if ((tmp_conns == NULL) || (tmp_fds == NULL)) {
+          ERROR("unixsock plugin: realloc failed.");
+          us_conn_destroy(conn);
+          continue;
+        }
+        conns_size = new_size;
+      }
+      conns[conns_num++] = conn;
     }
 
-    if (strcasecmp(fields[0], "getval") == 0) {
-      cmd_handle_getval(fhout, buffer);
-    } else if (strcasecmp(fields[0], "getthreshold") == 0) {
-      handle_getthreshold(fhout, buffer);
-    } else if (strcasecmp(fields[0], "putval") == 0) {
-      cmd_handle_putval(fhout, buffer);
-    } else if (strcasecmp(fields[0], "listval") == 0) {
-      cmd_handle_listval(fhout, buffer);
-    } else if (strcasecmp(fields[0], "putnotif") == 0) {
-      handle_putnotif(fhout, buffer);
-    } else if (strcasecmp(fields[0], "flush") == 0) {
-      cmd_handle_flush(fhout, buffer);
-    } else {
-      if (fprintf(fhout, "-1 Unknown command: %s\n", fields[0]) < 0) {
-        WARNING("unixsock plugin: failed to write to socket #%i: %s",
-                fileno(fhout), STRERRNO);
+    if (fds == NULL) {
+      fds = calloc(1, sizeof(*fds));
+      if (fds == NULL) {
+        ERROR("unixsock plugin: calloc failed.");
         break;
       }
     }
-  } /* while (fgets) */
 
-  DEBUG("unixsock plugin: us_handle_client: Exiting..");
-  fclose(fhin);
-  fclose(fhout);
+    fds[0] = (struct pollfd){.fd = w->wakeup[0], .events = POLLIN};
+    for (size_t i = 0; i < conns_num; i++)
+      fds[i + 1] = (struct pollfd){.fd = conns[i]->fd, .events = POLLIN};
+
+    int status = poll(fds, (nfds_t)(conns_num + 1), /* timeout = */ -1);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      ERROR("unixsock plugin: poll failed: %s", STRERRNO);
+      break;
+    }
+
+    if (fds[0].revents != 0) {
+      char discard[64];
+      while (read(w->wakeup[0], discard, sizeof(discard)) > 0)
+        /* nop */;
+    }
+
+    /* Iterate backwards, so that removing a connection by moving the last one
+     * into its place does not skip any. */
+    for (size_t i = conns_num; i > 0; i--) {
+      if (fds[i].revents == 0)
+        continue;
+
+      if (us_conn_read(conns[i - 1]) != 0) {
+        us_conn_destroy(conns[i - 1]);
+        conns[i - 1] = conns[conns_num - 1];
+        conns_num--;
+      }
+    }
+  } /* while (loop) */
+
+  for (size_t i = 0; i < conns_num; i++)
+    us_conn_destroy(conns[i]);
+  sfree(conns);
+  sfree(fds);
+
+  pthread_mutex_lock(&w->lock);
+  while (w->new_conns != NULL) {
+    us_conn_t *conn = w->new_conns;
+    w->new_conns = conn->next;
+    us_conn_destroy(conn);
+  }
+  pthread_mutex_unlock(&w->lock);
 
-  pthread_exit((void *)0);
   return (void *)0;
-} /* void *us_handle_client */
+} /* void *us_worker_thread */
+
+static void us_reject(int fd) {
+  static const char msg[] = "-1 Too many connections.\n";
+
+  if (write(fd, msg, sizeof(msg) - 1) < 0)
+    DEBUG("unixsock plugin: write failed: %s", STRERRNO);
+  close(fd);
+} /* void us_reject */
 
 static void *us_server_thread(void __attribute__((unused)) * arg) {
   int status;
-  int *remote_fd;
-  pthread_t th;
+  size_t next_worker = 0;
 
   if (us_open_socket() != 0)
     pthread_exit((void *)1);
 
   while (loop != 0) {
     DEBUG("unixsock plugin: Calling accept..");
-    status = accept(sock_fd, NULL, NULL);
-    if (status < 0) {
+    int fd = accept(sock_fd, NULL, NULL);
+    if (fd < 0) {
 
       if (errno == EINTR)
         continue;
@@ -292,26 +522,50 @@ static void *us_server_thread(void __attribute__((unused)) * arg) {
       pthread_exit((void *)1);
     }
 
-    remote_fd = malloc(sizeof(*remote_fd));
-    if (remote_fd == NULL) {
-      WARNING("unixsock plugin: malloc failed: %s", STRERRNO);
-      close(status);
+    pthread_mutex_lock(&stats_lock);
+    bool reject =
+        (max_connections > 0) && (stats_connections >= max_connections);
+    if (reject) {
+      stats_rejected++;
+    } else {
+      stats_connections++;
+      stats_accepted++;
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    if (reject) {
+      c_complain(LOG_WARNING, &reject_complaint,
+                 "unixsock plugin: Rejecting connection: %zu connections are "
+                 "open already. Consider increasing \"MaxConnections\".",
+                 max_connections);
+      us_reject(fd);
       continue;
     }
-    *remote_fd = status;
-
-    DEBUG("Spawning child to handle connection on fd #%i", *remote_fd);
-
-    status = plugin_thread_create(&th, us_handle_client, (void *)remote_fd,
-                                  "unixsock conn");
-    if (status == 0) {
-      pthread_detach(th);
-    } else {
-      WARNING("unixsock plugin: pthread_create failed: %s", STRERRNO);
-      close(*remote_fd);
-      free(remote_fd);
+    c_release(LOG_INFO, &reject_complaint,
+              "unixsock plugin: Accepting connections again.");
+
+    us_conn_t *conn = us_conn_create(fd);
+    if (conn == NULL) {
+      close(fd);
+      pthread_mutex_lock(&stats_lock);
+      stats_connections--;
+      pthread_mutex_unlock(&stats_lock);
       continue;
     }
+
+    us_worker_t *w = workers + next_worker;
+    next_worker = (next_worker + 1) % workers_num;
+
+    DEBUG("unixsock plugin: Handing connection on fd #%i to worker #%zu", fd,
+          (size_t)(w - workers));
+
+    pthread_mutex_lock(&w->lock);
+    conn->next = w->new_conns;
+    w->new_conns = conn;
+    pthread_mutex_unlock(&w->lock);
+
+    if ((write(w->wakeup[1], "", 1) < 0) && (errno != EAGAIN))
+      WARNING("unixsock plugin: waking worker failed: %s", STRERRNO);
   } /* while (loop) */
 
   close(sock_fd);
@@ -326,6 +580,36 @@ static void *us_server_thread(void __attribute__((unused)) * arg) {
   return (void *)0;
 } /* void *us_server_thread */
 
+static void us_submit(char const *type, char const *type_instance,
+                      value_t v) {
+  value_list_t vl = VALUE_LIST_INIT;
+
+  vl.values = &v;
+  vl.values_len = 1;
+  sstrncpy(vl.plugin, "unixsock", sizeof(vl.plugin));
+  sstrncpy(vl.type, type, sizeof(vl.type));
+  sstrncpy(vl.type_instance, type_instance, sizeof(vl.type_instance));
+
+  plugin_dispatch_values(&vl);
+} /* void us_submit */
+
+static int us_read(void) {
+  pthread_mutex_lock(&stats_lock);
+  size_t connections = stats_connections;
+  derive_t accepted = stats_accepted;
+  derive_t rejected = stats_rejected;
+  derive_t requests = stats_requests;
+  pthread_mutex_unlock(&stats_lock);
+
+  us_submit("current_connections", "",
+            (value_t){.gauge = (gauge_t)connections});
+  us_submit("total_connections", "accepted", (value_t){.derive = accepted});
+  us_submit("total_connections", "rejected", (value_t){.derive = rejected});
+  us_submit("total_requests", "", (value_t){.derive = requests});
+
+  return 0;
+} /* int us_read */
+
 static int us_config(const char *key, const char *val) {
   if (strcasecmp(key, "SocketFile") == 0) {
     char *new_sock_file = strdup(val);
@@ -348,6 +632,22 @@ static int us_config(const char *key, const char *val) {
       delete_socket = true;
     else
       delete_socket = false;
+  } else if (strcasecmp(key, "WorkerThreads") == 0) {
+    int tmp = atoi(val);
+    if (tmp < 1) {
+      WARNING("unixsock plugin: WorkerThreads must be at least 1.");
+      return 1;
+    }
+    workers_num = (size_t)tmp;
+  } else if (strcasecmp(key, "MaxConnections") == 0) {
+    int tmp = atoi(val);
+    if (tmp < 0) {
+      WARNING("unixsock plugin: MaxConnections must not be negative.");
+      return 1;
+    }
+    max_connections = (size_t)tmp;
+  } else if (strcasecmp(key, "ReportStats") == 0) {
+    report_stats = IS_TRUE(val);
   } else {
     return -1;
   }
@@ -367,6 +667,34 @@ static int us_init(void) {
 
   loop = 1;
 
+  workers = calloc(workers_num, sizeof(*workers));
+  if (workers == NULL) {
+    ERROR("unixsock plugin: calloc failed.");
+    return -1;
+  }
+
+  for (size_t i = 0; i < workers_num; i++) {
+    us_worker_t *w = workers + i;
+
+    pthread_mutex_init(&w->lock, NULL);
+    if (pipe(w->wakeup) != 0) {
+      ERROR("unixsock plugin: pipe failed: %s", STRERRNO);
+      return -1;
+    }
+    for (size_t j = 0; j < 2; j++)
+      fcntl(w->wakeup[j], F_SETFL, fcntl(w->wakeup[j], F_GETFL) | O_NONBLOCK);
+
+    status = plugin_thread_create(&w->thread, us_worker_thread, w,
+                                  "unixsock worker");
+    if (status != 0) {
+      ERROR("unixsock plugin: pthread_create failed: %s", STRERRNO);
+      return -1;
+    }
+  }
+
+  if (report_stats)
+    plugin_register_read("unixsock", us_read);
+
   status = plugin_thread_create(&listen_thread, us_server_thread, NULL,
                                 "unixsock listen");
   if (status != 0) {
@@ -388,6 +716,25 @@ static int us_shutdown(void) {
     listen_thread = (pthread_t)0;
   }
 
+  for (size_t i = 0; (workers != NULL) && (i < workers_num); i++) {
+    us_worker_t *w = workers + i;
+
+    if (w->thread == (pthread_t)0)
+      continue;
+
+    if (write(w->wakeup[1], "", 1) < 0)
+      WARNING("unixsock plugin: waking worker failed: %s", STRERRNO);
+    pthread_join(w->thread, &ret);
+    w->thread = (pthread_t)0;
+
+    close(w->wakeup[0]);
+    close(w->wakeup[1]);
+    pthread_mutex_destroy(&w->lock);
+  }
+  sfree(workers);
+
+  if (report_stats)
+    plugin_unregister_read("unixsock");
   plugin_unregister_init("unixsock");
   plugin_unregister_shutdown("unixsock");
 
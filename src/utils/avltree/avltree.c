@@ -589,6 +589,30 @@ c_avl_iterator_t *c_avl_get_iterator(c_avl_tree_t *t) {
   return iter;
 } /* c_avl_iterator_t *c_avl_get_iterator */
 
+c_avl_iterator_t *c_avl_get_iterator_after(c_avl_tree_t *t, const void *key) {
+  c_avl_iterator_t *iter = c_avl_get_iterator(t);
+  if (iter == NULL)
+    return NULL;
+
+  /* Position the iterator on the largest node not greater than `key', so that
+   * the next call to c_avl_iterator_next() returns its successor. If there is
+   * no such node, the iterator starts with the smallest node. */
+  c_avl_node_t *n = t->root;
+  while (n != NULL) {
+    int cmp = t->compare(key, n->key);
+    if (cmp < 0) {
+      n = n->left;
+    } else {
+      iter->node = n;
+      if (cmp == 0)
+        break;
+      n = n->right;
+    }
+  }
+
+  return iter;
+} /* c_avl_iterator_t *c_avl_get_iterator_after */
+
 int c_avl_iterator_next(c_avl_iterator_t *iter, void **key, void **value) {
   c_avl_node_t *n;
 
@@ -147,6 +147,22 @@ int c_avl_get(c_avl_tree_t *t, const void *key, void **value);
 int c_avl_pick(c_avl_tree_t *t, void **key, void **value);
 
 c_avl_iterator_t *c_avl_get_iterator(c_avl_tree_t *t);
+
+/*
+ * NAME
+ *   c_avl_get_iterator_after
+ *
+ * DESCRIPTION
+ *   Creates an iterator whose first call to `c_avl_iterator_next' returns the
+ *   smallest key which is greater than `key'. `key' does not need to be in
+ *   the tree. This allows resuming an iteration after the tree has been
+ *   modified, e.g. because a lock protecting it was released in between.
+ *
+ * RETURN VALUE
+ *   An iterator or NULL upon failure.
+ */
+c_avl_iterator_t *c_avl_get_iterator_after(c_avl_tree_t *t, const void *key);
+
 int c_avl_iterator_next(c_avl_iterator_t *iter, void **key, void **value);
 int c_avl_iterator_prev(c_avl_iterator_t *iter, void **key, void **value);
 void c_avl_iterator_destroy(c_avl_iterator_t *iter);
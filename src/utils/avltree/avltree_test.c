@@ -133,6 +133,52 @@ DEF_TEST(success) {
     EXPECT_EQ_INT(i, STATIC_ARRAY_SIZE(cases));
   }
 
+  /* resume after a key */
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(sorted_cases); i++) {
+    c_avl_iterator_t *iter;
+    char *key;
+    char *value;
+
+    CHECK_NOT_NULL(iter = c_avl_get_iterator_after(t, sorted_cases[i].key));
+    if (i + 1 < STATIC_ARRAY_SIZE(sorted_cases)) {
+      CHECK_ZERO(c_avl_iterator_next(iter, (void **)&key, (void **)&value));
+      EXPECT_EQ_STR(sorted_cases[i + 1].key, key);
+    } else {
+      EXPECT_EQ_INT(-1,
+                    c_avl_iterator_next(iter, (void **)&key, (void **)&value));
+    }
+    c_avl_iterator_destroy(iter);
+  }
+
+  /* resume after keys which are not in the tree */
+  {
+    c_avl_iterator_t *iter;
+    char *key;
+    char *value;
+
+    /* "0" sorts before all keys. */
+    CHECK_NOT_NULL(iter = c_avl_get_iterator_after(t, "0"));
+    CHECK_ZERO(c_avl_iterator_next(iter, (void **)&key, (void **)&value));
+    EXPECT_EQ_STR(sorted_cases[0].key, key);
+    c_avl_iterator_destroy(iter);
+
+    /* "Aech6vah" < "Aech6vahX" < "BocaeB8n" */
+    CHECK_NOT_NULL(iter = c_avl_get_iterator_after(t, "Aech6vahX"));
+    size_t i = 0;
+    while (c_avl_iterator_next(iter, (void **)&key, (void **)&value) == 0) {
+      EXPECT_EQ_STR(sorted_cases[i + 1].key, key);
+      i++;
+    }
+    EXPECT_EQ_INT(STATIC_ARRAY_SIZE(sorted_cases) - 1, i);
+    c_avl_iterator_destroy(iter);
+
+    /* "~" sorts after all keys. */
+    CHECK_NOT_NULL(iter = c_avl_get_iterator_after(t, "~"));
+    EXPECT_EQ_INT(-1,
+                  c_avl_iterator_next(iter, (void **)&key, (void **)&value));
+    c_avl_iterator_destroy(iter);
+  }
+
   /* remove half */
   for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases) / 2; i++) {
     char *key = NULL;
@@ -59,8 +59,24 @@ typedef struct {
 typedef struct {
   char *raw_identifier;
   identifier_t identifier;
+
+  /* All identifiers, if more than one was requested. The first one is also
+   * available as raw_identifier and identifier. */
+  char **raw_identifiers;
+  identifier_t *identifiers;
+  size_t identifiers_num;
 } cmd_getval_t;
 
+typedef struct {
+  /* Glob patterns the parts of an identifier have to match. NULL matches
+   * everything. */
+  char *host;
+  char *plugin;
+  char *plugin_instance;
+  char *type;
+  char *type_instance;
+} cmd_listval_t;
+
 typedef struct {
   /* The raw identifier as provided by the user. */
   char *raw_identifier;
@@ -83,6 +99,7 @@ typedef struct {
   union {
     cmd_flush_t flush;
     cmd_getval_t getval;
+    cmd_listval_t listval;
     cmd_putval_t putval;
   } cmd;
 } cmd_t;
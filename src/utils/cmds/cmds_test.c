@@ -32,6 +32,7 @@
 #include "utils/common/common.h"
 #include "testing.h"
 #include "utils/cmds/cmds.h"
+#include "utils/cmds/putval.h"
 // clang-format on
 
 static void error_cb(void *ud, cmd_status_t status, const char *format,
@@ -130,6 +131,12 @@ static struct {
         CMD_OK,
         CMD_GETVAL,
     },
+    {
+        "GETVAL myhost/magic/MAGIC myhost/magic-foo/MAGIC-bar",
+        NULL,
+        CMD_OK,
+        CMD_GETVAL,
+    },
 
     /* Invalid GETVAL commands. */
     {
@@ -150,6 +157,12 @@ static struct {
         CMD_PARSE_ERROR,
         CMD_UNKNOWN,
     },
+    {
+        "GETVAL myhost/magic/MAGIC invalid",
+        NULL,
+        CMD_PARSE_ERROR,
+        CMD_UNKNOWN,
+    },
 
     /* Valid LISTVAL commands. */
     {
@@ -158,6 +171,18 @@ static struct {
         CMD_OK,
         CMD_LISTVAL,
     },
+    {
+        "LISTVAL plugin=cpu type=\"cpu*\"",
+        NULL,
+        CMD_OK,
+        CMD_LISTVAL,
+    },
+    {
+        "LISTVAL host=web-? plugin_instance=[0-3] type_instance=",
+        NULL,
+        CMD_OK,
+        CMD_LISTVAL,
+    },
 
     /* Invalid LISTVAL commands. */
     {
@@ -166,6 +191,18 @@ static struct {
         CMD_PARSE_ERROR,
         CMD_UNKNOWN,
     },
+    {
+        "LISTVAL plugin=cpu invalid",
+        NULL,
+        CMD_PARSE_ERROR,
+        CMD_UNKNOWN,
+    },
+    {
+        "LISTVAL identifier=cpu",
+        NULL,
+        CMD_PARSE_ERROR,
+        CMD_UNKNOWN,
+    },
 
     /* Valid PUTVAL commands. */
     {
@@ -330,7 +367,114 @@ DEF_TEST(parse) {
   return test_result;
 }
 
+DEF_TEST(parse_fields) {
+  cmd_error_handler_t err = {error_cb, NULL};
+  cmd_t cmd;
+
+  char getval[] =
+      "GETVAL myhost/magic/MAGIC \"myhost/magic-foo/MAGIC-bar baz\"";
+  CHECK_ZERO(cmd_parse(getval, &cmd, NULL, &err));
+  EXPECT_EQ_INT(CMD_GETVAL, cmd.type);
+  EXPECT_EQ_INT(2, cmd.cmd.getval.identifiers_num);
+  EXPECT_EQ_STR("myhost/magic/MAGIC", cmd.cmd.getval.raw_identifier);
+  EXPECT_EQ_STR("myhost/magic-foo/MAGIC-bar baz",
+                cmd.cmd.getval.raw_identifiers[1]);
+  EXPECT_EQ_STR("foo", cmd.cmd.getval.identifiers[1].plugin_instance);
+  EXPECT_EQ_STR("bar baz", cmd.cmd.getval.identifiers[1].type_instance);
+  cmd_destroy(&cmd);
+
+  char listval[] = "LISTVAL plugin=cpu type=\"cpu*\" type_instance=";
+  CHECK_ZERO(cmd_parse(listval, &cmd, NULL, &err));
+  EXPECT_EQ_INT(CMD_LISTVAL, cmd.type);
+  OK(cmd.cmd.listval.host == NULL);
+  EXPECT_EQ_STR("cpu", cmd.cmd.listval.plugin);
+  OK(cmd.cmd.listval.plugin_instance == NULL);
+  EXPECT_EQ_STR("cpu*", cmd.cmd.listval.type);
+  EXPECT_EQ_STR("", cmd.cmd.listval.type_instance);
+  cmd_destroy(&cmd);
+
+  return 0;
+}
+
+static int run_batch(char const *input, char *output, size_t output_size,
+                     char *rest, size_t rest_size) {
+  FILE *fhin = tmpfile();
+  FILE *fhout = tmpfile();
+  if ((fhin == NULL) || (fhout == NULL))
+    return -1;
+
+  fputs(input, fhin);
+  rewind(fhin);
+
+  char header[1024];
+  if (fgets(header, sizeof(header), fhin) == NULL)
+    return -1;
+  header[strcspn(header, "\r\n")] = '\0';
+
+  int status = (int)cmd_handle_putval_batch(fhin, fhout, header);
+
+  rest[0] = '\0';
+  if (fgets(rest, (int)rest_size, fhin) == NULL)
+    rest[0] = '\0';
+
+  rewind(fhout);
+  output[0] = '\0';
+  if (fgets(output, (int)output_size, fhout) == NULL)
+    output[0] = '\0';
+
+  fclose(fhin);
+  fclose(fhout);
+  return status;
+}
+
+DEF_TEST(putval_batch) {
+  char output[1024];
+  char rest[1024];
+
+  EXPECT_EQ_INT(CMD_OK,
+                run_batch("BATCH 3\n"
+                          "PUTVAL myhost/magic/MAGIC N:1\r\n"
+                          "PUTVAL myhost/magic/MAGIC N:2\n"
+                          "PUTVAL myhost/magic/MAGIC N:3\n"
+                          "GETVAL myhost/magic/MAGIC\n",
+                          output, sizeof(output), rest, sizeof(rest)));
+  EXPECT_EQ_STR("0 Success: 3 values have been dispatched.\n", output);
+  /* Input following the batch must not be consumed. */
+  EXPECT_EQ_STR("GETVAL myhost/magic/MAGIC\n", rest);
+
+  EXPECT_EQ_INT(CMD_PARSE_ERROR,
+                run_batch("BATCH 3\n"
+                          "PUTVAL myhost/magic/MAGIC N:1\n"
+                          "GETVAL myhost/magic/MAGIC\n"
+                          "PUTVAL myhost/magic/MAGIC N:3\n"
+                          "FLUSH\n",
+                          output, sizeof(output), rest, sizeof(rest)));
+  OK(strncmp(output, "-1 1 of 3 lines failed, 2 values have been dispatched. "
+                     "Line 2: ",
+             strlen("-1 1 of 3 lines failed, 2 values have been dispatched. "
+                    "Line 2: ")) == 0);
+  EXPECT_EQ_STR("FLUSH\n", rest);
+
+  /* Too few lines. */
+  EXPECT_EQ_INT(CMD_ERROR,
+                run_batch("BATCH 2\n"
+                          "PUTVAL myhost/magic/MAGIC N:1\n",
+                          output, sizeof(output), rest, sizeof(rest)));
+
+  /* Invalid headers. */
+  EXPECT_EQ_INT(CMD_PARSE_ERROR, run_batch("BATCH\n", output, sizeof(output),
+                                           rest, sizeof(rest)));
+  EXPECT_EQ_INT(CMD_PARSE_ERROR, run_batch("BATCH 0\n", output,
+                                           sizeof(output), rest, sizeof(rest)));
+  EXPECT_EQ_INT(CMD_PARSE_ERROR, run_batch("BATCH 1x\n", output,
+                                           sizeof(output), rest, sizeof(rest)));
+
+  return 0;
+}
+
 int main(int argc, char **argv) {
   RUN_TEST(parse);
+  RUN_TEST(parse_fields);
+  RUN_TEST(putval_batch);
   END_TEST;
 }
@@ -0,0 +1,244 @@
+/**
+ * collectd - src/utils/cmds/gethistory.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ **/
+
+#include "collectd.h"
+
+#include "plugin.h"
+#include "utils/common/common.h"
+
+#include "utils/cmds/gethistory.h"
+#include "utils/cmds/parse_option.h"
+#include "utils_cache.h"
+
+#define print_to_socket(fh, ...)                                               \
+  do {                                                                         \
+    if (fprintf(fh, __VA_ARGS__) < 0) {                                        \
+      WARNING("handle_gethistory: failed to write to socket #%i: %s",          \
+              fileno(fh), STRERRNO);                                           \
+      return -1;                                                               \
+    }                                                                          \
+  } while (0)
+
+/* Parses an epoch time. Negative values are relative to the current time. */
+static int parse_time(const char *value, cdtime_t *ret_time) {
+  char *endptr = NULL;
+  double tmp;
+
+  errno = 0;
+  tmp = strtod(value, &endptr);
+  if ((errno != 0) || (endptr == value) || (endptr == NULL) ||
+      (*endptr != 0))
+    return -1;
+
+  if (tmp < 0.0) {
+    cdtime_t now = cdtime();
+    cdtime_t offset = DOUBLE_TO_CDTIME_T(-tmp);
+    *ret_time = (offset < now) ? (now - offset) : 0;
+  } else {
+    *ret_time = DOUBLE_TO_CDTIME_T(tmp);
+  }
+
+  return 0;
+} /* int parse_time */
+
+static int print_value(FILE *fh, gauge_t value) {
+  if (isnan(value))
+    print_to_socket(fh, "NaN");
+  else
+    print_to_socket(fh, "%e", value);
+  return 0;
+} /* int print_value */
+
+static int print_summary(FILE *fh, const data_set_t *ds, const char *name,
+                         cdtime_t begin, cdtime_t end) {
+  uc_history_stats_t stats[ds->ds_num];
+
+  int status = uc_get_history_stats_by_name(name, begin, end, stats,
+                                            ds->ds_num);
+  if (status == -ENOTSUP) {
+    print_to_socket(fh, "-1 The value history is disabled.\n");
+    return -1;
+  } else if (status != 0) {
+    print_to_socket(fh, "-1 No such value.\n");
+    return -1;
+  }
+
+  print_to_socket(fh, "%" PRIsz " Value%s found\n", ds->ds_num,
+                  (ds->ds_num == 1) ? "" : "s");
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    print_to_socket(fh, "%s min=", ds->ds[i].name);
+    print_value(fh, stats[i].min);
+    print_to_socket(fh, " max=");
+    print_value(fh, stats[i].max);
+    print_to_socket(fh, " average=");
+    print_value(fh, stats[i].average);
+    print_to_socket(fh, " num=%" PRIsz "\n", stats[i].num);
+  }
+
+  return 0;
+} /* int print_summary */
+
+static int print_range(FILE *fh, const char *name, cdtime_t begin,
+                       cdtime_t end) {
+  cdtime_t *times = NULL;
+  gauge_t *values = NULL;
+  size_t num = 0;
+  size_t values_num = 0;
+
+  int status = uc_get_history_range_by_name(name, begin, end, &times, &values,
+                                            &num, &values_num);
+  if (status == -ENOTSUP) {
+    print_to_socket(fh, "-1 The value history is disabled.\n");
+    return -1;
+  } else if (status != 0) {
+    print_to_socket(fh, "-1 No such value.\n");
+    return -1;
+  }
+
+  status = 0;
+  if (fprintf(fh, "%" PRIsz " Point%s found\n", num, (num == 1) ? "" : "s") <
+      0)
+    status = -1;
+
+  for (size_t i = 0; (i < num) && (status == 0); i++) {
+    if (fprintf(fh, "%.3f", CDTIME_T_TO_DOUBLE(times[i])) < 0)
+      status = -1;
+
+    for (size_t j = 0; (j < values_num) && (status == 0); j++) {
+      gauge_t v = values[(i * values_num) + j];
+      if (fprintf(fh, isnan(v) ? ":U" : ":%e", v) < 0)
+        status = -1;
+    }
+
+    if ((status == 0) && (fprintf(fh, "\n") < 0))
+      status = -1;
+  }
+
+  if (status != 0)
+    WARNING("handle_gethistory: failed to write to socket #%i: %s",
+            fileno(fh), STRERRNO);
+
+  sfree(times);
+  sfree(values);
+  return status;
+} /* int print_range */
+
+int handle_gethistory(FILE *fh, char *buffer) {
+  char *command = NULL;
+  char *identifier = NULL;
+  char *identifier_copy;
+
+  char *host;
+  char *plugin;
+  char *plugin_instance;
+  char *type;
+  char *type_instance;
+
+  cdtime_t begin = 0;
+  cdtime_t end = 0;
+  bool summary = false;
+
+  int status;
+
+  if ((fh == NULL) || (buffer == NULL))
+    return -1;
+
+  DEBUG("utils_cmd_gethistory: handle_gethistory (fh = %p, buffer = %s);",
+        (void *)fh, buffer);
+
+  status = parse_string(&buffer, &command);
+  if (status != 0) {
+    print_to_socket(fh, "-1 Cannot parse command.\n");
+    return -1;
+  }
+  assert(command != NULL);
+
+  if (strcasecmp("GETHISTORY", command) != 0) {
+    print_to_socket(fh, "-1 Unexpected command: `%s'.\n", command);
+    return -1;
+  }
+
+  status = parse_string(&buffer, &identifier);
+  if (status != 0) {
+    print_to_socket(fh, "-1 Cannot parse identifier.\n");
+    return -1;
+  }
+  assert(identifier != NULL);
+
+  while (*buffer != 0) {
+    char *key;
+    char *value;
+
+    status = parse_option(&buffer, &key, &value);
+    if (status != 0) {
+      print_to_socket(fh, "-1 Malformed option.\n");
+      return -1;
+    }
+
+    if (strcasecmp("begin", key) == 0)
+      status = parse_time(value, &begin);
+    else if (strcasecmp("end", key) == 0)
+      status = parse_time(value, &end);
+    else if (strcasecmp("summary", key) == 0)
+      summary = IS_TRUE(value);
+    else
+      status = -1;
+
+    if (status != 0) {
+      print_to_socket(fh, "-1 Error parsing option `%s'\n", key);
+      return -1;
+    }
+  }
+
+  /* parse_identifier() modifies its first argument,
+   * returning pointers into it */
+  identifier_copy = sstrdup(identifier);
+
+  status = parse_identifier(identifier_copy, &host, &plugin, &plugin_instance,
+                            &type, &type_instance,
+                            /* default_host = */ NULL);
+  if (status != 0) {
+    DEBUG("handle_gethistory: Cannot parse identifier `%s'.", identifier);
+    print_to_socket(fh, "-1 Cannot parse identifier `%s'.\n", identifier);
+    sfree(identifier_copy);
+    return -1;
+  }
+
+  const data_set_t *ds = plugin_get_ds(type);
+  if (ds == NULL) {
+    DEBUG("handle_gethistory: plugin_get_ds (%s) == NULL;", type);
+    print_to_socket(fh, "-1 Type `%s' is unknown.\n", type);
+    sfree(identifier_copy);
+    return -1;
+  }
+  sfree(identifier_copy);
+
+  if (summary)
+    return print_summary(fh, ds, identifier, begin, end);
+
+  return print_range(fh, identifier, begin, end);
+} /* int handle_gethistory */
@@ -37,41 +37,53 @@ cmd_status_t cmd_parse_getval(size_t argc, char **argv,
                               cmd_getval_t *ret_getval,
                               const cmd_options_t *opts,
                               cmd_error_handler_t *err) {
-  char *identifier_copy;
-  int status;
-
   if ((ret_getval == NULL) || (opts == NULL)) {
     errno = EINVAL;
     cmd_error(CMD_ERROR, err, "Invalid arguments to cmd_parse_getval.");
     return CMD_ERROR;
   }
 
-  if (argc != 1) {
-    if (argc == 0)
-      cmd_error(CMD_PARSE_ERROR, err, "Missing identifier.");
-    else
-      cmd_error(CMD_PARSE_ERROR, err, "Garbage after identifier: `%s'.",
-                argv[1]);
+  if (argc == 0) {
+    cmd_error(CMD_PARSE_ERROR, err, "Missing identifier.");
     return CMD_PARSE_ERROR;
   }
 
-  /* parse_identifier() modifies its first argument,
-   * returning pointers into it */
-  identifier_copy = sstrdup(argv[0]);
+  ret_getval->raw_identifiers = calloc(argc, sizeof(char *));
+  ret_getval->identifiers = calloc(argc, sizeof(identifier_t));
+  if ((ret_getval->raw_identifiers == NULL) ||
+      (ret_getval->identifiers == NULL)) {
+    cmd_error(CMD_ERROR, err, "calloc failed.");
+    cmd_destroy_getval(ret_getval);
+    return CMD_ERROR;
+  }
 
-  status = parse_identifier(
-      argv[0], &ret_getval->identifier.host, &ret_getval->identifier.plugin,
-      &ret_getval->identifier.plugin_instance, &ret_getval->identifier.type,
-      &ret_getval->identifier.type_instance, opts->identifier_default_host);
-  if (status != 0) {
-    DEBUG("cmd_parse_getval: Cannot parse identifier `%s'.", identifier_copy);
-    cmd_error(CMD_PARSE_ERROR, err, "Cannot parse identifier `%s'.",
-              identifier_copy);
-    sfree(identifier_copy);
-    return CMD_PARSE_ERROR;
+  for (size_t i = 0; i < argc; i++) {
+    identifier_t *id = ret_getval->identifiers + i;
+
+    /* parse_identifier() modifies its first argument,
+     * returning pointers into it */
+    char *identifier_copy = sstrdup(argv[i]);
+
+    int status = parse_identifier(argv[i], &id->host, &id->plugin,
+                                  &id->plugin_instance, &id->type,
+                                  &id->type_instance,
+                                  opts->identifier_default_host);
+    if (status != 0) {
+      DEBUG("cmd_parse_getval: Cannot parse identifier `%s'.",
+            identifier_copy);
+      cmd_error(CMD_PARSE_ERROR, err, "Cannot parse identifier `%s'.",
+                identifier_copy);
+      sfree(identifier_copy);
+      cmd_destroy_getval(ret_getval);
+      return CMD_PARSE_ERROR;
+    }
+
+    ret_getval->raw_identifiers[i] = identifier_copy;
+    ret_getval->identifiers_num++;
   }
 
-  ret_getval->raw_identifier = identifier_copy;
+  ret_getval->raw_identifier = ret_getval->raw_identifiers[0];
+  ret_getval->identifier = ret_getval->identifiers[0];
   return CMD_OK;
 } /* cmd_status_t cmd_parse_getval */
 
@@ -85,6 +97,91 @@ cmd_status_t cmd_parse_getval(size_t argc, char **argv,
     fflush(fh);                                                                \
   } while (0)
 
+/* getval_multi handles a GETVAL command with more than one identifier. It
+ * responds with one line per identifier found, holding the identifier followed
+ * by the data sources and their rates. Unknown identifiers are skipped. */
+static cmd_status_t getval_multi(FILE *fh, cmd_getval_t *getval) {
+  size_t num = getval->identifiers_num;
+  size_t found = 0;
+
+  /* The number of lines has to be sent first, so all values are looked up
+   * before anything is written. */
+  gauge_t **values = calloc(num, sizeof(*values));
+  const data_set_t **ds = calloc(num, sizeof(*ds));
+  if ((values == NULL) || (ds == NULL)) {
+    cmd_error_handler_t err = {cmd_error_fh, fh};
+    cmd_error(CMD_ERROR, &err, "calloc failed.");
+    sfree(values);
+    sfree(ds);
+    return CMD_ERROR;
+  }
+
+  for (size_t i = 0; i < num; i++) {
+    size_t values_num = 0;
+
+    ds[i] = plugin_get_ds(getval->identifiers[i].type);
+    if (ds[i] == NULL)
+      continue;
+
+    if (uc_get_rate_by_name(getval->raw_identifiers[i], &values[i],
+                            &values_num) != 0) {
+      values[i] = NULL;
+      continue;
+    }
+
+    if (ds[i]->ds_num != values_num) {
+      ERROR("ds[%s]->ds_num = %" PRIsz ", "
+            "but uc_get_rate_by_name returned %" PRIsz " values.",
+            ds[i]->type, ds[i]->ds_num, values_num);
+      sfree(values[i]);
+      continue;
+    }
+
+    found++;
+  }
+
+  cmd_status_t status = CMD_OK;
+  int ret;
+  if (found == num)
+    ret = fprintf(fh, "%" PRIsz " Value%s found\n", found,
+                  (found == 1) ? "" : "s");
+  else
+    ret = fprintf(fh, "%" PRIsz " Value%s found, %" PRIsz " not found\n",
+                  found, (found == 1) ? "" : "s", num - found);
+  if (ret < 0)
+    status = CMD_ERROR;
+
+  for (size_t i = 0; (status == CMD_OK) && (i < num); i++) {
+    if (values[i] == NULL)
+      continue;
+
+    if (fputs(getval->raw_identifiers[i], fh) < 0)
+      status = CMD_ERROR;
+    for (size_t j = 0; (status == CMD_OK) && (j < ds[i]->ds_num); j++) {
+      if (isnan(values[i][j]))
+        ret = fprintf(fh, " %s=NaN", ds[i]->ds[j].name);
+      else
+        ret = fprintf(fh, " %s=%12e", ds[i]->ds[j].name, values[i][j]);
+      if (ret < 0)
+        status = CMD_ERROR;
+    }
+    if ((status == CMD_OK) && (fputc('\n', fh) == EOF))
+      status = CMD_ERROR;
+  }
+
+  if ((status != CMD_OK) || (fflush(fh) != 0)) {
+    WARNING("cmd_handle_getval: failed to write to socket #%i: %s", fileno(fh),
+            STRERRNO);
+    status = CMD_ERROR;
+  }
+
+  for (size_t i = 0; i < num; i++)
+    sfree(values[i]);
+  sfree(values);
+  sfree(ds);
+  return status;
+} /* cmd_status_t getval_multi */
+
 cmd_status_t cmd_handle_getval(FILE *fh, char *buffer) {
   cmd_error_handler_t err = {cmd_error_fh, fh};
   cmd_status_t status;
@@ -110,6 +207,12 @@ cmd_status_t cmd_handle_getval(FILE *fh, char *buffer) {
     return CMD_UNKNOWN_COMMAND;
   }
 
+  if (cmd.cmd.getval.identifiers_num > 1) {
+    status = getval_multi(fh, &cmd.cmd.getval);
+    cmd_destroy(&cmd);
+    return status;
+  }
+
   ds = plugin_get_ds(cmd.cmd.getval.identifier.type);
   if (ds == NULL) {
     DEBUG("cmd_handle_getval: plugin_get_ds (%s) == NULL;",
@@ -161,5 +264,10 @@ void cmd_destroy_getval(cmd_getval_t *getval) {
   if (getval == NULL)
     return;
 
-  sfree(getval->raw_identifier);
+  for (size_t i = 0; i < getval->identifiers_num; i++)
+    sfree(getval->raw_identifiers[i]);
+  sfree(getval->raw_identifiers);
+  sfree(getval->identifiers);
+  getval->identifiers_num = 0;
+  getval->raw_identifier = NULL;
 } /* void cmd_destroy_getval */
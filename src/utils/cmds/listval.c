@@ -33,49 +33,124 @@
 #include "utils/cmds/parse_option.h"
 #include "utils_cache.h"
 
+#include <fnmatch.h>
+
 cmd_status_t cmd_parse_listval(size_t argc, char **argv,
+                               cmd_listval_t *ret_listval,
                                const cmd_options_t *opts
                                __attribute__((unused)),
                                cmd_error_handler_t *err) {
-  if (argc != 0) {
-    cmd_error(CMD_PARSE_ERROR, err, "Garbage after end of command: `%s'.",
-              argv[0]);
-    return CMD_PARSE_ERROR;
+  for (size_t i = 0; i < argc; i++) {
+    char *opt_key = NULL;
+    char *opt_value = NULL;
+    char **field = NULL;
+
+    cmd_status_t status =
+        cmd_parse_option(argv[i], &opt_key, &opt_value, err);
+    if (status != CMD_OK) {
+      if (status == CMD_NO_OPTION)
+        cmd_error(CMD_PARSE_ERROR, err, "Garbage after end of command: `%s'.",
+                  argv[i]);
+      cmd_destroy_listval(ret_listval);
+      return CMD_PARSE_ERROR;
+    }
+
+    if (strcasecmp("host", opt_key) == 0)
+      field = &ret_listval->host;
+    else if (strcasecmp("plugin", opt_key) == 0)
+      field = &ret_listval->plugin;
+    else if (strcasecmp("plugin_instance", opt_key) == 0)
+      field = &ret_listval->plugin_instance;
+    else if (strcasecmp("type", opt_key) == 0)
+      field = &ret_listval->type;
+    else if (strcasecmp("type_instance", opt_key) == 0)
+      field = &ret_listval->type_instance;
+    else {
+      cmd_error(CMD_PARSE_ERROR, err, "Cannot parse option `%s'.", opt_key);
+      cmd_destroy_listval(ret_listval);
+      return CMD_PARSE_ERROR;
+    }
+
+    sfree(*field);
+    *field = strdup(opt_value);
+    if (*field == NULL) {
+      cmd_error(CMD_ERROR, err, "strdup failed.");
+      cmd_destroy_listval(ret_listval);
+      return CMD_ERROR;
+    }
   }
 
   return CMD_OK;
 } /* cmd_status_t cmd_parse_listval */
 
-#define free_everything_and_return(status)                                     \
-  do {                                                                         \
-    for (size_t j = 0; j < number; j++) {                                      \
-      sfree(names[j]);                                                         \
-      names[j] = NULL;                                                         \
-    }                                                                          \
-    sfree(names);                                                              \
-    sfree(times);                                                              \
-    return status;                                                             \
-  } while (0)
-
-#define print_to_socket(fh, ...)                                               \
-  do {                                                                         \
-    if (fprintf(fh, __VA_ARGS__) < 0) {                                        \
-      WARNING("handle_listval: failed to write to socket #%i: %s", fileno(fh), \
-              STRERRNO);                                                       \
-      free_everything_and_return(CMD_ERROR);                                   \
-    }                                                                          \
-    fflush(fh);                                                                \
-  } while (0)
+typedef struct {
+  cmd_listval_t *selector;
+  bool filter;
+
+  /* The response is assembled in memory, because the number of lines has to
+   * be sent first. */
+  char *buffer;
+  size_t buffer_len;
+  size_t buffer_size;
+  size_t number;
+} listval_ctx_t;
+
+static bool listval_match(const char *pattern, const char *value) {
+  if (pattern == NULL)
+    return true;
+  return fnmatch(pattern, (value != NULL) ? value : "", /* flags = */ 0) == 0;
+} /* bool listval_match */
+
+static int listval_callback(const char *name, cdtime_t time, void *user_data) {
+  listval_ctx_t *ctx = user_data;
+
+  if (ctx->filter) {
+    char copy[6 * DATA_MAX_NAME_LEN];
+    char *host, *plugin, *plugin_instance, *type, *type_instance;
+
+    sstrncpy(copy, name, sizeof(copy));
+    if (parse_identifier(copy, &host, &plugin, &plugin_instance, &type,
+                         &type_instance, /* default_host = */ NULL) != 0)
+      return 0;
+
+    if (!listval_match(ctx->selector->host, host) ||
+        !listval_match(ctx->selector->plugin, plugin) ||
+        !listval_match(ctx->selector->plugin_instance, plugin_instance) ||
+        !listval_match(ctx->selector->type, type) ||
+        !listval_match(ctx->selector->type_instance, type_instance))
+      return 0;
+  }
+
+  /* Room for the time, a space, the name, a newline and the null byte. */
+  size_t need = strlen(name) + 64;
+  if (ctx->buffer_size - ctx->buffer_len < need) {
+    size_t new_size = (ctx->buffer_size == 0) ? 65536 : 2 * ctx->buffer_size;
+    while (new_size - ctx->buffer_len < need)
+      new_size *= 2;
+
+    char *tmp = realloc(ctx->buffer, new_size);
+    if (tmp == NULL)
+      return ENOMEM;
+    ctx->buffer = tmp;
+    ctx->buffer_size = new_size;
+  }
+
+  int status = snprintf(ctx->buffer + ctx->buffer_len,
+                        ctx->buffer_size - ctx->buffer_len, "%.3f %s\n",
+                        CDTIME_T_TO_DOUBLE(time), name);
+  if ((status < 0) || ((size_t)status >= ctx->buffer_size - ctx->buffer_len))
+    return EINVAL;
+
+  ctx->buffer_len += (size_t)status;
+  ctx->number++;
+  return 0;
+} /* int listval_callback */
 
 cmd_status_t cmd_handle_listval(FILE *fh, char *buffer) {
   cmd_error_handler_t err = {cmd_error_fh, fh};
   cmd_status_t status;
   cmd_t cmd;
 
-  char **names = NULL;
-  cdtime_t *times = NULL;
-  size_t number = 0;
-
   DEBUG("utils_cmd_listval: handle_listval (fh = %p, buffer = %s);", (void *)fh,
         buffer);
 
@@ -84,20 +159,50 @@ cmd_status_t cmd_handle_listval(FILE *fh, char *buffer) {
   if (cmd.type != CMD_LISTVAL) {
     cmd_error(CMD_UNKNOWN_COMMAND, &err, "Unexpected command: `%s'.",
               CMD_TO_STRING(cmd.type));
-    free_everything_and_return(CMD_UNKNOWN_COMMAND);
+    cmd_destroy(&cmd);
+    return CMD_UNKNOWN_COMMAND;
   }
 
-  status = uc_get_names(&names, &times, &number);
-  if (status != 0) {
-    DEBUG("command listval: uc_get_names failed with status %i", status);
-    cmd_error(CMD_ERROR, &err, "uc_get_names failed.");
-    free_everything_and_return(CMD_ERROR);
+  cmd_listval_t *selector = &cmd.cmd.listval;
+  listval_ctx_t ctx = {
+      .selector = selector,
+      .filter = (selector->host != NULL) || (selector->plugin != NULL) ||
+                (selector->plugin_instance != NULL) ||
+                (selector->type != NULL) || (selector->type_instance != NULL),
+  };
+
+  int foreach_status = uc_foreach_name(listval_callback, &ctx);
+  if (foreach_status != 0) {
+    DEBUG("command listval: uc_foreach_name failed with status %i",
+          foreach_status);
+    cmd_error(CMD_ERROR, &err, "uc_foreach_name failed.");
+    sfree(ctx.buffer);
+    cmd_destroy(&cmd);
+    return CMD_ERROR;
   }
 
-  print_to_socket(fh, "%i Value%s found\n", (int)number,
-                  (number == 1) ? "" : "s");
-  for (size_t i = 0; i < number; i++)
-    print_to_socket(fh, "%.3f %s\n", CDTIME_T_TO_DOUBLE(times[i]), names[i]);
+  status = CMD_OK;
+  if ((fprintf(fh, "%i Value%s found\n", (int)ctx.number,
+               (ctx.number == 1) ? "" : "s") < 0) ||
+      (fwrite(ctx.buffer, 1, ctx.buffer_len, fh) != ctx.buffer_len) ||
+      (fflush(fh) != 0)) {
+    WARNING("handle_listval: failed to write to socket #%i: %s", fileno(fh),
+            STRERRNO);
+    status = CMD_ERROR;
+  }
 
-  free_everything_and_return(CMD_OK);
+  sfree(ctx.buffer);
+  cmd_destroy(&cmd);
+  return status;
 } /* cmd_status_t cmd_handle_listval */
+
+void cmd_destroy_listval(cmd_listval_t *listval) {
+  if (listval == NULL)
+    return;
+
+  sfree(listval->host);
+  sfree(listval->plugin);
+  sfree(listval->plugin_instance);
+  sfree(listval->type);
+  sfree(listval->type_instance);
+} /* void cmd_destroy_listval */
@@ -301,6 +301,154 @@ cmd_status_t cmd_handle_putval(FILE *fh, char *buffer) {
   return CMD_OK;
 } /* int cmd_handle_putval */
 
+static void batch_error_cb(void *ud, cmd_status_t status, const char *format,
+                           va_list ap) {
+  cmd_putval_batch_t *batch = ud;
+
+  if (status == CMD_OK)
+    return;
+
+  batch->errors_num++;
+  if (batch->errors_num == 1) {
+    batch->first_error_line = batch->lines_done + 1;
+    vsnprintf(batch->first_error, sizeof(batch->first_error), format, ap);
+  }
+} /* void batch_error_cb */
+
+cmd_status_t cmd_putval_batch_begin(cmd_putval_batch_t *batch, char *buffer,
+                                    cmd_error_handler_t *err) {
+  char *fields[3];
+
+  memset(batch, 0, sizeof(*batch));
+
+  /* The header is "BATCH <count>". If it cannot be parsed, the number of
+   * lines to skip is unknown and they will be handled as separate commands. */
+  char *endptr = NULL;
+  unsigned long lines_num = 0;
+  if (strsplit(buffer, fields, STATIC_ARRAY_SIZE(fields)) == 2) {
+    errno = 0;
+    lines_num = strtoul(fields[1], &endptr, 10);
+    if ((errno != 0) || (endptr == fields[1]) || (*endptr != '\0'))
+      lines_num = 0;
+  }
+  if ((lines_num == 0) || (lines_num > CMD_BATCH_MAX_LINES)) {
+    cmd_error(CMD_PARSE_ERROR, err,
+              "Usage: BATCH <count>, followed by <count> PUTVAL lines "
+              "(at most %d).",
+              CMD_BATCH_MAX_LINES);
+    return CMD_PARSE_ERROR;
+  }
+
+  batch->lines_num = (size_t)lines_num;
+  return CMD_OK;
+} /* cmd_status_t cmd_putval_batch_begin */
+
+bool cmd_putval_batch_line(cmd_putval_batch_t *batch, char *line) {
+  cmd_error_handler_t err = {batch_error_cb, batch};
+  cmd_t cmd;
+
+  assert(batch->lines_done < batch->lines_num);
+
+  if (line == NULL) {
+    cmd_error(CMD_PARSE_ERROR, &err, "Line too long.");
+  } else if (cmd_parse(line, &cmd, NULL, &err) == CMD_OK) {
+    if (cmd.type == CMD_PUTVAL) {
+      for (size_t i = 0; i < cmd.cmd.putval.vl_num; ++i)
+        plugin_dispatch_values(&cmd.cmd.putval.vl[i]);
+      batch->values_num += cmd.cmd.putval.vl_num;
+    } else {
+      cmd_error(CMD_UNKNOWN_COMMAND, &err,
+                "Unexpected command: `%s'. Only PUTVAL may be batched.",
+                CMD_TO_STRING(cmd.type));
+    }
+    cmd_destroy(&cmd);
+  }
+
+  batch->lines_done++;
+  return batch->lines_done >= batch->lines_num;
+} /* bool cmd_putval_batch_line */
+
+cmd_status_t cmd_putval_batch_finish(cmd_putval_batch_t *batch,
+                                     cmd_error_handler_t *err) {
+  if (batch->lines_done < batch->lines_num) {
+    cmd_error(CMD_ERROR, err, "Batch ended after %zu of %zu lines.",
+              batch->lines_done, batch->lines_num);
+    return CMD_ERROR;
+  }
+
+  if (batch->errors_num > 0) {
+    cmd_error(CMD_PARSE_ERROR, err,
+              "%zu of %zu lines failed, %zu %s been dispatched. "
+              "Line %zu: %s",
+              batch->errors_num, batch->lines_num, batch->values_num,
+              (batch->values_num == 1) ? "value has" : "values have",
+              batch->first_error_line, batch->first_error);
+    return CMD_PARSE_ERROR;
+  }
+
+  cmd_error(CMD_OK, err, "Success: %zu %s been dispatched.", batch->values_num,
+            (batch->values_num == 1) ? "value has" : "values have");
+  return CMD_OK;
+} /* cmd_status_t cmd_putval_batch_finish */
+
+/* batch_read_line reads one line from fh and removes the line ending. Lines
+ * which do not fit into the buffer are consumed completely, so that the next
+ * call reads the next line. */
+static int batch_read_line(FILE *fh, char *buffer, size_t buffer_size,
+                           bool *ret_truncated) {
+  *ret_truncated = false;
+
+  while (fgets(buffer, (int)buffer_size, fh) == NULL) {
+    if ((errno == EINTR) || (errno == EAGAIN)) {
+      errno = 0;
+      continue;
+    }
+    return -1;
+  }
+
+  size_t len = strlen(buffer);
+  if ((len > 0) && (buffer[len - 1] != '\n') && !feof(fh)) {
+    char discard[256];
+    *ret_truncated = true;
+    while (fgets(discard, sizeof(discard), fh) != NULL) {
+      if (discard[strlen(discard) - 1] == '\n')
+        break;
+    }
+  }
+
+  while ((len > 0) &&
+         ((buffer[len - 1] == '\n') || (buffer[len - 1] == '\r')))
+    buffer[--len] = '\0';
+
+  return 0;
+} /* int batch_read_line */
+
+cmd_status_t cmd_handle_putval_batch(FILE *fhin, FILE *fhout, char *buffer) {
+  cmd_error_handler_t err = {cmd_error_fh, fhout};
+  cmd_putval_batch_t batch;
+
+  DEBUG("utils_cmd_putval: cmd_handle_putval_batch (fhin = %p, fhout = %p, "
+        "buffer = %s);",
+        (void *)fhin, (void *)fhout, buffer);
+
+  cmd_status_t status = cmd_putval_batch_begin(&batch, buffer, &err);
+  if (status != CMD_OK)
+    return status;
+
+  bool done = false;
+  while (!done) {
+    char line[1024];
+    bool truncated = false;
+
+    if (batch_read_line(fhin, line, sizeof(line), &truncated) != 0)
+      break;
+
+    done = cmd_putval_batch_line(&batch, truncated ? NULL : line);
+  }
+
+  return cmd_putval_batch_finish(&batch, &err);
+} /* cmd_status_t cmd_handle_putval_batch */
+
 int cmd_create_putval(char *ret, size_t ret_len, /* {{{ */
                       const data_set_t *ds, const value_list_t *vl) {
   char buffer_ident[6 * DATA_MAX_NAME_LEN];
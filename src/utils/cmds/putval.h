@@ -39,6 +39,39 @@ cmd_status_t cmd_parse_putval(size_t argc, char **argv,
 
 cmd_status_t cmd_handle_putval(FILE *fh, char *buffer);
 
+/* The maximum number of lines a single BATCH command may announce. */
+#define CMD_BATCH_MAX_LINES 65536
+
+/* State of a BATCH command whose lines are handled one at a time. */
+typedef struct {
+  size_t lines_num;
+  size_t lines_done;
+  size_t values_num;
+  size_t errors_num;
+  size_t first_error_line;
+  char first_error[1024];
+} cmd_putval_batch_t;
+
+/* cmd_putval_batch_begin parses the "BATCH <count>" header in buffer and
+ * initializes batch. Errors are reported to err. */
+cmd_status_t cmd_putval_batch_begin(cmd_putval_batch_t *batch, char *buffer,
+                                    cmd_error_handler_t *err);
+
+/* cmd_putval_batch_line handles the next line of the batch and dispatches its
+ * values. A NULL line stands for a line which could not be read completely.
+ * Returns true once all announced lines have been handled. */
+bool cmd_putval_batch_line(cmd_putval_batch_t *batch, char *line);
+
+/* cmd_putval_batch_finish reports the status of the whole batch to err. */
+cmd_status_t cmd_putval_batch_finish(cmd_putval_batch_t *batch,
+                                     cmd_error_handler_t *err);
+
+/* cmd_handle_putval_batch handles a "BATCH <count>" command: it reads the
+ * following <count> PUTVAL lines from fhin, dispatches their values and writes
+ * a single status line to fhout. Lines which fail to parse are skipped; the
+ * status reports the first of them. */
+cmd_status_t cmd_handle_putval_batch(FILE *fhin, FILE *fhout, char *buffer);
+
 void cmd_destroy_putval(cmd_putval_t *putval);
 
 int cmd_create_putval(char *ret, size_t ret_len, const data_set_t *ds,
@@ -334,20 +334,31 @@ int swrite(int fd, const void *buf, size_t count) {
   return 0;
 }
 
+static inline bool strsplit_is_space(char c) {
+  return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n');
+}
+
 int strsplit(char *string, char **fields, size_t size) {
-  size_t i;
-  char *ptr;
-  char *saveptr;
+  size_t i = 0;
+  char *ptr = string;
+
+  /* This is called for every line of files in /proc by many plugins, so it
+   * does a single pass instead of using strtok_r. */
+  while (i < size) {
+    while (strsplit_is_space(*ptr))
+      ptr++;
+    if (*ptr == 0)
+      break;
 
-  i = 0;
-  ptr = string;
-  saveptr = NULL;
-  while ((fields[i] = strtok_r(ptr, " \t\r\n", &saveptr)) != NULL) {
-    ptr = NULL;
+    fields[i] = ptr;
     i++;
 
-    if (i >= size)
+    while ((*ptr != 0) && !strsplit_is_space(*ptr))
+      ptr++;
+    if (*ptr == 0)
       break;
+    *ptr = 0;
+    ptr++;
   }
 
   return (int)i;
@@ -1319,6 +1330,96 @@ ssize_t read_text_file_contents(const char *filename, char *buf,
   return ret + 1;
 }
 
+struct procfile_s {
+  char *path;
+  int fd;
+  char *buffer;
+  size_t buffer_size;
+};
+
+procfile_t *procfile_create(char const *path) {
+  procfile_t *pf = calloc(1, sizeof(*pf));
+  if (pf == NULL)
+    return NULL;
+
+  pf->path = strdup(path);
+  if (pf->path == NULL) {
+    free(pf);
+    return NULL;
+  }
+  pf->fd = -1;
+
+  return pf;
+} /* procfile_t *procfile_create */
+
+char *procfile_read(procfile_t *pf) {
+  if (pf->fd < 0) {
+    pf->fd = open(pf->path, O_RDONLY | O_CLOEXEC);
+    if (pf->fd < 0)
+      return NULL;
+  }
+
+  size_t len = 0;
+  while (42) {
+    if (len + 1 >= pf->buffer_size) {
+      size_t size = (pf->buffer_size == 0) ? 4096 : 2 * pf->buffer_size;
+      char *tmp = realloc(pf->buffer, size);
+      if (tmp == NULL) {
+        errno = ENOMEM;
+        return NULL;
+      }
+      pf->buffer = tmp;
+      pf->buffer_size = size;
+    }
+
+    ssize_t status = pread(pf->fd, pf->buffer + len,
+                           pf->buffer_size - len - 1, (off_t)len);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+
+      int err = errno;
+      close(pf->fd);
+      pf->fd = -1;
+      errno = err;
+      return NULL;
+    }
+    if (status == 0)
+      break;
+    len += (size_t)status;
+  }
+
+  pf->buffer[len] = 0;
+  return pf->buffer;
+} /* char *procfile_read */
+
+void procfile_destroy(procfile_t *pf) {
+  if (pf == NULL)
+    return;
+
+  if (pf->fd >= 0)
+    close(pf->fd);
+  free(pf->buffer);
+  free(pf->path);
+  free(pf);
+} /* void procfile_destroy */
+
+char *next_line(char **ptr) {
+  char *line = *ptr;
+  if ((line == NULL) || (*line == 0))
+    return NULL;
+
+  char *end = strchr(line, '\n');
+  if (end == NULL) {
+    *ptr = line + strlen(line);
+  } else {
+    *end = 0;
+    *ptr = end + 1;
+  }
+
+  return line;
+} /* char *next_line */
+
 counter_t counter_diff(counter_t old_value, counter_t new_value) {
   counter_t diff;
 
@@ -364,6 +364,44 @@ ssize_t read_file_contents(char const *filename, void *buf, size_t bufsize);
 ssize_t read_text_file_contents(char const *filename, char *buf,
                                 size_t bufsize);
 
+/*
+ * NAME
+ *   procfile_t
+ *
+ * DESCRIPTION
+ *   Keeps a file in /proc or /sys open and reads it from the beginning with
+ *   pread(2) every time procfile_read is called. The kernel generates these
+ *   files' contents when they are read, so this returns up-to-date values
+ *   without opening the file and allocating a stdio buffer every interval.
+ *   The contents are read into a buffer owned by the procfile_t, which grows
+ *   as needed.
+ *
+ *   procfile_read returns a pointer to the null-terminated contents, which is
+ *   valid until the next call. The contents may be modified by the caller,
+ *   e.g. by next_line and strsplit. On error, NULL is returned and `errno' is
+ *   set; the file is opened again by the next call.
+ */
+struct procfile_s;
+typedef struct procfile_s procfile_t;
+
+procfile_t *procfile_create(char const *path);
+char *procfile_read(procfile_t *pf);
+void procfile_destroy(procfile_t *pf);
+
+/*
+ * NAME
+ *   next_line
+ *
+ * DESCRIPTION
+ *   Returns the line `*ptr' points to and advances `*ptr' to the beginning of
+ *   the next line. The newline character is replaced with a null byte, i.e.
+ *   the string is modified in place.
+ *
+ * RETURN VALUE
+ *   Returns the line or NULL if `*ptr' points to the end of the string.
+ */
+char *next_line(char **ptr);
+
 counter_t counter_diff(counter_t old_value, counter_t new_value);
 
 /* Convert a rate back to a value_t. When converting to a derive_t, counter_t
@@ -130,6 +130,31 @@ DEF_TEST(strsplit) {
   status = strsplit(buffer, fields, 8);
   OK(status == 0);
 
+  strncpy(buffer, " \t\r\n", sizeof(buffer));
+  status = strsplit(buffer, fields, 8);
+  OK(status == 0);
+
+  /* The last field is terminated even if more follow. */
+  strncpy(buffer, "a b c", sizeof(buffer));
+  status = strsplit(buffer, fields, 2);
+  OK(status == 2);
+  EXPECT_EQ_STR("b", fields[1]);
+  EXPECT_EQ_STR("c", buffer + 4);
+
+  return 0;
+}
+
+DEF_TEST(next_line) {
+  char buffer[] = "first line\n\nthird\nlast";
+  char *ptr = buffer;
+
+  EXPECT_EQ_STR("first line", next_line(&ptr));
+  EXPECT_EQ_STR("", next_line(&ptr));
+  EXPECT_EQ_STR("third", next_line(&ptr));
+  EXPECT_EQ_STR("last", next_line(&ptr));
+  OK(next_line(&ptr) == NULL);
+  OK(next_line(&ptr) == NULL);
+
   return 0;
 }
 
@@ -375,16 +400,54 @@ DEF_TEST(value_to_rate) {
   return 0;
 }
 
+DEF_TEST(procfile) {
+  char path[] = "/tmp/procfile_test.XXXXXX";
+  char data[10000];
+  procfile_t *pf;
+
+  int fd = mkstemp(path);
+  CHECK_NOT_NULL(pf = procfile_create(path));
+
+  CHECK_ZERO(swrite(fd, "one\ntwo\n", strlen("one\ntwo\n")));
+  EXPECT_EQ_STR("one\ntwo\n", procfile_read(pf));
+
+  /* The file is read from the beginning every time. */
+  EXPECT_EQ_STR("one\ntwo\n", procfile_read(pf));
+
+  /* Contents larger than the initial buffer. */
+  memset(data, 'x', sizeof(data) - 1);
+  data[sizeof(data) - 1] = 0;
+  CHECK_ZERO(ftruncate(fd, 0));
+  CHECK_ZERO(pwrite(fd, data, strlen(data), 0) != (ssize_t)strlen(data));
+  OK(strcmp(data, procfile_read(pf)) == 0);
+
+  CHECK_ZERO(ftruncate(fd, 0));
+  EXPECT_EQ_STR("", procfile_read(pf));
+
+  close(fd);
+  unlink(path);
+  procfile_destroy(pf);
+
+  CHECK_NOT_NULL(pf = procfile_create(path));
+  OK(procfile_read(pf) == NULL);
+  EXPECT_EQ_INT(ENOENT, errno);
+  procfile_destroy(pf);
+
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(sstrncpy);
   RUN_TEST(sstrdup);
   RUN_TEST(strsplit);
+  RUN_TEST(next_line);
   RUN_TEST(strjoin);
   RUN_TEST(escape_slashes);
   RUN_TEST(escape_string);
   RUN_TEST(strunescape);
   RUN_TEST(parse_values);
   RUN_TEST(value_to_rate);
+  RUN_TEST(procfile);
 
   END_TEST;
 }
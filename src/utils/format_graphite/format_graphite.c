@@ -26,6 +26,7 @@
 #include "plugin.h"
 #include "utils/common/common.h"
 
+#include "utils/avltree/avltree.h"
 #include "utils/format_graphite/format_graphite.h"
 #include "utils_cache.h"
 
@@ -63,46 +64,100 @@ void reverse_hostname(char *r_host, char const *orig_host) {
   reverse_string(&r_host[p], len_host - p);
 }
 
+static char const gr_digit_pairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Writes the decimal representation of `n' to `buffer', which must have room
+ * for at least 20 characters. The result is not null terminated. Returns the
+ * number of characters written. */
+static size_t gr_format_uint(char *buffer, uint64_t n) /* {{{ */
+{
+  char tmp[20];
+  char *ptr = tmp + sizeof(tmp);
+
+  while (n >= 100) {
+    ptr -= 2;
+    memcpy(ptr, gr_digit_pairs + 2 * (n % 100), 2);
+    n /= 100;
+  }
+  if (n >= 10) {
+    ptr -= 2;
+    memcpy(ptr, gr_digit_pairs + 2 * n, 2);
+  } else {
+    *(--ptr) = (char)('0' + n);
+  }
+
+  size_t len = (size_t)(tmp + sizeof(tmp) - ptr);
+  memcpy(buffer, ptr, len);
+  return len;
+} /* }}} size_t gr_format_uint */
+
+static size_t gr_format_int(char *buffer, int64_t n) /* {{{ */
+{
+  if (n >= 0)
+    return gr_format_uint(buffer, (uint64_t)n);
+
+  buffer[0] = '-';
+  return 1 + gr_format_uint(buffer + 1, ((uint64_t)0) - ((uint64_t)n));
+} /* }}} size_t gr_format_int */
+
+/* Formats `v' like printf's "%f" (if `fixed' is true) or GAUGE_FORMAT. Whole
+ * numbers, which make up the bulk of the values we see, are handled by
+ * gr_format_int(); everything else is passed on to snprintf(3). */
+static int gr_format_double(char *buffer, size_t buffer_size, double v,
+                            bool fixed) /* {{{ */
+{
+  /* 1e15 keeps the value within the 15 significant digits of GAUGE_FORMAT,
+   * i.e. printf would not switch to exponential notation. Negative zero is
+   * printed as "-0" by printf. */
+  if ((fabs(v) < 1e15) && (v == (double)(int64_t)v) &&
+      ((v != 0.0) || !signbit(v))) {
+    size_t len = gr_format_int(buffer, (int64_t)v);
+    if (fixed) {
+      memcpy(buffer + len, ".000000", strlen(".000000"));
+      len += strlen(".000000");
+    }
+    buffer[len] = 0;
+    return (int)len;
+  }
+
+  return snprintf(buffer, buffer_size, fixed ? "%f" : GAUGE_FORMAT, v);
+} /* }}} int gr_format_double */
+
+/* Converts the value `ds_num' to an ASCII representation. Returns the length
+ * of the string or a negative value on error. */
 static int gr_format_values(char *ret, size_t ret_len, int ds_num,
                             const data_set_t *ds, const value_list_t *vl,
                             gauge_t const *rates) {
-  size_t offset = 0;
   int status;
 
   assert(0 == strcmp(ds->type, vl->type));
 
-  memset(ret, 0, ret_len);
-
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    status = snprintf(ret + offset, ret_len - offset, __VA_ARGS__);            \
-    if (status < 1) {                                                          \
-      return -1;                                                               \
-    } else if (((size_t)status) >= (ret_len - offset)) {                       \
-      return -1;                                                               \
-    } else                                                                     \
-      offset += ((size_t)status);                                              \
-  } while (0)
-
   if (ds->ds[ds_num].type == DS_TYPE_GAUGE)
-    BUFFER_ADD(GAUGE_FORMAT, vl->values[ds_num].gauge);
+    status = gr_format_double(ret, ret_len, vl->values[ds_num].gauge, false);
   else if (rates != NULL)
-    BUFFER_ADD("%f", rates[ds_num]);
+    status = gr_format_double(ret, ret_len, rates[ds_num], true);
   else if (ds->ds[ds_num].type == DS_TYPE_COUNTER)
-    BUFFER_ADD("%" PRIu64, (uint64_t)vl->values[ds_num].counter);
+    status = (int)gr_format_uint(ret, (uint64_t)vl->values[ds_num].counter);
   else if (ds->ds[ds_num].type == DS_TYPE_DERIVE)
-    BUFFER_ADD("%" PRIi64, vl->values[ds_num].derive);
+    status = (int)gr_format_int(ret, vl->values[ds_num].derive);
   else if (ds->ds[ds_num].type == DS_TYPE_ABSOLUTE)
-    BUFFER_ADD("%" PRIu64, vl->values[ds_num].absolute);
+    status = (int)gr_format_uint(ret, vl->values[ds_num].absolute);
   else {
     P_ERROR("gr_format_values: Unknown data source type: %i",
             ds->ds[ds_num].type);
     return -1;
   }
 
-#undef BUFFER_ADD
+  if ((status < 1) || ((size_t)status >= ret_len))
+    return -1;
+  ret[status] = 0;
 
-  return 0;
+  return status;
 }
 
 static void gr_copy_escape_part(char *dst, const char *src, size_t dst_len,
@@ -294,12 +349,85 @@ static void escape_graphite_string(char *buffer, char escape_char) {
     *head = escape_char;
 }
 
+/* Copies the escaped metric path of data source `ds_name' to `key'. */
+static int gr_format_key(char *key, size_t key_size, value_list_t const *vl,
+                         char const *ds_name, char const *prefix,
+                         char const *postfix, char const escape_char,
+                         unsigned int flags) /* {{{ */
+{
+  int status;
+
+  if (flags & GRAPHITE_USE_TAGS) {
+    status = gr_format_name_tagged(key, (int)key_size, vl, ds_name, prefix,
+                                   postfix, escape_char, flags);
+    if (status != 0) {
+      P_ERROR("format_graphite: error with gr_format_name_tagged");
+      return status;
+    }
+  } else {
+    status = gr_format_name(key, (int)key_size, vl, ds_name, prefix, postfix,
+                            escape_char, flags);
+    if (status != 0) {
+      P_ERROR("format_graphite: error with gr_format_name");
+      return status;
+    }
+  }
+
+  escape_graphite_string(key, escape_char);
+  return 0;
+} /* }}} int gr_format_key */
+
+/* Appends "<key> <value> <time>\r\n" to `buffer' and keeps it null
+ * terminated. Leaves `buffer' untouched if the line does not fit. */
+static int gr_append_line(char *buffer, size_t buffer_size, size_t *buffer_pos,
+                          char const *key, size_t key_len, size_t ds_index,
+                          data_set_t const *ds, value_list_t const *vl,
+                          gauge_t const *rates, char const *time,
+                          size_t time_len) /* {{{ */
+{
+  char values[512];
+  int values_len;
+
+  values_len =
+      gr_format_values(values, sizeof(values), (int)ds_index, ds, vl, rates);
+  if (values_len < 0) {
+    P_ERROR("format_graphite: error with gr_format_values");
+    return -1;
+  }
+
+  size_t message_len = key_len + 1 + (size_t)values_len + 1 + time_len + 2;
+  if ((*buffer_pos + message_len) >= buffer_size) {
+    P_ERROR("format_graphite: target buffer too small");
+    return -ENOMEM;
+  }
+
+  char *ptr = buffer + *buffer_pos;
+  memcpy(ptr, key, key_len);
+  ptr += key_len;
+  *(ptr++) = ' ';
+  memcpy(ptr, values, (size_t)values_len);
+  ptr += values_len;
+  *(ptr++) = ' ';
+  memcpy(ptr, time, time_len);
+  ptr += time_len;
+  *(ptr++) = '\r';
+  *(ptr++) = '\n';
+  *ptr = 0;
+
+  *buffer_pos += message_len;
+  return 0;
+} /* }}} int gr_append_line */
+
+static size_t gr_format_time(char *buffer, value_list_t const *vl) {
+  return gr_format_uint(buffer, (unsigned int)CDTIME_T_TO_TIME_T(vl->time));
+}
+
 int format_graphite(char *buffer, size_t buffer_size, data_set_t const *ds,
                     value_list_t const *vl, char const *prefix,
                     char const *postfix, char const escape_char,
                     unsigned int flags) {
   int status = 0;
-  int buffer_pos = 0;
+  size_t buffer_pos = 0;
 
   gauge_t *rates = NULL;
   if (flags & GRAPHITE_STORE_RATES) {
@@ -310,68 +438,378 @@ int format_graphite(char *buffer, size_t buffer_size, data_set_t const *ds,
     }
   }
 
+  char time[24];
+  size_t time_len = gr_format_time(time, vl);
+
   for (size_t i = 0; i < ds->ds_num; i++) {
     char const *ds_name = NULL;
     char key[10 * DATA_MAX_NAME_LEN];
-    char values[512];
-    size_t message_len;
-    char message[1024];
 
     if ((flags & GRAPHITE_ALWAYS_APPEND_DS) || (ds->ds_num > 1))
       ds_name = ds->ds[i].name;
 
     /* Copy the identifier to `key' and escape it. */
-    if (flags & GRAPHITE_USE_TAGS) {
-      status = gr_format_name_tagged(key, sizeof(key), vl, ds_name, prefix,
-                                     postfix, escape_char, flags);
-      if (status != 0) {
-        P_ERROR("format_graphite: error with gr_format_name_tagged");
-        sfree(rates);
-        return status;
-      }
-    } else {
-      status = gr_format_name(key, sizeof(key), vl, ds_name, prefix, postfix,
-                              escape_char, flags);
-      if (status != 0) {
-        P_ERROR("format_graphite: error with gr_format_name");
-        sfree(rates);
-        return status;
-      }
-    }
+    status = gr_format_key(key, sizeof(key), vl, ds_name, prefix, postfix,
+                           escape_char, flags);
+    if (status != 0)
+      break;
+
+    status = gr_append_line(buffer, buffer_size, &buffer_pos, key, strlen(key),
+                            i, ds, vl, rates, time, time_len);
+    if (status != 0)
+      break;
+  }
+  sfree(rates);
+  return status;
+} /* int format_graphite */
 
-    escape_graphite_string(key, escape_char);
+/*
+ * Metric path cache
+ */
+#define GR_CACHE_TIMEOUT TIME_T_TO_CDTIME_T_STATIC(900)
+
+/* Identifier of a value list. Used as the key of the cache tree; for lookups
+ * the pointers refer to the value list's fields. */
+typedef struct {
+  char const *host;
+  char const *plugin;
+  char const *plugin_instance;
+  char const *type;
+  char const *type_instance;
+} gr_cache_id_t;
+
+typedef struct {
+  char *name;
+  size_t len;
+} gr_cache_key_t;
+
+typedef struct {
+  gr_cache_id_t id;
+  char *id_buffer;
+
+  gr_cache_key_t *keys;
+  size_t keys_num;
+
+  cdtime_t last_used;
+} gr_cache_entry_t;
+
+struct format_graphite_cache_s {
+  pthread_mutex_t lock;
+  c_avl_tree_t *tree; /* gr_cache_id_t* -> gr_cache_entry_t* */
+
+  /* Options the cached paths have been built with. */
+  char *prefix;
+  char *postfix;
+  char escape_char;
+  unsigned int flags;
+
+  cdtime_t next_prune;
+};
+
+static int gr_cache_id_compare(void const *a, void const *b) /* {{{ */
+{
+  gr_cache_id_t const *id_a = a;
+  gr_cache_id_t const *id_b = b;
+  int status;
 
-    /* Convert the values to an ASCII representation and put that into
-     * `values'. */
-    status = gr_format_values(values, sizeof(values), i, ds, vl, rates);
-    if (status != 0) {
-      P_ERROR("format_graphite: error with gr_format_values");
-      sfree(rates);
+  if ((status = strcmp(id_a->type, id_b->type)) != 0)
+    return status;
+  if ((status = strcmp(id_a->plugin, id_b->plugin)) != 0)
+    return status;
+  if ((status = strcmp(id_a->host, id_b->host)) != 0)
+    return status;
+  if ((status = strcmp(id_a->plugin_instance, id_b->plugin_instance)) != 0)
+    return status;
+  return strcmp(id_a->type_instance, id_b->type_instance);
+} /* }}} int gr_cache_id_compare */
+
+static void gr_cache_entry_free(gr_cache_entry_t *e) /* {{{ */
+{
+  if (e == NULL)
+    return;
+
+  for (size_t i = 0; i < e->keys_num; i++)
+    sfree(e->keys[i].name);
+  sfree(e->keys);
+  sfree(e->id_buffer);
+  sfree(e);
+} /* }}} void gr_cache_entry_free */
+
+static gr_cache_entry_t *gr_cache_entry_create(value_list_t const *vl) /* {{{ */
+{
+  char const *fields[] = {vl->host, vl->plugin, vl->plugin_instance, vl->type,
+                          vl->type_instance};
+  size_t fields_len[STATIC_ARRAY_SIZE(fields)];
+  size_t size = 0;
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(fields); i++) {
+    fields_len[i] = strlen(fields[i]) + 1;
+    size += fields_len[i];
+  }
+
+  gr_cache_entry_t *e = calloc(1, sizeof(*e));
+  if (e == NULL)
+    return NULL;
+
+  e->id_buffer = malloc(size);
+  if (e->id_buffer == NULL) {
+    sfree(e);
+    return NULL;
+  }
+
+  char *copies[STATIC_ARRAY_SIZE(fields)];
+  char *ptr = e->id_buffer;
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(fields); i++) {
+    memcpy(ptr, fields[i], fields_len[i]);
+    copies[i] = ptr;
+    ptr += fields_len[i];
+  }
+  e->id = (gr_cache_id_t){copies[0], copies[1], copies[2], copies[3],
+                          copies[4]};
+
+  return e;
+} /* }}} gr_cache_entry_t *gr_cache_entry_create */
+
+/* (Re)builds the metric paths of all data sources of `e'. */
+static int gr_cache_entry_build(format_graphite_cache_t *cache,
+                                gr_cache_entry_t *e, data_set_t const *ds,
+                                value_list_t const *vl) /* {{{ */
+{
+  for (size_t i = 0; i < e->keys_num; i++)
+    sfree(e->keys[i].name);
+  sfree(e->keys);
+  e->keys_num = 0;
+
+  e->keys = calloc(ds->ds_num, sizeof(*e->keys));
+  if (e->keys == NULL)
+    return ENOMEM;
+
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    char const *ds_name = NULL;
+    char key[10 * DATA_MAX_NAME_LEN];
+
+    if ((cache->flags & GRAPHITE_ALWAYS_APPEND_DS) || (ds->ds_num > 1))
+      ds_name = ds->ds[i].name;
+
+    int status =
+        gr_format_key(key, sizeof(key), vl, ds_name, cache->prefix,
+                      cache->postfix, cache->escape_char, cache->flags);
+    if (status != 0)
       return status;
-    }
 
-    /* Compute the graphite command */
-    message_len =
-        (size_t)snprintf(message, sizeof(message), "%s %s %u\r\n", key, values,
-                         (unsigned int)CDTIME_T_TO_TIME_T(vl->time));
-    if (message_len >= sizeof(message)) {
-      P_ERROR("format_graphite: message buffer too small: "
-              "Need %" PRIsz " bytes.",
-              message_len + 1);
-      sfree(rates);
-      return -ENOMEM;
+    e->keys[i].name = strdup(key);
+    if (e->keys[i].name == NULL)
+      return ENOMEM;
+    e->keys[i].len = strlen(key);
+    e->keys_num = i + 1;
+  }
+
+  return 0;
+} /* }}} int gr_cache_entry_build */
+
+static void gr_cache_clear(format_graphite_cache_t *cache) /* {{{ */
+{
+  void *key;
+  gr_cache_entry_t *e;
+
+  while (c_avl_pick(cache->tree, &key, (void *)&e) == 0)
+    gr_cache_entry_free(e);
+} /* }}} void gr_cache_clear */
+
+/* Removes entries which have not been used for GR_CACHE_TIMEOUT, so the cache
+ * does not keep growing when series come and go. */
+static void gr_cache_prune(format_graphite_cache_t *cache,
+                           cdtime_t now) /* {{{ */
+{
+  c_avl_iterator_t *iter;
+  gr_cache_id_t *id;
+  gr_cache_entry_t *e;
+  gr_cache_id_t **expired = NULL;
+  size_t expired_num = 0;
+
+  iter = c_avl_get_iterator(cache->tree);
+  if (iter == NULL)
+    return;
+
+  while (c_avl_iterator_next(iter, (void *)&id, (void *)&e) == 0) {
+    if ((now - e->last_used) < GR_CACHE_TIMEOUT)
+      continue;
+
+    gr_cache_id_t **tmp =
+        realloc(expired, (expired_num + 1) * sizeof(*expired));
+    if (tmp == NULL)
+      break;
+    expired = tmp;
+    expired[expired_num++] = id;
+  }
+  c_avl_iterator_destroy(iter);
+
+  for (size_t i = 0; i < expired_num; i++) {
+    if (c_avl_remove(cache->tree, expired[i], NULL, (void *)&e) == 0)
+      gr_cache_entry_free(e);
+  }
+  sfree(expired);
+} /* }}} void gr_cache_prune */
+
+static bool gr_string_equal(char const *a, char const *b) {
+  if ((a == NULL) || (b == NULL))
+    return a == b;
+  return strcmp(a, b) == 0;
+}
+
+/* Drops all cached paths if the options differ from the ones they have been
+ * built with. */
+static int gr_cache_set_options(format_graphite_cache_t *cache,
+                                char const *prefix, char const *postfix,
+                                char const escape_char,
+                                unsigned int flags) /* {{{ */
+{
+  if ((cache->escape_char == escape_char) && (cache->flags == flags) &&
+      gr_string_equal(cache->prefix, prefix) &&
+      gr_string_equal(cache->postfix, postfix))
+    return 0;
+
+  gr_cache_clear(cache);
+  sfree(cache->prefix);
+  sfree(cache->postfix);
+
+  if (prefix != NULL) {
+    cache->prefix = strdup(prefix);
+    if (cache->prefix == NULL)
+      return ENOMEM;
+  }
+  if (postfix != NULL) {
+    cache->postfix = strdup(postfix);
+    if (cache->postfix == NULL)
+      return ENOMEM;
+  }
+  cache->escape_char = escape_char;
+  cache->flags = flags;
+
+  return 0;
+} /* }}} int gr_cache_set_options */
+
+/* Returns the cache entry for `vl', creating or rebuilding it as necessary.
+ * Returns NULL if the entry could not be created. */
+static gr_cache_entry_t *gr_cache_get(format_graphite_cache_t *cache,
+                                      data_set_t const *ds,
+                                      value_list_t const *vl,
+                                      cdtime_t now) /* {{{ */
+{
+  gr_cache_id_t id = {vl->host, vl->plugin, vl->plugin_instance, vl->type,
+                      vl->type_instance};
+  gr_cache_entry_t *e = NULL;
+
+  if (c_avl_get(cache->tree, &id, (void *)&e) == 0) {
+    /* The number of data sources only changes if the types.db is reloaded. */
+    if ((e->keys_num != ds->ds_num) &&
+        (gr_cache_entry_build(cache, e, ds, vl) != 0)) {
+      if (c_avl_remove(cache->tree, &id, NULL, NULL) == 0)
+        gr_cache_entry_free(e);
+      return NULL;
     }
+    e->last_used = now;
+    return e;
+  }
+
+  e = gr_cache_entry_create(vl);
+  if (e == NULL)
+    return NULL;
+
+  if ((gr_cache_entry_build(cache, e, ds, vl) != 0) ||
+      (c_avl_insert(cache->tree, &e->id, e) != 0)) {
+    gr_cache_entry_free(e);
+    return NULL;
+  }
+
+  e->last_used = now;
+  return e;
+} /* }}} gr_cache_entry_t *gr_cache_get */
+
+format_graphite_cache_t *format_graphite_cache_create(void) /* {{{ */
+{
+  format_graphite_cache_t *cache = calloc(1, sizeof(*cache));
+  if (cache == NULL)
+    return NULL;
 
-    /* Append it in case we got multiple data set */
-    if ((buffer_pos + message_len) >= buffer_size) {
-      P_ERROR("format_graphite: target buffer too small");
-      sfree(rates);
-      return -ENOMEM;
+  cache->tree = c_avl_create(gr_cache_id_compare);
+  if (cache->tree == NULL) {
+    sfree(cache);
+    return NULL;
+  }
+
+  pthread_mutex_init(&cache->lock, /* attr = */ NULL);
+  return cache;
+} /* }}} format_graphite_cache_t *format_graphite_cache_create */
+
+void format_graphite_cache_destroy(format_graphite_cache_t *cache) /* {{{ */
+{
+  if (cache == NULL)
+    return;
+
+  gr_cache_clear(cache);
+  c_avl_destroy(cache->tree);
+  pthread_mutex_destroy(&cache->lock);
+  sfree(cache->prefix);
+  sfree(cache->postfix);
+  sfree(cache);
+} /* }}} void format_graphite_cache_destroy */
+
+int format_graphite_cached(format_graphite_cache_t *cache, char *buffer,
+                           size_t buffer_size, data_set_t const *ds,
+                           value_list_t const *vl, char const *prefix,
+                           char const *postfix, char const escape_char,
+                           unsigned int flags) /* {{{ */
+{
+  if (cache == NULL)
+    return format_graphite(buffer, buffer_size, ds, vl, prefix, postfix,
+                           escape_char, flags);
+
+  gauge_t *rates = NULL;
+  if (flags & GRAPHITE_STORE_RATES) {
+    rates = uc_get_rate(ds, vl);
+    if (rates == NULL) {
+      P_ERROR("format_graphite: error with uc_get_rate");
+      return -1;
     }
-    memcpy((void *)(buffer + buffer_pos), message, message_len);
-    buffer_pos += message_len;
-    buffer[buffer_pos] = '\0';
   }
+
+  char time[24];
+  size_t time_len = gr_format_time(time, vl);
+  cdtime_t now = cdtime();
+
+  pthread_mutex_lock(&cache->lock);
+
+  if (gr_cache_set_options(cache, prefix, postfix, escape_char, flags) != 0) {
+    pthread_mutex_unlock(&cache->lock);
+    sfree(rates);
+    return format_graphite(buffer, buffer_size, ds, vl, prefix, postfix,
+                           escape_char, flags);
+  }
+
+  if (now >= cache->next_prune) {
+    gr_cache_prune(cache, now);
+    cache->next_prune = now + GR_CACHE_TIMEOUT;
+  }
+
+  gr_cache_entry_t *e = gr_cache_get(cache, ds, vl, now);
+  if (e == NULL) {
+    pthread_mutex_unlock(&cache->lock);
+    sfree(rates);
+    return format_graphite(buffer, buffer_size, ds, vl, prefix, postfix,
+                           escape_char, flags);
+  }
+
+  int status = 0;
+  size_t buffer_pos = 0;
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    status = gr_append_line(buffer, buffer_size, &buffer_pos, e->keys[i].name,
+                            e->keys[i].len, i, ds, vl, rates, time, time_len);
+    if (status != 0)
+      break;
+  }
+
+  pthread_mutex_unlock(&cache->lock);
   sfree(rates);
   return status;
-} /* int format_graphite */
+} /* }}} int format_graphite_cached */
@@ -39,4 +39,28 @@ int format_graphite(char *buffer, size_t buffer_size, const data_set_t *ds,
                     const char *postfix, const char escape_char,
                     unsigned int flags);
 
+/*
+ * Cache of escaped metric paths, keyed by value list identifier. Building the
+ * path is the bulk of the work done by format_graphite(); with a cache it is
+ * done once per series. All cached paths are dropped when
+ * format_graphite_cached() is called with options other than the ones they
+ * have been built with, and paths of series which have not been written for
+ * a while are removed.
+ *
+ * The cache does its own locking and may be shared between threads.
+ */
+struct format_graphite_cache_s;
+typedef struct format_graphite_cache_s format_graphite_cache_t;
+
+format_graphite_cache_t *format_graphite_cache_create(void);
+void format_graphite_cache_destroy(format_graphite_cache_t *cache);
+
+/* Same as format_graphite(), but takes the metric paths from `cache'. If
+ * `cache' is NULL, this is equivalent to calling format_graphite(). */
+int format_graphite_cached(format_graphite_cache_t *cache, char *buffer,
+                           size_t buffer_size, const data_set_t *ds,
+                           const value_list_t *vl, const char *prefix,
+                           const char *postfix, const char escape_char,
+                           unsigned int flags);
+
 #endif /* UTILS_FORMAT_GRAPHITE_H */
@@ -205,9 +205,153 @@ DEF_TEST(null_termination) {
   return 0;
 }
 
+DEF_TEST(values) {
+  data_set_t ds = {
+      .type = "quad",
+      .ds_num = 4,
+      .ds =
+          (data_source_t[]){
+              {"g", DS_TYPE_GAUGE, NAN, NAN},
+              {"d", DS_TYPE_DERIVE, NAN, NAN},
+              {"c", DS_TYPE_COUNTER, NAN, NAN},
+              {"a", DS_TYPE_ABSOLUTE, NAN, NAN},
+          },
+  };
+  struct {
+    gauge_t gauge;
+    derive_t derive;
+    counter_t counter;
+    absolute_t absolute;
+  } cases[] = {
+      {0.0, 0, 0, 0},
+      {-0.0, -1, 1, 1},
+      {42.0, INT64_MIN, UINT64_MAX, UINT64_MAX},
+      {-42.5, INT64_MAX, 10, 99},
+      {999999999999999.0, 100, 1000, 10000},
+      {-999999999999999.0, -100, 123456789, 987654321},
+      {1e15, 1, 2, 3},
+      {1e-7, -9, 9, 9},
+      {0.1, 0, 0, 0},
+      {123456789.123, 0, 0, 0},
+      {NAN, 0, 0, 0},
+      {INFINITY, 0, 0, 0},
+      {-INFINITY, 0, 0, 0},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    value_t values[] = {
+        {.gauge = cases[i].gauge},
+        {.derive = cases[i].derive},
+        {.counter = cases[i].counter},
+        {.absolute = cases[i].absolute},
+    };
+    value_list_t vl = {
+        .values = values,
+        .values_len = STATIC_ARRAY_SIZE(values),
+        .time = TIME_T_TO_CDTIME_T_STATIC(1480063672),
+        .interval = TIME_T_TO_CDTIME_T_STATIC(10),
+        .host = "example.com",
+        .plugin = "test",
+        .type = "quad",
+    };
+
+    char want[1024];
+    ssnprintf(want, sizeof(want),
+              "example_com.test.quad.g " GAUGE_FORMAT " 1480063672\r\n"
+              "example_com.test.quad.d %" PRIi64 " 1480063672\r\n"
+              "example_com.test.quad.c %" PRIu64 " 1480063672\r\n"
+              "example_com.test.quad.a %" PRIu64 " 1480063672\r\n",
+              cases[i].gauge, cases[i].derive, (uint64_t)cases[i].counter,
+              cases[i].absolute);
+
+    char got[1024];
+    EXPECT_EQ_INT(0, format_graphite(got, sizeof(got), &ds, &vl, NULL, NULL,
+                                     '_', 0));
+    EXPECT_EQ_STR(want, got);
+  }
+
+  return 0;
+}
+
+DEF_TEST(cached) {
+  char const *instances[] = {"", "foo", "f.o.o", "foo (test)"};
+  char const *prefixes[] = {NULL, "foo."};
+  unsigned int flags[] = {
+      0,
+      GRAPHITE_SEPARATE_INSTANCES | GRAPHITE_ALWAYS_APPEND_DS,
+      GRAPHITE_PRESERVE_SEPARATOR | GRAPHITE_DROP_DUPE_FIELDS,
+      GRAPHITE_USE_TAGS,
+      GRAPHITE_USE_TAGS | GRAPHITE_ALWAYS_APPEND_DS | GRAPHITE_REVERSE_HOST,
+  };
+  format_graphite_cache_t *cache;
+
+  CHECK_NOT_NULL(cache = format_graphite_cache_create());
+
+  /* Every option change invalidates the cache; the second round is served
+   * from it. */
+  for (int round = 0; round < 2; round++) {
+    for (size_t f = 0; f < STATIC_ARRAY_SIZE(flags); f++) {
+      for (size_t p = 0; p < STATIC_ARRAY_SIZE(prefixes); p++) {
+        for (size_t i = 0; i < STATIC_ARRAY_SIZE(instances); i++) {
+          value_list_t vl = {
+              .values = &(value_t){.gauge = 42.5 * (double)i},
+              .values_len = 1,
+              .time = TIME_T_TO_CDTIME_T_STATIC(1480063672 + round),
+              .interval = TIME_T_TO_CDTIME_T_STATIC(10),
+              .host = "example.com",
+              .plugin = "test",
+              .type = "single",
+          };
+          sstrncpy(vl.plugin_instance, instances[i],
+                   sizeof(vl.plugin_instance));
+          sstrncpy(vl.type_instance, instances[STATIC_ARRAY_SIZE(instances) -
+                                               1 - i],
+                   sizeof(vl.type_instance));
+
+          char want[1024];
+          char got[1024];
+          EXPECT_EQ_INT(0, format_graphite(want, sizeof(want), &ds_single, &vl,
+                                           prefixes[p], ".bar", '@',
+                                           flags[f]));
+          EXPECT_EQ_INT(0, format_graphite_cached(
+                               cache, got, sizeof(got), &ds_single, &vl,
+                               prefixes[p], ".bar", '@', flags[f]));
+          EXPECT_EQ_STR(want, got);
+
+          /* Same series again, now a cache hit. */
+          EXPECT_EQ_INT(0, format_graphite_cached(
+                               cache, got, sizeof(got), &ds_single, &vl,
+                               prefixes[p], ".bar", '@', flags[f]));
+          EXPECT_EQ_STR(want, got);
+        }
+      }
+    }
+  }
+
+  /* A buffer that is too small is reported and left untouched. */
+  value_list_t vl = {
+      .values = &(value_t){.gauge = 1},
+      .values_len = 1,
+      .time = TIME_T_TO_CDTIME_T_STATIC(1480063672),
+      .host = "example.com",
+      .plugin = "test",
+      .type = "single",
+  };
+  char small[16] = "garbage";
+  EXPECT_EQ_INT(-ENOMEM, format_graphite_cached(cache, small, sizeof(small),
+                                                &ds_single, &vl, NULL, NULL,
+                                                '_', 0));
+  EXPECT_EQ_STR("garbage", small);
+
+  format_graphite_cache_destroy(cache);
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(metric_name);
   RUN_TEST(null_termination);
+  RUN_TEST(values);
+  RUN_TEST(cached);
 
   END_TEST;
 }
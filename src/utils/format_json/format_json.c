@@ -43,69 +43,261 @@
 #endif
 #endif
 
-static int json_escape_string(char *buffer, size_t buffer_size, /* {{{ */
-                              const char *string) {
-  size_t dst_pos;
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
-  if ((buffer == NULL) || (string == NULL))
-    return -EINVAL;
+#define JSON_BUFFER_MIN_SIZE 256
 
-  if (buffer_size < 3)
+/*
+ * json_buffer_t
+ */
+void json_buffer_init(json_buffer_t *b) /* {{{ */
+{
+  *b = (json_buffer_t){0};
+} /* }}} void json_buffer_init */
+
+void json_buffer_init_fixed(json_buffer_t *b, char *ptr, /* {{{ */
+                            size_t size) {
+  *b = (json_buffer_t){
+      .ptr = ptr,
+      .size = size,
+      .fixed = true,
+  };
+  if (size > 0)
+    ptr[0] = 0;
+} /* }}} void json_buffer_init_fixed */
+
+void json_buffer_reset(json_buffer_t *b) /* {{{ */
+{
+  b->pos = 0;
+  if (b->size > 0)
+    b->ptr[0] = 0;
+} /* }}} void json_buffer_reset */
+
+void json_buffer_free(json_buffer_t *b) /* {{{ */
+{
+  if (!b->fixed)
+    sfree(b->ptr);
+  *b = (json_buffer_t){0};
+} /* }}} void json_buffer_free */
+
+/* Makes room for `len' more bytes plus the terminating null byte. */
+static int json_buffer_reserve(json_buffer_t *b, size_t len) /* {{{ */
+{
+  if (b->pos + len < b->size)
+    return 0;
+  if (b->fixed)
     return -ENOMEM;
 
-  dst_pos = 0;
+  size_t size = (b->size < JSON_BUFFER_MIN_SIZE) ? JSON_BUFFER_MIN_SIZE : b->size;
+  while (size <= b->pos + len)
+    size *= 2;
 
-#define BUFFER_ADD(c)                                                          \
-  do {                                                                         \
-    if (dst_pos >= (buffer_size - 1)) {                                        \
-      buffer[buffer_size - 1] = '\0';                                          \
-      return -ENOMEM;                                                          \
-    }                                                                          \
-    buffer[dst_pos] = (c);                                                     \
-    dst_pos++;                                                                 \
-  } while (0)
+  char *ptr = realloc(b->ptr, size);
+  if (ptr == NULL)
+    return -ENOMEM;
 
-  /* Escape special characters */
-  BUFFER_ADD('"');
-  for (size_t src_pos = 0; string[src_pos] != 0; src_pos++) {
-    if ((string[src_pos] == '"') || (string[src_pos] == '\\')) {
-      BUFFER_ADD('\\');
-      BUFFER_ADD(string[src_pos]);
-    } else if (string[src_pos] <= 0x001F)
-      BUFFER_ADD('?');
-    else
-      BUFFER_ADD(string[src_pos]);
-  } /* for */
-  BUFFER_ADD('"');
-  buffer[dst_pos] = 0;
+  b->ptr = ptr;
+  b->size = size;
+  return 0;
+} /* }}} int json_buffer_reserve */
 
-#undef BUFFER_ADD
+int json_buffer_append(json_buffer_t *b, char const *s, size_t len) /* {{{ */
+{
+  int status = json_buffer_reserve(b, len);
+  if (status != 0)
+    return status;
 
+  memcpy(b->ptr + b->pos, s, len);
+  b->pos += len;
+  b->ptr[b->pos] = 0;
   return 0;
-} /* }}} int json_escape_string */
+} /* }}} int json_buffer_append */
 
-static int values_to_json(char *buffer, size_t buffer_size, /* {{{ */
-                          const data_set_t *ds, const value_list_t *vl,
-                          int store_rates) {
-  size_t offset = 0;
-  gauge_t *rates = NULL;
+int json_buffer_printf(json_buffer_t *b, char const *format, ...) /* {{{ */
+{
+  va_list ap;
+  int status;
 
-  memset(buffer, 0, buffer_size);
+  /* Most numbers fit into the space that is reserved here, so formatting
+   * rarely has to be repeated after growing the buffer. */
+  if (!b->fixed && (json_buffer_reserve(b, 64) != 0))
+    return -ENOMEM;
+
+  size_t avail = b->size - b->pos;
+  va_start(ap, format);
+  status = vsnprintf((avail > 0) ? b->ptr + b->pos : NULL, avail, format, ap);
+  va_end(ap);
+  if (status < 0)
+    return -1;
 
+  size_t len = (size_t)status;
+  if (len >= avail) {
+    if (avail > 0)
+      b->ptr[b->pos] = 0;
+    if (json_buffer_reserve(b, len) != 0)
+      return -ENOMEM;
+
+    va_start(ap, format);
+    vsnprintf(b->ptr + b->pos, b->size - b->pos, format, ap);
+    va_end(ap);
+  }
+
+  b->pos += len;
+  return 0;
+} /* }}} int json_buffer_printf */
+
+/* Returns the length of the prefix of `s' which can be copied without
+ * escaping, i.e. which contains neither quotes, backslashes nor control
+ * characters. Bytes >= 0x80 are passed through, so UTF-8 is preserved. The
+ * vectorized loops only ever read within the first `len' bytes. */
+static size_t json_plain_prefix(unsigned char const *s, size_t len) /* {{{ */
+{
+  size_t i = 0;
+
+#if defined(__AVX2__)
+  __m256i const quote32 = _mm256_set1_epi8('"');
+  __m256i const bslash32 = _mm256_set1_epi8('\\');
+  __m256i const ctrl32 = _mm256_set1_epi8(0x1F);
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((__m256i const *)(s + i));
+    __m256i m = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, quote32),
+                        _mm256_cmpeq_epi8(v, bslash32)),
+        /* unsigned v <= 0x1F */
+        _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctrl32), v));
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(m);
+    if (mask != 0)
+      return i + (size_t)__builtin_ctz(mask);
+  }
+#endif
+#if defined(__SSE2__)
+  __m128i const quote = _mm_set1_epi8('"');
+  __m128i const bslash = _mm_set1_epi8('\\');
+  __m128i const ctrl = _mm_set1_epi8(0x1F);
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((__m128i const *)(s + i));
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)),
+        _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v));
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(m);
+    if (mask != 0)
+      return i + (size_t)__builtin_ctz(mask);
+  }
+#else
+  /* Portable fallback: test eight bytes at a time using the "has less than"
+   * and "has zero byte" tricks and only look at words which matched. */
+  uint64_t const ones = UINT64_C(0x0101010101010101);
+  uint64_t const highs = UINT64_C(0x8080808080808080);
+  for (; i + 8 <= len; i += 8) {
+    uint64_t v;
+    memcpy(&v, s + i, sizeof(v));
+
+    uint64_t q = v ^ (ones * '"');
+    uint64_t b = v ^ (ones * '\\');
+    uint64_t hit = ((v - ones * 0x20) & ~v) | ((q - ones) & ~q) |
+                   ((b - ones) & ~b);
+    if ((hit & highs) != 0)
+      break;
+  }
+#endif
+
+  for (; i < len; i++) {
+    if ((s[i] == '"') || (s[i] == '\\') || (s[i] < 0x20))
+      return i;
+  }
+  return len;
+} /* }}} size_t json_plain_prefix */
+
+int json_buffer_append_string(json_buffer_t *b, char const *s) /* {{{ */
+{
+  size_t start = b->pos;
+  size_t len = strlen(s);
+  unsigned char const *src = (unsigned char const *)s;
+  int status;
+
+  /* Reserve for the common case of a string without special characters. */
+  if ((status = json_buffer_reserve(b, len + 2)) != 0)
+    return status;
+  b->ptr[b->pos++] = '"';
+
+  while (len > 0) {
+    size_t n = json_plain_prefix(src, len);
+    if ((n > 0) && ((status = json_buffer_append(b, (char const *)src, n)) != 0))
+      break;
+    src += n;
+    len -= n;
+    if (len == 0)
+      break;
+
+    char esc[8];
+    switch (*src) {
+    case '"':
+      status = json_buffer_append(b, "\\\"", 2);
+      break;
+    case '\\':
+      status = json_buffer_append(b, "\\\\", 2);
+      break;
+    case '\b':
+      status = json_buffer_append(b, "\\b", 2);
+      break;
+    case '\f':
+      status = json_buffer_append(b, "\\f", 2);
+      break;
+    case '\n':
+      status = json_buffer_append(b, "\\n", 2);
+      break;
+    case '\r':
+      status = json_buffer_append(b, "\\r", 2);
+      break;
+    case '\t':
+      status = json_buffer_append(b, "\\t", 2);
+      break;
+    default:
+      snprintf(esc, sizeof(esc), "\\u%04x", (unsigned int)*src);
+      status = json_buffer_append(b, esc, 6);
+    }
+    if (status != 0)
+      break;
+    src++;
+    len--;
+  }
+
+  if ((status == 0) && ((status = json_buffer_append(b, "\"", 1)) == 0))
+    return 0;
+
+  b->pos = start;
+  b->ptr[start] = 0;
+  return status;
+} /* }}} int json_buffer_append_string */
+
+/*
+ * Value lists
+ */
 #define BUFFER_ADD(...)                                                        \
   do {                                                                         \
-    int status;                                                                \
-    status = snprintf(buffer + offset, buffer_size - offset, __VA_ARGS__);     \
-    if (status < 1) {                                                          \
-      sfree(rates);                                                            \
-      return -1;                                                               \
-    } else if (((size_t)status) >= (buffer_size - offset)) {                   \
-      sfree(rates);                                                            \
-      return -ENOMEM;                                                          \
-    } else                                                                     \
-      offset += ((size_t)status);                                              \
+    status = json_buffer_printf(b, __VA_ARGS__);                               \
+    if (status != 0)                                                           \
+      goto out;                                                                \
   } while (0)
 
+#define BUFFER_ADD_STRING(s)                                                   \
+  do {                                                                         \
+    status = json_buffer_append_string(b, (s));                                \
+    if (status != 0)                                                           \
+      goto out;                                                                \
+  } while (0)
+
+static int values_to_json(json_buffer_t *b, /* {{{ */
+                          const data_set_t *ds, const value_list_t *vl,
+                          int store_rates) {
+  gauge_t *rates = NULL;
+  int status = 0;
+
   BUFFER_ADD("[");
   for (size_t i = 0; i < ds->ds_num; i++) {
     if (i > 0)
@@ -121,8 +313,8 @@ static int values_to_json(char *buffer, size_t buffer_size, /* {{{ */
         rates = uc_get_rate(ds, vl);
       if (rates == NULL) {
         WARNING("utils_format_json: uc_get_rate failed.");
-        sfree(rates);
-        return -1;
+        status = -1;
+        goto out;
       }
 
       if (isfinite(rates[i]))
@@ -137,35 +329,20 @@ static int values_to_json(char *buffer, size_t buffer_size, /* {{{ */
       BUFFER_ADD("%" PRIu64, vl->values[i].absolute);
     else {
       ERROR("format_json: Unknown data source type: %i", ds->ds[i].type);
-      sfree(rates);
-      return -1;
+      status = -1;
+      goto out;
     }
   } /* for ds->ds_num */
   BUFFER_ADD("]");
 
-#undef BUFFER_ADD
-
+out:
   sfree(rates);
-  return 0;
+  return status;
 } /* }}} int values_to_json */
 
-static int dstypes_to_json(char *buffer, size_t buffer_size, /* {{{ */
-                           const data_set_t *ds) {
-  size_t offset = 0;
-
-  memset(buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    int status;                                                                \
-    status = snprintf(buffer + offset, buffer_size - offset, __VA_ARGS__);     \
-    if (status < 1)                                                            \
-      return -1;                                                               \
-    else if (((size_t)status) >= (buffer_size - offset))                       \
-      return -ENOMEM;                                                          \
-    else                                                                       \
-      offset += ((size_t)status);                                              \
-  } while (0)
+static int dstypes_to_json(json_buffer_t *b, const data_set_t *ds) /* {{{ */
+{
+  int status = 0;
 
   BUFFER_ADD("[");
   for (size_t i = 0; i < ds->ds_num; i++) {
@@ -176,180 +353,139 @@ static int dstypes_to_json(char *buffer, size_t buffer_size, /* {{{ */
   } /* for ds->ds_num */
   BUFFER_ADD("]");
 
-#undef BUFFER_ADD
-
-  return 0;
+out:
+  return status;
 } /* }}} int dstypes_to_json */
 
-static int dsnames_to_json(char *buffer, size_t buffer_size, /* {{{ */
-                           const data_set_t *ds) {
-  size_t offset = 0;
-
-  memset(buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    int status;                                                                \
-    status = snprintf(buffer + offset, buffer_size - offset, __VA_ARGS__);     \
-    if (status < 1)                                                            \
-      return -1;                                                               \
-    else if (((size_t)status) >= (buffer_size - offset))                       \
-      return -ENOMEM;                                                          \
-    else                                                                       \
-      offset += ((size_t)status);                                              \
-  } while (0)
+static int dsnames_to_json(json_buffer_t *b, const data_set_t *ds) /* {{{ */
+{
+  int status = 0;
 
   BUFFER_ADD("[");
   for (size_t i = 0; i < ds->ds_num; i++) {
     if (i > 0)
       BUFFER_ADD(",");
 
-    BUFFER_ADD("\"%s\"", ds->ds[i].name);
+    BUFFER_ADD_STRING(ds->ds[i].name);
   } /* for ds->ds_num */
   BUFFER_ADD("]");
 
-#undef BUFFER_ADD
-
-  return 0;
+out:
+  return status;
 } /* }}} int dsnames_to_json */
 
-static int meta_data_keys_to_json(char *buffer, size_t buffer_size, /* {{{ */
+static int meta_data_keys_to_json(json_buffer_t *b, /* {{{ */
                                   meta_data_t *meta, char **keys,
                                   size_t keys_num) {
-  size_t offset = 0;
-  int status;
-
-  buffer[0] = 0;
-
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    status = snprintf(buffer + offset, buffer_size - offset, __VA_ARGS__);     \
-    if (status < 1)                                                            \
-      return -1;                                                               \
-    else if (((size_t)status) >= (buffer_size - offset))                       \
-      return -ENOMEM;                                                          \
-    else                                                                       \
-      offset += ((size_t)status);                                              \
-  } while (0)
+  size_t start = b->pos;
+  int status = 0;
 
   for (size_t i = 0; i < keys_num; ++i) {
     int type;
     char *key = keys[i];
 
     type = meta_data_type(meta, key);
+    if ((type != MD_TYPE_STRING) && (type != MD_TYPE_SIGNED_INT) &&
+        (type != MD_TYPE_UNSIGNED_INT) && (type != MD_TYPE_DOUBLE) &&
+        (type != MD_TYPE_BOOLEAN))
+      continue;
+
+    BUFFER_ADD((b->pos == start) ? "{" : ",");
+    BUFFER_ADD_STRING(key);
+    BUFFER_ADD(":");
+
     if (type == MD_TYPE_STRING) {
       char *value = NULL;
       if (meta_data_get_string(meta, key, &value) == 0) {
-        char temp[512] = "";
-
-        status = json_escape_string(temp, sizeof(temp), value);
+        status = json_buffer_append_string(b, value);
         sfree(value);
         if (status != 0)
-          return status;
-
-        BUFFER_ADD(",\"%s\":%s", key, temp);
-      }
+          goto out;
+      } else
+        BUFFER_ADD("null");
     } else if (type == MD_TYPE_SIGNED_INT) {
       int64_t value = 0;
-      if (meta_data_get_signed_int(meta, key, &value) == 0)
-        BUFFER_ADD(",\"%s\":%" PRIi64, key, value);
+      meta_data_get_signed_int(meta, key, &value);
+      BUFFER_ADD("%" PRIi64, value);
     } else if (type == MD_TYPE_UNSIGNED_INT) {
       uint64_t value = 0;
-      if (meta_data_get_unsigned_int(meta, key, &value) == 0)
-        BUFFER_ADD(",\"%s\":%" PRIu64, key, value);
+      meta_data_get_unsigned_int(meta, key, &value);
+      BUFFER_ADD("%" PRIu64, value);
     } else if (type == MD_TYPE_DOUBLE) {
       double value = 0.0;
-      if (meta_data_get_double(meta, key, &value) == 0)
-        BUFFER_ADD(",\"%s\":%f", key, value);
+      meta_data_get_double(meta, key, &value);
+      BUFFER_ADD("%f", value);
     } else if (type == MD_TYPE_BOOLEAN) {
       bool value = false;
-      if (meta_data_get_boolean(meta, key, &value) == 0)
-        BUFFER_ADD(",\"%s\":%s", key, value ? "true" : "false");
+      meta_data_get_boolean(meta, key, &value);
+      BUFFER_ADD("%s", value ? "true" : "false");
     }
   } /* for (keys) */
 
-  if (offset == 0)
+  if (b->pos == start)
     return ENOENT;
 
-  buffer[0] = '{'; /* replace leading ',' */
   BUFFER_ADD("}");
 
-#undef BUFFER_ADD
-
-  return 0;
+out:
+  return status;
 } /* }}} int meta_data_keys_to_json */
 
-static int meta_data_to_json(char *buffer, size_t buffer_size, /* {{{ */
-                             meta_data_t *meta) {
+static int meta_data_to_json(json_buffer_t *b, meta_data_t *meta) /* {{{ */
+{
   char **keys = NULL;
   size_t keys_num;
   int status;
 
-  if ((buffer == NULL) || (buffer_size == 0) || (meta == NULL))
-    return EINVAL;
-
   status = meta_data_toc(meta, &keys);
   if (status <= 0)
     return status;
   keys_num = (size_t)status;
 
-  status = meta_data_keys_to_json(buffer, buffer_size, meta, keys, keys_num);
+  /* Only add the "meta" key if there is at least one supported entry. */
+  size_t start = b->pos;
+  status = json_buffer_append(b, ",\"meta\":", strlen(",\"meta\":"));
+  if (status == 0)
+    status = meta_data_keys_to_json(b, meta, keys, keys_num);
+  if (status != 0) {
+    b->pos = start;
+    b->ptr[start] = 0;
+  }
 
   for (size_t i = 0; i < keys_num; ++i)
     sfree(keys[i]);
   sfree(keys);
 
-  return status;
+  return (status == ENOENT) ? 0 : status;
 } /* }}} int meta_data_to_json */
 
-static int value_list_to_json(char *buffer, size_t buffer_size, /* {{{ */
-                              const data_set_t *ds, const value_list_t *vl,
-                              int store_rates) {
-  char temp[512];
-  size_t offset = 0;
-  int status;
-
-  memset(buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    status = snprintf(buffer + offset, buffer_size - offset, __VA_ARGS__);     \
-    if (status < 1)                                                            \
-      return -1;                                                               \
-    else if (((size_t)status) >= (buffer_size - offset))                       \
-      return -ENOMEM;                                                          \
-    else                                                                       \
-      offset += ((size_t)status);                                              \
-  } while (0)
-
-  /* All value lists have a leading comma. The first one will be replaced with
-   * a square bracket in `format_json_finalize'. */
-  BUFFER_ADD(",{");
-
-  status = values_to_json(temp, sizeof(temp), ds, vl, store_rates);
-  if (status != 0)
-    return status;
-  BUFFER_ADD("\"values\":%s", temp);
+int format_json_value_list_object(json_buffer_t *b, /* {{{ */
+                                  const data_set_t *ds,
+                                  const value_list_t *vl, int store_rates) {
+  size_t start;
+  int status = 0;
 
-  status = dstypes_to_json(temp, sizeof(temp), ds);
-  if (status != 0)
-    return status;
-  BUFFER_ADD(",\"dstypes\":%s", temp);
-
-  status = dsnames_to_json(temp, sizeof(temp), ds);
-  if (status != 0)
-    return status;
-  BUFFER_ADD(",\"dsnames\":%s", temp);
+  if ((b == NULL) || (ds == NULL) || (vl == NULL))
+    return -EINVAL;
+  start = b->pos;
+
+  BUFFER_ADD("{\"values\":");
+  if ((status = values_to_json(b, ds, vl, store_rates)) != 0)
+    goto out;
+  BUFFER_ADD(",\"dstypes\":");
+  if ((status = dstypes_to_json(b, ds)) != 0)
+    goto out;
+  BUFFER_ADD(",\"dsnames\":");
+  if ((status = dsnames_to_json(b, ds)) != 0)
+    goto out;
 
   BUFFER_ADD(",\"time\":%.3f", CDTIME_T_TO_DOUBLE(vl->time));
   BUFFER_ADD(",\"interval\":%.3f", CDTIME_T_TO_DOUBLE(vl->interval));
 
 #define BUFFER_ADD_KEYVAL(key, value)                                          \
   do {                                                                         \
-    status = json_escape_string(temp, sizeof(temp), (value));                  \
-    if (status != 0)                                                           \
-      return status;                                                           \
-    BUFFER_ADD(",\"%s\":%s", (key), temp);                                     \
+    BUFFER_ADD(",\"%s\":", (key));                                             \
+    BUFFER_ADD_STRING(value);                                                  \
   } while (0)
 
   BUFFER_ADD_KEYVAL("host", vl->host);
@@ -358,44 +494,26 @@ static int value_list_to_json(char *buffer, size_t buffer_size, /* {{{ */
   BUFFER_ADD_KEYVAL("type", vl->type);
   BUFFER_ADD_KEYVAL("type_instance", vl->type_instance);
 
-  if (vl->meta != NULL) {
-    char meta_buffer[buffer_size];
-    memset(meta_buffer, 0, sizeof(meta_buffer));
-    status = meta_data_to_json(meta_buffer, sizeof(meta_buffer), vl->meta);
-    if (status != 0)
-      return status;
-
-    BUFFER_ADD(",\"meta\":%s", meta_buffer);
-  } /* if (vl->meta != NULL) */
-
-  BUFFER_ADD("}");
-
 #undef BUFFER_ADD_KEYVAL
-#undef BUFFER_ADD
 
-  return 0;
-} /* }}} int value_list_to_json */
-
-static int format_json_value_list_nocheck(char *buffer, /* {{{ */
-                                          size_t *ret_buffer_fill,
-                                          size_t *ret_buffer_free,
-                                          const data_set_t *ds,
-                                          const value_list_t *vl,
-                                          int store_rates, size_t temp_size) {
-  char temp[temp_size];
-  int status;
+  if (vl->meta != NULL) {
+    if ((status = meta_data_to_json(b, vl->meta)) != 0)
+      goto out;
+  }
 
-  status = value_list_to_json(temp, sizeof(temp), ds, vl, store_rates);
-  if (status != 0)
-    return status;
-  temp_size = strlen(temp);
+  BUFFER_ADD("}");
 
-  memcpy(buffer + (*ret_buffer_fill), temp, temp_size + 1);
-  (*ret_buffer_fill) += temp_size;
-  (*ret_buffer_free) -= temp_size;
+out:
+  if (status != 0) {
+    b->pos = start;
+    if (b->size > 0)
+      b->ptr[start] = 0;
+  }
+  return status;
+} /* }}} int format_json_value_list_object */
 
-  return 0;
-} /* }}} int format_json_value_list_nocheck */
+#undef BUFFER_ADD_STRING
+#undef BUFFER_ADD
 
 int format_json_initialize(char *buffer, /* {{{ */
                            size_t *ret_buffer_fill, size_t *ret_buffer_free) {
@@ -433,7 +551,7 @@ int format_json_finalize(char *buffer, /* {{{ */
   if (*ret_buffer_free < 2)
     return -ENOMEM;
 
-  /* Replace the leading comma added in `value_list_to_json' with a square
+  /* Replace the leading comma added in `format_json_value_list' with a square
    * bracket. */
   if (buffer[0] != ',')
     return -EINVAL;
@@ -453,6 +571,9 @@ int format_json_value_list(char *buffer, /* {{{ */
                            size_t *ret_buffer_fill, size_t *ret_buffer_free,
                            const data_set_t *ds, const value_list_t *vl,
                            int store_rates) {
+  json_buffer_t b;
+  int status;
+
   if ((buffer == NULL) || (ret_buffer_fill == NULL) ||
       (ret_buffer_free == NULL) || (ds == NULL) || (vl == NULL))
     return -EINVAL;
@@ -460,9 +581,23 @@ int format_json_value_list(char *buffer, /* {{{ */
   if (*ret_buffer_free < 3)
     return -ENOMEM;
 
-  return format_json_value_list_nocheck(buffer, ret_buffer_fill,
-                                        ret_buffer_free, ds, vl, store_rates,
-                                        (*ret_buffer_free) - 2);
+  /* Keep one byte for the closing bracket added by `format_json_finalize'. */
+  json_buffer_init_fixed(&b, buffer + *ret_buffer_fill, *ret_buffer_free - 1);
+
+  /* All value lists have a leading comma. The first one will be replaced with
+   * a square bracket in `format_json_finalize'. */
+  status = json_buffer_append(&b, ",", 1);
+  if (status == 0)
+    status = format_json_value_list_object(&b, ds, vl, store_rates);
+  if (status != 0) {
+    buffer[*ret_buffer_fill] = 0;
+    return status;
+  }
+
+  (*ret_buffer_fill) += b.pos;
+  (*ret_buffer_free) -= b.pos;
+
+  return 0;
 } /* }}} int format_json_value_list */
 
 #if HAVE_LIBYAJL
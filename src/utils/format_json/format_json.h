@@ -35,6 +35,48 @@
 #define JSON_GAUGE_FORMAT GAUGE_FORMAT
 #endif
 
+/*
+ * A null terminated output buffer for the JSON encoder. Buffers set up with
+ * `json_buffer_init' grow as needed and must be released with
+ * `json_buffer_free'. Buffers set up with `json_buffer_init_fixed' wrap
+ * caller-provided memory; appending to them fails with -ENOMEM once full.
+ */
+typedef struct {
+  char *ptr;
+  size_t pos;  /* length of the content, excluding the null byte */
+  size_t size; /* allocated size */
+  bool fixed;
+} json_buffer_t;
+
+void json_buffer_init(json_buffer_t *b);
+void json_buffer_init_fixed(json_buffer_t *b, char *ptr, size_t size);
+/* Empties the buffer but keeps the allocated memory for reuse. */
+void json_buffer_reset(json_buffer_t *b);
+void json_buffer_free(json_buffer_t *b);
+
+int json_buffer_append(json_buffer_t *b, char const *s, size_t len);
+int json_buffer_printf(json_buffer_t *b, char const *format, ...)
+    __attribute__((format(printf, 2, 3)));
+/* Appends `s' as a quoted JSON string. Characters which need escaping are
+ * located several bytes at a time, so runs of plain text are copied as a
+ * whole. On failure the buffer is left unchanged. */
+int json_buffer_append_string(json_buffer_t *b, char const *s);
+
+/*
+ * NAME
+ *   format_json_value_list_object
+ *
+ * DESCRIPTION
+ *   Appends the JSON object describing `vl' to `b', without any separator.
+ *   Unlike `format_json_value_list', the size of the output is only limited
+ *   by the buffer, so the value list never has to be formatted twice.
+ *
+ * RETURN VALUE
+ *   Zero upon success. Upon failure the buffer is left unchanged.
+ */
+int format_json_value_list_object(json_buffer_t *b, const data_set_t *ds,
+                                  const value_list_t *vl, int store_rates);
+
 int format_json_initialize(char *buffer, size_t *ret_buffer_fill,
                            size_t *ret_buffer_free);
 int format_json_value_list(char *buffer, size_t *ret_buffer_fill,
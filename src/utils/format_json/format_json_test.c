@@ -177,8 +177,212 @@ DEF_TEST(notification) {
   return expect_json_labels(got, labels, STATIC_ARRAY_SIZE(labels));
 }
 
+/* Straightforward reference implementation of the string escaping. */
+static void escape_reference(char *buffer, size_t buffer_size, char const *s) {
+  size_t pos = 0;
+
+  buffer[pos++] = '"';
+  for (unsigned char const *c = (void *)s; *c != 0; c++) {
+    assert(pos + 8 < buffer_size);
+    if ((*c == '"') || (*c == '\\')) {
+      buffer[pos++] = '\\';
+      buffer[pos++] = (char)*c;
+    } else if (*c == '\n') {
+      buffer[pos++] = '\\';
+      buffer[pos++] = 'n';
+    } else if (*c == '\t') {
+      buffer[pos++] = '\\';
+      buffer[pos++] = 't';
+    } else if (*c < 0x20) {
+      pos += (size_t)snprintf(buffer + pos, buffer_size - pos, "\\u%04x", *c);
+    } else {
+      buffer[pos++] = (char)*c;
+    }
+  }
+  buffer[pos++] = '"';
+  buffer[pos] = 0;
+}
+
+DEF_TEST(escape) {
+  struct {
+    char const *in;
+    char const *want;
+  } cases[] = {
+      {"", "\"\""},
+      {"foo", "\"foo\""},
+      {"say \"hi\"", "\"say \\\"hi\\\"\""},
+      {"C:\\", "\"C:\\\\\""},
+      {"line\nbreak\ttab\x01", "\"line\\nbreak\\ttab\\u0001\""},
+      {"gr\xc3\xbc\xc3\x9f" "e", "\"gr\xc3\xbc\xc3\x9f" "e\""},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    json_buffer_t b;
+    json_buffer_init(&b);
+    CHECK_ZERO(json_buffer_append_string(&b, cases[i].in));
+    EXPECT_EQ_STR(cases[i].want, b.ptr);
+    json_buffer_free(&b);
+  }
+
+  /* Put a special character at every position of strings which are long
+   * enough to exercise the vectorized code paths and their boundaries. */
+  char const specials[] = {'"', '\\', '\n', 0x1f};
+  json_buffer_t b;
+  json_buffer_init(&b);
+  for (size_t len = 1; len <= 100; len++) {
+    for (size_t pos = 0; pos < len; pos++) {
+      char in[128];
+      char want[1024];
+
+      memset(in, 'x', len);
+      in[len] = 0;
+      in[pos] = specials[(len + pos) % STATIC_ARRAY_SIZE(specials)];
+      escape_reference(want, sizeof(want), in);
+
+      json_buffer_reset(&b);
+      CHECK_ZERO(json_buffer_append_string(&b, in));
+      if (strcmp(want, b.ptr) != 0) {
+        EXPECT_EQ_STR(want, b.ptr);
+      }
+    }
+  }
+  json_buffer_free(&b);
+
+  /* A fixed buffer which is too small is left unchanged. */
+  char small[8];
+  json_buffer_init_fixed(&b, small, sizeof(small));
+  CHECK_ZERO(json_buffer_append(&b, "ab", 2));
+  EXPECT_EQ_INT(-ENOMEM, json_buffer_append_string(&b, "0123456789"));
+  EXPECT_EQ_STR("ab", small);
+  EXPECT_EQ_INT(2, (int)b.pos);
+
+  return 0;
+}
+
+static data_source_t test_ds_sources[] = {
+    {"value", DS_TYPE_GAUGE, 0, NAN},
+    {"count", DS_TYPE_DERIVE, 0, NAN},
+};
+static data_set_t test_ds = {"test", STATIC_ARRAY_SIZE(test_ds_sources),
+                             test_ds_sources};
+
+static void make_value_list(value_list_t *vl, value_t *values) {
+  values[0].gauge = 42.5;
+  values[1].derive = 1337;
+  *vl = (value_list_t){
+      .values = values,
+      .values_len = 2,
+      .time = MS_TO_CDTIME_T(1480063672044),
+      .interval = TIME_T_TO_CDTIME_T(10),
+      .host = "example.com",
+      .plugin = "unit",
+      .plugin_instance = "\"quoted\"",
+      .type = "test",
+  };
+}
+
+DEF_TEST(value_list) {
+  value_t values[2];
+  value_list_t vl;
+  make_value_list(&vl, values);
+
+  char const *want =
+      "{\"values\":[42.5,1337],\"dstypes\":[\"gauge\",\"derive\"],"
+      "\"dsnames\":[\"value\",\"count\"],\"time\":1480063672.044,"
+      "\"interval\":10.000,\"host\":\"example.com\",\"plugin\":\"unit\","
+      "\"plugin_instance\":\"\\\"quoted\\\"\",\"type\":\"test\","
+      "\"type_instance\":\"\"}";
+
+  json_buffer_t b;
+  json_buffer_init(&b);
+  CHECK_ZERO(format_json_value_list_object(&b, &test_ds, &vl, 0));
+  EXPECT_EQ_STR(want, b.ptr);
+  json_buffer_free(&b);
+
+  /* The fixed buffer interface produces an array of the same objects. */
+  char buffer[1024];
+  size_t bfill = 0;
+  size_t bfree = sizeof(buffer);
+  char want_array[1024];
+  snprintf(want_array, sizeof(want_array), "[%s,%s]", want, want);
+
+  CHECK_ZERO(format_json_initialize(buffer, &bfill, &bfree));
+  CHECK_ZERO(format_json_value_list(buffer, &bfill, &bfree, &test_ds, &vl, 0));
+  CHECK_ZERO(format_json_value_list(buffer, &bfill, &bfree, &test_ds, &vl, 0));
+  CHECK_ZERO(format_json_finalize(buffer, &bfill, &bfree));
+  EXPECT_EQ_STR(want_array, buffer);
+  EXPECT_EQ_INT((int)strlen(want_array), (int)bfill);
+
+  /* If the value list does not fit, the buffer is left unchanged. */
+  bfill = 0;
+  bfree = strlen(want) + 2;
+  CHECK_ZERO(format_json_initialize(buffer, &bfill, &bfree));
+  EXPECT_EQ_INT(-ENOMEM, format_json_value_list(buffer, &bfill, &bfree,
+                                                &test_ds, &vl, 0));
+  EXPECT_EQ_INT(0, (int)bfill);
+  EXPECT_EQ_STR("", buffer);
+
+  return 0;
+}
+
+/* cdtime() is mocked in unit tests. */
+static double monotonic_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Not a correctness test: reports the throughput of the encoder so changes to
+ * the fast paths can be compared. */
+DEF_TEST(benchmark) {
+  char text[4096];
+  for (size_t i = 0; i < sizeof(text) - 1; i++)
+    text[i] = (char)('a' + (i % 26));
+  text[sizeof(text) - 1] = 0;
+
+  json_buffer_t b;
+  json_buffer_init(&b);
+
+  size_t iterations = 20000;
+  double start = monotonic_seconds();
+  for (size_t i = 0; i < iterations; i++) {
+    json_buffer_reset(&b);
+    CHECK_ZERO(json_buffer_append_string(&b, text));
+  }
+  double elapsed = monotonic_seconds() - start;
+  printf("escape: %.1f MiB/s\n",
+         (double)(iterations * sizeof(text)) / (1024.0 * 1024.0) / elapsed);
+
+  char reference[2 * sizeof(text)];
+  start = monotonic_seconds();
+  for (size_t i = 0; i < iterations; i++)
+    escape_reference(reference, sizeof(reference), text);
+  elapsed = monotonic_seconds() - start;
+  printf("escape (byte by byte): %.1f MiB/s\n",
+         (double)(iterations * sizeof(text)) / (1024.0 * 1024.0) / elapsed);
+
+  value_t values[2];
+  value_list_t vl;
+  make_value_list(&vl, values);
+
+  iterations = 100000;
+  json_buffer_reset(&b);
+  start = monotonic_seconds();
+  for (size_t i = 0; i < iterations; i++)
+    CHECK_ZERO(format_json_value_list_object(&b, &test_ds, &vl, 0));
+  elapsed = monotonic_seconds() - start;
+  printf("value lists: %.0f/s (%zu bytes)\n", (double)iterations / elapsed,
+         b.pos);
+
+  json_buffer_free(&b);
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(notification);
+  RUN_TEST(escape);
+  RUN_TEST(value_list);
+  RUN_TEST(benchmark);
 
   END_TEST;
 }
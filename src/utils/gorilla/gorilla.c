@@ -0,0 +1,485 @@
+/**
+ * collectd - src/utils/gorilla/gorilla.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ **/
+
+#include "collectd.h"
+
+#include "utils/common/common.h"
+#include "utils/gorilla/gorilla.h"
+
+/* Number of samples per block. Smaller blocks make expiry more precise,
+ * larger blocks amortize the uncompressed first sample better. */
+#define GORILLA_BLOCK_POINTS 120
+#define GORILLA_INITIAL_SIZE 64
+
+/* Marks a column whose XOR window has not been set yet. */
+#define GORILLA_NO_WINDOW 0xff
+
+/*
+ * Layout of a block (all fields are written MSB first):
+ *
+ *   first sample:  time (64 bits), value[0..n] (64 bits each)
+ *   other samples: delta-of-delta of the time, XOR-encoded value[0..n]
+ *
+ * delta-of-delta (milliseconds):
+ *   '0'                          dod == 0
+ *   '10'   + 7 bits              dod in [-63, 64]
+ *   '110'  + 9 bits              dod in [-255, 256]
+ *   '1110' + 12 bits             dod in [-2047, 2048]
+ *   '1111' + 64 bits             anything else
+ *
+ * value (XOR with the previous value of the same column):
+ *   '0'                          identical value
+ *   '10' + significant bits      fits into the previous leading/trailing window
+ *   '11' + 5 bits leading zeros + 6 bits (length - 1) + significant bits
+ */
+
+typedef struct gorilla_block_s gorilla_block_t;
+struct gorilla_block_s {
+  uint8_t *data;
+  size_t data_size; /* bytes allocated */
+  size_t bits;      /* bits used */
+
+  size_t points_num;
+  uint64_t first_ms;
+  uint64_t last_ms;
+
+  gorilla_block_t *next;
+};
+
+typedef struct {
+  uint64_t value;
+  uint8_t leading;
+  uint8_t trailing;
+} gorilla_column_t;
+
+struct gorilla_s {
+  size_t values_num;
+  uint64_t retention_ms;
+
+  /* Oldest block first; `tail' is the block currently being written to. */
+  gorilla_block_t *head;
+  gorilla_block_t *tail;
+  size_t points_num;
+
+  /* Encoder state of `tail'. */
+  int64_t last_delta;
+  gorilla_column_t *columns;
+};
+
+typedef struct {
+  uint8_t const *data;
+  size_t pos;
+} gorilla_reader_t;
+
+static int count_leading_zeros(uint64_t x) {
+#if defined(__GNUC__)
+  return __builtin_clzll(x);
+#else
+  int n = 0;
+  while ((x & (UINT64_C(1) << 63)) == 0) {
+    x <<= 1;
+    n++;
+  }
+  return n;
+#endif
+} /* int count_leading_zeros */
+
+static int count_trailing_zeros(uint64_t x) {
+#if defined(__GNUC__)
+  return __builtin_ctzll(x);
+#else
+  int n = 0;
+  while ((x & 1) == 0) {
+    x >>= 1;
+    n++;
+  }
+  return n;
+#endif
+} /* int count_trailing_zeros */
+
+static uint64_t gauge_to_bits(gauge_t g) {
+  uint64_t ret;
+  memcpy(&ret, &g, sizeof(ret));
+  return ret;
+}
+
+static gauge_t bits_to_gauge(uint64_t b) {
+  gauge_t ret;
+  memcpy(&ret, &b, sizeof(ret));
+  return ret;
+}
+
+/* Makes sure at least `bits' more bits can be written to the block. */
+static int block_reserve(gorilla_block_t *b, size_t bits) {
+  size_t need = (b->bits + bits + 7) / 8;
+  if (need <= b->data_size)
+    return 0;
+
+  size_t size = (b->data_size > 0) ? b->data_size : GORILLA_INITIAL_SIZE;
+  while (size < need)
+    size *= 2;
+
+  uint8_t *tmp = realloc(b->data, size);
+  if (tmp == NULL)
+    return ENOMEM;
+  memset(tmp + b->data_size, 0, size - b->data_size);
+
+  b->data = tmp;
+  b->data_size = size;
+  return 0;
+} /* int block_reserve */
+
+/* Releases the slack of a block that will not be written to anymore. */
+static void block_shrink(gorilla_block_t *b) {
+  size_t need = (b->bits + 7) / 8;
+  if ((need == 0) || (need >= b->data_size))
+    return;
+
+  uint8_t *tmp = realloc(b->data, need);
+  if (tmp == NULL)
+    return;
+
+  b->data = tmp;
+  b->data_size = need;
+} /* void block_shrink */
+
+static void block_free(gorilla_block_t *b) {
+  if (b == NULL)
+    return;
+
+  sfree(b->data);
+  sfree(b);
+} /* void block_free */
+
+static void bits_write(gorilla_block_t *b, uint64_t value, int nbits) {
+  while (nbits > 0) {
+    size_t byte = b->bits / 8;
+    int avail = 8 - (int)(b->bits % 8);
+    int n = (nbits < avail) ? nbits : avail;
+    uint8_t chunk = (uint8_t)((value >> (nbits - n)) & ((1U << n) - 1));
+
+    b->data[byte] |= (uint8_t)(chunk << (avail - n));
+    b->bits += (size_t)n;
+    nbits -= n;
+  }
+} /* void bits_write */
+
+static uint64_t bits_read(gorilla_reader_t *r, int nbits) {
+  uint64_t ret = 0;
+
+  while (nbits > 0) {
+    size_t byte = r->pos / 8;
+    int avail = 8 - (int)(r->pos % 8);
+    int n = (nbits < avail) ? nbits : avail;
+    uint8_t chunk = (uint8_t)((r->data[byte] >> (avail - n)) & ((1U << n) - 1));
+
+    ret = (ret << n) | chunk;
+    r->pos += (size_t)n;
+    nbits -= n;
+  }
+
+  return ret;
+} /* uint64_t bits_read */
+
+static void dod_write(gorilla_block_t *b, int64_t dod) {
+  if (dod == 0) {
+    bits_write(b, 0x0, 1);
+  } else if ((dod >= -63) && (dod <= 64)) {
+    bits_write(b, 0x2, 2);
+    bits_write(b, (uint64_t)(dod + 63), 7);
+  } else if ((dod >= -255) && (dod <= 256)) {
+    bits_write(b, 0x6, 3);
+    bits_write(b, (uint64_t)(dod + 255), 9);
+  } else if ((dod >= -2047) && (dod <= 2048)) {
+    bits_write(b, 0xe, 4);
+    bits_write(b, (uint64_t)(dod + 2047), 12);
+  } else {
+    bits_write(b, 0xf, 4);
+    bits_write(b, (uint64_t)dod, 64);
+  }
+} /* void dod_write */
+
+static int64_t dod_read(gorilla_reader_t *r) {
+  int ones = 0;
+  while ((ones < 4) && (bits_read(r, 1) == 1))
+    ones++;
+
+  switch (ones) {
+  case 0:
+    return 0;
+  case 1:
+    return (int64_t)bits_read(r, 7) - 63;
+  case 2:
+    return (int64_t)bits_read(r, 9) - 255;
+  case 3:
+    return (int64_t)bits_read(r, 12) - 2047;
+  default:
+    return (int64_t)bits_read(r, 64);
+  }
+} /* int64_t dod_read */
+
+static void value_write(gorilla_block_t *b, gorilla_column_t *col,
+                        uint64_t value) {
+  uint64_t xor = value ^ col->value;
+  col->value = value;
+
+  if (xor == 0) {
+    bits_write(b, 0x0, 1);
+    return;
+  }
+
+  int leading = count_leading_zeros(xor);
+  int trailing = count_trailing_zeros(xor);
+  /* The number of leading zeros is stored in five bits. */
+  if (leading > 31)
+    leading = 31;
+
+  if ((col->leading != GORILLA_NO_WINDOW) && (leading >= col->leading) &&
+      (trailing >= col->trailing)) {
+    bits_write(b, 0x2, 2);
+    bits_write(b, xor >> col->trailing, 64 - col->leading - col->trailing);
+    return;
+  }
+
+  int significant = 64 - leading - trailing;
+  bits_write(b, 0x3, 2);
+  bits_write(b, (uint64_t)leading, 5);
+  bits_write(b, (uint64_t)(significant - 1), 6);
+  bits_write(b, xor >> trailing, significant);
+
+  col->leading = (uint8_t)leading;
+  col->trailing = (uint8_t)trailing;
+} /* void value_write */
+
+static void value_read(gorilla_reader_t *r, gorilla_column_t *col) {
+  if (bits_read(r, 1) == 0)
+    return;
+
+  if (bits_read(r, 1) == 1) {
+    int leading = (int)bits_read(r, 5);
+    int significant = (int)bits_read(r, 6) + 1;
+
+    col->leading = (uint8_t)leading;
+    col->trailing = (uint8_t)(64 - leading - significant);
+  }
+
+  int significant = 64 - col->leading - col->trailing;
+  col->value ^= bits_read(r, significant) << col->trailing;
+} /* void value_read */
+
+gorilla_t *gorilla_create(size_t values_num, cdtime_t retention) {
+  if (values_num == 0)
+    return NULL;
+
+  gorilla_t *g = calloc(1, sizeof(*g));
+  if (g == NULL)
+    return NULL;
+
+  g->columns = calloc(values_num, sizeof(*g->columns));
+  if (g->columns == NULL) {
+    sfree(g);
+    return NULL;
+  }
+
+  g->values_num = values_num;
+  g->retention_ms = CDTIME_T_TO_MS(retention);
+
+  return g;
+} /* gorilla_t *gorilla_create */
+
+void gorilla_destroy(gorilla_t *g) {
+  if (g == NULL)
+    return;
+
+  gorilla_block_t *b = g->head;
+  while (b != NULL) {
+    gorilla_block_t *next = b->next;
+    block_free(b);
+    b = next;
+  }
+
+  sfree(g->columns);
+  sfree(g);
+} /* void gorilla_destroy */
+
+static void gorilla_expire(gorilla_t *g, uint64_t now_ms) {
+  if (now_ms < g->retention_ms)
+    return;
+
+  while ((g->head != NULL) && (g->head != g->tail) &&
+         (g->head->last_ms < (now_ms - g->retention_ms))) {
+    gorilla_block_t *b = g->head;
+
+    g->head = b->next;
+    g->points_num -= b->points_num;
+    block_free(b);
+  }
+} /* void gorilla_expire */
+
+int gorilla_append(gorilla_t *g, cdtime_t time, gauge_t const *values) {
+  if ((g == NULL) || (values == NULL))
+    return EINVAL;
+
+  uint64_t ms = CDTIME_T_TO_MS(time);
+  if ((g->tail != NULL) && (ms < g->tail->last_ms))
+    return EINVAL;
+
+  gorilla_block_t *b = g->tail;
+  bool new_block = false;
+  if ((b == NULL) || (b->points_num >= GORILLA_BLOCK_POINTS)) {
+    b = calloc(1, sizeof(*b));
+    if (b == NULL)
+      return ENOMEM;
+    new_block = true;
+  }
+
+  /* Reserve space for the worst case up front, so that a failing allocation
+   * never leaves a partially written sample behind. */
+  size_t max_bits = 68 + 77 * g->values_num;
+  if (block_reserve(b, max_bits) != 0) {
+    if (new_block)
+      block_free(b);
+    return ENOMEM;
+  }
+
+  if (b->points_num == 0) {
+    bits_write(b, ms, 64);
+    for (size_t i = 0; i < g->values_num; i++) {
+      g->columns[i].value = gauge_to_bits(values[i]);
+      g->columns[i].leading = GORILLA_NO_WINDOW;
+      g->columns[i].trailing = 0;
+      bits_write(b, g->columns[i].value, 64);
+    }
+
+    g->last_delta = 0;
+    b->first_ms = ms;
+  } else {
+    int64_t delta = (int64_t)(ms - b->last_ms);
+    dod_write(b, delta - g->last_delta);
+    g->last_delta = delta;
+
+    for (size_t i = 0; i < g->values_num; i++)
+      value_write(b, g->columns + i, gauge_to_bits(values[i]));
+  }
+
+  b->last_ms = ms;
+  b->points_num++;
+  g->points_num++;
+
+  if (new_block) {
+    if (g->tail != NULL) {
+      block_shrink(g->tail);
+      g->tail->next = b;
+    } else {
+      g->head = b;
+    }
+    g->tail = b;
+  }
+
+  gorilla_expire(g, ms);
+  return 0;
+} /* int gorilla_append */
+
+int gorilla_foreach(gorilla_t const *g, cdtime_t begin, cdtime_t end,
+                    gorilla_callback_t callback, void *user_data) {
+  if ((g == NULL) || (callback == NULL))
+    return EINVAL;
+
+  uint64_t begin_ms = CDTIME_T_TO_MS(begin);
+  uint64_t end_ms = (end == 0) ? UINT64_MAX : CDTIME_T_TO_MS(end);
+
+  gorilla_column_t *columns = calloc(g->values_num, sizeof(*columns));
+  gauge_t *values = calloc(g->values_num, sizeof(*values));
+  if ((columns == NULL) || (values == NULL)) {
+    sfree(columns);
+    sfree(values);
+    return ENOMEM;
+  }
+
+  int status = 0;
+  for (gorilla_block_t *b = g->head; (b != NULL) && (status == 0);
+       b = b->next) {
+    if (b->last_ms < begin_ms)
+      continue;
+    if (b->first_ms > end_ms)
+      break;
+
+    gorilla_reader_t r = {.data = b->data};
+    uint64_t ms = 0;
+    int64_t delta = 0;
+
+    for (size_t p = 0; p < b->points_num; p++) {
+      if (p == 0) {
+        ms = bits_read(&r, 64);
+        for (size_t i = 0; i < g->values_num; i++) {
+          columns[i].value = bits_read(&r, 64);
+          columns[i].leading = GORILLA_NO_WINDOW;
+          columns[i].trailing = 0;
+        }
+      } else {
+        delta += dod_read(&r);
+        ms += (uint64_t)delta;
+        for (size_t i = 0; i < g->values_num; i++)
+          value_read(&r, columns + i);
+      }
+
+      if (ms < begin_ms)
+        continue;
+      if (ms > end_ms)
+        break;
+
+      for (size_t i = 0; i < g->values_num; i++)
+        values[i] = bits_to_gauge(columns[i].value);
+
+      status = (*callback)(MS_TO_CDTIME_T(ms), values, g->values_num,
+                           user_data);
+      if (status != 0)
+        break;
+    }
+  }
+
+  sfree(columns);
+  sfree(values);
+  return status;
+} /* int gorilla_foreach */
+
+size_t gorilla_size(gorilla_t const *g) {
+  if (g == NULL)
+    return 0;
+
+  return g->points_num;
+} /* size_t gorilla_size */
+
+size_t gorilla_memory_usage(gorilla_t const *g) {
+  if (g == NULL)
+    return 0;
+
+  size_t ret = sizeof(*g) + g->values_num * sizeof(*g->columns);
+  for (gorilla_block_t *b = g->head; b != NULL; b = b->next)
+    ret += sizeof(*b) + b->data_size;
+
+  return ret;
+} /* size_t gorilla_memory_usage */
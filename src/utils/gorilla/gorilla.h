@@ -0,0 +1,118 @@
+/**
+ * collectd - src/utils/gorilla/gorilla.h
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ **/
+
+#ifndef UTILS_GORILLA_H
+#define UTILS_GORILLA_H 1
+
+#include "plugin.h"
+
+/*
+ * A compressed, time-bounded ring of samples for one series, using the
+ * encoding described in "Gorilla: A Fast, Scalable, In-Memory Time Series
+ * Database": timestamps are stored as delta-of-deltas, values as the XOR with
+ * their predecessor. Every sample holds `values_num' gauges sharing one
+ * timestamp. Timestamps are kept with millisecond resolution.
+ *
+ * Samples are stored in blocks of a fixed number of points. Whole blocks are
+ * dropped once their newest sample is older than the retention time, so the
+ * ring may hold up to one block of samples more than requested.
+ *
+ * The ring does not do any locking; callers must serialize access.
+ */
+struct gorilla_s;
+typedef struct gorilla_s gorilla_t;
+
+/*
+ * NAME
+ *   gorilla_callback_t
+ *
+ * DESCRIPTION
+ *   Callback invoked by `gorilla_foreach' for every sample in the requested
+ *   range, oldest first. `values' holds `values_num' gauges and is only valid
+ *   during the call. Returning non-zero stops the iteration.
+ */
+typedef int (*gorilla_callback_t)(cdtime_t time, gauge_t const *values,
+                                  size_t values_num, void *user_data);
+
+/*
+ * NAME
+ *   gorilla_create
+ *
+ * DESCRIPTION
+ *   Allocates a new, empty ring for samples of `values_num' gauges that keeps
+ *   at least `retention' worth of data.
+ *
+ * RETURN VALUE
+ *   A gorilla_t-pointer upon success or NULL upon failure.
+ */
+gorilla_t *gorilla_create(size_t values_num, cdtime_t retention);
+
+/*
+ * NAME
+ *   gorilla_destroy
+ *
+ * DESCRIPTION
+ *   Frees the ring and all samples stored in it.
+ */
+void gorilla_destroy(gorilla_t *g);
+
+/*
+ * NAME
+ *   gorilla_append
+ *
+ * DESCRIPTION
+ *   Appends one sample to the ring and drops blocks which have fallen out of
+ *   the retention window.
+ *
+ * RETURN VALUE
+ *   Zero upon success, EINVAL if `time' is older than the newest sample
+ *   already stored, ENOMEM if memory could not be allocated.
+ */
+int gorilla_append(gorilla_t *g, cdtime_t time, gauge_t const *values);
+
+/*
+ * NAME
+ *   gorilla_foreach
+ *
+ * DESCRIPTION
+ *   Decodes all samples with `begin <= time <= end' and passes them to
+ *   `callback'. Blocks outside of the range are skipped without being
+ *   decoded. Passing zero for `end' means "up to the newest sample".
+ *
+ * RETURN VALUE
+ *   Zero upon success, the return value of `callback' if it stopped the
+ *   iteration, or an errno-style error code.
+ */
+int gorilla_foreach(gorilla_t const *g, cdtime_t begin, cdtime_t end,
+                    gorilla_callback_t callback, void *user_data);
+
+/* Returns the number of samples currently stored. */
+size_t gorilla_size(gorilla_t const *g);
+
+/* Returns the number of bytes used by the ring, including bookkeeping. */
+size_t gorilla_memory_usage(gorilla_t const *g);
+
+#endif /* UTILS_GORILLA_H */
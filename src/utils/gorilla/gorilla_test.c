@@ -0,0 +1,162 @@
+/**
+ * collectd - src/utils/gorilla/gorilla_test.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ **/
+
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils/gorilla/gorilla.h"
+
+#define POINTS_NUM 1000
+
+typedef struct {
+  cdtime_t *times;
+  gauge_t *values; /* two columns */
+  size_t num;
+  size_t max;
+} collect_t;
+
+static int collect(cdtime_t t, gauge_t const *values, size_t values_num,
+                   void *ud) {
+  collect_t *c = ud;
+
+  if ((values_num != 2) || (c->num >= c->max))
+    return -1;
+
+  c->times[c->num] = t;
+  c->values[2 * c->num] = values[0];
+  c->values[2 * c->num + 1] = values[1];
+  c->num++;
+  return 0;
+}
+
+static cdtime_t point_time(size_t i) {
+  /* 10 second interval with a few milliseconds of jitter. */
+  return MS_TO_CDTIME_T(1500000000000 + 10000 * i + (i % 7));
+}
+
+static gauge_t point_value(size_t i, size_t column) {
+  if (column == 0)
+    return (gauge_t)(i / 3) * 1.5;
+  if ((i % 97) == 0)
+    return NAN;
+  return sin((double)i / 10.0) * 1000.0;
+}
+
+DEF_TEST(roundtrip) {
+  gorilla_t *g;
+  cdtime_t times[POINTS_NUM];
+  gauge_t values[2 * POINTS_NUM];
+  collect_t c = {times, values, 0, POINTS_NUM};
+
+  CHECK_NOT_NULL(g = gorilla_create(2, TIME_T_TO_CDTIME_T(86400)));
+  for (size_t i = 0; i < POINTS_NUM; i++) {
+    gauge_t v[] = {point_value(i, 0), point_value(i, 1)};
+    CHECK_ZERO(gorilla_append(g, point_time(i), v));
+  }
+  EXPECT_EQ_INT(POINTS_NUM, gorilla_size(g));
+
+  CHECK_ZERO(gorilla_foreach(g, 0, 0, collect, &c));
+  EXPECT_EQ_INT(POINTS_NUM, c.num);
+  for (size_t i = 0; i < POINTS_NUM; i++) {
+    EXPECT_EQ_UINT64(CDTIME_T_TO_MS(point_time(i)), CDTIME_T_TO_MS(times[i]));
+    EXPECT_EQ_DOUBLE(point_value(i, 0), values[2 * i]);
+    EXPECT_EQ_DOUBLE(point_value(i, 1), values[2 * i + 1]);
+  }
+
+  /* Out of order samples are rejected. */
+  gauge_t v[] = {1.0, 2.0};
+  EXPECT_EQ_INT(EINVAL, gorilla_append(g, point_time(0), v));
+
+  gorilla_destroy(g);
+  return 0;
+}
+
+DEF_TEST(range) {
+  gorilla_t *g;
+  cdtime_t times[POINTS_NUM];
+  gauge_t values[2 * POINTS_NUM];
+  collect_t c = {times, values, 0, POINTS_NUM};
+
+  CHECK_NOT_NULL(g = gorilla_create(2, TIME_T_TO_CDTIME_T(86400)));
+  for (size_t i = 0; i < POINTS_NUM; i++) {
+    gauge_t v[] = {point_value(i, 0), point_value(i, 1)};
+    CHECK_ZERO(gorilla_append(g, point_time(i), v));
+  }
+
+  CHECK_ZERO(gorilla_foreach(g, point_time(300), point_time(449), collect, &c));
+  EXPECT_EQ_INT(150, c.num);
+  EXPECT_EQ_UINT64(CDTIME_T_TO_MS(point_time(300)), CDTIME_T_TO_MS(times[0]));
+  EXPECT_EQ_DOUBLE(point_value(449, 0), values[2 * 149]);
+
+  gorilla_destroy(g);
+  return 0;
+}
+
+DEF_TEST(retention) {
+  gorilla_t *g;
+
+  /* One hour at a 10 second interval is 360 samples. */
+  CHECK_NOT_NULL(g = gorilla_create(2, TIME_T_TO_CDTIME_T(3600)));
+  for (size_t i = 0; i < POINTS_NUM; i++) {
+    gauge_t v[] = {point_value(i, 0), point_value(i, 1)};
+    CHECK_ZERO(gorilla_append(g, point_time(i), v));
+  }
+
+  OK(gorilla_size(g) >= 360);
+  OK(gorilla_size(g) < POINTS_NUM);
+
+  gorilla_destroy(g);
+  return 0;
+}
+
+DEF_TEST(compression) {
+  gorilla_t *g;
+
+  /* A regularly sampled, slowly changing gauge should compress to a small
+   * fraction of the 16 bytes needed by a plain time/value pair. */
+  CHECK_NOT_NULL(g = gorilla_create(1, TIME_T_TO_CDTIME_T(86400)));
+  for (size_t i = 0; i < POINTS_NUM; i++) {
+    gauge_t v = (gauge_t)(1000 + (i / 10));
+    CHECK_ZERO(gorilla_append(g, MS_TO_CDTIME_T(1500000000000 + 10000 * i),
+                              &v));
+  }
+
+  size_t bytes = gorilla_memory_usage(g);
+  printf("%zu bytes for %d points\n", bytes, POINTS_NUM);
+  OK(bytes < 2 * POINTS_NUM);
+
+  gorilla_destroy(g);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(roundtrip);
+  RUN_TEST(range);
+  RUN_TEST(retention);
+  RUN_TEST(compression);
+
+  END_TEST;
+}
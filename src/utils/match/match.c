@@ -31,16 +31,42 @@
 
 #include "utils/match/match.h"
 
+#include <ctype.h>
 #include <regex.h>
 
 #define UTILS_MATCH_FLAGS_EXCLUDE_REGEX 0x02
 #define UTILS_MATCH_FLAGS_REGEX 0x04
 
+/* The required literals of all matches are compiled into one Aho-Corasick
+ * automaton. Bytes that occur in none of the literals share class zero, which
+ * keeps the transition table small. */
+struct cu_match_set_s {
+  cu_match_t **matches;
+  size_t matches_num;
+
+  uint8_t classes[256];
+  size_t classes_num;
+
+  int32_t *next; /* states_num * classes_num transitions */
+  int32_t *fail;
+  int32_t *out;      /* first state on the fail chain with own matches */
+  int32_t *own_head; /* first match ending in this state */
+  int32_t *own_next; /* next match with the same literal */
+  size_t states_num;
+
+  /* A match is a candidate for the current line if seen[i] == generation. */
+  unsigned int *seen;
+  unsigned int generation;
+};
+
 struct cu_match_s {
   regex_t regex;
   regex_t excluderegex;
   int flags;
 
+  /* A string every line matched by `regex' contains, or NULL. */
+  char *literal;
+
   int (*callback)(const char *str, char *const *matches, size_t matches_num,
                   void *user_data);
   void *user_data;
@@ -72,6 +98,146 @@ static char *match_substr(const char *str, int begin, int end) {
   return ret;
 } /* char *match_substr */
 
+/* Returns the end of the bracket expression starting at `p', i.e. a pointer to
+ * the closing bracket, or NULL if the expression is not terminated. */
+static const char *match_skip_bracket(const char *p) {
+  p++;
+  if (*p == '^')
+    p++;
+  if (*p == ']')
+    p++;
+
+  while ((*p != 0) && (*p != ']')) {
+    if ((p[0] == '[') && ((p[1] == ':') || (p[1] == '.') || (p[1] == '='))) {
+      char end[] = {p[1], ']', 0};
+      p = strstr(p + 2, end);
+      if (p == NULL)
+        return NULL;
+      p += 2;
+      continue;
+    }
+    p++;
+  }
+
+  return (*p == ']') ? p : NULL;
+} /* const char *match_skip_bracket */
+
+/* Returns the longest string that every line matched by the extended regular
+ * expression `regex' must contain, or NULL if none could be determined. The
+ * expression is only inspected superficially: anything that is not obviously a
+ * plain character, including groups and everything inside them, ends the
+ * current run of literal characters. */
+static char *match_required_literal(const char *regex) {
+  size_t len = strlen(regex);
+  char *run = malloc(len + 1);
+  char *best = malloc(len + 1);
+  size_t run_len = 0;
+  size_t best_len = 0;
+  bool last_literal = false;
+  /* Group nesting depth. Negative if the expression is not understood. */
+  int depth = 0;
+
+  if ((run == NULL) || (best == NULL)) {
+    sfree(run);
+    sfree(best);
+    return NULL;
+  }
+
+  for (const char *p = regex; *p != 0; p++) {
+    enum { ATOM, LITERAL, OPTIONAL, REPEAT } kind = ATOM;
+    char c = *p;
+
+    switch (c) {
+    case '\\':
+      if (p[1] == 0) {
+        depth = -1;
+        break;
+      }
+      p++;
+      /* GNU extensions such as \w, \b, \< and \' are not literals. */
+      if (ispunct((unsigned char)*p) && (strchr("<>'`", *p) == NULL)) {
+        kind = LITERAL;
+        c = *p;
+      }
+      break;
+    case '[':
+      p = match_skip_bracket(p);
+      if (p == NULL)
+        depth = -1;
+      break;
+    case '(':
+      depth++;
+      break;
+    case ')':
+      depth--;
+      break;
+    case '|':
+      /* An alternative at the top level makes everything optional. */
+      if (depth == 0)
+        depth = -1;
+      break;
+    case '{':
+      p = strchr(p, '}');
+      if (p == NULL)
+        depth = -1;
+      kind = OPTIONAL;
+      break;
+    case '*':
+    case '?':
+      kind = OPTIONAL;
+      break;
+    case '+':
+      kind = REPEAT;
+      break;
+    case '.':
+    case '^':
+    case '$':
+      break;
+    default:
+      if (!(c & 0x80))
+        kind = LITERAL;
+    }
+
+    if (depth < 0) {
+      best_len = 0;
+      break;
+    }
+    if ((depth > 0) && (kind == LITERAL))
+      kind = ATOM;
+
+    if (kind == LITERAL) {
+      run[run_len++] = c;
+      last_literal = true;
+      continue;
+    }
+
+    /* A quantifier that allows zero repetitions removes the preceding
+     * character from the run. */
+    if ((kind == OPTIONAL) && last_literal)
+      run_len--;
+    if (run_len > best_len) {
+      memcpy(best, run, run_len);
+      best_len = run_len;
+    }
+    run_len = 0;
+    last_literal = false;
+  }
+
+  if ((depth == 0) && (run_len > best_len)) {
+    memcpy(best, run, run_len);
+    best_len = run_len;
+  }
+
+  sfree(run);
+  if ((depth != 0) || (best_len == 0)) {
+    sfree(best);
+    return NULL;
+  }
+
+  best[best_len] = 0;
+  return best;
+} /* char *match_required_literal */
+
 static int default_callback(const char __attribute__((unused)) * str,
                             char *const *matches, size_t matches_num,
                             void *user_data) {
@@ -248,6 +414,9 @@ match_create_callback(const char *regex, const char *excluderegex,
     obj->flags |= UTILS_MATCH_FLAGS_EXCLUDE_REGEX;
   }
 
+  obj->literal = match_required_literal(regex);
+  DEBUG("utils_match: match_create_callback: literal = %s", obj->literal);
+
   obj->callback = callback;
   obj->user_data = user_data;
   obj->free = free_user_data;
@@ -307,21 +476,20 @@ void match_destroy(cu_match_t *obj) {
     regfree(&obj->regex);
   if (obj->flags & UTILS_MATCH_FLAGS_EXCLUDE_REGEX)
     regfree(&obj->excluderegex);
+  sfree(obj->literal);
   if ((obj->user_data != NULL) && (obj->free != NULL))
     (*obj->free)(obj->user_data);
 
   sfree(obj);
 } /* void match_destroy */
 
-int match_apply(cu_match_t *obj, const char *str) {
+/* Runs the regular expressions of `obj' without consulting the literal. */
+static int match_apply_regex(cu_match_t *obj, const char *str) {
   int status;
   regmatch_t re_match[32];
   char *matches[32] = {0};
   size_t matches_num;
 
-  if ((obj == NULL) || (str == NULL))
-    return -1;
-
   if (obj->flags & UTILS_MATCH_FLAGS_EXCLUDE_REGEX) {
     status =
         regexec(&obj->excluderegex, str, STATIC_ARRAY_SIZE(re_match), re_match,
@@ -367,6 +535,17 @@ int match_apply(cu_match_t *obj, const char *str) {
   }
 
   return status;
+} /* int match_apply_regex */
+
+int match_apply(cu_match_t *obj, const char *str) {
+  if ((obj == NULL) || (str == NULL))
+    return -1;
+
+  /* Lines without the required literal can not match. */
+  if ((obj->literal != NULL) && (strstr(str, obj->literal) == NULL))
+    return 0;
+
+  return match_apply_regex(obj, str);
 } /* int match_apply */
 
 void *match_get_user_data(cu_match_t *obj) {
@@ -374,3 +553,175 @@ void *match_get_user_data(cu_match_t *obj) {
     return NULL;
   return obj->user_data;
 } /* void *match_get_user_data */
+
+/* Adds the literal of match `index' to the trie in `set'. The transitions
+ * of all states are -1 ("none") until match_set_create() completes them. */
+static void match_set_add_literal(cu_match_set_t *set, int32_t index) {
+  const char *literal = set->matches[index]->literal;
+  int32_t state = 0;
+
+  for (const char *p = literal; *p != 0; p++) {
+    int32_t *next =
+        set->next + state * set->classes_num + set->classes[(uint8_t)*p];
+    if (*next < 0) {
+      *next = (int32_t)set->states_num;
+      set->states_num++;
+    }
+    state = *next;
+  }
+
+  set->own_next[index] = set->own_head[state];
+  set->own_head[state] = index;
+} /* void match_set_add_literal */
+
+cu_match_set_t *match_set_create(cu_match_t *const *matches,
+                                 size_t matches_num) {
+  cu_match_set_t *set = calloc(1, sizeof(*set));
+  if (set == NULL)
+    return NULL;
+
+  set->matches = calloc(matches_num, sizeof(*set->matches));
+  set->own_next = calloc(matches_num, sizeof(*set->own_next));
+  set->seen = calloc(matches_num, sizeof(*set->seen));
+  if ((set->matches == NULL) || (set->own_next == NULL) ||
+      (set->seen == NULL)) {
+    ERROR("utils_match: match_set_create: calloc failed.");
+    match_set_destroy(set);
+    return NULL;
+  }
+  memcpy(set->matches, matches, matches_num * sizeof(*matches));
+  set->matches_num = matches_num;
+
+  /* Assign a class to each byte used by a literal and count the states
+   * needed in the worst case. */
+  size_t states_max = 1;
+  set->classes_num = 1;
+  for (size_t i = 0; i < matches_num; i++) {
+    const char *literal = matches[i]->literal;
+    if (literal == NULL)
+      continue;
+
+    for (const char *p = literal; *p != 0; p++) {
+      if (set->classes[(uint8_t)*p] == 0)
+        set->classes[(uint8_t)*p] = (uint8_t)set->classes_num++;
+      states_max++;
+    }
+  }
+
+  set->next = malloc(states_max * set->classes_num * sizeof(*set->next));
+  set->fail = calloc(states_max, sizeof(*set->fail));
+  set->out = calloc(states_max, sizeof(*set->out));
+  set->own_head = malloc(states_max * sizeof(*set->own_head));
+  if ((set->next == NULL) || (set->fail == NULL) || (set->out == NULL) ||
+      (set->own_head == NULL)) {
+    ERROR("utils_match: match_set_create: malloc failed.");
+    match_set_destroy(set);
+    return NULL;
+  }
+  for (size_t i = 0; i < states_max * set->classes_num; i++)
+    set->next[i] = -1;
+  for (size_t i = 0; i < states_max; i++)
+    set->own_head[i] = -1;
+
+  set->states_num = 1;
+  for (size_t i = 0; i < matches_num; i++) {
+    set->own_next[i] = -1;
+    if (matches[i]->literal != NULL)
+      match_set_add_literal(set, (int32_t)i);
+  }
+
+  /* Complete the transitions in breadth-first order, so that the fail state of
+   * each state has been completed before the state itself. Class zero and
+   * missing transitions of the root lead back to the root. */
+  int32_t *queue = calloc(set->states_num, sizeof(*queue));
+  if (queue == NULL) {
+    ERROR("utils_match: match_set_create: calloc failed.");
+    match_set_destroy(set);
+    return NULL;
+  }
+
+  size_t queue_head = 0;
+  size_t queue_tail = 0;
+  set->out[0] = -1;
+  for (size_t c = 0; c < set->classes_num; c++) {
+    int32_t child = set->next[c];
+    if ((c == 0) || (child < 0)) {
+      set->next[c] = 0;
+      continue;
+    }
+    set->fail[child] = 0;
+    queue[queue_tail++] = child;
+  }
+
+  while (queue_head < queue_tail) {
+    int32_t state = queue[queue_head++];
+    int32_t *next = set->next + state * set->classes_num;
+    int32_t *fail_next = set->next + set->fail[state] * set->classes_num;
+
+    set->out[state] =
+        (set->own_head[state] >= 0) ? state : set->out[set->fail[state]];
+
+    for (size_t c = 0; c < set->classes_num; c++) {
+      if (next[c] < 0) {
+        next[c] = fail_next[c];
+        continue;
+      }
+      set->fail[next[c]] = fail_next[c];
+      queue[queue_tail++] = next[c];
+    }
+  }
+  sfree(queue);
+
+  DEBUG("utils_match: match_set_create: %zu matches, %zu states, %zu classes",
+        matches_num, set->states_num, set->classes_num);
+  return set;
+} /* cu_match_set_t *match_set_create */
+
+void match_set_destroy(cu_match_set_t *set) {
+  if (set == NULL)
+    return;
+
+  sfree(set->matches);
+  sfree(set->next);
+  sfree(set->fail);
+  sfree(set->out);
+  sfree(set->own_head);
+  sfree(set->own_next);
+  sfree(set->seen);
+  sfree(set);
+} /* void match_set_destroy */
+
+int match_set_apply(cu_match_set_t *set, const char *str) {
+  int32_t state = 0;
+  int status = 0;
+
+  if ((set == NULL) || (str == NULL))
+    return -1;
+
+  set->generation++;
+  if (set->generation == 0) {
+    memset(set->seen, 0, set->matches_num * sizeof(*set->seen));
+    set->generation = 1;
+  }
+
+  /* Scan the line once and mark all matches whose literal occurs in it. */
+  for (const uint8_t *p = (const uint8_t *)str; *p != 0; p++) {
+    state = set->next[state * set->classes_num + set->classes[*p]];
+    for (int32_t out = set->out[state]; out > 0;
+         out = set->out[set->fail[out]])
+      for (int32_t i = set->own_head[out]; i >= 0; i = set->own_next[i])
+        set->seen[i] = set->generation;
+  }
+
+  for (size_t i = 0; i < set->matches_num; i++) {
+    cu_match_t *obj = set->matches[i];
+
+    if ((obj->literal != NULL) && (set->seen[i] != set->generation))
+      continue;
+
+    if (match_apply_regex(obj, str) != 0)
+      status = -1;
+  }
+
+  return status;
+} /* int match_set_apply */
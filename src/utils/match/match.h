@@ -68,6 +68,9 @@
 struct cu_match_s;
 typedef struct cu_match_s cu_match_t;
 
+struct cu_match_set_s;
+typedef struct cu_match_set_s cu_match_set_t;
+
 struct cu_match_value_s {
   int ds_type;
   value_t value;
@@ -176,4 +179,42 @@ int match_apply(cu_match_t *obj, const char *str);
  */
 void *match_get_user_data(cu_match_t *obj);
 
+/*
+ * NAME
+ *  match_set_create
+ *
+ * DESCRIPTION
+ *  Creates a `cu_match_set_t' object for applying all `matches' to the same
+ *  lines. When a match is created, the longest string that every matching
+ *  line must contain is derived from its regular expression. The set compiles
+ *  these strings into a single automaton, so that each line is scanned only
+ *  once and the regular expressions are only run for matches whose string
+ *  occurs in the line. Matches for which no such string is known are always
+ *  run.
+ *  The set does not take ownership of the matches; they must not be destroyed
+ *  before the set.
+ */
+cu_match_set_t *match_set_create(cu_match_t *const *matches,
+                                 size_t matches_num);
+
+/*
+ * NAME
+ *  match_set_destroy
+ *
+ * DESCRIPTION
+ *  Destroys the set. The matches it was created from are not destroyed.
+ */
+void match_set_destroy(cu_match_set_t *set);
+
+/*
+ * NAME
+ *  match_set_apply
+ *
+ * DESCRIPTION
+ *  Equivalent to calling `match_apply' with `str' for each match of the set,
+ *  in the order passed to `match_set_create'. Returns non-zero if any of the
+ *  callbacks failed.
+ */
+int match_set_apply(cu_match_set_t *set, const char *str);
+
 #endif /* UTILS_MATCH_H */
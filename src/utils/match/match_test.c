@@ -0,0 +1,260 @@
+/**
+ * collectd - src/utils/match/match_test.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ **/
+
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils/common/common.h"
+#include "utils/match/match.h"
+
+#include <regex.h>
+
+#define BENCH_MATCHES_NUM 60
+#define BENCH_LINES_NUM 5000
+
+static int count_callback(__attribute__((unused)) const char *str,
+                          __attribute__((unused)) char *const *matches,
+                          __attribute__((unused)) size_t matches_num,
+                          void *user_data) {
+  int *count = user_data;
+  (*count)++;
+  return 0;
+}
+
+/* Expressions whose required literal is easy to get wrong. */
+static char const *regexes[] = {
+    "GET /index\\.html",
+    "colou?r",
+    "ab+c",
+    "x(yz)*w",
+    "(foo|bar)baz",
+    "foo|bar",
+    "[[:digit:]]+ms",
+    "[]a]bc",
+    "\\bword\\b",
+    "a{2,3}b",
+    "^status=([0-9]+)$",
+    "user \\(admin\\)",
+    "\\.\\*lit",
+    "t\xc3\xa9+st",
+    "^[a-z]",
+    "q\\?",
+    "[^]x]yz",
+    "de(f)?g",
+};
+
+static char const *lines[] = {
+    "",
+    "GET /index.html HTTP/1.1",
+    "GET /indexxhtml HTTP/1.1",
+    "color",
+    "colour",
+    "colr",
+    "abbbc",
+    "ac",
+    "xw",
+    "xyzyzw",
+    "barbaz",
+    "foo",
+    "bar",
+    "12ms",
+    "ms",
+    "]bc",
+    "abc",
+    "a word here",
+    "swordfish",
+    "aab",
+    "aaab",
+    "ab",
+    "status=200",
+    "status=",
+    "user (admin)",
+    "user admin",
+    ".*lit",
+    "xxlit",
+    "t\xc3\xa9st",
+    "t\xc3\xa9\xc3\xa9st",
+    "tst",
+    "q?",
+    "q",
+    "ayz",
+    "]yz",
+    "dg",
+    "dfg",
+    "defg",
+};
+
+DEF_TEST(set) {
+  size_t regexes_num = STATIC_ARRAY_SIZE(regexes);
+  cu_match_t *matches[STATIC_ARRAY_SIZE(regexes)];
+  int single[STATIC_ARRAY_SIZE(regexes)] = {0};
+  int combined[STATIC_ARRAY_SIZE(regexes)] = {0};
+  cu_match_set_t *set;
+
+  for (size_t i = 0; i < regexes_num; i++)
+    CHECK_NOT_NULL(matches[i] = match_create_callback(
+                       regexes[i], NULL, count_callback, combined + i, NULL));
+  CHECK_NOT_NULL(set = match_set_create(matches, regexes_num));
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(lines); i++)
+    EXPECT_EQ_INT(0, match_set_apply(set, lines[i]));
+
+  for (size_t i = 0; i < regexes_num; i++) {
+    regex_t re;
+    int want = 0;
+    int got = 0;
+
+    CHECK_ZERO(regcomp(&re, regexes[i], REG_EXTENDED | REG_NEWLINE));
+    for (size_t j = 0; j < STATIC_ARRAY_SIZE(lines); j++)
+      if (regexec(&re, lines[j], 0, NULL, 0) == 0)
+        want++;
+    regfree(&re);
+
+    match_destroy(matches[i]);
+    CHECK_NOT_NULL(matches[i] = match_create_callback(
+                       regexes[i], NULL, count_callback, single + i, NULL));
+    for (size_t j = 0; j < STATIC_ARRAY_SIZE(lines); j++)
+      EXPECT_EQ_INT(0, match_apply(matches[i], lines[j]));
+    got = single[i];
+
+    printf("regex \"%s\": %d matching lines\n", regexes[i], want);
+    EXPECT_EQ_INT(want, got);
+    EXPECT_EQ_INT(want, combined[i]);
+  }
+
+  match_set_destroy(set);
+  for (size_t i = 0; i < regexes_num; i++)
+    match_destroy(matches[i]);
+  return 0;
+}
+
+DEF_TEST(exclude) {
+  int counts[2] = {0};
+  cu_match_t *matches[2];
+  cu_match_set_t *set;
+
+  CHECK_NOT_NULL(matches[0] = match_create_callback(
+                     "error", "ignored", count_callback, counts + 0, NULL));
+  CHECK_NOT_NULL(matches[1] = match_create_callback(
+                     "warning", NULL, count_callback, counts + 1, NULL));
+  CHECK_NOT_NULL(set = match_set_create(matches, 2));
+
+  CHECK_ZERO(match_set_apply(set, "an error occurred"));
+  CHECK_ZERO(match_set_apply(set, "an ignored error occurred"));
+  CHECK_ZERO(match_set_apply(set, "warning: error"));
+  CHECK_ZERO(match_set_apply(set, "nothing to see"));
+
+  EXPECT_EQ_INT(2, counts[0]);
+  EXPECT_EQ_INT(1, counts[1]);
+
+  match_set_destroy(set);
+  match_destroy(matches[0]);
+  match_destroy(matches[1]);
+  return 0;
+}
+
+static double elapsed(struct timespec const *begin) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (double)(end.tv_sec - begin->tv_sec) +
+         (double)(end.tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+static void bench_regex(char *buffer, size_t buffer_size, size_t i) {
+  snprintf(buffer, buffer_size,
+           "^[0-9.]+ - - \\[[^]]+\\] \"GET /app/page%zu\\.html "
+           "HTTP/1\\.[01]\" [0-9]+ ([0-9]+)",
+           i);
+}
+
+/* Compares running every regular expression on every line, which is what
+ * applying the matches one by one used to do, with applying them as a set, on
+ * lines resembling a web server's access log. */
+DEF_TEST(benchmark) {
+  static char log_lines[BENCH_LINES_NUM][256];
+  regex_t compiled[BENCH_MATCHES_NUM];
+  cu_match_t *matches[BENCH_MATCHES_NUM];
+  int single[BENCH_MATCHES_NUM] = {0};
+  int combined[BENCH_MATCHES_NUM] = {0};
+  cu_match_set_t *set;
+  struct timespec begin;
+
+  for (size_t i = 0; i < BENCH_LINES_NUM; i++)
+    snprintf(log_lines[i], sizeof(log_lines[i]),
+             "192.0.2.%zu - - [19/Oct/2026:10:00:00 +0000] "
+             "\"GET /app/page%zu.html HTTP/1.1\" %d %zu \"-\" "
+             "\"Mozilla/5.0 (X11; Linux x86_64)\"",
+             i % 256, i % (2 * BENCH_MATCHES_NUM), (i % 10) ? 200 : 404,
+             i * 7 % 10000);
+
+  for (size_t i = 0; i < BENCH_MATCHES_NUM; i++) {
+    char regex[128];
+    bench_regex(regex, sizeof(regex), i);
+    CHECK_ZERO(regcomp(compiled + i, regex, REG_EXTENDED | REG_NEWLINE));
+    CHECK_NOT_NULL(matches[i] = match_create_callback(
+                       regex, NULL, count_callback, combined + i, NULL));
+  }
+  CHECK_NOT_NULL(set = match_set_create(matches, BENCH_MATCHES_NUM));
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (size_t i = 0; i < BENCH_LINES_NUM; i++) {
+    for (size_t j = 0; j < BENCH_MATCHES_NUM; j++) {
+      regmatch_t re_match[32];
+      if (regexec(compiled + j, log_lines[i], STATIC_ARRAY_SIZE(re_match),
+                  re_match, 0) == 0)
+        single[j]++;
+    }
+  }
+  double single_time = elapsed(&begin);
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (size_t i = 0; i < BENCH_LINES_NUM; i++)
+    match_set_apply(set, log_lines[i]);
+  double set_time = elapsed(&begin);
+
+  /* Timings depend on the machine and its load; they are informational
+   * only. */
+  printf("%d matches, %d lines: one by one %.3f s, as a set %.3f s\n",
+         BENCH_MATCHES_NUM, BENCH_LINES_NUM, single_time, set_time);
+
+  for (size_t i = 0; i < BENCH_MATCHES_NUM; i++)
+    EXPECT_EQ_INT(single[i], combined[i]);
+
+  match_set_destroy(set);
+  for (size_t i = 0; i < BENCH_MATCHES_NUM; i++) {
+    regfree(compiled + i);
+    match_destroy(matches[i]);
+  }
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(set);
+  RUN_TEST(exclude);
+  RUN_TEST(benchmark);
+
+  END_TEST;
+}
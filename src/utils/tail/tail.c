@@ -28,6 +28,9 @@
  * Description:
  *   Encapsulates useful code for plugins which must watch for appends to
  *   the end of a file.
+ *   The file is read in large blocks which are split into lines in memory. On
+ *   Linux, inotify is used to learn about rotation, so that files which did
+ *   not change cost a single fstat(2) of the open file and no read(2).
  **/
 
 #include "collectd.h"
@@ -35,12 +38,188 @@
 #include "utils/common/common.h"
 #include "utils/tail/tail.h"
 
+#if KERNEL_LINUX
+#include <sys/inotify.h>
+#endif
+
+#define CU_TAIL_BUFFER_SIZE 65536
+
+/* inotify does not report changes made by other hosts on network file
+ * systems. Check the path for rotation on every nth read regardless. */
+#ifndef CU_TAIL_STAT_INTERVAL
+#define CU_TAIL_STAT_INTERVAL 16
+#endif
+
 struct cu_tail_s {
   char *file;
-  FILE *fh;
+  int fd;
   struct stat stat;
+  /* Number of bytes read from `fd' so far. */
+  off_t offset;
+
+  /* Data read from the file but not yet returned is buffer[begin, end). */
+  char *buffer;
+  size_t begin;
+  size_t end;
+  bool eof;
+
+  /* Number of bytes waiting when the last cu_tail_read() started. */
+  uint64_t backlog;
+  unsigned int reads_num;
+
+  /* `modified' is set when the file may have grown or shrunk, `changed' when
+   * it may have been replaced. Without inotify both are always set. */
+  bool modified;
+  bool changed;
+#if KERNEL_LINUX
+  int inotify_fd;
+  int file_wd;
+  int dir_wd;
+  char *base_name;
+#endif
 };
 
+#if KERNEL_LINUX
+/* Creates the inotify instance and watches the directory containing the file
+ * for files being created or renamed. On failure the caller falls back to
+ * checking the file with stat(2). */
+static void cu_tail_watch_init(cu_tail_t *obj) {
+  obj->file_wd = -1;
+  obj->dir_wd = -1;
+
+  obj->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (obj->inotify_fd < 0) {
+    P_WARNING("utils_tail: inotify_init1 failed: %s", STRERRNO);
+    return;
+  }
+
+  char *dir = strdup(obj->file);
+  if (dir == NULL) {
+    close(obj->inotify_fd);
+    obj->inotify_fd = -1;
+    return;
+  }
+
+  char *slash = strrchr(dir, '/');
+  if (slash == NULL) {
+    obj->base_name = strdup(dir);
+    free(dir);
+    dir = strdup(".");
+  } else {
+    obj->base_name = strdup(slash + 1);
+    /* Keep the slash of files in the root directory. */
+    slash[(slash == dir) ? 1 : 0] = 0;
+  }
+
+  if ((dir != NULL) && (obj->base_name != NULL))
+    obj->dir_wd = inotify_add_watch(
+        obj->inotify_fd, dir, IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+  if (obj->dir_wd < 0) {
+    P_WARNING("utils_tail: Watching directory `%s' failed: %s", dir,
+              STRERRNO);
+    close(obj->inotify_fd);
+    obj->inotify_fd = -1;
+  }
+  free(dir);
+} /* void cu_tail_watch_init */
+
+/* Watches the file that has just been opened. If the file at `obj->file' is
+ * already a different one, the change is picked up by the next stat(2). */
+static void cu_tail_watch_file(cu_tail_t *obj) {
+  if (obj->inotify_fd < 0)
+    return;
+
+  if (obj->file_wd >= 0)
+    inotify_rm_watch(obj->inotify_fd, obj->file_wd);
+
+  obj->file_wd =
+      inotify_add_watch(obj->inotify_fd, obj->file,
+                        IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+  if (obj->file_wd < 0) {
+    P_WARNING("utils_tail: Watching `%s' failed: %s", obj->file, STRERRNO);
+    close(obj->inotify_fd);
+    obj->inotify_fd = -1;
+    return;
+  }
+
+  struct stat stat_buf = {0};
+  if ((stat(obj->file, &stat_buf) != 0) ||
+      (stat_buf.st_ino != obj->stat.st_ino) ||
+      (stat_buf.st_dev != obj->stat.st_dev))
+    obj->changed = true;
+} /* void cu_tail_watch_file */
+
+/* Reads all queued inotify events and updates `modified' and `changed'. */
+static void cu_tail_watch_events(cu_tail_t *obj) {
+  char buffer[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  if (obj->inotify_fd < 0) {
+    obj->modified = true;
+    obj->changed = true;
+    return;
+  }
+
+  while (42) {
+    ssize_t len = read(obj->inotify_fd, buffer, sizeof(buffer));
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN) {
+        P_WARNING("utils_tail: Reading inotify events failed: %s", STRERRNO);
+        close(obj->inotify_fd);
+        obj->inotify_fd = -1;
+        obj->modified = true;
+        obj->changed = true;
+      }
+      return;
+    }
+
+    for (char *ptr = buffer; ptr < buffer + len;) {
+      struct inotify_event *event = (struct inotify_event *)ptr;
+      ptr += sizeof(*event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        obj->modified = true;
+        obj->changed = true;
+      } else if (event->wd == obj->file_wd) {
+        if (event->mask & IN_MODIFY)
+          obj->modified = true;
+        if (event->mask & ~IN_MODIFY)
+          obj->changed = true;
+      } else if ((event->wd == obj->dir_wd) && (event->len > 0) &&
+                 (strcmp(event->name, obj->base_name) == 0)) {
+        obj->changed = true;
+      }
+    }
+  }
+} /* void cu_tail_watch_events */
+
+static void cu_tail_watch_destroy(cu_tail_t *obj) {
+  if (obj->inotify_fd >= 0)
+    close(obj->inotify_fd);
+  obj->inotify_fd = -1;
+  sfree(obj->base_name);
+} /* void cu_tail_watch_destroy */
+#else  /* !KERNEL_LINUX */
+static void cu_tail_watch_init(__attribute__((unused)) cu_tail_t *obj) {}
+static void cu_tail_watch_file(__attribute__((unused)) cu_tail_t *obj) {}
+static void cu_tail_watch_events(cu_tail_t *obj) {
+  obj->modified = true;
+  obj->changed = true;
+}
+static void cu_tail_watch_destroy(__attribute__((unused)) cu_tail_t *obj) {}
+#endif /* !KERNEL_LINUX */
+
+static void cu_tail_close(cu_tail_t *obj) {
+  if (obj->fd >= 0)
+    close(obj->fd);
+  obj->fd = -1;
+  obj->begin = 0;
+  obj->end = 0;
+  obj->eof = false;
+} /* void cu_tail_close */
+
 static int cu_tail_reopen(cu_tail_t *obj, bool force_rewind) {
   int seek_end = 0;
   struct stat stat_buf = {0};
@@ -52,19 +231,22 @@ static int cu_tail_reopen(cu_tail_t *obj, bool force_rewind) {
   }
 
   /* The file is already open.. */
-  if ((obj->fh != NULL) && (stat_buf.st_ino == obj->stat.st_ino)) {
+  if ((obj->fd >= 0) && (stat_buf.st_ino == obj->stat.st_ino)) {
     /* Seek to the beginning if file was truncated */
-    if (stat_buf.st_size < obj->stat.st_size) {
+    if (stat_buf.st_size < obj->offset) {
       P_INFO("utils_tail: File `%s' was truncated.", obj->file);
-      status = fseek(obj->fh, 0, SEEK_SET);
-      if (status != 0) {
-        P_ERROR("utils_tail: fseek (%s) failed: %s", obj->file, STRERRNO);
-        fclose(obj->fh);
-        obj->fh = NULL;
+      if (lseek(obj->fd, 0, SEEK_SET) == (off_t)-1) {
+        P_ERROR("utils_tail: lseek (%s) failed: %s", obj->file, STRERRNO);
+        cu_tail_close(obj);
         return -1;
       }
+      obj->offset = 0;
+      obj->begin = 0;
+      obj->end = 0;
+      obj->eof = false;
     }
     memcpy(&obj->stat, &stat_buf, sizeof(struct stat));
+    obj->changed = false;
     return 1;
   }
 
@@ -74,29 +256,77 @@ static int cu_tail_reopen(cu_tail_t *obj, bool force_rewind) {
   if ((obj->stat.st_ino == 0) || (obj->stat.st_ino == stat_buf.st_ino))
     seek_end = !force_rewind;
 
-  FILE *fh = fopen(obj->file, "r");
-  if (fh == NULL) {
-    P_ERROR("utils_tail: fopen (%s) failed: %s", obj->file, STRERRNO);
+  int fd = open(obj->file, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    P_ERROR("utils_tail: open (%s) failed: %s", obj->file, STRERRNO);
     return -1;
   }
 
+  off_t offset = 0;
   if (seek_end != 0) {
-    status = fseek(fh, 0, SEEK_END);
-    if (status != 0) {
-      P_ERROR("utils_tail: fseek (%s) failed: %s", obj->file, STRERRNO);
-      fclose(fh);
+    offset = lseek(fd, 0, SEEK_END);
+    if (offset == (off_t)-1) {
+      P_ERROR("utils_tail: lseek (%s) failed: %s", obj->file, STRERRNO);
+      close(fd);
       return -1;
     }
   }
 
-  if (obj->fh != NULL)
-    fclose(obj->fh);
-  obj->fh = fh;
+  if (obj->fd >= 0)
+    close(obj->fd);
+  obj->fd = fd;
+  obj->offset = offset;
+  obj->eof = false;
   memcpy(&obj->stat, &stat_buf, sizeof(struct stat));
 
+  obj->changed = false;
+  cu_tail_watch_file(obj);
+
   return 0;
 } /* int cu_tail_reopen */
 
+/* Copies up to `buflen - 1' bytes from the buffer to `buf', up to and
+ * including the first newline character if `line_end' is not NULL. */
+static void cu_tail_copy(cu_tail_t *obj, char *buf, int buflen,
+                         const char *line_end) {
+  size_t len = (line_end != NULL) ? (size_t)(line_end - obj->buffer) + 1
+                                  : obj->end;
+  len -= obj->begin;
+  if (len > (size_t)buflen - 1)
+    len = (size_t)buflen - 1;
+
+  memcpy(buf, obj->buffer + obj->begin, len);
+  buf[len] = 0;
+
+  obj->begin += len;
+  if (obj->begin == obj->end) {
+    obj->begin = 0;
+    obj->end = 0;
+  }
+} /* void cu_tail_copy */
+
+/* Reads the next block from the file. Returns the number of bytes read, zero
+ * at the end of file, or -1 on error. */
+static ssize_t cu_tail_fill(cu_tail_t *obj) {
+  if (obj->begin > 0) {
+    memmove(obj->buffer, obj->buffer + obj->begin, obj->end - obj->begin);
+    obj->end -= obj->begin;
+    obj->begin = 0;
+  }
+
+  while (42) {
+    ssize_t len = read(obj->fd, obj->buffer + obj->end,
+                       CU_TAIL_BUFFER_SIZE - obj->end);
+    if ((len < 0) && (errno == EINTR))
+      continue;
+    if (len > 0) {
+      obj->end += (size_t)len;
+      obj->offset += (off_t)len;
+    }
+    return len;
+  }
+} /* ssize_t cu_tail_fill */
+
 cu_tail_t *cu_tail_create(const char *file) {
   cu_tail_t *obj;
 
@@ -105,19 +335,26 @@ cu_tail_t *cu_tail_create(const char *file) {
     return NULL;
 
   obj->file = strdup(file);
-  if (obj->file == NULL) {
+  obj->buffer = malloc(CU_TAIL_BUFFER_SIZE);
+  if ((obj->file == NULL) || (obj->buffer == NULL)) {
+    free(obj->file);
+    free(obj->buffer);
     free(obj);
     return NULL;
   }
 
-  obj->fh = NULL;
+  obj->fd = -1;
+  obj->modified = true;
+  obj->changed = true;
+  cu_tail_watch_init(obj);
 
   return obj;
 } /* cu_tail_t *cu_tail_create */
 
 int cu_tail_destroy(cu_tail_t *obj) {
-  if (obj->fh != NULL)
-    fclose(obj->fh);
+  cu_tail_close(obj);
+  cu_tail_watch_destroy(obj);
+  free(obj->buffer);
   free(obj->file);
   free(obj);
 
@@ -132,64 +369,92 @@ int cu_tail_readline(cu_tail_t *obj, char *buf, int buflen, bool force_rewind) {
     return -1;
   }
 
-  if (obj->fh == NULL) {
+  if (obj->fd < 0) {
     status = cu_tail_reopen(obj, force_rewind);
     if (status < 0)
       return status;
   }
-  assert(obj->fh != NULL);
+  assert(obj->fd >= 0);
 
-  /* Try to read from the filehandle. If that succeeds, everything appears to
-   * be fine and we can return. */
-  clearerr(obj->fh);
-  if (fgets(buf, buflen, obj->fh) != NULL) {
-    buf[buflen - 1] = '\0';
-    return 0;
-  }
+  while (42) {
+    /* Return complete lines from the buffer first. Lines longer than `buflen'
+     * or the buffer are returned in pieces. */
+    char *line_end =
+        memchr(obj->buffer + obj->begin, '\n', obj->end - obj->begin);
+    size_t pending = obj->end - obj->begin;
+    if ((line_end != NULL) || (pending >= (size_t)buflen - 1) ||
+        (pending == CU_TAIL_BUFFER_SIZE)) {
+      cu_tail_copy(obj, buf, buflen, line_end);
+      return 0;
+    }
 
-  /* Check if we encountered an error */
-  if (ferror(obj->fh) != 0) {
-    /* Jupp, error. Force `cu_tail_reopen' to reopen the file.. */
-    fclose(obj->fh);
-    obj->fh = NULL;
-  }
-  /* else: eof -> check if the file was moved away and reopen the new file if
-   * so.. */
+    /* Nothing was appended since we last reached the end of the file. */
+    cu_tail_watch_events(obj);
+    if (obj->eof && !obj->modified && !obj->changed) {
+      buf[0] = 0;
+      return 0;
+    }
 
-  status = cu_tail_reopen(obj, force_rewind);
-  /* error -> return with error */
-  if (status < 0)
-    return status;
-  /* file end reached and file not reopened -> nothing more to read */
-  else if (status > 0) {
-    buf[0] = 0;
-    return 0;
-  }
+    ssize_t len = cu_tail_fill(obj);
+    if (len > 0) {
+      obj->eof = false;
+      continue;
+    }
 
-  /* If we get here: file was re-opened and there may be more to read.. Let's
-   * try again. */
-  if (fgets(buf, buflen, obj->fh) != NULL) {
-    buf[buflen - 1] = '\0';
-    return 0;
-  }
+    if (len < 0) {
+      /* Jupp, error. Force `cu_tail_reopen' to reopen the file.. */
+      WARNING("utils_tail: read (%s) failed: %s", obj->file, STRERRNO);
+      cu_tail_close(obj);
+    } else {
+      obj->eof = true;
+      obj->modified = false;
+    }
 
-  if (ferror(obj->fh) != 0) {
-    WARNING("utils_tail: fgets (%s) returned an error: %s", obj->file,
-            STRERRNO);
-    fclose(obj->fh);
-    obj->fh = NULL;
-    return -1;
-  }
+    /* eof -> check if the file was truncated or moved away and reopen the new
+     * file if so.. */
+    status = cu_tail_reopen(obj, force_rewind);
+    /* error -> return with error */
+    if (status < 0)
+      return status;
+    /* file end reached and file not reopened -> nothing more to read, unless
+     * the file was truncated */
+    if ((status > 0) && obj->eof) {
+      buf[0] = 0;
+      return 0;
+    }
 
-  /* EOf, well, apparently the new file is empty.. */
-  buf[0] = 0;
-  return 0;
+    /* The old file ended without a newline: return the remainder as the last
+     * line before reading the new file. */
+    if ((status == 0) && (obj->end > obj->begin)) {
+      cu_tail_copy(obj, buf, buflen, NULL);
+      return 0;
+    }
+  }
 } /* int cu_tail_readline */
 
 int cu_tail_read(cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
                  void *data, bool force_rewind) {
   int status;
 
+  obj->backlog = 0;
+  if (obj->fd >= 0) {
+    struct stat stat_buf = {0};
+    /* Appends by other hosts on network file systems and writes through
+     * mmap(2) do not generate inotify events, but show in the size. */
+    if (fstat(obj->fd, &stat_buf) == 0) {
+      if (stat_buf.st_size != obj->offset)
+        obj->modified = true;
+      if (stat_buf.st_nlink == 0)
+        obj->changed = true;
+      if (stat_buf.st_size > obj->offset)
+        obj->backlog = (uint64_t)(stat_buf.st_size - obj->offset);
+    }
+    obj->backlog += obj->end - obj->begin;
+
+    if (++obj->reads_num % CU_TAIL_STAT_INTERVAL == 0)
+      obj->changed = true;
+  }
+
   while (42) {
     size_t len;
 
@@ -223,3 +488,5 @@ int cu_tail_read(cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
 
   return status;
 } /* int cu_tail_read */
+
+uint64_t cu_tail_backlog(cu_tail_t *obj) { return obj->backlog; }
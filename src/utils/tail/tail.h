@@ -85,4 +85,11 @@ int cu_tail_readline(cu_tail_t *obj, char *buf, int buflen, bool force_rewind);
 int cu_tail_read(cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
                  void *data, bool force_rewind);
 
+/*
+ * cu_tail_backlog
+ * Returns the number of bytes that were waiting to be read when the last call
+ * to `cu_tail_read' started.
+ */
+uint64_t cu_tail_backlog(cu_tail_t *obj);
+
 #endif /* UTILS_TAIL_H */
@@ -0,0 +1,270 @@
+/**
+ * collectd - src/utils/tail/tail_test.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ **/
+
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils/common/common.h"
+#include "utils/tail/tail.h"
+
+#if KERNEL_LINUX
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#endif
+
+static char dir[] = "/tmp/utils_tail_test.XXXXXX";
+static char file[sizeof(dir) + 16];
+static char rotated[sizeof(dir) + 16];
+
+#if KERNEL_LINUX
+/* When set, watches are accepted but never report anything, like on network
+ * file systems where other hosts append to the file. */
+static bool watch_nothing;
+
+int inotify_add_watch(int fd, const char *pathname, uint32_t mask) {
+  if (watch_nothing)
+    return 4242;
+  return (int)syscall(SYS_inotify_add_watch, fd, pathname, mask);
+}
+#endif
+
+typedef struct {
+  char lines[1024];
+  size_t lines_num;
+  size_t bytes;
+} collect_t;
+
+static int collect(void *data, char *buf, __attribute__((unused)) int buflen) {
+  collect_t *c = data;
+  size_t len = strlen(c->lines);
+
+  snprintf(c->lines + len, sizeof(c->lines) - len, "%s%s",
+           (c->lines_num > 0) ? "|" : "", buf);
+  c->lines_num++;
+  c->bytes += strlen(buf);
+  return 0;
+}
+
+static int append(char const *path, char const *data) {
+  FILE *fh = fopen(path, "a");
+  if (fh == NULL)
+    return -1;
+  fputs(data, fh);
+  return fclose(fh);
+}
+
+/* read_lines reads all new lines of `tail' and returns them separated by "|".
+ */
+static char const *read_lines(cu_tail_t *tail, bool force_rewind) {
+  static collect_t c;
+  char buffer[4096];
+
+  memset(&c, 0, sizeof(c));
+  if (cu_tail_read(tail, buffer, sizeof(buffer), collect, &c, force_rewind) !=
+      0)
+    return "(error)";
+  return c.lines;
+}
+
+DEF_TEST(append) {
+  cu_tail_t *tail;
+
+  CHECK_ZERO(append(file, "one\ntwo\n"));
+  CHECK_NOT_NULL(tail = cu_tail_create(file));
+
+  EXPECT_EQ_STR("one|two", read_lines(tail, true));
+  EXPECT_EQ_STR("", read_lines(tail, true));
+
+  /* Incomplete lines are held back until their newline is written. */
+  CHECK_ZERO(append(file, "three\nfo"));
+  EXPECT_EQ_STR("three", read_lines(tail, true));
+  CHECK_ZERO(append(file, "ur\n"));
+  EXPECT_EQ_STR("four", read_lines(tail, true));
+
+  cu_tail_destroy(tail);
+  unlink(file);
+  return 0;
+}
+
+DEF_TEST(seek_end) {
+  cu_tail_t *tail;
+
+  /* Without force_rewind, existing lines are skipped on the first read. */
+  CHECK_ZERO(append(file, "old\n"));
+  CHECK_NOT_NULL(tail = cu_tail_create(file));
+  EXPECT_EQ_STR("", read_lines(tail, false));
+
+  CHECK_ZERO(append(file, "new\n"));
+  EXPECT_EQ_STR("new", read_lines(tail, false));
+
+  cu_tail_destroy(tail);
+  unlink(file);
+  return 0;
+}
+
+DEF_TEST(truncate) {
+  cu_tail_t *tail;
+
+  CHECK_ZERO(append(file, "a long first line\n"));
+  CHECK_NOT_NULL(tail = cu_tail_create(file));
+  EXPECT_EQ_STR("a long first line", read_lines(tail, true));
+
+  CHECK_ZERO(truncate(file, 0));
+  CHECK_ZERO(append(file, "short\n"));
+  EXPECT_EQ_STR("short", read_lines(tail, true));
+
+  cu_tail_destroy(tail);
+  unlink(file);
+  return 0;
+}
+
+DEF_TEST(rotate) {
+  cu_tail_t *tail;
+
+  CHECK_ZERO(append(file, "first\n"));
+  CHECK_NOT_NULL(tail = cu_tail_create(file));
+  EXPECT_EQ_STR("", read_lines(tail, false));
+  CHECK_ZERO(append(file, "second\n"));
+  EXPECT_EQ_STR("second", read_lines(tail, false));
+
+  /* Lines written to the old file after the rotation, including an
+   * incomplete last line, are read before the new file. */
+  CHECK_ZERO(rename(file, rotated));
+  CHECK_ZERO(append(rotated, "third\nlast"));
+  CHECK_ZERO(append(file, "new\n"));
+  EXPECT_EQ_STR("third|last|new", read_lines(tail, false));
+  EXPECT_EQ_STR("", read_lines(tail, false));
+
+  cu_tail_destroy(tail);
+  unlink(file);
+  unlink(rotated);
+  return 0;
+}
+
+#if KERNEL_LINUX
+DEF_TEST(no_events) {
+  cu_tail_t *tail;
+  char const *lines = "";
+
+  watch_nothing = true;
+  CHECK_ZERO(append(file, "start\n"));
+  CHECK_NOT_NULL(tail = cu_tail_create(file));
+  EXPECT_EQ_STR("start", read_lines(tail, true));
+
+  /* Appends and truncation are noticed by the size of the open file. */
+  CHECK_ZERO(append(file, "appended\n"));
+  EXPECT_EQ_STR("appended", read_lines(tail, true));
+  EXPECT_EQ_STR("", read_lines(tail, true));
+
+  CHECK_ZERO(truncate(file, 0));
+  CHECK_ZERO(append(file, "short\n"));
+  EXPECT_EQ_STR("short", read_lines(tail, true));
+
+  /* Rotation is noticed by checking the path every so often. */
+  CHECK_ZERO(rename(file, rotated));
+  CHECK_ZERO(append(file, "new\n"));
+  for (int i = 0; (i < 100) && (strlen(lines) == 0); i++)
+    lines = read_lines(tail, true);
+  EXPECT_EQ_STR("new", lines);
+
+  cu_tail_destroy(tail);
+  unlink(file);
+  unlink(rotated);
+  watch_nothing = false;
+  return 0;
+}
+#endif
+
+DEF_TEST(long_line) {
+  cu_tail_t *tail;
+  collect_t c = {0};
+  char buffer[4096];
+  char line[100001];
+
+  memset(line, 'x', sizeof(line) - 2);
+  line[sizeof(line) - 2] = '\n';
+  line[sizeof(line) - 1] = 0;
+
+  CHECK_ZERO(append(file, line));
+  CHECK_NOT_NULL(tail = cu_tail_create(file));
+  CHECK_ZERO(cu_tail_read(tail, buffer, sizeof(buffer), collect, &c, true));
+
+  /* Lines longer than the buffer are returned in pieces. */
+  EXPECT_EQ_INT(sizeof(line) - 2, c.bytes);
+  EXPECT_EQ_INT((sizeof(line) - 1 + sizeof(buffer) - 2) / (sizeof(buffer) - 1),
+                c.lines_num);
+
+  cu_tail_destroy(tail);
+  unlink(file);
+  return 0;
+}
+
+DEF_TEST(backlog) {
+  cu_tail_t *tail;
+  char data[1001];
+
+  memset(data, 'y', sizeof(data) - 2);
+  data[sizeof(data) - 2] = '\n';
+  data[sizeof(data) - 1] = 0;
+
+  CHECK_ZERO(append(file, "start\n"));
+  CHECK_NOT_NULL(tail = cu_tail_create(file));
+  EXPECT_EQ_STR("start", read_lines(tail, true));
+  EXPECT_EQ_INT(0, cu_tail_backlog(tail));
+
+  CHECK_ZERO(append(file, data));
+  read_lines(tail, true);
+  EXPECT_EQ_INT(sizeof(data) - 1, cu_tail_backlog(tail));
+
+  read_lines(tail, true);
+  EXPECT_EQ_INT(0, cu_tail_backlog(tail));
+
+  cu_tail_destroy(tail);
+  unlink(file);
+  return 0;
+}
+
+int main(void) {
+  if (mkdtemp(dir) == NULL) {
+    fprintf(stderr, "mkdtemp failed: %s\n", STRERRNO);
+    return 1;
+  }
+  snprintf(file, sizeof(file), "%s/log", dir);
+  snprintf(rotated, sizeof(rotated), "%s/log.1", dir);
+
+  RUN_TEST(append);
+  RUN_TEST(seek_end);
+  RUN_TEST(truncate);
+  RUN_TEST(rotate);
+#if KERNEL_LINUX
+  RUN_TEST(no_events);
+#endif
+  RUN_TEST(long_line);
+  RUN_TEST(backlog);
+
+  rmdir(dir);
+  END_TEST;
+}
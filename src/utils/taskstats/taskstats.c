@@ -305,3 +305,22 @@ int ts_delay_by_tgid(ts_t *ts, uint32_t tgid, ts_delay_t *out) {
   };
   return 0;
 }
+
+int ts_cswitch_by_tgid(ts_t *ts, uint32_t tgid, ts_cswitch_t *out) {
+  if ((ts == NULL) || (out == NULL)) {
+    return EINVAL;
+  }
+
+  struct taskstats raw = {0};
+
+  int status = get_taskstats(ts, tgid, &raw);
+  if (status != 0) {
+    return status;
+  }
+
+  *out = (ts_cswitch_t){
+      .voluntary = raw.nvcsw,
+      .involuntary = raw.nivcsw,
+  };
+  return 0;
+}
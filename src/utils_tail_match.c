@@ -59,6 +59,9 @@ struct cu_tail_match_s {
   cu_tail_t *tail;
   cu_tail_match_match_t *matches;
   size_t matches_num;
+
+  /* Built from `matches' on the first read after a match has been added. */
+  cu_match_set_t *match_set;
 };
 
 /*
@@ -171,6 +174,11 @@ static int tail_callback(void *data, char *buf,
                          int __attribute__((unused)) buflen) {
   cu_tail_match_t *obj = (cu_tail_match_t *)data;
 
+  if (obj->match_set != NULL) {
+    match_set_apply(obj->match_set, buf);
+    return 0;
+  }
+
   for (size_t i = 0; i < obj->matches_num; i++)
     match_apply(obj->matches[i].match, buf);
 
@@ -211,6 +219,9 @@ void tail_match_destroy(cu_tail_match_t *obj) {
     obj->tail = NULL;
   }
 
+  match_set_destroy(obj->match_set);
+  obj->match_set = NULL;
+
   for (size_t i = 0; i < obj->matches_num; i++) {
     cu_tail_match_match_t *match = obj->matches + i;
     if (match->match != NULL) {
@@ -242,6 +253,9 @@ int tail_match_add_match(cu_tail_match_t *obj, cu_match_t *match,
   obj->matches = temp;
   obj->matches_num++;
 
+  match_set_destroy(obj->match_set);
+  obj->match_set = NULL;
+
   temp = obj->matches + (obj->matches_num - 1);
 
   temp->match = match;
@@ -310,6 +324,18 @@ int tail_match_read(cu_tail_match_t *obj, bool force_rewind) {
   char buffer[4096];
   int status;
 
+  /* Without a match set every match is applied on its own, which is slower
+   * but otherwise equivalent. */
+  if ((obj->match_set == NULL) && (obj->matches_num > 0)) {
+    cu_match_t **matches = calloc(obj->matches_num, sizeof(*matches));
+    if (matches != NULL) {
+      for (size_t i = 0; i < obj->matches_num; i++)
+        matches[i] = obj->matches[i].match;
+      obj->match_set = match_set_create(matches, obj->matches_num);
+      sfree(matches);
+    }
+  }
+
   status = cu_tail_read(obj->tail, buffer, sizeof(buffer), tail_callback,
                         (void *)obj, force_rewind);
   if (status != 0) {
@@ -328,3 +354,7 @@ int tail_match_read(cu_tail_match_t *obj, bool force_rewind) {
 
   return 0;
 } /* int tail_match_read */
+
+uint64_t tail_match_backlog(cu_tail_match_t *obj) {
+  return cu_tail_backlog(obj->tail);
+} /* uint64_t tail_match_backlog */
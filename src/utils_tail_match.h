@@ -137,4 +137,14 @@ int tail_match_add_match_simple(cu_tail_match_t *obj, const char *regex,
  */
 int tail_match_read(cu_tail_match_t *obj, bool force_rewind);
 
+/*
+ * NAME
+ *   tail_match_backlog
+ *
+ * DESCRIPTION
+ *   Returns the number of bytes that were waiting to be read when the last
+ *   call to `tail_match_read' started, see `cu_tail_backlog'.
+ */
+uint64_t tail_match_backlog(cu_tail_match_t *obj);
+
 #endif /* UTILS_TAIL_MATCH_H */
@@ -34,6 +34,8 @@ static const char *config_keys[] = {"Verbose"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static int verbose_output;
+
+static procfile_t *pf_vmstat;
 /* #endif KERNEL_LINUX */
 
 #else
@@ -100,16 +102,19 @@ static int vmem_read(void) {
   derive_t pgmajfault = 0;
   int pgfaultvalid = 0;
 
-  FILE *fh;
-  char buffer[1024];
+  char *buffer;
+  char *ptr;
+
+  if ((pf_vmstat == NULL) &&
+      ((pf_vmstat = procfile_create("/proc/vmstat")) == NULL))
+    return -1;
 
-  fh = fopen("/proc/vmstat", "r");
-  if (fh == NULL) {
-    ERROR("vmem plugin: fopen (/proc/vmstat) failed: %s", STRERRNO);
+  if ((ptr = procfile_read(pf_vmstat)) == NULL) {
+    ERROR("vmem plugin: Reading /proc/vmstat failed: %s", STRERRNO);
     return -1;
   }
 
-  while (fgets(buffer, sizeof(buffer), fh) != NULL) {
+  while ((buffer = next_line(&ptr)) != NULL) {
     char *fields[4];
     int fields_num;
     char *key;
@@ -237,10 +242,7 @@ static int vmem_read(void) {
       value_t value = {.derive = counter};
       submit_one(NULL, "vmpage_action", "deactivate", value);
     }
-  } /* while (fgets) */
-
-  fclose(fh);
-  fh = NULL;
+  } /* while (next_line) */
 
   if (pgfaultvalid == 0x03)
     submit_two(NULL, "vmpage_faults", NULL, pgfault, pgmajfault);
@@ -255,7 +257,14 @@ static int vmem_read(void) {
   return 0;
 } /* int vmem_read */
 
+static int vmem_shutdown(void) {
+  procfile_destroy(pf_vmstat);
+  pf_vmstat = NULL;
+  return 0;
+} /* int vmem_shutdown */
+
 void module_register(void) {
   plugin_register_config("vmem", vmem_config, config_keys, config_keys_num);
   plugin_register_read("vmem", vmem_read);
+  plugin_register_shutdown("vmem", vmem_shutdown);
 } /* void module_register */
@@ -40,6 +40,8 @@
  *     Prefix "collectd"
  *     UseTags true
  *     ReverseHost false
+ *     SendQueueSize 8388608
+ *     Connections 2
  *   </Carbon>
  * </Plugin>
  */
@@ -52,7 +54,9 @@
 #include "utils/format_graphite/format_graphite.h"
 #include "utils_complain.h"
 
+#include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
 
 #ifndef WG_DEFAULT_NODE
 #define WG_DEFAULT_NODE "localhost"
@@ -83,9 +87,38 @@
 #define WG_MIN_RECONNECT_INTERVAL TIME_T_TO_CDTIME_T(1)
 #endif
 
+/* Per-connection buffer of the asynchronous sender (TCP only; UDP datagrams
+ * are limited to WG_SEND_BUF_SIZE). */
+#ifndef WG_STAGE_SIZE
+#define WG_STAGE_SIZE 65536
+#endif
+
+/* Time the sender thread has to empty the queue when shutting down. */
+#ifndef WG_SHUTDOWN_TIMEOUT
+#define WG_SHUTDOWN_TIMEOUT TIME_T_TO_CDTIME_T(2)
+#endif
+
 /*
  * Private variables
  */
+
+/* One connection of the asynchronous sender. Only used by the sender thread.
+ */
+struct wg_connection {
+  int fd;
+  bool connecting;
+  struct addrinfo *ai_list;
+  struct addrinfo *ai_next;
+  cdtime_t last_connect_time;
+  cdtime_t connect_time;
+
+  /* Whole lines taken from the queue, `stage_pos' of which have been sent. */
+  char *stage;
+  size_t stage_size;
+  size_t stage_fill;
+  size_t stage_pos;
+};
+
 struct wg_callback {
   int sock_fd;
 
@@ -100,6 +133,7 @@ struct wg_callback {
   char escape_char;
 
   unsigned int format_flags;
+  format_graphite_cache_t *format_cache;
 
   char send_buf[WG_SEND_BUF_SIZE];
   size_t send_buf_free;
@@ -114,6 +148,31 @@ struct wg_callback {
   cdtime_t last_reconnect_time;
   cdtime_t reconnect_interval;
   bool reconnect_interval_reached;
+
+  /* Asynchronous mode: formatted lines are appended to a ring buffer of
+   * `queue_size' bytes, from which wg_send_thread() sends them. The sender
+   * is set up by the first write; `async_failed' is set if that failed and
+   * values are sent synchronously instead. */
+  size_t queue_size;
+  int connections_num;
+  bool report_stats;
+
+  char *queue;
+  uint64_t queue_head; /* total number of bytes enqueued */
+  uint64_t queue_tail; /* total number of bytes dequeued */
+  pthread_mutex_t queue_lock;
+  c_complain_t queue_complaint;
+  int wakeup_fd[2];
+  bool wakeup_pending;
+  bool async_failed;
+  bool send_thread_running;
+  bool send_thread_shutdown;
+  pthread_t send_thread;
+  struct wg_connection *connections;
+
+  uint64_t stats_sent;
+  uint64_t stats_dropped;
+  uint64_t stats_staged;
 };
 
 /* wg_force_reconnect_check closes cb->sock_fd when it was open for longer
@@ -281,6 +340,497 @@ static int wg_callback_init(struct wg_callback *cb) {
   return 0;
 }
 
+/*
+ * Asynchronous sender
+ */
+static void wg_conn_close(struct wg_connection *conn) /* {{{ */
+{
+  if (conn->fd >= 0) {
+    close(conn->fd);
+    conn->fd = -1;
+  }
+  conn->connecting = false;
+
+  if (conn->ai_list != NULL) {
+    freeaddrinfo(conn->ai_list);
+    conn->ai_list = NULL;
+    conn->ai_next = NULL;
+  }
+} /* }}} void wg_conn_close */
+
+static void wg_conn_established(struct wg_callback *cb,
+                                struct wg_connection *conn) /* {{{ */
+{
+  conn->connecting = false;
+  conn->connect_time = cdtime();
+
+  freeaddrinfo(conn->ai_list);
+  conn->ai_list = NULL;
+  conn->ai_next = NULL;
+
+  c_release(LOG_INFO, &cb->init_complaint,
+            "write_graphite plugin: Successfully connected to %s:%s via %s.",
+            cb->node, cb->service, cb->protocol);
+} /* }}} void wg_conn_established */
+
+/* Starts a non-blocking connect to the next address in `conn->ai_list'.
+ * Returns zero if the connection has been established or is in progress. */
+static int wg_conn_connect_next(struct wg_callback *cb,
+                                struct wg_connection *conn,
+                                char const *last_error) /* {{{ */
+{
+  char connerr[1024];
+
+  sstrncpy(connerr, last_error, sizeof(connerr));
+
+  while (conn->ai_next != NULL) {
+    struct addrinfo *ai = conn->ai_next;
+    conn->ai_next = ai->ai_next;
+
+    conn->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (conn->fd < 0) {
+      snprintf(connerr, sizeof(connerr), "failed to open socket: %s", STRERRNO);
+      continue;
+    }
+
+    set_sock_opts(conn->fd);
+    fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+
+    if (connect(conn->fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      wg_conn_established(cb, conn);
+      return 0;
+    } else if (errno == EINPROGRESS) {
+      conn->connecting = true;
+      return 0;
+    }
+
+    snprintf(connerr, sizeof(connerr), "failed to connect to remote host: %s",
+             STRERRNO);
+    close(conn->fd);
+    conn->fd = -1;
+  }
+
+  wg_conn_close(conn);
+  c_complain(LOG_ERR, &cb->init_complaint,
+             "write_graphite plugin: Connecting to %s:%s via %s failed. "
+             "The last error was: %s",
+             cb->node, cb->service, cb->protocol, connerr);
+  return -1;
+} /* }}} int wg_conn_connect_next */
+
+static int wg_conn_connect(struct wg_callback *cb, struct wg_connection *conn,
+                           cdtime_t now) /* {{{ */
+{
+  /* Don't try to reconnect too often. By default, one reconnection attempt
+   * is made per second. */
+  if ((now - conn->last_connect_time) < WG_MIN_RECONNECT_INTERVAL)
+    return EAGAIN;
+  conn->last_connect_time = now;
+
+  struct addrinfo ai_hints = {.ai_family = AF_UNSPEC,
+                              .ai_flags = AI_ADDRCONFIG};
+
+  if (0 == strcasecmp("tcp", cb->protocol))
+    ai_hints.ai_socktype = SOCK_STREAM;
+  else
+    ai_hints.ai_socktype = SOCK_DGRAM;
+
+  int status = getaddrinfo(cb->node, cb->service, &ai_hints, &conn->ai_list);
+  if (status != 0) {
+    ERROR("write_graphite plugin: getaddrinfo (%s, %s, %s) failed: %s",
+          cb->node, cb->service, cb->protocol, gai_strerror(status));
+    conn->ai_list = NULL;
+    return -1;
+  }
+
+  conn->ai_next = conn->ai_list;
+  return wg_conn_connect_next(cb, conn, "no address to connect to");
+} /* }}} int wg_conn_connect */
+
+static void wg_conn_connect_finish(struct wg_callback *cb,
+                                   struct wg_connection *conn) /* {{{ */
+{
+  int error = 0;
+  socklen_t error_len = sizeof(error);
+
+  if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &error_len) != 0)
+    error = errno;
+
+  if (error == 0) {
+    wg_conn_established(cb, conn);
+    return;
+  }
+
+  char connerr[1024];
+  snprintf(connerr, sizeof(connerr), "failed to connect to remote host: %s",
+           STRERROR(error));
+  close(conn->fd);
+  conn->fd = -1;
+  conn->connecting = false;
+
+  wg_conn_connect_next(cb, conn, connerr);
+} /* }}} void wg_conn_connect_finish */
+
+/* Closes a broken connection. Over TCP the staged lines are sent again once
+ * the connection has been re-established, so lines may be duplicated but are
+ * not lost. Datagrams are dropped. */
+static void wg_conn_failed(struct wg_callback *cb,
+                           struct wg_connection *conn) /* {{{ */
+{
+  wg_conn_close(conn);
+
+  pthread_mutex_lock(&cb->queue_lock);
+  if (strcasecmp("tcp", cb->protocol) == 0) {
+    cb->stats_staged += conn->stage_pos;
+  } else {
+    cb->stats_dropped += conn->stage_fill - conn->stage_pos;
+    cb->stats_staged -= conn->stage_fill - conn->stage_pos;
+    conn->stage_fill = 0;
+  }
+  conn->stage_pos = 0;
+  pthread_mutex_unlock(&cb->queue_lock);
+} /* }}} void wg_conn_failed */
+
+/* Moves as many whole lines from the queue to the connection's stage as fit.
+ * The stage must be empty. */
+static void wg_conn_fill(struct wg_callback *cb,
+                         struct wg_connection *conn) /* {{{ */
+{
+  pthread_mutex_lock(&cb->queue_lock);
+  uint64_t tail = cb->queue_tail;
+  size_t avail = (size_t)(cb->queue_head - tail);
+  pthread_mutex_unlock(&cb->queue_lock);
+
+  if (avail == 0)
+    return;
+
+  size_t take = avail;
+  if (take > conn->stage_size) {
+    take = conn->stage_size;
+    while ((take > 0) &&
+           (cb->queue[(tail + take - 1) % cb->queue_size] != '\n'))
+      take--;
+    /* A single line larger than the stage; send it in pieces. */
+    if (take == 0)
+      take = conn->stage_size;
+  }
+
+  /* Writers only append behind `queue_head' and the tail is only advanced by
+   * this thread, so the data can be copied without holding the lock. */
+  size_t pos = (size_t)(tail % cb->queue_size);
+  size_t first = take;
+  if (first > cb->queue_size - pos)
+    first = cb->queue_size - pos;
+  memcpy(conn->stage, cb->queue + pos, first);
+  memcpy(conn->stage + first, cb->queue, take - first);
+  conn->stage_fill = take;
+  conn->stage_pos = 0;
+
+  pthread_mutex_lock(&cb->queue_lock);
+  cb->queue_tail += take;
+  cb->stats_staged += take;
+  pthread_mutex_unlock(&cb->queue_lock);
+} /* }}} void wg_conn_fill */
+
+static void wg_conn_send(struct wg_callback *cb,
+                         struct wg_connection *conn) /* {{{ */
+{
+  ssize_t status = write(conn->fd, conn->stage + conn->stage_pos,
+                         conn->stage_fill - conn->stage_pos);
+  if (status < 0) {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+      return;
+
+    if (cb->log_send_errors)
+      ERROR("write_graphite plugin: send to %s:%s (%s) failed: %s", cb->node,
+            cb->service, cb->protocol, STRERRNO);
+    wg_conn_failed(cb, conn);
+    return;
+  }
+
+  conn->stage_pos += (size_t)status;
+  if (conn->stage_pos == conn->stage_fill) {
+    conn->stage_pos = 0;
+    conn->stage_fill = 0;
+  }
+
+  pthread_mutex_lock(&cb->queue_lock);
+  cb->stats_sent += (uint64_t)status;
+  cb->stats_staged -= (uint64_t)status;
+  pthread_mutex_unlock(&cb->queue_lock);
+} /* }}} void wg_conn_send */
+
+/* Carbon never sends anything, so a readable socket means the peer closed the
+ * connection or an error is pending. */
+static void wg_conn_check_closed(struct wg_callback *cb,
+                                 struct wg_connection *conn) /* {{{ */
+{
+  char buffer[64];
+  ssize_t status = recv(conn->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+
+  if ((status > 0) ||
+      ((status < 0) &&
+       ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))))
+    return;
+
+  if (cb->log_send_errors)
+    ERROR("write_graphite plugin: Connection to %s:%s (%s) closed: %s",
+          cb->node, cb->service, cb->protocol,
+          (status == 0) ? "closed by peer" : STRERRNO);
+  wg_conn_failed(cb, conn);
+} /* }}} void wg_conn_check_closed */
+
+/* Interrupts the sender thread's poll(2). If the pipe is full, a wake-up is
+ * pending anyway. */
+static void wg_wakeup(struct wg_callback *cb) /* {{{ */
+{
+  if ((write(cb->wakeup_fd[1], "", 1) < 0) && (errno != EAGAIN))
+    ERROR("write_graphite plugin: Waking up the sender thread failed: %s",
+          STRERRNO);
+} /* }}} void wg_wakeup */
+
+/* The sender thread owns all connections of a node. It moves data from the
+ * queue to the connections and writes it with non-blocking sockets, so a slow
+ * or unreachable server never blocks the write callback. Spreading the
+ * data over multiple connections is done by handing the next chunk of the
+ * queue to the first idle connection, starting with a different one in every
+ * iteration. */
+static void *wg_send_thread(void *arg) /* {{{ */
+{
+  struct wg_callback *cb = arg;
+  size_t conn_num = (size_t)cb->connections_num;
+  struct pollfd *fds = calloc(conn_num + 1, sizeof(*fds));
+  struct wg_connection **polled = calloc(conn_num + 1, sizeof(*polled));
+  bool tcp = (strcasecmp("tcp", cb->protocol) == 0);
+  size_t start = 0;
+  cdtime_t deadline = 0;
+
+  if ((fds == NULL) || (polled == NULL)) {
+    ERROR("write_graphite plugin: calloc failed.");
+    sfree(fds);
+    sfree(polled);
+    return NULL;
+  }
+
+  while (true) {
+    cdtime_t now = cdtime();
+
+    pthread_mutex_lock(&cb->queue_lock);
+    bool shutdown = cb->send_thread_shutdown;
+    bool idle = (cb->queue_head == cb->queue_tail);
+    cb->wakeup_pending = false;
+    pthread_mutex_unlock(&cb->queue_lock);
+
+    if (shutdown) {
+      if (deadline == 0)
+        deadline = now + WG_SHUTDOWN_TIMEOUT;
+      for (size_t i = 0; i < conn_num; i++)
+        if (cb->connections[i].stage_fill > 0)
+          idle = false;
+      if (idle || (now >= deadline))
+        break;
+    }
+
+    fds[0] = (struct pollfd){.fd = cb->wakeup_fd[0], .events = POLLIN};
+    polled[0] = NULL;
+    size_t fds_num = 1;
+
+    for (size_t i = 0; i < conn_num; i++) {
+      struct wg_connection *conn = cb->connections + ((start + i) % conn_num);
+
+      if ((conn->fd >= 0) && !conn->connecting && (conn->stage_fill == 0) &&
+          (cb->reconnect_interval > 0) &&
+          ((now - conn->connect_time) >= cb->reconnect_interval)) {
+        INFO("write_graphite plugin: Connection closed after %.3f seconds.",
+             CDTIME_T_TO_DOUBLE(now - conn->connect_time));
+        wg_conn_close(conn);
+        conn->last_connect_time = 0;
+      }
+
+      if ((conn->fd < 0) && (wg_conn_connect(cb, conn, now) != 0))
+        continue;
+
+      short events = 0;
+      if (conn->connecting) {
+        events = POLLOUT;
+      } else {
+        if (conn->stage_fill == 0)
+          wg_conn_fill(cb, conn);
+        if (conn->stage_fill > 0)
+          events |= POLLOUT;
+        if (tcp)
+          events |= POLLIN;
+      }
+      if (events == 0)
+        continue;
+
+      fds[fds_num] = (struct pollfd){.fd = conn->fd, .events = events};
+      polled[fds_num] = conn;
+      fds_num++;
+    }
+    start = (start + 1) % conn_num;
+
+    cdtime_t timeout = WG_MIN_RECONNECT_INTERVAL;
+    if ((deadline != 0) && ((deadline - now) < timeout))
+      timeout = deadline - now;
+
+    int status = poll(fds, (nfds_t)fds_num, (int)CDTIME_T_TO_MS(timeout));
+    if (status < 0) {
+      if (errno != EINTR)
+        ERROR("write_graphite plugin: poll failed: %s", STRERRNO);
+      continue;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      char buffer[64];
+      while (read(cb->wakeup_fd[0], buffer, sizeof(buffer)) > 0)
+        ;
+    }
+
+    for (size_t i = 1; i < fds_num; i++) {
+      struct wg_connection *conn = polled[i];
+      short revents = fds[i].revents;
+
+      if (revents == 0)
+        continue;
+
+      if (conn->connecting) {
+        wg_conn_connect_finish(cb, conn);
+        continue;
+      }
+
+      if (revents & (POLLIN | POLLERR | POLLHUP)) {
+        wg_conn_check_closed(cb, conn);
+        if (conn->fd < 0)
+          continue;
+      }
+      if ((revents & POLLOUT) && (conn->stage_fill > 0))
+        wg_conn_send(cb, conn);
+    }
+  }
+
+  for (size_t i = 0; i < conn_num; i++)
+    wg_conn_close(cb->connections + i);
+
+  sfree(fds);
+  sfree(polled);
+  return NULL;
+} /* }}} void *wg_send_thread */
+
+static void wg_async_free(struct wg_callback *cb) /* {{{ */
+{
+  if (cb->send_thread_running) {
+    pthread_mutex_lock(&cb->queue_lock);
+    cb->send_thread_shutdown = true;
+    pthread_mutex_unlock(&cb->queue_lock);
+    wg_wakeup(cb);
+
+    pthread_join(cb->send_thread, NULL);
+    cb->send_thread_running = false;
+  }
+
+  for (int i = 0; i < 2; i++) {
+    if (cb->wakeup_fd[i] >= 0) {
+      close(cb->wakeup_fd[i]);
+      cb->wakeup_fd[i] = -1;
+    }
+  }
+
+  if (cb->connections != NULL) {
+    for (int i = 0; i < cb->connections_num; i++) {
+      wg_conn_close(cb->connections + i);
+      sfree(cb->connections[i].stage);
+    }
+    sfree(cb->connections);
+  }
+  sfree(cb->queue);
+} /* }}} void wg_async_free */
+
+static int wg_async_init(struct wg_callback *cb) /* {{{ */
+{
+  size_t stage_size = WG_STAGE_SIZE;
+  if (strcasecmp("udp", cb->protocol) == 0)
+    stage_size = WG_SEND_BUF_SIZE;
+
+  cb->queue = malloc(cb->queue_size);
+  cb->connections = calloc((size_t)cb->connections_num,
+                           sizeof(*cb->connections));
+  if ((cb->queue == NULL) || (cb->connections == NULL)) {
+    ERROR("write_graphite plugin: Allocating the send queue failed.");
+    return -1;
+  }
+
+  for (int i = 0; i < cb->connections_num; i++) {
+    struct wg_connection *conn = cb->connections + i;
+
+    conn->fd = -1;
+    conn->stage_size = stage_size;
+    conn->stage = malloc(stage_size);
+    if (conn->stage == NULL) {
+      ERROR("write_graphite plugin: Allocating the send queue failed.");
+      return -1;
+    }
+  }
+
+  if (pipe(cb->wakeup_fd) != 0) {
+    ERROR("write_graphite plugin: pipe failed: %s", STRERRNO);
+    cb->wakeup_fd[0] = cb->wakeup_fd[1] = -1;
+    return -1;
+  }
+  for (int i = 0; i < 2; i++)
+    fcntl(cb->wakeup_fd[i], F_SETFL,
+          fcntl(cb->wakeup_fd[i], F_GETFL) | O_NONBLOCK);
+
+  int status = plugin_thread_create(&cb->send_thread, wg_send_thread, cb,
+                                    "wg send");
+  if (status != 0) {
+    ERROR("write_graphite plugin: Starting the sender thread failed: %s",
+          STRERROR(status));
+    return -1;
+  }
+  cb->send_thread_running = true;
+
+  return 0;
+} /* }}} int wg_async_init */
+
+static int wg_stats_read(user_data_t *user_data) /* {{{ */
+{
+  struct wg_callback *cb = user_data->data;
+
+  pthread_mutex_lock(&cb->queue_lock);
+  gauge_t queued =
+      (gauge_t)(cb->queue_head - cb->queue_tail + cb->stats_staged);
+  derive_t sent = (derive_t)cb->stats_sent;
+  derive_t dropped = (derive_t)cb->stats_dropped;
+  pthread_mutex_unlock(&cb->queue_lock);
+
+  value_list_t vl = VALUE_LIST_INIT;
+  value_t value;
+
+  vl.values = &value;
+  vl.values_len = 1;
+  sstrncpy(vl.plugin, "write_graphite", sizeof(vl.plugin));
+  sstrncpy(vl.plugin_instance, (cb->name != NULL) ? cb->name : cb->node,
+           sizeof(vl.plugin_instance));
+
+  value.gauge = queued;
+  sstrncpy(vl.type, "bytes", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "queued", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  sstrncpy(vl.type, "total_bytes", sizeof(vl.type));
+
+  value.derive = sent;
+  sstrncpy(vl.type_instance, "sent", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  value.derive = dropped;
+  sstrncpy(vl.type_instance, "dropped", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  return 0;
+} /* }}} int wg_stats_read */
+
 static void wg_callback_free(void *data) {
   struct wg_callback *cb;
 
@@ -289,6 +839,8 @@ static void wg_callback_free(void *data) {
 
   cb = data;
 
+  wg_async_free(cb);
+
   pthread_mutex_lock(&cb->send_lock);
 
   wg_flush_nolock(/* timeout = */ 0, cb);
@@ -304,9 +856,11 @@ static void wg_callback_free(void *data) {
   sfree(cb->service);
   sfree(cb->prefix);
   sfree(cb->postfix);
+  format_graphite_cache_destroy(cb->format_cache);
 
   pthread_mutex_unlock(&cb->send_lock);
   pthread_mutex_destroy(&cb->send_lock);
+  pthread_mutex_destroy(&cb->queue_lock);
 
   sfree(cb);
 }
@@ -322,6 +876,15 @@ static int wg_flush(cdtime_t timeout,
 
   cb = user_data->data;
 
+  /* The sender thread sends everything as soon as it is queued. */
+  if (cb->queue_size > 0) {
+    pthread_mutex_lock(&cb->queue_lock);
+    bool async_failed = cb->async_failed;
+    pthread_mutex_unlock(&cb->queue_lock);
+    if (!async_failed)
+      return 0;
+  }
+
   pthread_mutex_lock(&cb->send_lock);
 
   if (cb->sock_fd < 0) {
@@ -387,6 +950,59 @@ static int wg_send_message(char const *message, struct wg_callback *cb) {
   return 0;
 }
 
+static int wg_enqueue(char const *message, struct wg_callback *cb) /* {{{ */
+{
+  size_t message_len = strlen(message);
+
+  pthread_mutex_lock(&cb->queue_lock);
+
+  /* The configuration is read before the daemon forks, so the sender thread
+   * is started here rather than in wg_config_node(). */
+  if (!cb->send_thread_running && !cb->async_failed &&
+      (wg_async_init(cb) != 0)) {
+    ERROR("write_graphite plugin: Falling back to sending values "
+          "synchronously.");
+    wg_async_free(cb);
+    cb->async_failed = true;
+  }
+  if (cb->async_failed) {
+    pthread_mutex_unlock(&cb->queue_lock);
+    return wg_send_message(message, cb);
+  }
+
+  if ((cb->queue_head - cb->queue_tail) + message_len > cb->queue_size) {
+    cb->stats_dropped += message_len;
+    c_complain(LOG_WARNING, &cb->queue_complaint,
+               "write_graphite plugin: The send queue for %s:%s is full. "
+               "Dropping values until it has drained.",
+               cb->node, cb->service);
+    pthread_mutex_unlock(&cb->queue_lock);
+    return -1;
+  }
+  c_release(LOG_INFO, &cb->queue_complaint,
+            "write_graphite plugin: The send queue for %s:%s has space "
+            "again.",
+            cb->node, cb->service);
+
+  size_t pos = (size_t)(cb->queue_head % cb->queue_size);
+  size_t first = message_len;
+  if (first > cb->queue_size - pos)
+    first = cb->queue_size - pos;
+  memcpy(cb->queue + pos, message, first);
+  memcpy(cb->queue, message + first, message_len - first);
+  cb->queue_head += message_len;
+
+  bool wakeup = !cb->wakeup_pending;
+  cb->wakeup_pending = true;
+
+  pthread_mutex_unlock(&cb->queue_lock);
+
+  if (wakeup)
+    wg_wakeup(cb);
+
+  return 0;
+} /* }}} int wg_enqueue */
+
 static int wg_write_messages(const data_set_t *ds, const value_list_t *vl,
                              struct wg_callback *cb) {
   char buffer[WG_SEND_BUF_SIZE] = {0};
@@ -398,13 +1014,17 @@ static int wg_write_messages(const data_set_t *ds, const value_list_t *vl,
     return -1;
   }
 
-  status = format_graphite(buffer, sizeof(buffer), ds, vl, cb->prefix,
-                           cb->postfix, cb->escape_char, cb->format_flags);
+  status = format_graphite_cached(cb->format_cache, buffer, sizeof(buffer), ds,
+                                  vl, cb->prefix, cb->postfix, cb->escape_char,
+                                  cb->format_flags);
   if (status != 0) /* error message has been printed already. */
     return status;
 
   /* Send the message to graphite */
-  status = wg_send_message(buffer, cb);
+  if (cb->queue_size > 0)
+    status = wg_enqueue(buffer, cb);
+  else
+    status = wg_send_message(buffer, cb);
   if (status != 0) /* error message has been printed already. */
     return status;
 
@@ -474,6 +1094,13 @@ static int wg_config_node(oconfig_item_t *ci) {
   cb->postfix = NULL;
   cb->escape_char = WG_DEFAULT_ESCAPE;
   cb->format_flags = GRAPHITE_STORE_RATES;
+  cb->queue_size = 0;
+  cb->connections_num = 1;
+  cb->report_stats = false;
+  cb->wakeup_fd[0] = -1;
+  cb->wakeup_fd[1] = -1;
+  /* If this fails, metric paths are simply built for every value list. */
+  cb->format_cache = format_graphite_cache_create();
 
   /* FIXME: Legacy configuration syntax. */
   if (strcasecmp("Carbon", ci->key) != 0) {
@@ -485,7 +1112,9 @@ static int wg_config_node(oconfig_item_t *ci) {
   }
 
   pthread_mutex_init(&cb->send_lock, /* attr = */ NULL);
+  pthread_mutex_init(&cb->queue_lock, /* attr = */ NULL);
   C_COMPLAIN_INIT(&cb->init_complaint);
+  C_COMPLAIN_INIT(&cb->queue_complaint);
 
   for (int i = 0; i < ci->children_num; i++) {
     oconfig_item_t *child = ci->children + i;
@@ -526,6 +1155,23 @@ static int wg_config_node(oconfig_item_t *ci) {
       cf_util_get_flag(child, &cb->format_flags, GRAPHITE_REVERSE_HOST);
     else if (strcasecmp("EscapeCharacter", child->key) == 0)
       config_set_char(&cb->escape_char, child);
+    else if (strcasecmp("SendQueueSize", child->key) == 0) {
+      int tmp = 0;
+      status = cf_util_get_int(child, &tmp);
+      if ((status == 0) && (tmp < 0)) {
+        ERROR("write_graphite plugin: \"SendQueueSize\" must not be "
+              "negative.");
+        status = -1;
+      }
+      cb->queue_size = (size_t)tmp;
+    } else if (strcasecmp("Connections", child->key) == 0) {
+      status = cf_util_get_int(child, &cb->connections_num);
+      if ((status == 0) && (cb->connections_num < 1)) {
+        ERROR("write_graphite plugin: \"Connections\" must be at least 1.");
+        status = -1;
+      }
+    } else if (strcasecmp("ReportStats", child->key) == 0)
+      cf_util_get_boolean(child, &cb->report_stats);
     else {
       ERROR("write_graphite plugin: Invalid configuration "
             "option: %s.",
@@ -542,6 +1188,19 @@ static int wg_config_node(oconfig_item_t *ci) {
     return status;
   }
 
+  if ((cb->queue_size > 0) && (cb->queue_size < WG_STAGE_SIZE)) {
+    WARNING("write_graphite plugin: \"SendQueueSize\" is smaller than %d "
+            "bytes. Increasing it.",
+            WG_STAGE_SIZE);
+    cb->queue_size = WG_STAGE_SIZE;
+  }
+  if ((cb->queue_size == 0) && (cb->connections_num > 1))
+    WARNING("write_graphite plugin: \"Connections\" requires "
+            "\"SendQueueSize\" and will be ignored.");
+  if ((cb->queue_size == 0) && cb->report_stats)
+    WARNING("write_graphite plugin: \"ReportStats\" requires "
+            "\"SendQueueSize\" and will be ignored.");
+
   /* FIXME: Legacy configuration syntax. */
   if (cb->name == NULL)
     snprintf(callback_name, sizeof(callback_name), "write_graphite/%s/%s/%s",
@@ -558,6 +1217,11 @@ static int wg_config_node(oconfig_item_t *ci) {
 
   plugin_register_flush(callback_name, wg_flush, &(user_data_t){.data = cb});
 
+  if ((cb->queue_size > 0) && cb->report_stats)
+    plugin_register_complex_read(/* group = */ NULL, callback_name,
+                                 wg_stats_read, /* interval = */ 0,
+                                 &(user_data_t){.data = cb});
+
   return 0;
 }
 
@@ -26,6 +26,7 @@
 #include "collectd.h"
 
 #include "plugin.h"
+#include "utils/avltree/avltree.h"
 #include "utils/common/common.h"
 #include "utils/curl_stats/curl_stats.h"
 #include "utils/format_json/format_json.h"
@@ -33,6 +34,13 @@
 
 #include <curl/curl.h>
 
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
+#if HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
 #ifndef WRITE_HTTP_DEFAULT_BUFFER_SIZE
 #define WRITE_HTTP_DEFAULT_BUFFER_SIZE 4096
 #endif
@@ -45,9 +53,57 @@
 #define WRITE_HTTP_RESPONSE_BUFFER_SIZE 1024
 #endif
 
+#ifndef WRITE_HTTP_DEFAULT_SPOOL_SIZE
+#define WRITE_HTTP_DEFAULT_SPOOL_SIZE 64 /* MiB */
+#endif
+
+/* Maximum number of spooled batches replayed by one synchronous flush. */
+#ifndef WRITE_HTTP_SPOOL_REPLAY_MAX
+#define WRITE_HTTP_SPOOL_REPLAY_MAX 16
+#endif
+
+/* curl_multi_poll() and curl_multi_wakeup() were added in 7.66 and 7.68. */
+#if LIBCURL_VERSION_NUM >= 0x074400
+#define WH_HAVE_MULTI_WAKEUP 1
+#endif
+
 /*
  * Private variables
  */
+typedef struct {
+  char buffer[WRITE_HTTP_RESPONSE_BUFFER_SIZE];
+  unsigned int pos;
+} wh_response_t;
+
+typedef struct {
+  char *data;
+  size_t size;
+} wh_buffer_t;
+
+/* A spooled batch. The directory is only read once, at startup; afterwards
+ * the files are tracked in memory. Their names sort by time, so the oldest
+ * batch is the first entry of the index. */
+typedef struct {
+  char *name;
+  uint64_t size;
+} wh_spool_entry_t;
+
+/* One in-flight POST of the asynchronous sender. */
+typedef struct {
+  CURL *curl;
+  bool busy;
+  bool pending; /* assigned, but not yet added to the multi handle */
+  bool replay;  /* posts `spool_file' rather than a queued send buffer */
+  char *data;
+  size_t data_size;
+  char spool_file[PATH_MAX];
+  wh_buffer_t compressed;
+  char const *body; /* `data' or `compressed' */
+  size_t body_size;
+  wh_response_t response;
+  char curl_errbuf[CURL_ERROR_SIZE];
+} wh_request_t;
+
 struct wh_callback_s {
   char *name;
 
@@ -73,6 +129,13 @@ struct wh_callback_s {
 #define WH_FORMAT_JSON 1
 #define WH_FORMAT_KAIROSDB 2
   int format;
+
+#define WH_COMPRESS_NONE 0
+#define WH_COMPRESS_GZIP 1
+#define WH_COMPRESS_ZSTD 2
+  int compression;
+  wh_buffer_t compressed;
+
   bool send_metrics;
   bool send_notifications;
 
@@ -82,6 +145,7 @@ struct wh_callback_s {
   char curl_errbuf[CURL_ERROR_SIZE];
 
   char *send_buffer;
+  json_buffer_t json; /* scratch space for one value list */
   size_t send_buffer_size;
   size_t send_buffer_free;
   size_t send_buffer_fill;
@@ -89,8 +153,45 @@ struct wh_callback_s {
 
   pthread_mutex_t send_lock;
 
-  char response_buffer[WRITE_HTTP_RESPONSE_BUFFER_SIZE];
-  unsigned int response_buffer_pos;
+  wh_response_t response;
+
+  /* Asynchronous sender, enabled by "MaxConcurrentRequests". Full send
+   * buffers are queued and posted by `send_thread' while writers continue
+   * with a spare buffer. */
+  int max_requests;
+  bool http2;
+  CURLM *multi;
+  wh_request_t *requests;
+  size_t requests_inflight;
+  pthread_t send_thread;
+  bool send_thread_running;
+  bool send_thread_shutdown;
+
+  pthread_mutex_t queue_lock;
+  pthread_cond_t queue_cond;
+  char **queue; /* ring buffer of `max_requests' send buffers */
+  size_t queue_head;
+  size_t queue_num;
+  /* Up to `max_requests' unused send buffers. Writers allocate a new buffer
+   * when none is left, so more buffers than that may exist at times; the
+   * surplus is freed when it is returned. */
+  char **spare;
+  size_t spare_num;
+
+  /* On-disk retry spool, enabled by "SpoolDirectory". Bodies which could
+   * not be posted are stored as one file each and replayed, oldest first,
+   * with exponential backoff. */
+  char *spool_dir;
+  uint64_t spool_max_size;
+  cdtime_t spool_retry_interval;
+  cdtime_t spool_retry_max_interval;
+  pthread_mutex_t spool_lock;
+  c_avl_tree_t *spool_index; /* file name -> wh_spool_entry_t */
+  uint64_t spool_size;
+  size_t spool_files;
+  cdtime_t spool_backoff;
+  cdtime_t spool_next_retry;
+  bool spool_replaying; /* protected by queue_lock */
 
   int data_ttl;
   char *metrics_prefix;
@@ -106,21 +207,21 @@ static size_t http_attrs_num;
 static size_t wh_curl_write_callback(char *ptr, size_t size, size_t nmemb,
                                      void *userdata) {
 
-  wh_callback_t *cb = (wh_callback_t *)userdata;
+  wh_response_t *r = (wh_response_t *)userdata;
   unsigned int len = 0;
 
-  if ((cb->response_buffer_pos + nmemb) > sizeof(cb->response_buffer))
-    len = sizeof(cb->response_buffer) - cb->response_buffer_pos;
+  if ((r->pos + nmemb) > sizeof(r->buffer))
+    len = sizeof(r->buffer) - r->pos;
   else
     len = nmemb;
 
   DEBUG(
       "write_http plugin: curl callback nmemb=%zu buffer_pos=%u write_len=%u ",
-      nmemb, cb->response_buffer_pos, len);
+      nmemb, r->pos, len);
 
-  memcpy(cb->response_buffer + cb->response_buffer_pos, ptr, len);
-  cb->response_buffer_pos += len;
-  cb->response_buffer[sizeof(cb->response_buffer) - 1] = '\0';
+  memcpy(r->buffer + r->pos, ptr, len);
+  r->pos += len;
+  r->buffer[sizeof(r->buffer) - 1] = '\0';
 
   /* Always return nmemb even if we write less so libcurl won't throw an error
    */
@@ -128,13 +229,13 @@ static size_t wh_curl_write_callback(char *ptr, size_t size, size_t nmemb,
 
 } /* }}} wh_curl_write_callback */
 
-static void wh_log_http_error(wh_callback_t *cb) {
+static void wh_log_http_error(wh_callback_t *cb, CURL *curl) {
   if (!cb->log_http_error)
     return;
 
   long http_code = 0;
 
-  curl_easy_getinfo(cb->curl, CURLINFO_RESPONSE_CODE, &http_code);
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
 
   if (http_code != 200)
     INFO("write_http plugin: HTTP Error code: %lu", http_code);
@@ -155,27 +256,448 @@ static void wh_reset_buffer(wh_callback_t *cb) /* {{{ */
                            &cb->send_buffer_free);
   }
 
-  memset(cb->response_buffer, 0, sizeof(cb->response_buffer));
-  cb->response_buffer_pos = 0;
+  memset(&cb->response, 0, sizeof(cb->response));
 
 } /* }}} wh_reset_buffer */
 
-/* must hold cb->send_lock when calling */
-static int wh_post_nolock(wh_callback_t *cb, char const *data) /* {{{ */
+static char const *wh_compression_name(int compression) /* {{{ */
 {
-  int status = 0;
+  switch (compression) {
+  case WH_COMPRESS_GZIP:
+    return "gzip";
+  case WH_COMPRESS_ZSTD:
+    return "zstd";
+  default:
+    return "raw";
+  }
+} /* }}} wh_compression_name */
 
-  curl_easy_setopt(cb->curl, CURLOPT_URL, cb->location);
-  curl_easy_setopt(cb->curl, CURLOPT_POSTFIELDS, data);
-  curl_easy_setopt(cb->curl, CURLOPT_WRITEFUNCTION, &wh_curl_write_callback);
-  curl_easy_setopt(cb->curl, CURLOPT_WRITEDATA, (void *)cb);
-  status = curl_easy_perform(cb->curl);
+static int wh_buffer_reserve(wh_buffer_t *buf, size_t size) /* {{{ */
+{
+  if (buf->size >= size)
+    return 0;
+
+  char *tmp = realloc(buf->data, size);
+  if (tmp == NULL)
+    return ENOMEM;
+
+  buf->data = tmp;
+  buf->size = size;
+  return 0;
+} /* }}} int wh_buffer_reserve */
+
+/* Compresses `data' into `out' according to the node's "Compression" option.
+ * `ret_body' points either to `data' or into `out' afterwards. */
+static int wh_compress(wh_callback_t *cb, char const *data, /* {{{ */
+                       size_t data_size, wh_buffer_t *out,
+                       char const **ret_body, size_t *ret_size) {
+#if HAVE_LIBZ
+  if (cb->compression == WH_COMPRESS_GZIP) {
+    z_stream z = {0};
+
+    /* 15 window bits, plus 16 for a gzip header and trailer. */
+    if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+      ERROR("write_http plugin: deflateInit2 failed.");
+      return -1;
+    }
+    if (wh_buffer_reserve(out, deflateBound(&z, data_size)) != 0) {
+      deflateEnd(&z);
+      return ENOMEM;
+    }
+
+    z.next_in = (Bytef *)data;
+    z.avail_in = (uInt)data_size;
+    z.next_out = (Bytef *)out->data;
+    z.avail_out = (uInt)out->size;
+
+    int status = deflate(&z, Z_FINISH);
+    deflateEnd(&z);
+    if (status != Z_STREAM_END) {
+      ERROR("write_http plugin: deflate failed with status %i.", status);
+      return -1;
+    }
+
+    *ret_body = out->data;
+    *ret_size = (size_t)z.total_out;
+    return 0;
+  }
+#endif
+#if HAVE_LIBZSTD
+  if (cb->compression == WH_COMPRESS_ZSTD) {
+    if (wh_buffer_reserve(out, ZSTD_compressBound(data_size)) != 0)
+      return ENOMEM;
+
+    size_t size = ZSTD_compress(out->data, out->size, data, data_size,
+                                ZSTD_CLEVEL_DEFAULT);
+    if (ZSTD_isError(size)) {
+      ERROR("write_http plugin: ZSTD_compress failed: %s",
+            ZSTD_getErrorName(size));
+      return -1;
+    }
+
+    *ret_body = out->data;
+    *ret_size = size;
+    return 0;
+  }
+#endif
+
+  *ret_body = data;
+  *ret_size = data_size;
+  return 0;
+} /* }}} int wh_compress */
+
+/* Returns true if a POST should be retried later: the server could not be
+ * reached, or it answered with a status code that signals a temporary
+ * condition. Other client errors would fail again and are not retried. */
+static bool wh_post_failed(CURL *curl, CURLcode status) /* {{{ */
+{
+  if (status != CURLE_OK)
+    return true;
+
+  long http_code = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+  return (http_code >= 500) || (http_code == 408) || (http_code == 429);
+} /* }}} bool wh_post_failed */
+
+/* must hold cb->spool_lock when calling */
+static int wh_spool_index_add_nolock(wh_callback_t *cb, /* {{{ */
+                                     char const *name, uint64_t size) {
+  wh_spool_entry_t *e = calloc(1, sizeof(*e));
+  if (e == NULL)
+    return ENOMEM;
+
+  e->name = strdup(name);
+  e->size = size;
+  if ((e->name == NULL) || (c_avl_insert(cb->spool_index, e->name, e) != 0)) {
+    sfree(e->name);
+    sfree(e);
+    return -1;
+  }
+
+  cb->spool_size += size;
+  cb->spool_files++;
+  return 0;
+} /* }}} int wh_spool_index_add_nolock */
+
+static void wh_spool_index_free(wh_callback_t *cb) /* {{{ */
+{
+  void *key;
+  wh_spool_entry_t *e;
+
+  if (cb->spool_index == NULL)
+    return;
+
+  while (c_avl_pick(cb->spool_index, &key, (void *)&e) == 0) {
+    sfree(e->name);
+    sfree(e);
+  }
+  c_avl_destroy(cb->spool_index);
+  cb->spool_index = NULL;
+} /* }}} void wh_spool_index_free */
+
+/* Returns the oldest spooled batch, or NULL if the spool is empty.
+ * must hold cb->spool_lock when calling */
+static wh_spool_entry_t *wh_spool_oldest_nolock(wh_callback_t *cb) /* {{{ */
+{
+  c_avl_iterator_t *iter;
+  void *key;
+  wh_spool_entry_t *e = NULL;
+
+  if ((cb->spool_index == NULL) ||
+      ((iter = c_avl_get_iterator(cb->spool_index)) == NULL))
+    return NULL;
+
+  if (c_avl_iterator_next(iter, &key, (void *)&e) != 0)
+    e = NULL;
+  c_avl_iterator_destroy(iter);
 
-  wh_log_http_error(cb);
+  return e;
+} /* }}} wh_spool_entry_t *wh_spool_oldest_nolock */
+
+/* Removes the spooled file `name' from the directory and the index.
+ * must hold cb->spool_lock when calling */
+static void wh_spool_unlink_nolock(wh_callback_t *cb, /* {{{ */
+                                   char const *name) {
+  char path[PATH_MAX];
+  wh_spool_entry_t *e = NULL;
+
+  if (c_avl_remove(cb->spool_index, name, NULL, (void *)&e) != 0)
+    return;
+
+  snprintf(path, sizeof(path), "%s/%s", cb->spool_dir, name);
+  if ((unlink(path) != 0) && (errno != ENOENT))
+    ERROR("write_http plugin: unlink (%s) failed: %s", path, STRERRNO);
+
+  cb->spool_size -= (e->size < cb->spool_size) ? e->size : cb->spool_size;
+  if (cb->spool_files > 0)
+    cb->spool_files--;
+
+  sfree(e->name);
+  sfree(e);
+} /* }}} void wh_spool_unlink_nolock */
+
+static int wh_spool_init_cb(const char *dirname, /* {{{ */
+                            const char *filename, void *user_data) {
+  wh_callback_t *cb = user_data;
+  char path[PATH_MAX];
+  struct stat statbuf;
+
+  snprintf(path, sizeof(path), "%s/%s", dirname, filename);
+
+  /* Left behind by wh_spool_store when the daemon was killed. */
+  if (filename[0] == '.') {
+    size_t len = strlen(filename);
+    if ((len > strlen(".tmp")) &&
+        (strcmp(filename + len - strlen(".tmp"), ".tmp") == 0) &&
+        (unlink(path) != 0))
+      WARNING("write_http plugin: unlink (%s) failed: %s", path, STRERRNO);
+    return 0;
+  }
+
+  if ((lstat(path, &statbuf) != 0) || !S_ISREG(statbuf.st_mode))
+    return 0;
+
+  wh_spool_index_add_nolock(cb, filename, (uint64_t)statbuf.st_size);
+  return 0;
+} /* }}} int wh_spool_init_cb */
+
+static int wh_spool_init(wh_callback_t *cb) /* {{{ */
+{
+  char dir[PATH_MAX];
+
+  if (cb->spool_dir == NULL)
+    return 0;
+
+  snprintf(dir, sizeof(dir), "%s/", cb->spool_dir);
+  if (check_create_dir(dir) != 0) {
+    ERROR("write_http plugin: Creating the spool directory \"%s\" failed.",
+          cb->spool_dir);
+    return -1;
+  }
+
+  cb->spool_index = c_avl_create((int (*)(const void *, const void *))strcmp);
+  if (cb->spool_index == NULL) {
+    ERROR("write_http plugin: c_avl_create failed.");
+    return -1;
+  }
+
+  cb->spool_backoff = cb->spool_retry_interval;
+  walk_directory(cb->spool_dir, wh_spool_init_cb, cb, /* hidden = */ 1);
+  if (cb->spool_files > 0)
+    INFO("write_http plugin: Node \"%s\": %" PRIsz " spooled batches "
+         "(%" PRIu64 " bytes) will be replayed.",
+         cb->name, cb->spool_files, cb->spool_size);
+
+  return 0;
+} /* }}} int wh_spool_init */
+
+/* Stores a body which could not be posted, dropping the oldest batches if
+ * the spool would grow beyond "SpoolMaxSize". */
+static int wh_spool_store(wh_callback_t *cb, char const *body, /* {{{ */
+                          size_t size) {
+  char path[PATH_MAX];
+  char tmp[PATH_MAX];
+
+  if (cb->spool_dir == NULL)
+    return ENOTSUP;
+
+  if (size > cb->spool_max_size) {
+    WARNING("write_http plugin: Node \"%s\": Dropping a batch of %" PRIsz
+            " bytes which exceeds SpoolMaxSize.",
+            cb->name, size);
+    return EFBIG;
+  }
+
+  pthread_mutex_lock(&cb->spool_lock);
+
+  while (cb->spool_size + size > cb->spool_max_size) {
+    wh_spool_entry_t *e = wh_spool_oldest_nolock(cb);
+    if (e == NULL)
+      break;
+    WARNING("write_http plugin: Node \"%s\": Spool is full, dropping %s.",
+            cb->name, e->name);
+    wh_spool_unlink_nolock(cb, e->name);
+  }
+
+  /* File names sort by time; the suffix records the content encoding. */
+  char name[64];
+  int fd = -1;
+  for (cdtime_t t = cdtime(); fd < 0; t++) {
+    snprintf(name, sizeof(name), "%016" PRIx64 ".%s", (uint64_t)t,
+             wh_compression_name(cb->compression));
+    snprintf(path, sizeof(path), "%s/%s", cb->spool_dir, name);
+    snprintf(tmp, sizeof(tmp), "%s/.%016" PRIx64 ".tmp", cb->spool_dir,
+             (uint64_t)t);
+    if (access(path, F_OK) == 0)
+      continue;
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if ((fd < 0) && (errno != EEXIST)) {
+      ERROR("write_http plugin: open (%s) failed: %s", tmp, STRERRNO);
+      pthread_mutex_unlock(&cb->spool_lock);
+      return -1;
+    }
+  }
+
+  int status = swrite(fd, body, size);
+  if (status != 0)
+    ERROR("write_http plugin: Writing %s failed: %s", tmp, STRERRNO);
+  if ((close(fd) != 0) && (status == 0)) {
+    ERROR("write_http plugin: close (%s) failed: %s", tmp, STRERRNO);
+    status = -1;
+  }
+  if ((status == 0) && (rename(tmp, path) != 0)) {
+    ERROR("write_http plugin: rename (%s, %s) failed: %s", tmp, path,
+          STRERRNO);
+    status = -1;
+  }
+
+  if (status != 0) {
+    unlink(tmp);
+  } else {
+    if (wh_spool_index_add_nolock(cb, name, (uint64_t)size) != 0) {
+      ERROR("write_http plugin: Adding %s to the spool index failed.", path);
+      unlink(path);
+      pthread_mutex_unlock(&cb->spool_lock);
+      return -1;
+    }
+    DEBUG("write_http plugin: Spooled %" PRIsz " bytes to %s.", size, path);
+  }
+
+  pthread_mutex_unlock(&cb->spool_lock);
+  return status;
+} /* }}} int wh_spool_store */
+
+/* Reads the oldest spooled batch and returns its path in `path'. Batches
+ * written with a different "Compression" setting cannot be sent with this
+ * node's headers and are discarded. */
+static int wh_spool_load(wh_callback_t *cb, char *path, /* {{{ */
+                         size_t path_size, char **ret_data,
+                         size_t *ret_size) {
+  char suffix[16];
+  wh_spool_entry_t *e;
+
+  snprintf(suffix, sizeof(suffix), ".%s",
+           wh_compression_name(cb->compression));
+
+  pthread_mutex_lock(&cb->spool_lock);
+  while ((e = wh_spool_oldest_nolock(cb)) != NULL) {
+    snprintf(path, path_size, "%s/%s", cb->spool_dir, e->name);
+
+    size_t len = strlen(e->name);
+    if ((len < strlen(suffix)) ||
+        (strcmp(e->name + len - strlen(suffix), suffix) != 0)) {
+      WARNING("write_http plugin: Node \"%s\": Discarding %s, which does "
+              "not match the configured compression.",
+              cb->name, path);
+      wh_spool_unlink_nolock(cb, e->name);
+      continue;
+    }
+
+    if (e->size == 0) {
+      wh_spool_unlink_nolock(cb, e->name);
+      continue;
+    }
+
+    char *data = malloc((size_t)e->size);
+    if (data == NULL) {
+      pthread_mutex_unlock(&cb->spool_lock);
+      return ENOMEM;
+    }
+
+    ssize_t size = read_file_contents(path, data, (size_t)e->size);
+    if (size != (ssize_t)e->size) {
+      ERROR("write_http plugin: Reading %s failed, discarding it.", path);
+      sfree(data);
+      wh_spool_unlink_nolock(cb, e->name);
+      continue;
+    }
+
+    pthread_mutex_unlock(&cb->spool_lock);
+    *ret_data = data;
+    *ret_size = (size_t)size;
+    return 0;
+  }
+  pthread_mutex_unlock(&cb->spool_lock);
+
+  return ENOENT;
+} /* }}} int wh_spool_load */
+
+static void wh_spool_remove(wh_callback_t *cb, char const *path) /* {{{ */
+{
+  char const *name = strrchr(path, '/');
+
+  pthread_mutex_lock(&cb->spool_lock);
+  wh_spool_unlink_nolock(cb, (name != NULL) ? name + 1 : path);
+  pthread_mutex_unlock(&cb->spool_lock);
+} /* }}} void wh_spool_remove */
+
+/* Updates the backoff after a POST: failures double the retry interval up to
+ * "SpoolRetryMaxInterval", a success makes spooled batches due at once. */
+static void wh_spool_result(wh_callback_t *cb, bool failed) /* {{{ */
+{
+  if (cb->spool_dir == NULL)
+    return;
+
+  pthread_mutex_lock(&cb->spool_lock);
+  if (failed) {
+    cb->spool_next_retry = cdtime() + cb->spool_backoff;
+    cb->spool_backoff *= 2;
+    if (cb->spool_backoff > cb->spool_retry_max_interval)
+      cb->spool_backoff = cb->spool_retry_max_interval;
+  } else {
+    cb->spool_next_retry = 0;
+    cb->spool_backoff = cb->spool_retry_interval;
+  }
+  pthread_mutex_unlock(&cb->spool_lock);
+} /* }}} void wh_spool_result */
+
+/* Returns true while backing off after a failed POST. New bodies are spooled
+ * directly during that time instead of waiting for the server to time out. */
+static bool wh_spool_backoff(wh_callback_t *cb) /* {{{ */
+{
+  if (cb->spool_dir == NULL)
+    return false;
+
+  pthread_mutex_lock(&cb->spool_lock);
+  bool ret = cdtime() < cb->spool_next_retry;
+  pthread_mutex_unlock(&cb->spool_lock);
+
+  return ret;
+} /* }}} bool wh_spool_backoff */
+
+/* Returns the time at which spooled batches should be replayed, or zero if
+ * there is nothing to replay. */
+static cdtime_t wh_spool_due_time(wh_callback_t *cb) /* {{{ */
+{
+  if (cb->spool_dir == NULL)
+    return 0;
+
+  pthread_mutex_lock(&cb->spool_lock);
+  cdtime_t ret = 0;
+  if (cb->spool_files > 0)
+    ret = (cb->spool_next_retry > 0) ? cb->spool_next_retry : 1;
+  pthread_mutex_unlock(&cb->spool_lock);
+
+  return ret;
+} /* }}} cdtime_t wh_spool_due_time */
+
+static bool wh_spool_due(wh_callback_t *cb) /* {{{ */
+{
+  cdtime_t due = wh_spool_due_time(cb);
+  return (due != 0) && (due <= cdtime());
+} /* }}} bool wh_spool_due */
+
+/* Logs the result of a finished POST and dispatches the cURL statistics. */
+static void wh_post_done(wh_callback_t *cb, CURL *curl, /* {{{ */
+                         CURLcode status, char const *errbuf,
+                         wh_response_t const *response) {
+  wh_log_http_error(cb, curl);
 
   if (cb->curl_stats != NULL) {
-    int rc = curl_stats_dispatch(cb->curl_stats, cb->curl, NULL, "write_http",
-                                 cb->name);
+    int rc =
+        curl_stats_dispatch(cb->curl_stats, curl, NULL, "write_http", cb->name);
     if (rc != 0) {
       ERROR("write_http plugin: curl_stats_dispatch failed with "
             "status %i",
@@ -186,94 +708,469 @@ static int wh_post_nolock(wh_callback_t *cb, char const *data) /* {{{ */
   if (status != CURLE_OK) {
     ERROR("write_http plugin: curl_easy_perform failed with "
           "status %i: %s",
-          status, cb->curl_errbuf);
-    if (strlen(cb->response_buffer) > 0) {
-      ERROR("write_http plugin: curl_response=%s", cb->response_buffer);
+          status, errbuf);
+    if (strlen(response->buffer) > 0) {
+      ERROR("write_http plugin: curl_response=%s", response->buffer);
     }
   } else {
-    DEBUG("write_http plugin: curl_response=%s", cb->response_buffer);
+    DEBUG("write_http plugin: curl_response=%s", response->buffer);
   }
+} /* }}} wh_post_done */
+
+/* must hold cb->send_lock when calling */
+static int wh_perform_nolock(wh_callback_t *cb, char const *body, /* {{{ */
+                             size_t size, bool *ret_failed) {
+  int status = 0;
+
+  curl_easy_setopt(cb->curl, CURLOPT_URL, cb->location);
+  curl_easy_setopt(cb->curl, CURLOPT_POSTFIELDSIZE, (long)size);
+  curl_easy_setopt(cb->curl, CURLOPT_POSTFIELDS, body);
+  curl_easy_setopt(cb->curl, CURLOPT_WRITEFUNCTION, &wh_curl_write_callback);
+  curl_easy_setopt(cb->curl, CURLOPT_WRITEDATA, (void *)&cb->response);
+  status = curl_easy_perform(cb->curl);
+
+  wh_post_done(cb, cb->curl, status, cb->curl_errbuf, &cb->response);
+  *ret_failed = wh_post_failed(cb->curl, status);
+  return status;
+} /* }}} wh_perform_nolock */
+
+/* must hold cb->send_lock when calling */
+static int wh_post_nolock(wh_callback_t *cb, char const *data) /* {{{ */
+{
+  char const *body;
+  size_t size;
+  bool failed;
+
+  int status = wh_compress(cb, data, strlen(data), &cb->compressed, &body,
+                           &size);
+  if (status != 0)
+    return status;
+
+  if (wh_spool_backoff(cb))
+    return wh_spool_store(cb, body, size);
+
+  status = wh_perform_nolock(cb, body, size, &failed);
+  wh_spool_result(cb, failed);
+  /* Once spooled, the batch is not lost and the caller may go on. */
+  if (failed && (wh_spool_store(cb, body, size) == 0))
+    status = 0;
+
   return status;
 } /* }}} wh_post_nolock */
 
-static int wh_callback_init(wh_callback_t *cb) /* {{{ */
+/* Posts spooled batches, oldest first, until one fails.
+ * must hold cb->send_lock when calling */
+static void wh_spool_replay_nolock(wh_callback_t *cb) /* {{{ */
 {
-  if (cb->curl != NULL)
-    return 0;
+  for (int i = 0; (i < WRITE_HTTP_SPOOL_REPLAY_MAX) && wh_spool_due(cb); i++) {
+    char path[PATH_MAX];
+    char *data = NULL;
+    size_t size = 0;
+    bool failed;
 
-  cb->curl = curl_easy_init();
-  if (cb->curl == NULL) {
-    ERROR("curl plugin: curl_easy_init failed.");
-    return -1;
+    if (wh_spool_load(cb, path, sizeof(path), &data, &size) != 0)
+      break;
+
+    wh_perform_nolock(cb, data, size, &failed);
+    sfree(data);
+
+    wh_spool_result(cb, failed);
+    if (failed)
+      break;
+    wh_spool_remove(cb, path);
   }
+} /* }}} void wh_spool_replay_nolock */
 
+/* Applies the per-node options to an easy handle. */
+static int wh_curl_setopt(wh_callback_t *cb, CURL *curl, /* {{{ */
+                          char *errbuf) {
   if (cb->low_speed_limit > 0 && cb->low_speed_time > 0) {
-    curl_easy_setopt(cb->curl, CURLOPT_LOW_SPEED_LIMIT,
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT,
                      (long)(cb->low_speed_limit * cb->low_speed_time));
-    curl_easy_setopt(cb->curl, CURLOPT_LOW_SPEED_TIME,
-                     (long)cb->low_speed_time);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)cb->low_speed_time);
   }
 
 #ifdef HAVE_CURLOPT_TIMEOUT_MS
   if (cb->timeout > 0)
-    curl_easy_setopt(cb->curl, CURLOPT_TIMEOUT_MS, (long)cb->timeout);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)cb->timeout);
 #endif
 
-  curl_easy_setopt(cb->curl, CURLOPT_NOSIGNAL, 1L);
-  curl_easy_setopt(cb->curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, cb->headers);
 
-  cb->headers = curl_slist_append(cb->headers, "Accept:  */*");
-  if (cb->format == WH_FORMAT_JSON || cb->format == WH_FORMAT_KAIROSDB)
-    cb->headers =
-        curl_slist_append(cb->headers, "Content-Type: application/json");
-  else
-    cb->headers = curl_slist_append(cb->headers, "Content-Type: text/plain");
-  cb->headers = curl_slist_append(cb->headers, "Expect:");
-  curl_easy_setopt(cb->curl, CURLOPT_HTTPHEADER, cb->headers);
-
-  curl_easy_setopt(cb->curl, CURLOPT_ERRORBUFFER, cb->curl_errbuf);
-  curl_easy_setopt(cb->curl, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(cb->curl, CURLOPT_MAXREDIRS, 50L);
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 50L);
 
   if (cb->user != NULL) {
 #ifdef HAVE_CURLOPT_USERNAME
-    curl_easy_setopt(cb->curl, CURLOPT_USERNAME, cb->user);
-    curl_easy_setopt(cb->curl, CURLOPT_PASSWORD,
+    curl_easy_setopt(curl, CURLOPT_USERNAME, cb->user);
+    curl_easy_setopt(curl, CURLOPT_PASSWORD,
                      (cb->pass == NULL) ? "" : cb->pass);
 #else
-    size_t credentials_size;
+    if (cb->credentials == NULL) {
+      size_t credentials_size;
 
-    credentials_size = strlen(cb->user) + 2;
-    if (cb->pass != NULL)
-      credentials_size += strlen(cb->pass);
+      credentials_size = strlen(cb->user) + 2;
+      if (cb->pass != NULL)
+        credentials_size += strlen(cb->pass);
 
-    cb->credentials = malloc(credentials_size);
-    if (cb->credentials == NULL) {
-      ERROR("curl plugin: malloc failed.");
-      return -1;
-    }
+      cb->credentials = malloc(credentials_size);
+      if (cb->credentials == NULL) {
+        ERROR("curl plugin: malloc failed.");
+        return -1;
+      }
 
-    snprintf(cb->credentials, credentials_size, "%s:%s", cb->user,
-             (cb->pass == NULL) ? "" : cb->pass);
-    curl_easy_setopt(cb->curl, CURLOPT_USERPWD, cb->credentials);
+      snprintf(cb->credentials, credentials_size, "%s:%s", cb->user,
+               (cb->pass == NULL) ? "" : cb->pass);
+    }
+    curl_easy_setopt(curl, CURLOPT_USERPWD, cb->credentials);
 #endif
-    curl_easy_setopt(cb->curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+    curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
   }
 
-  curl_easy_setopt(cb->curl, CURLOPT_SSL_VERIFYPEER, (long)cb->verify_peer);
-  curl_easy_setopt(cb->curl, CURLOPT_SSL_VERIFYHOST, cb->verify_host ? 2L : 0L);
-  curl_easy_setopt(cb->curl, CURLOPT_SSLVERSION, cb->sslversion);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, (long)cb->verify_peer);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, cb->verify_host ? 2L : 0L);
+  curl_easy_setopt(curl, CURLOPT_SSLVERSION, cb->sslversion);
   if (cb->cacert != NULL)
-    curl_easy_setopt(cb->curl, CURLOPT_CAINFO, cb->cacert);
+    curl_easy_setopt(curl, CURLOPT_CAINFO, cb->cacert);
   if (cb->capath != NULL)
-    curl_easy_setopt(cb->curl, CURLOPT_CAPATH, cb->capath);
+    curl_easy_setopt(curl, CURLOPT_CAPATH, cb->capath);
 
   if (cb->clientkey != NULL && cb->clientcert != NULL) {
-    curl_easy_setopt(cb->curl, CURLOPT_SSLKEY, cb->clientkey);
-    curl_easy_setopt(cb->curl, CURLOPT_SSLCERT, cb->clientcert);
+    curl_easy_setopt(curl, CURLOPT_SSLKEY, cb->clientkey);
+    curl_easy_setopt(curl, CURLOPT_SSLCERT, cb->clientcert);
 
     if (cb->clientkeypass != NULL)
-      curl_easy_setopt(cb->curl, CURLOPT_SSLKEYPASSWD, cb->clientkeypass);
+      curl_easy_setopt(curl, CURLOPT_SSLKEYPASSWD, cb->clientkeypass);
+  }
+
+#ifdef CURL_HTTP_VERSION_2TLS
+  if (cb->http2) {
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+#ifdef CURLOPT_PIPEWAIT
+    /* Prefer waiting for a multiplexed connection over opening a new one. */
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+#endif
+  }
+#endif
+
+  return 0;
+} /* }}} int wh_curl_setopt */
+
+/* Assigns queued send buffers, and spooled batches once they are due, to
+ * idle requests.
+ * must hold cb->queue_lock when calling */
+static void wh_assign_requests_nolock(wh_callback_t *cb) /* {{{ */
+{
+  for (int i = 0; i < cb->max_requests; i++) {
+    wh_request_t *r = cb->requests + i;
+    if (r->busy)
+      continue;
+
+    /* Replay one batch at a time, so a server which is still down only
+     * costs a single failed request per retry. */
+    if (!cb->spool_replaying && !cb->send_thread_shutdown &&
+        wh_spool_due(cb)) {
+      r->replay = true;
+      cb->spool_replaying = true;
+    } else if (cb->queue_num > 0) {
+      r->replay = false;
+      r->data = cb->queue[cb->queue_head];
+      cb->queue_head = (cb->queue_head + 1) % (size_t)cb->max_requests;
+      cb->queue_num--;
+    } else {
+      break;
+    }
+
+    r->busy = true;
+    r->pending = true;
+    cb->requests_inflight++;
+  }
+
+  /* Writers may be waiting for room in the queue. */
+  pthread_cond_broadcast(&cb->queue_cond);
+} /* }}} void wh_assign_requests_nolock */
+
+static void wh_release_request(wh_callback_t *cb, wh_request_t *r) /* {{{ */
+{
+  pthread_mutex_lock(&cb->queue_lock);
+  if (r->replay) {
+    sfree(r->data);
+    cb->spool_replaying = false;
+  } else if (r->data != NULL) {
+    if (cb->spare_num < (size_t)cb->max_requests)
+      cb->spare[cb->spare_num++] = r->data;
+    else
+      sfree(r->data);
+    r->data = NULL;
+  }
+  r->busy = false;
+  r->pending = false;
+  cb->requests_inflight--;
+  pthread_mutex_unlock(&cb->queue_lock);
+} /* }}} void wh_release_request */
+
+/* Prepares the bodies of newly assigned requests and adds them to the multi
+ * handle. Done without holding cb->queue_lock, because it may compress data
+ * or access the spool. */
+static void wh_start_requests(wh_callback_t *cb) /* {{{ */
+{
+  for (int i = 0; i < cb->max_requests; i++) {
+    wh_request_t *r = cb->requests + i;
+    char const *body;
+    size_t size;
+
+    if (!r->pending)
+      continue;
+    r->pending = false;
+
+    if (r->replay) {
+      if (wh_spool_load(cb, r->spool_file, sizeof(r->spool_file), &r->data,
+                        &r->data_size) != 0) {
+        wh_release_request(cb, r);
+        continue;
+      }
+      body = r->data;
+      size = r->data_size;
+    } else {
+      if (wh_compress(cb, r->data, strlen(r->data), &r->compressed, &body,
+                      &size) != 0) {
+        wh_release_request(cb, r);
+        continue;
+      }
+      if (wh_spool_backoff(cb)) {
+        wh_spool_store(cb, body, size);
+        wh_release_request(cb, r);
+        continue;
+      }
+    }
+
+    r->body = body;
+    r->body_size = size;
+    memset(&r->response, 0, sizeof(r->response));
+    r->curl_errbuf[0] = 0;
+    curl_easy_setopt(r->curl, CURLOPT_POSTFIELDSIZE, (long)size);
+    curl_easy_setopt(r->curl, CURLOPT_POSTFIELDS, body);
+
+    CURLMcode status = curl_multi_add_handle(cb->multi, r->curl);
+    if (status != CURLM_OK) {
+      ERROR("write_http plugin: curl_multi_add_handle failed: %s",
+            curl_multi_strerror(status));
+      if (!r->replay)
+        wh_spool_store(cb, body, size);
+      wh_release_request(cb, r);
+    }
+  }
+} /* }}} void wh_start_requests */
+
+/* Handles all POSTs which have finished since the last call. */
+static void wh_finish_requests(wh_callback_t *cb) /* {{{ */
+{
+  CURLMsg *msg;
+  int msgs_left;
+
+  while ((msg = curl_multi_info_read(cb->multi, &msgs_left)) != NULL) {
+    if (msg->msg != CURLMSG_DONE)
+      continue;
+
+    wh_request_t *r = NULL;
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&r);
+    assert(r != NULL);
+
+    CURLcode result = msg->data.result;
+    wh_post_done(cb, r->curl, result, r->curl_errbuf, &r->response);
+    curl_multi_remove_handle(cb->multi, r->curl);
+
+    bool failed = wh_post_failed(r->curl, result);
+    wh_spool_result(cb, failed);
+    if (r->replay && !failed) {
+      wh_spool_remove(cb, r->spool_file);
+    } else if (!r->replay && failed) {
+      wh_spool_store(cb, r->body, r->body_size);
+    }
+
+    wh_release_request(cb, r);
+  }
+} /* }}} void wh_finish_requests */
+
+static void *wh_send_thread(void *arg) /* {{{ */
+{
+  wh_callback_t *cb = arg;
+
+  pthread_mutex_lock(&cb->queue_lock);
+  while (42) {
+    wh_assign_requests_nolock(cb);
+
+    if (cb->requests_inflight == 0) {
+      /* Drain the queue before shutting down. */
+      if (cb->send_thread_shutdown && (cb->queue_num == 0))
+        break;
+
+      /* Wake up for the next retry if batches are spooled. */
+      cdtime_t due = wh_spool_due_time(cb);
+      if (due != 0) {
+        struct timespec ts = CDTIME_T_TO_TIMESPEC(due);
+        pthread_cond_timedwait(&cb->queue_cond, &cb->queue_lock, &ts);
+      } else {
+        pthread_cond_wait(&cb->queue_cond, &cb->queue_lock);
+      }
+      continue;
+    }
+    pthread_mutex_unlock(&cb->queue_lock);
+
+    wh_start_requests(cb);
+
+    int running = 0;
+    CURLMcode status = curl_multi_perform(cb->multi, &running);
+    if (status != CURLM_OK)
+      ERROR("write_http plugin: curl_multi_perform failed: %s",
+            curl_multi_strerror(status));
+
+    wh_finish_requests(cb);
+
+    if (running > 0) {
+#ifdef WH_HAVE_MULTI_WAKEUP
+      curl_multi_poll(cb->multi, NULL, 0, 1000, NULL);
+#else
+      /* Without curl_multi_wakeup() newly queued buffers are only picked up
+       * after this timeout. */
+      curl_multi_wait(cb->multi, NULL, 0, 100, NULL);
+#endif
+    }
+
+    pthread_mutex_lock(&cb->queue_lock);
+  }
+  pthread_mutex_unlock(&cb->queue_lock);
+
+  return NULL;
+} /* }}} void *wh_send_thread */
+
+/* Waits for the sender thread to post all queued buffers and frees the
+ * resources of the asynchronous sender. */
+static void wh_async_free(wh_callback_t *cb) /* {{{ */
+{
+  if (cb->send_thread_running) {
+    pthread_mutex_lock(&cb->queue_lock);
+    cb->send_thread_shutdown = true;
+    pthread_cond_broadcast(&cb->queue_cond);
+    pthread_mutex_unlock(&cb->queue_lock);
+
+    pthread_join(cb->send_thread, NULL);
+    cb->send_thread_running = false;
+  }
+
+  if (cb->requests != NULL) {
+    for (int i = 0; i < cb->max_requests; i++) {
+      wh_request_t *r = cb->requests + i;
+      if (r->curl != NULL)
+        curl_easy_cleanup(r->curl);
+      if (r->replay)
+        sfree(r->data);
+      sfree(r->compressed.data);
+    }
+    sfree(cb->requests);
+  }
+  if (cb->multi != NULL) {
+    curl_multi_cleanup(cb->multi);
+    cb->multi = NULL;
+  }
+  if (cb->spare != NULL) {
+    for (size_t i = 0; i < cb->spare_num; i++)
+      sfree(cb->spare[i]);
+    sfree(cb->spare);
+  }
+  sfree(cb->queue);
+  cb->spare_num = 0;
+  cb->queue_num = 0;
+  cb->queue_head = 0;
+  cb->send_thread_shutdown = false;
+} /* }}} void wh_async_free */
+
+static int wh_async_init(wh_callback_t *cb) /* {{{ */
+{
+  size_t num = (size_t)cb->max_requests;
+
+  cb->multi = curl_multi_init();
+  cb->requests = calloc(num, sizeof(*cb->requests));
+  cb->queue = calloc(num, sizeof(*cb->queue));
+  cb->spare = calloc(num, sizeof(*cb->spare));
+  if ((cb->multi == NULL) || (cb->requests == NULL) || (cb->queue == NULL) ||
+      (cb->spare == NULL)) {
+    ERROR("write_http plugin: Allocating the asynchronous sender failed.");
+    return -1;
+  }
+
+#if LIBCURL_VERSION_NUM >= 0x071e00
+  curl_multi_setopt(cb->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)num);
+#endif
+#ifdef CURLPIPE_MULTIPLEX
+  if (cb->http2)
+    curl_multi_setopt(cb->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+
+  for (size_t i = 0; i < num; i++) {
+    wh_request_t *r = cb->requests + i;
+
+    r->curl = curl_easy_init();
+    if (r->curl == NULL) {
+      ERROR("write_http plugin: curl_easy_init failed.");
+      return -1;
+    }
+    if (wh_curl_setopt(cb, r->curl, r->curl_errbuf) != 0)
+      return -1;
+
+    curl_easy_setopt(r->curl, CURLOPT_URL, cb->location);
+    curl_easy_setopt(r->curl, CURLOPT_WRITEFUNCTION, &wh_curl_write_callback);
+    curl_easy_setopt(r->curl, CURLOPT_WRITEDATA, (void *)&r->response);
+    curl_easy_setopt(r->curl, CURLOPT_PRIVATE, (void *)r);
+  }
+
+  int status = plugin_thread_create(&cb->send_thread, wh_send_thread, cb,
+                                    "write_http send");
+  if (status != 0) {
+    ERROR("write_http plugin: Starting the sender thread failed: %s",
+          STRERROR(status));
+    return -1;
+  }
+  cb->send_thread_running = true;
+
+  return 0;
+} /* }}} int wh_async_init */
+
+static int wh_callback_init(wh_callback_t *cb) /* {{{ */
+{
+  if (cb->curl != NULL)
+    return 0;
+
+  cb->curl = curl_easy_init();
+  if (cb->curl == NULL) {
+    ERROR("curl plugin: curl_easy_init failed.");
+    return -1;
+  }
+
+  cb->headers = curl_slist_append(cb->headers, "Accept:  */*");
+  if (cb->format == WH_FORMAT_JSON || cb->format == WH_FORMAT_KAIROSDB)
+    cb->headers =
+        curl_slist_append(cb->headers, "Content-Type: application/json");
+  else
+    cb->headers = curl_slist_append(cb->headers, "Content-Type: text/plain");
+  cb->headers = curl_slist_append(cb->headers, "Expect:");
+  if (cb->compression == WH_COMPRESS_GZIP)
+    cb->headers = curl_slist_append(cb->headers, "Content-Encoding: gzip");
+  else if (cb->compression == WH_COMPRESS_ZSTD)
+    cb->headers = curl_slist_append(cb->headers, "Content-Encoding: zstd");
+
+  if (wh_curl_setopt(cb, cb->curl, cb->curl_errbuf) != 0)
+    return -1;
+
+  if ((cb->max_requests > 0) && (wh_async_init(cb) != 0)) {
+    ERROR("write_http plugin: Node \"%s\": Falling back to synchronous "
+          "sending.",
+          cb->name);
+    wh_async_free(cb);
+    cb->max_requests = 0;
   }
 
   wh_reset_buffer(cb);
@@ -281,6 +1178,57 @@ static int wh_callback_init(wh_callback_t *cb) /* {{{ */
   return 0;
 } /* }}} int wh_callback_init */
 
+/* Hands the send buffer to the sender thread and continues with a spare
+ * buffer. Blocks while `max_requests' buffers are already queued.
+ * must hold cb->send_lock when calling */
+static int wh_enqueue_nolock(wh_callback_t *cb) /* {{{ */
+{
+  char *next = NULL;
+
+  pthread_mutex_lock(&cb->queue_lock);
+  while (cb->queue_num >= (size_t)cb->max_requests)
+    pthread_cond_wait(&cb->queue_cond, &cb->queue_lock);
+
+  if (cb->spare_num > 0)
+    next = cb->spare[--cb->spare_num];
+  else
+    next = malloc(cb->send_buffer_size);
+  if (next == NULL) {
+    pthread_mutex_unlock(&cb->queue_lock);
+    ERROR("write_http plugin: malloc(%" PRIsz ") failed.",
+          cb->send_buffer_size);
+    wh_reset_buffer(cb);
+    return ENOMEM;
+  }
+
+  size_t tail = (cb->queue_head + cb->queue_num) % (size_t)cb->max_requests;
+  cb->queue[tail] = cb->send_buffer;
+  cb->queue_num++;
+  cb->send_buffer = next;
+
+  pthread_cond_broadcast(&cb->queue_cond);
+#ifdef WH_HAVE_MULTI_WAKEUP
+  curl_multi_wakeup(cb->multi);
+#endif
+  pthread_mutex_unlock(&cb->queue_lock);
+
+  wh_reset_buffer(cb);
+  return 0;
+} /* }}} int wh_enqueue_nolock */
+
+/* must hold cb->send_lock when calling */
+static int wh_send_nolock(wh_callback_t *cb) /* {{{ */
+{
+  if (cb->max_requests > 0)
+    return wh_enqueue_nolock(cb);
+
+  wh_spool_replay_nolock(cb);
+
+  int status = wh_post_nolock(cb, cb->send_buffer);
+  wh_reset_buffer(cb);
+  return status;
+} /* }}} int wh_send_nolock */
+
 static int wh_flush_nolock(cdtime_t timeout, wh_callback_t *cb) /* {{{ */
 {
   int status;
@@ -304,8 +1252,7 @@ static int wh_flush_nolock(cdtime_t timeout, wh_callback_t *cb) /* {{{ */
       return 0;
     }
 
-    status = wh_post_nolock(cb, cb->send_buffer);
-    wh_reset_buffer(cb);
+    status = wh_send_nolock(cb);
   } else if (cb->format == WH_FORMAT_JSON || cb->format == WH_FORMAT_KAIROSDB) {
     if (cb->send_buffer_fill <= 2) {
       cb->send_buffer_init_time = cdtime();
@@ -321,8 +1268,7 @@ static int wh_flush_nolock(cdtime_t timeout, wh_callback_t *cb) /* {{{ */
       return status;
     }
 
-    status = wh_post_nolock(cb, cb->send_buffer);
-    wh_reset_buffer(cb);
+    status = wh_send_nolock(cb);
   } else {
     ERROR("write_http: wh_flush_nolock: "
           "Unknown format: %i",
@@ -367,9 +1313,13 @@ static void wh_callback_free(void *data) /* {{{ */
 
   cb = data;
 
-  if (cb->send_buffer != NULL)
+  if ((cb->send_buffer != NULL) && (cb->curl != NULL))
     wh_flush_nolock(/* timeout = */ 0, cb);
 
+  wh_async_free(cb);
+  pthread_mutex_destroy(&cb->queue_lock);
+  pthread_cond_destroy(&cb->queue_cond);
+
   if (cb->curl != NULL) {
     curl_easy_cleanup(cb->curl);
     cb->curl = NULL;
@@ -394,7 +1344,12 @@ static void wh_callback_free(void *data) /* {{{ */
   sfree(cb->clientcert);
   sfree(cb->clientkeypass);
   sfree(cb->send_buffer);
+  json_buffer_free(&cb->json);
+  sfree(cb->compressed.data);
   sfree(cb->metrics_prefix);
+  wh_spool_index_free(cb);
+  sfree(cb->spool_dir);
+  pthread_mutex_destroy(&cb->spool_lock);
 
   sfree(cb);
 } /* }}} void wh_callback_free */
@@ -493,26 +1448,40 @@ static int wh_write_json(const data_set_t *ds, const value_list_t *vl, /* {{{ */
     return -1;
   }
 
-  status =
-      format_json_value_list(cb->send_buffer, &cb->send_buffer_fill,
-                             &cb->send_buffer_free, ds, vl, cb->store_rates);
-  if (status == -ENOMEM) {
+  /* Format the value list only once, then copy it into the send buffer. */
+  json_buffer_reset(&cb->json);
+  status = format_json_value_list_object(&cb->json, ds, vl, cb->store_rates);
+  if (status != 0) {
+    pthread_mutex_unlock(&cb->send_lock);
+    return status;
+  }
+
+  /* The object is preceded by a comma, which `format_json_finalize' replaces
+   * with the opening bracket, and followed by room for the closing bracket
+   * and the null byte. */
+  size_t len = cb->json.pos + 1;
+  if (len + 2 > cb->send_buffer_free) {
     status = wh_flush_nolock(/* timeout = */ 0, cb);
     if (status != 0) {
       wh_reset_buffer(cb);
       pthread_mutex_unlock(&cb->send_lock);
       return status;
     }
-
-    status =
-        format_json_value_list(cb->send_buffer, &cb->send_buffer_fill,
-                               &cb->send_buffer_free, ds, vl, cb->store_rates);
   }
-  if (status != 0) {
+  if (len + 2 > cb->send_buffer_free) {
+    ERROR("write_http plugin: Value list of %" PRIsz " bytes does not fit into "
+          "the send buffer. Consider increasing BufferSize.",
+          len);
     pthread_mutex_unlock(&cb->send_lock);
-    return status;
+    return -ENOMEM;
   }
 
+  cb->send_buffer[cb->send_buffer_fill] = ',';
+  memcpy(cb->send_buffer + cb->send_buffer_fill + 1, cb->json.ptr,
+         cb->json.pos + 1);
+  cb->send_buffer_fill += len;
+  cb->send_buffer_free -= len;
+
   DEBUG("write_http plugin: <%s> buffer %" PRIsz "/%" PRIsz " (%g%%)",
         cb->location, cb->send_buffer_fill, cb->send_buffer_size,
         100.0 * ((double)cb->send_buffer_fill) /
@@ -655,6 +1624,37 @@ static int config_set_format(wh_callback_t *cb, /* {{{ */
   return 0;
 } /* }}} int config_set_format */
 
+static int config_set_compression(wh_callback_t *cb, /* {{{ */
+                                  oconfig_item_t *ci) {
+  char *string;
+
+  if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_STRING)) {
+    WARNING("write_http plugin: The `%s' config option "
+            "needs exactly one string argument.",
+            ci->key);
+    return -1;
+  }
+
+  string = ci->values[0].value.string;
+  if (strcasecmp("None", string) == 0)
+    cb->compression = WH_COMPRESS_NONE;
+#if HAVE_LIBZ
+  else if (strcasecmp("gzip", string) == 0)
+    cb->compression = WH_COMPRESS_GZIP;
+#endif
+#if HAVE_LIBZSTD
+  else if (strcasecmp("zstd", string) == 0)
+    cb->compression = WH_COMPRESS_ZSTD;
+#endif
+  else {
+    ERROR("write_http plugin: Invalid or unsupported compression: %s",
+          string);
+    return -1;
+  }
+
+  return 0;
+} /* }}} int config_set_compression */
+
 static int wh_config_append_string(const char *name,
                                    struct curl_slist **dest, /* {{{ */
                                    oconfig_item_t *ci) {
@@ -698,6 +1698,10 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
   cb->data_ttl = 0;
   cb->metrics_prefix = strdup(WRITE_HTTP_DEFAULT_PREFIX);
   cb->curl_stats = NULL;
+  cb->compression = WH_COMPRESS_NONE;
+  cb->spool_max_size = WRITE_HTTP_DEFAULT_SPOOL_SIZE;
+  cb->spool_retry_interval = TIME_T_TO_CDTIME_T(10);
+  cb->spool_retry_max_interval = TIME_T_TO_CDTIME_T(600);
 
   if (cb->metrics_prefix == NULL) {
     ERROR("write_http plugin: strdup failed.");
@@ -706,6 +1710,9 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
   }
 
   pthread_mutex_init(&cb->send_lock, /* attr = */ NULL);
+  pthread_mutex_init(&cb->queue_lock, /* attr = */ NULL);
+  pthread_cond_init(&cb->queue_cond, /* attr = */ NULL);
+  pthread_mutex_init(&cb->spool_lock, /* attr = */ NULL);
 
   cf_util_get_string(ci, &cb->name);
 
@@ -770,6 +1777,8 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
       sfree(value);
     } else if (strcasecmp("Format", child->key) == 0)
       status = config_set_format(cb, child);
+    else if (strcasecmp("Compression", child->key) == 0)
+      status = config_set_compression(cb, child);
     else if (strcasecmp("Metrics", child->key) == 0)
       cf_util_get_boolean(child, &cb->send_metrics);
     else if (strcasecmp("Statistics", child->key) == 0) {
@@ -788,6 +1797,24 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_int(child, &cb->timeout);
     else if (strcasecmp("LogHttpError", child->key) == 0)
       status = cf_util_get_boolean(child, &cb->log_http_error);
+    else if (strcasecmp("MaxConcurrentRequests", child->key) == 0)
+      status = cf_util_get_int(child, &cb->max_requests);
+    else if (strcasecmp("HTTP2", child->key) == 0)
+      status = cf_util_get_boolean(child, &cb->http2);
+    else if (strcasecmp("SpoolDirectory", child->key) == 0)
+      status = cf_util_get_string(child, &cb->spool_dir);
+    else if (strcasecmp("SpoolMaxSize", child->key) == 0) {
+      int tmp = 0;
+      status = cf_util_get_int(child, &tmp);
+      if ((status == 0) && (tmp <= 0)) {
+        ERROR("write_http plugin: SpoolMaxSize must be positive.");
+        status = EINVAL;
+      }
+      cb->spool_max_size = (uint64_t)tmp;
+    } else if (strcasecmp("SpoolRetryInterval", child->key) == 0)
+      status = cf_util_get_cdtime(child, &cb->spool_retry_interval);
+    else if (strcasecmp("SpoolRetryMaxInterval", child->key) == 0)
+      status = cf_util_get_cdtime(child, &cb->spool_retry_max_interval);
     else if (strcasecmp("Header", child->key) == 0)
       status = wh_config_append_string("Header", &cb->headers, child);
     else if (strcasecmp("Attribute", child->key) == 0) {
@@ -854,6 +1881,29 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
   if (strlen(cb->metrics_prefix) == 0)
     sfree(cb->metrics_prefix);
 
+  if (cb->max_requests < 0) {
+    ERROR("write_http plugin: MaxConcurrentRequests must not be negative.");
+    wh_callback_free(cb);
+    return -1;
+  }
+
+  /* SpoolMaxSize is configured in MiB. */
+  cb->spool_max_size *= 1024 * 1024;
+  if (cb->spool_retry_interval == 0)
+    cb->spool_retry_interval = TIME_T_TO_CDTIME_T(1);
+  if (cb->spool_retry_max_interval < cb->spool_retry_interval)
+    cb->spool_retry_max_interval = cb->spool_retry_interval;
+  if (wh_spool_init(cb) != 0) {
+    wh_callback_free(cb);
+    return -1;
+  }
+
+#ifndef CURL_HTTP_VERSION_2TLS
+  if (cb->http2)
+    WARNING("write_http plugin: HTTP2 is not supported by this version of "
+            "libcurl and will be ignored.");
+#endif
+
   if (cb->low_speed_limit > 0)
     cb->low_speed_time = CDTIME_T_TO_TIME_T(plugin_get_interval());
 
@@ -0,0 +1,567 @@
+/**
+ * collectd - src/write_http_test.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Licensed under the same terms and conditions as src/write_http.c.
+ *
+ * Authors:
+ *   collectd contributors
+ **/
+
+#define plugin_register_write test_register_write
+#define plugin_thread_create test_thread_create
+
+#include "write_http.c" /* sic */
+#include "testing.h"
+
+#include <dirent.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/* wh_config_node() registers the node it created; this is where it ends up.
+ */
+static wh_callback_t *registered_cb;
+
+int test_register_write(__attribute__((unused)) const char *name,
+                        __attribute__((unused)) plugin_write_cb callback,
+                        user_data_t const *ud) {
+  registered_cb = ud->data;
+  return 0;
+}
+
+int test_thread_create(pthread_t *thread, void *(*start_routine)(void *),
+                       void *arg, __attribute__((unused)) char const *name) {
+  return pthread_create(thread, NULL, start_routine, arg);
+}
+
+/*
+ * A minimal HTTP/1.1 server standing in for the receiving end. It answers
+ * every request with `status_code' and counts the PUTVAL lines of the
+ * requests it accepted, inflating gzip encoded bodies first.
+ */
+typedef struct {
+  int listen_fd;
+  int port;
+  pthread_t tid;
+
+  pthread_mutex_t lock;
+  int status_code;
+  int delay_ms;
+  size_t requests_num;
+  size_t gzip_num;
+  size_t lines_num;
+} server_t;
+
+static server_t server = {
+    .listen_fd = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .status_code = 200,
+};
+
+/* Reads one request into `buf' and returns the length of the header,
+ * including the empty line, and the length of the body. Bytes of the next
+ * request are kept at the end of `buf'. */
+static int server_read_request(int fd, char *buf, size_t buf_size,
+                               size_t *buf_fill, size_t *ret_header_len,
+                               size_t *ret_body_len) {
+  char *end;
+
+  while (42) {
+    buf[*buf_fill] = 0;
+    if ((end = strstr(buf, "\r\n\r\n")) != NULL)
+      break;
+
+    ssize_t n = read(fd, buf + *buf_fill, buf_size - *buf_fill - 1);
+    if (n <= 0)
+      return -1;
+    *buf_fill += (size_t)n;
+  }
+
+  size_t header_len = (size_t)(end - buf) + 4;
+  size_t body_len = 0;
+  char *cl = strstr(buf, "\r\nContent-Length:");
+  if ((cl != NULL) && (cl < end))
+    body_len = (size_t)strtoul(cl + strlen("\r\nContent-Length:"), NULL, 10);
+
+  if (header_len + body_len >= buf_size)
+    return -1;
+
+  while (*buf_fill < header_len + body_len) {
+    ssize_t n = read(fd, buf + *buf_fill, buf_size - *buf_fill - 1);
+    if (n <= 0)
+      return -1;
+    *buf_fill += (size_t)n;
+  }
+
+  *ret_header_len = header_len;
+  *ret_body_len = body_len;
+  return 0;
+}
+
+static size_t count_lines(char const *body, size_t body_len) {
+  size_t num = 0;
+
+  for (size_t i = 0; i + strlen("PUTVAL") <= body_len; i++)
+    if (memcmp(body + i, "PUTVAL", strlen("PUTVAL")) == 0)
+      num++;
+  return num;
+}
+
+static size_t count_body_lines(bool gzip, char const *body, size_t body_len) {
+  if (!gzip)
+    return count_lines(body, body_len);
+
+#if HAVE_LIBZ
+  size_t out_size = 64 * body_len + 1024;
+  char *out = malloc(out_size);
+  z_stream zs = {
+      .next_in = (Bytef *)body,
+      .avail_in = (uInt)body_len,
+      .next_out = (Bytef *)out,
+      .avail_out = (uInt)out_size,
+  };
+  size_t num = 0;
+
+  /* 15 + 32: maximum window size, detect the gzip header. */
+  if ((out != NULL) && (inflateInit2(&zs, 15 + 32) == Z_OK)) {
+    if (inflate(&zs, Z_FINISH) == Z_STREAM_END)
+      num = count_lines(out, out_size - zs.avail_out);
+    inflateEnd(&zs);
+  }
+  free(out);
+  return num;
+#else
+  return 0;
+#endif
+}
+
+static void *server_connection(void *arg) {
+  int fd = (int)(intptr_t)arg;
+  size_t buf_size = 1024 * 1024;
+  size_t buf_fill = 0;
+  char *buf = malloc(buf_size);
+
+  while (buf != NULL) {
+    size_t header_len, body_len;
+    if (server_read_request(fd, buf, buf_size, &buf_fill, &header_len,
+                            &body_len) != 0)
+      break;
+
+    char const *ce = strstr(buf, "\r\nContent-Encoding: gzip\r\n");
+    bool gzip = (ce != NULL) && (ce < buf + header_len);
+    size_t lines = count_body_lines(gzip, buf + header_len, body_len);
+
+    pthread_mutex_lock(&server.lock);
+    int delay_ms = server.delay_ms;
+    int status_code = server.status_code;
+    server.requests_num++;
+    if (gzip)
+      server.gzip_num++;
+    if ((status_code >= 200) && (status_code < 300))
+      server.lines_num += lines;
+    pthread_mutex_unlock(&server.lock);
+
+    if (delay_ms > 0)
+      usleep(1000 * delay_ms);
+
+    char response[128];
+    snprintf(response, sizeof(response),
+             "HTTP/1.1 %d Test\r\nContent-Length: 0\r\n\r\n", status_code);
+    if (swrite(fd, response, strlen(response)) != 0)
+      break;
+
+    buf_fill -= header_len + body_len;
+    memmove(buf, buf + header_len + body_len, buf_fill);
+  }
+
+  free(buf);
+  close(fd);
+  return NULL;
+}
+
+static void *server_thread(__attribute__((unused)) void *arg) {
+  while (42) {
+    int fd = accept(server.listen_fd, NULL, NULL);
+    if (fd < 0)
+      break;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, server_connection, (void *)(intptr_t)fd) !=
+        0) {
+      close(fd);
+      continue;
+    }
+    pthread_detach(tid);
+  }
+  return NULL;
+}
+
+static int server_start(void) {
+  struct sockaddr_in sa = {
+      .sin_family = AF_INET,
+      .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+  socklen_t sa_len = sizeof(sa);
+
+  server.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if ((server.listen_fd < 0) ||
+      (bind(server.listen_fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) ||
+      (listen(server.listen_fd, 16) != 0) ||
+      (getsockname(server.listen_fd, (struct sockaddr *)&sa, &sa_len) != 0))
+    return -1;
+
+  server.port = ntohs(sa.sin_port);
+  return pthread_create(&server.tid, NULL, server_thread, NULL);
+}
+
+static void server_reset(int status_code, int delay_ms) {
+  pthread_mutex_lock(&server.lock);
+  server.status_code = status_code;
+  server.delay_ms = delay_ms;
+  server.requests_num = 0;
+  server.gzip_num = 0;
+  server.lines_num = 0;
+  pthread_mutex_unlock(&server.lock);
+}
+
+static size_t server_lines(void) {
+  pthread_mutex_lock(&server.lock);
+  size_t num = server.lines_num;
+  pthread_mutex_unlock(&server.lock);
+  return num;
+}
+
+static size_t server_requests(void) {
+  pthread_mutex_lock(&server.lock);
+  size_t num = server.requests_num;
+  pthread_mutex_unlock(&server.lock);
+  return num;
+}
+
+/* Returns a URL nobody listens on. */
+static int refused_url(char *buf, size_t buf_size) {
+  struct sockaddr_in sa = {
+      .sin_family = AF_INET,
+      .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+  socklen_t sa_len = sizeof(sa);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if ((bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) ||
+      (getsockname(fd, (struct sockaddr *)&sa, &sa_len) != 0)) {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+
+  snprintf(buf, buf_size, "http://127.0.0.1:%d/", ntohs(sa.sin_port));
+  return 0;
+}
+
+/*
+ * Helpers to configure a node and write value lists to it.
+ */
+typedef struct {
+  char const *key;
+  int type;
+  char const *string;
+  double number;
+} test_option_t;
+
+static wh_callback_t *test_node(test_option_t const *options,
+                                size_t options_num) {
+  oconfig_value_t name = {.value.string = "test",
+                          .type = OCONFIG_TYPE_STRING};
+  oconfig_item_t ci = {
+      .key = "Node",
+      .values = &name,
+      .values_num = 1,
+      .children = calloc(options_num, sizeof(oconfig_item_t)),
+      .children_num = (int)options_num,
+  };
+  oconfig_value_t *values = calloc(options_num, sizeof(*values));
+
+  for (size_t i = 0; i < options_num; i++) {
+    values[i].type = options[i].type;
+    if (options[i].type == OCONFIG_TYPE_STRING)
+      values[i].value.string = (char *)options[i].string;
+    else if (options[i].type == OCONFIG_TYPE_BOOLEAN)
+      values[i].value.boolean = (options[i].number != 0);
+    else
+      values[i].value.number = options[i].number;
+
+    ci.children[i].key = (char *)options[i].key;
+    ci.children[i].values = values + i;
+    ci.children[i].values_num = 1;
+    ci.children[i].parent = &ci;
+  }
+
+  registered_cb = NULL;
+  int status = wh_config_node(&ci);
+
+  free(values);
+  free(ci.children);
+  return (status == 0) ? registered_cb : NULL;
+}
+
+static data_source_t test_dsrc = {"value", DS_TYPE_GAUGE, NAN, NAN};
+static data_set_t test_ds = {"gauge", 1, &test_dsrc};
+
+static int test_write(wh_callback_t *cb, int n) {
+  value_list_t vl = {
+      .values = &(value_t){.gauge = (gauge_t)n},
+      .values_len = 1,
+      .time = TIME_T_TO_CDTIME_T(1500000000 + n),
+      .interval = TIME_T_TO_CDTIME_T(10),
+      .host = "example.com",
+      .plugin = "test",
+      .type = "gauge",
+  };
+  user_data_t ud = {.data = cb};
+
+  return wh_write(&test_ds, &vl, &ud);
+}
+
+static int test_write_flush(wh_callback_t *cb, int first, int num) {
+  for (int i = first; i < first + num; i++) {
+    int status = test_write(cb, i);
+    if (status != 0)
+      return status;
+  }
+  return wh_flush(0, NULL, &(user_data_t){.data = cb});
+}
+
+/* Counts the batches in the spool directory, including hidden files. */
+static size_t spool_dir_files(char const *dir) {
+  DIR *dh = opendir(dir);
+  struct dirent *de;
+  size_t num = 0;
+
+  if (dh == NULL)
+    return 0;
+  while ((de = readdir(dh)) != NULL)
+    if ((strcmp(de->d_name, ".") != 0) && (strcmp(de->d_name, "..") != 0))
+      num++;
+  closedir(dh);
+  return num;
+}
+
+static void spool_dir_remove(char const *dir) {
+  DIR *dh = opendir(dir);
+  struct dirent *de;
+
+  if (dh == NULL)
+    return;
+  while ((de = readdir(dh)) != NULL) {
+    char path[PATH_MAX];
+    if ((strcmp(de->d_name, ".") == 0) || (strcmp(de->d_name, "..") == 0))
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+    unlink(path);
+  }
+  closedir(dh);
+  rmdir(dir);
+}
+
+static char test_url[64];
+
+DEF_TEST(async_queue_full) {
+  int max_requests = 2;
+  int values_num = 3000;
+  test_option_t options[] = {
+      {"URL", OCONFIG_TYPE_STRING, test_url},
+      {"BufferSize", OCONFIG_TYPE_NUMBER, NULL, 1024},
+      {"MaxConcurrentRequests", OCONFIG_TYPE_NUMBER, NULL, max_requests},
+  };
+  wh_callback_t *cb;
+
+  /* A slow server keeps the queue full while requests complete, so more
+   * send buffers exist than the spare pool holds. */
+  server_reset(200, 2);
+  CHECK_NOT_NULL(cb = test_node(options, STATIC_ARRAY_SIZE(options)));
+  for (int i = 0; i < values_num; i++)
+    CHECK_ZERO(test_write(cb, i));
+  CHECK_ZERO(wh_flush(0, NULL, &(user_data_t){.data = cb}));
+
+  /* Wait for the sender to post everything. */
+  for (int i = 0; i < 1000; i++) {
+    pthread_mutex_lock(&cb->queue_lock);
+    bool idle = (cb->queue_num == 0) && (cb->requests_inflight == 0);
+    pthread_mutex_unlock(&cb->queue_lock);
+    if (idle)
+      break;
+    usleep(10000);
+  }
+
+  OK(cb->spare_num <= (size_t)max_requests);
+  wh_callback_free(cb);
+  EXPECT_EQ_INT(values_num, (int)server_lines());
+  return 0;
+}
+
+#if HAVE_LIBZ
+DEF_TEST(compression_gzip) {
+  int values_num = 500;
+  test_option_t options[] = {
+      {"URL", OCONFIG_TYPE_STRING, test_url},
+      {"BufferSize", OCONFIG_TYPE_NUMBER, NULL, 4096},
+      {"Compression", OCONFIG_TYPE_STRING, "gzip"},
+  };
+  wh_callback_t *cb;
+
+  server_reset(200, 0);
+  CHECK_NOT_NULL(cb = test_node(options, STATIC_ARRAY_SIZE(options)));
+  CHECK_ZERO(test_write_flush(cb, 0, values_num));
+  wh_callback_free(cb);
+
+  OK(server_requests() > 1);
+  EXPECT_EQ_INT((int)server_requests(), (int)server.gzip_num);
+  EXPECT_EQ_INT(values_num, (int)server_lines());
+  return 0;
+}
+#endif
+
+DEF_TEST(spool_on_server_error) {
+  char dir[] = "/tmp/write_http_test.XXXXXX";
+  int values_num = 100;
+  wh_callback_t *cb;
+
+  CHECK_NOT_NULL(mkdtemp(dir));
+  test_option_t options[] = {
+      {"URL", OCONFIG_TYPE_STRING, test_url},
+      {"BufferSize", OCONFIG_TYPE_NUMBER, NULL, 1024},
+      {"SpoolDirectory", OCONFIG_TYPE_STRING, dir},
+  };
+
+  /* The first batch fails, the following ones are spooled without being
+   * posted while backing off. */
+  server_reset(503, 0);
+  CHECK_NOT_NULL(cb = test_node(options, STATIC_ARRAY_SIZE(options)));
+  CHECK_ZERO(test_write_flush(cb, 0, values_num));
+  EXPECT_EQ_INT(1, (int)server_requests());
+  EXPECT_EQ_INT(0, (int)server_lines());
+  OK(cb->spool_files > 1);
+  EXPECT_EQ_INT((int)cb->spool_files, (int)spool_dir_files(dir));
+
+  /* After recovery, the next flush replays the spool, oldest first, before
+   * posting the new batch. */
+  server_reset(200, 0);
+  cb->spool_next_retry = 0;
+  CHECK_ZERO(test_write_flush(cb, values_num, 1));
+  EXPECT_EQ_INT(values_num + 1, (int)server_lines());
+  EXPECT_EQ_INT(0, (int)cb->spool_files);
+  EXPECT_EQ_INT(0, (int)cb->spool_size);
+  EXPECT_EQ_INT(0, (int)spool_dir_files(dir));
+
+  wh_callback_free(cb);
+  spool_dir_remove(dir);
+  return 0;
+}
+
+DEF_TEST(spool_on_connection_refused) {
+  char dir[] = "/tmp/write_http_test.XXXXXX";
+  char url[64];
+  int values_num = 100;
+  wh_callback_t *cb;
+
+  CHECK_NOT_NULL(mkdtemp(dir));
+  CHECK_ZERO(refused_url(url, sizeof(url)));
+  test_option_t refused_options[] = {
+      {"URL", OCONFIG_TYPE_STRING, url},
+      {"BufferSize", OCONFIG_TYPE_NUMBER, NULL, 1024},
+      {"SpoolDirectory", OCONFIG_TYPE_STRING, dir},
+  };
+  test_option_t options[] = {
+      {"URL", OCONFIG_TYPE_STRING, test_url},
+      {"BufferSize", OCONFIG_TYPE_NUMBER, NULL, 1024},
+      {"SpoolDirectory", OCONFIG_TYPE_STRING, dir},
+  };
+
+  CHECK_NOT_NULL(
+      cb = test_node(refused_options, STATIC_ARRAY_SIZE(refused_options)));
+  CHECK_ZERO(test_write_flush(cb, 0, values_num));
+  size_t spooled = cb->spool_files;
+  OK(spooled > 1);
+  wh_callback_free(cb);
+
+  /* A temporary file left behind by a killed daemon. */
+  char tmp[PATH_MAX];
+  snprintf(tmp, sizeof(tmp), "%s/.%016x.tmp", dir, 42);
+  FILE *fh = fopen(tmp, "w");
+  CHECK_NOT_NULL(fh);
+  fputs("PUTVAL stale\n", fh);
+  fclose(fh);
+
+  /* A new instance picks up the spooled batches and removes the stale
+   * temporary file. */
+  server_reset(200, 0);
+  CHECK_NOT_NULL(cb = test_node(options, STATIC_ARRAY_SIZE(options)));
+  EXPECT_EQ_INT((int)spooled, (int)cb->spool_files);
+  EXPECT_EQ_INT((int)spooled, (int)spool_dir_files(dir));
+
+  CHECK_ZERO(test_write_flush(cb, values_num, 1));
+  EXPECT_EQ_INT(values_num + 1, (int)server_lines());
+  EXPECT_EQ_INT(0, (int)spool_dir_files(dir));
+
+  wh_callback_free(cb);
+  spool_dir_remove(dir);
+  return 0;
+}
+
+DEF_TEST(spool_max_size) {
+  char dir[] = "/tmp/write_http_test.XXXXXX";
+  int values_num = 200;
+  wh_callback_t *cb;
+
+  CHECK_NOT_NULL(mkdtemp(dir));
+  test_option_t options[] = {
+      {"URL", OCONFIG_TYPE_STRING, test_url},
+      {"BufferSize", OCONFIG_TYPE_NUMBER, NULL, 1024},
+      {"SpoolDirectory", OCONFIG_TYPE_STRING, dir},
+  };
+
+  server_reset(503, 0);
+  CHECK_NOT_NULL(cb = test_node(options, STATIC_ARRAY_SIZE(options)));
+  /* "SpoolMaxSize" is configured in MiB; make room for three batches. */
+  cb->spool_max_size = 3 * 1024;
+  CHECK_ZERO(test_write_flush(cb, 0, values_num));
+
+  /* The oldest batches were dropped to stay within the limit. */
+  OK(cb->spool_size <= cb->spool_max_size);
+  OK(cb->spool_files >= 2);
+  OK(cb->spool_files <= 3);
+  EXPECT_EQ_INT((int)cb->spool_files, (int)spool_dir_files(dir));
+
+  /* Only the newest values are replayed. */
+  server_reset(200, 0);
+  cb->spool_next_retry = 0;
+  CHECK_ZERO(test_write_flush(cb, values_num, 1));
+  OK(server_lines() > 1);
+  OK(server_lines() < (size_t)values_num);
+  EXPECT_EQ_INT(0, (int)spool_dir_files(dir));
+
+  wh_callback_free(cb);
+  spool_dir_remove(dir);
+  return 0;
+}
+
+int main(void) {
+  curl_global_init(CURL_GLOBAL_ALL);
+  if (server_start() != 0) {
+    fprintf(stderr, "Starting the HTTP server failed: %s\n", STRERRNO);
+    return 1;
+  }
+  snprintf(test_url, sizeof(test_url), "http://127.0.0.1:%d/", server.port);
+
+  RUN_TEST(async_queue_full);
+#if HAVE_LIBZ
+  RUN_TEST(compression_gzip);
+#endif
+  RUN_TEST(spool_on_server_error);
+  RUN_TEST(spool_on_connection_refused);
+  RUN_TEST(spool_max_size);
+
+  END_TEST;
+}
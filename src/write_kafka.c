@@ -26,21 +26,30 @@
 
 #include "collectd.h"
 
+#include "network.h"
 #include "plugin.h"
 #include "utils/cmds/putval.h"
 #include "utils/common/common.h"
 #include "utils/format_graphite/format_graphite.h"
 #include "utils/format_json/format_json.h"
+#include "utils_complain.h"
 #include "utils_random.h"
 
 #include <errno.h>
 #include <librdkafka/rdkafka.h>
+#if HAVE_ARPA_INET_H
+#include <arpa/inet.h> /* htons */
+#endif
 #include <stdint.h>
 
+#define KAFKA_BATCH_LINGER_DEFAULT TIME_T_TO_CDTIME_T(1)
+#define KAFKA_FLUSH_TIMEOUT_MS 5000
+
 struct kafka_topic_context {
 #define KAFKA_FORMAT_JSON 0
 #define KAFKA_FORMAT_COMMAND 1
 #define KAFKA_FORMAT_GRAPHITE 2
+#define KAFKA_FORMAT_BINARY 3
   uint8_t format;
   unsigned int graphite_flags;
   bool store_rates;
@@ -52,8 +61,27 @@ struct kafka_topic_context {
   char *prefix;
   char *postfix;
   char escape_char;
+  format_graphite_cache_t *graphite_cache;
   char *topic_name;
   pthread_mutex_t lock;
+  c_complain_t produce_complaint;
+
+  /* Batching: value lists are appended to `batch' until it reaches
+   * `batch_max_size' bytes or is older than `batch_linger'. The buffer is
+   * used for all formats, not only for JSON. */
+  size_t batch_max_size;
+  cdtime_t batch_linger;
+  json_buffer_t batch;
+  cdtime_t batch_init;
+  value_list_t batch_last; /* binary format: fields of the previous record */
+
+  /* Producer statistics, updated by the delivery report callback. */
+  bool report_stats;
+  uint64_t stats_delivered;
+  uint64_t stats_delivered_bytes;
+  uint64_t stats_failed;
+  uint64_t stats_latency_ms;
+  uint64_t stats_latency_num;
 };
 
 static int kafka_handle(struct kafka_topic_context *);
@@ -114,6 +142,32 @@ static int32_t kafka_partition(const rd_kafka_topic_t *rkt, const void *keydata,
   return target;
 }
 
+/* Called from rd_kafka_poll() and rd_kafka_flush() for every message once it
+ * has been delivered or has failed. ctx->lock must not be held by the caller
+ * of these functions. */
+static void kafka_delivery_report(rd_kafka_t *rk, /* {{{ */
+                                  const rd_kafka_message_t *msg,
+                                  void *opaque) {
+  struct kafka_topic_context *ctx = opaque;
+  uintptr_t now_ms = (uintptr_t)CDTIME_T_TO_MS(cdtime());
+
+  if (ctx == NULL)
+    return;
+
+  pthread_mutex_lock(&ctx->lock);
+  if (msg->err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+    ctx->stats_failed++;
+  } else {
+    ctx->stats_delivered++;
+    ctx->stats_delivered_bytes += (uint64_t)msg->len;
+    /* The message opaque holds the time it was produced. Unsigned arithmetic
+     * takes care of truncation on platforms with 32 bit pointers. */
+    ctx->stats_latency_ms += (uint64_t)(now_ms - (uintptr_t)msg->_private);
+    ctx->stats_latency_num++;
+  }
+  pthread_mutex_unlock(&ctx->lock);
+} /* }}} void kafka_delivery_report */
+
 static int kafka_handle(struct kafka_topic_context *ctx) /* {{{ */
 {
   char errbuf[1024];
@@ -170,27 +224,130 @@ static int kafka_handle(struct kafka_topic_context *ctx) /* {{{ */
 
 } /* }}} int kafka_handle */
 
-static int kafka_write(const data_set_t *ds, /* {{{ */
-                       const value_list_t *vl, user_data_t *ud) {
+static int kafka_binary_append_string(json_buffer_t *b, /* {{{ */
+                                      uint16_t type, char const *str) {
+  size_t len = strlen(str) + 1;
+  uint16_t header[2] = {htons(type), htons((uint16_t)(sizeof(header) + len))};
+  int status;
+
+  status = json_buffer_append(b, (char *)header, sizeof(header));
+  if (status == 0)
+    status = json_buffer_append(b, str, len);
+  return status;
+} /* }}} int kafka_binary_append_string */
+
+static int kafka_binary_append_number(json_buffer_t *b, /* {{{ */
+                                      uint16_t type, uint64_t value) {
+  uint16_t header[2] = {htons(type),
+                        htons((uint16_t)(sizeof(header) + sizeof(value)))};
+  int status;
+
+  value = htonll(value);
+  status = json_buffer_append(b, (char *)header, sizeof(header));
+  if (status == 0)
+    status = json_buffer_append(b, (char *)&value, sizeof(value));
+  return status;
+} /* }}} int kafka_binary_append_number */
+
+static int kafka_binary_append_values(json_buffer_t *b, /* {{{ */
+                                      const data_set_t *ds,
+                                      const value_list_t *vl) {
+  size_t len = 2 * sizeof(uint16_t) + sizeof(uint16_t) +
+               vl->values_len * (sizeof(uint8_t) + sizeof(value_t));
+  uint16_t header[3] = {htons(TYPE_VALUES), htons((uint16_t)len),
+                        htons((uint16_t)vl->values_len)};
+  int status;
+
+  status = json_buffer_append(b, (char *)header, sizeof(header));
+  for (size_t i = 0; (status == 0) && (i < vl->values_len); i++) {
+    uint8_t type = (uint8_t)ds->ds[i].type;
+    status = json_buffer_append(b, (char *)&type, sizeof(type));
+  }
+
+  for (size_t i = 0; (status == 0) && (i < vl->values_len); i++) {
+    value_t v;
+
+    switch (ds->ds[i].type) {
+    case DS_TYPE_COUNTER:
+      v.counter = htonll(vl->values[i].counter);
+      break;
+    case DS_TYPE_GAUGE:
+      v.gauge = htond(vl->values[i].gauge);
+      break;
+    case DS_TYPE_DERIVE:
+      v.derive = htonll(vl->values[i].derive);
+      break;
+    case DS_TYPE_ABSOLUTE:
+      v.absolute = htonll(vl->values[i].absolute);
+      break;
+    default:
+      return EINVAL;
+    }
+    status = json_buffer_append(b, (char *)&v, sizeof(v));
+  }
+
+  return status;
+} /* }}} int kafka_binary_append_values */
+
+/* Encodes `vl' in collectd's binary network protocol. Like the network
+ * plugin, fields which did not change since the previous value list in the
+ * same message (`last') are omitted. */
+static int kafka_binary_append(json_buffer_t *b, value_list_t *last, /* {{{ */
+                               const data_set_t *ds, const value_list_t *vl) {
   int status = 0;
-  void *key;
-  size_t keylen = 0;
-  char buffer[8192];
-  size_t bfree = sizeof(buffer);
-  size_t bfill = 0;
-  size_t blen = 0;
-  struct kafka_topic_context *ctx = ud->data;
 
-  if ((ds == NULL) || (vl == NULL) || (ctx == NULL))
-    return EINVAL;
+  if ((status == 0) && (strcmp(last->host, vl->host) != 0)) {
+    status = kafka_binary_append_string(b, TYPE_HOST, vl->host);
+    sstrncpy(last->host, vl->host, sizeof(last->host));
+  }
+  if ((status == 0) && (last->time != vl->time)) {
+    status = kafka_binary_append_number(b, TYPE_TIME_HR, (uint64_t)vl->time);
+    last->time = vl->time;
+  }
+  if ((status == 0) && (last->interval != vl->interval)) {
+    status = kafka_binary_append_number(b, TYPE_INTERVAL_HR,
+                                        (uint64_t)vl->interval);
+    last->interval = vl->interval;
+  }
+  if ((status == 0) && (strcmp(last->plugin, vl->plugin) != 0)) {
+    status = kafka_binary_append_string(b, TYPE_PLUGIN, vl->plugin);
+    sstrncpy(last->plugin, vl->plugin, sizeof(last->plugin));
+  }
+  if ((status == 0) &&
+      (strcmp(last->plugin_instance, vl->plugin_instance) != 0)) {
+    status = kafka_binary_append_string(b, TYPE_PLUGIN_INSTANCE,
+                                        vl->plugin_instance);
+    sstrncpy(last->plugin_instance, vl->plugin_instance,
+             sizeof(last->plugin_instance));
+  }
+  if ((status == 0) && (strcmp(last->type, vl->type) != 0)) {
+    status = kafka_binary_append_string(b, TYPE_TYPE, vl->type);
+    sstrncpy(last->type, vl->type, sizeof(last->type));
+  }
+  if ((status == 0) && (strcmp(last->type_instance, vl->type_instance) != 0)) {
+    status =
+        kafka_binary_append_string(b, TYPE_TYPE_INSTANCE, vl->type_instance);
+    sstrncpy(last->type_instance, vl->type_instance,
+             sizeof(last->type_instance));
+  }
+  if (status == 0)
+    status = kafka_binary_append_values(b, ds, vl);
 
-  pthread_mutex_lock(&ctx->lock);
-  status = kafka_handle(ctx);
-  pthread_mutex_unlock(&ctx->lock);
-  if (status != 0)
-    return status;
+  return status;
+} /* }}} int kafka_binary_append */
 
-  bzero(buffer, sizeof(buffer));
+/*
+ * Appends `vl' to `b', preceded by a separator if `b' already holds records.
+ * JSON arrays are left open; kafka_produce() closes them. Upon failure the
+ * buffer is left unchanged, except for `last' which is reset so the next
+ * binary record is complete.
+ */
+static int kafka_format_append(struct kafka_topic_context *ctx, /* {{{ */
+                               json_buffer_t *b, value_list_t *last,
+                               const data_set_t *ds, const value_list_t *vl) {
+  char buffer[8192];
+  size_t pos = b->pos;
+  int status = 0;
 
   switch (ctx->format) {
   case KAFKA_FORMAT_COMMAND:
@@ -198,42 +355,221 @@ static int kafka_write(const data_set_t *ds, /* {{{ */
     if (status != 0) {
       ERROR("write_kafka plugin: cmd_create_putval failed with status %i.",
             status);
-      return status;
+      break;
     }
-    blen = strlen(buffer);
+    if (b->pos > 0)
+      status = json_buffer_append(b, "\n", 1);
+    if (status == 0)
+      status = json_buffer_append(b, buffer, strlen(buffer));
     break;
   case KAFKA_FORMAT_JSON:
-    format_json_initialize(buffer, &bfill, &bfree);
-    format_json_value_list(buffer, &bfill, &bfree, ds, vl, ctx->store_rates);
-    format_json_finalize(buffer, &bfill, &bfree);
-    blen = strlen(buffer);
+    /* Value lists are not limited by the size of `buffer' in this format. */
+    status = json_buffer_append(b, (b->pos > 0) ? "," : "[", 1);
+    if (status == 0)
+      status = format_json_value_list_object(b, ds, vl, ctx->store_rates);
+    if (status != 0)
+      ERROR("write_kafka plugin: Formatting JSON failed with status %i.",
+            status);
     break;
   case KAFKA_FORMAT_GRAPHITE:
-    status =
-        format_graphite(buffer, sizeof(buffer), ds, vl, ctx->prefix,
-                        ctx->postfix, ctx->escape_char, ctx->graphite_flags);
+    status = format_graphite_cached(ctx->graphite_cache, buffer,
+                                    sizeof(buffer), ds, vl, ctx->prefix,
+                                    ctx->postfix, ctx->escape_char,
+                                    ctx->graphite_flags);
     if (status != 0) {
       ERROR("write_kafka plugin: format_graphite failed with status %i.",
             status);
-      return status;
+      break;
+    }
+    status = json_buffer_append(b, buffer, strlen(buffer));
+    break;
+  case KAFKA_FORMAT_BINARY:
+    if (b->pos == 0)
+      memset(last, 0, sizeof(*last));
+    status = kafka_binary_append(b, last, ds, vl);
+    if (status != 0) {
+      ERROR("write_kafka plugin: Binary encoding failed with status %i.",
+            status);
+      memset(last, 0, sizeof(*last));
     }
-    blen = strlen(buffer);
     break;
   default:
     ERROR("write_kafka plugin: invalid format %i.", ctx->format);
     return -1;
   }
 
+  if (status != 0) {
+    b->pos = pos;
+    if (b->size > 0)
+      b->ptr[pos] = 0;
+  }
+  return status;
+} /* }}} int kafka_format_append */
+
+/* Hands the formatted records in `b' to librdkafka. */
+static int kafka_produce(struct kafka_topic_context *ctx, /* {{{ */
+                         json_buffer_t *b) {
+  void *key;
+  size_t keylen = 0;
+  int status;
+
+  if (ctx->format == KAFKA_FORMAT_JSON) {
+    status = json_buffer_append(b, "]", 1);
+    if (status != 0)
+      return status;
+  }
+
   key =
       (ctx->key != NULL) ? ctx->key : kafka_random_key(KAFKA_RANDOM_KEY_BUFFER);
   keylen = strlen(key);
 
-  rd_kafka_produce(ctx->topic, RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_COPY,
-                   buffer, blen, key, keylen, NULL);
+  status = rd_kafka_produce(
+      ctx->topic, RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_COPY, b->ptr, b->pos,
+      key, keylen, (void *)(uintptr_t)CDTIME_T_TO_MS(cdtime()));
+  if (status != 0) {
+    c_complain(LOG_ERR, &ctx->produce_complaint,
+               "write_kafka plugin: rd_kafka_produce failed: %s",
+               rd_kafka_err2str(kafka_error()));
+    return status;
+  }
+
+  c_release(LOG_INFO, &ctx->produce_complaint,
+            "write_kafka plugin: rd_kafka_produce succeeded.");
+  return 0;
+} /* }}} int kafka_produce */
+
+/* ctx->lock must be held when calling this function. */
+static int kafka_batch_produce_nolock(struct kafka_topic_context *ctx) /* {{{ */
+{
+  int status = 0;
+
+  if (ctx->batch.pos > 0)
+    status = kafka_produce(ctx, &ctx->batch);
+
+  json_buffer_reset(&ctx->batch);
+  return status;
+} /* }}} int kafka_batch_produce_nolock */
+
+static int kafka_write(const data_set_t *ds, /* {{{ */
+                       const value_list_t *vl, user_data_t *ud) {
+  int status = 0;
+  json_buffer_t buffer;
+  value_list_t last = {0};
+  struct kafka_topic_context *ctx = ud->data;
+
+  if ((ds == NULL) || (vl == NULL) || (ctx == NULL))
+    return EINVAL;
+
+  pthread_mutex_lock(&ctx->lock);
+  status = kafka_handle(ctx);
+  if ((status != 0) || (ctx->batch_max_size == 0)) {
+    pthread_mutex_unlock(&ctx->lock);
+    if (status != 0)
+      return status;
+
+    json_buffer_init(&buffer);
+    status = kafka_format_append(ctx, &buffer, &last, ds, vl);
+    if (status == 0)
+      status = kafka_produce(ctx, &buffer);
+    json_buffer_free(&buffer);
+    return status;
+  }
+
+  cdtime_t now = cdtime();
+  if ((ctx->batch.pos > 0) && (ctx->batch_init + ctx->batch_linger <= now))
+    kafka_batch_produce_nolock(ctx);
+  if (ctx->batch.pos == 0)
+    ctx->batch_init = now;
+
+  status = kafka_format_append(ctx, &ctx->batch, &ctx->batch_last, ds, vl);
+  if ((status == 0) && (ctx->batch.pos >= ctx->batch_max_size))
+    status = kafka_batch_produce_nolock(ctx);
+  pthread_mutex_unlock(&ctx->lock);
 
   return status;
 } /* }}} int kafka_write */
 
+static int kafka_flush(cdtime_t timeout, /* {{{ */
+                       const char __attribute__((unused)) * identifier,
+                       user_data_t *ud) {
+  struct kafka_topic_context *ctx = ud->data;
+  int status = 0;
+
+  pthread_mutex_lock(&ctx->lock);
+  if ((ctx->batch.pos > 0) &&
+      ((timeout == 0) || (ctx->batch_init + timeout <= cdtime())))
+    status = kafka_batch_produce_nolock(ctx);
+  pthread_mutex_unlock(&ctx->lock);
+
+  return status;
+} /* }}} int kafka_flush */
+
+static void kafka_submit(struct kafka_topic_context *ctx, /* {{{ */
+                         char const *type, char const *type_instance,
+                         value_t v) {
+  value_list_t vl = VALUE_LIST_INIT;
+
+  vl.values = &v;
+  vl.values_len = 1;
+  sstrncpy(vl.plugin, "write_kafka", sizeof(vl.plugin));
+  sstrncpy(vl.plugin_instance, ctx->topic_name, sizeof(vl.plugin_instance));
+  sstrncpy(vl.type, type, sizeof(vl.type));
+  sstrncpy(vl.type_instance, type_instance, sizeof(vl.type_instance));
+
+  plugin_dispatch_values(&vl);
+} /* }}} void kafka_submit */
+
+/* Produces batches which have lingered for long enough, serves the delivery
+ * report callback and dispatches the producer statistics. */
+static int kafka_read(user_data_t *ud) /* {{{ */
+{
+  struct kafka_topic_context *ctx = ud->data;
+  rd_kafka_t *kafka;
+
+  pthread_mutex_lock(&ctx->lock);
+  if ((ctx->batch.pos > 0) &&
+      (ctx->batch_init + ctx->batch_linger <= cdtime()))
+    kafka_batch_produce_nolock(ctx);
+  kafka = ctx->kafka;
+  pthread_mutex_unlock(&ctx->lock);
+
+  /* The handle is created with the first write. */
+  if (kafka == NULL)
+    return 0;
+
+  rd_kafka_poll(kafka, /* timeout = */ 0);
+
+  if (!ctx->report_stats)
+    return 0;
+
+  pthread_mutex_lock(&ctx->lock);
+  uint64_t delivered = ctx->stats_delivered;
+  uint64_t delivered_bytes = ctx->stats_delivered_bytes;
+  uint64_t failed = ctx->stats_failed;
+  gauge_t latency = NAN;
+  if (ctx->stats_latency_num > 0)
+    latency = ((gauge_t)ctx->stats_latency_ms) /
+              (1000.0 * (gauge_t)ctx->stats_latency_num);
+  ctx->stats_latency_ms = 0;
+  ctx->stats_latency_num = 0;
+  size_t batch_bytes = ctx->batch.pos;
+  pthread_mutex_unlock(&ctx->lock);
+
+  kafka_submit(ctx, "queue_length", "messages",
+               (value_t){.gauge = (gauge_t)rd_kafka_outq_len(kafka)});
+  kafka_submit(ctx, "bytes", "batched",
+               (value_t){.gauge = (gauge_t)batch_bytes});
+  kafka_submit(ctx, "total_values", "delivered",
+               (value_t){.derive = (derive_t)delivered});
+  kafka_submit(ctx, "total_values", "failed",
+               (value_t){.derive = (derive_t)failed});
+  kafka_submit(ctx, "total_bytes", "delivered",
+               (value_t){.derive = (derive_t)delivered_bytes});
+  kafka_submit(ctx, "latency", "delivery", (value_t){.gauge = latency});
+
+  return 0;
+} /* }}} int kafka_read */
+
 static void kafka_topic_context_free(void *p) /* {{{ */
 {
   struct kafka_topic_context *ctx = p;
@@ -241,6 +577,16 @@ static void kafka_topic_context_free(void *p) /* {{{ */
   if (ctx == NULL)
     return;
 
+  if ((ctx->topic != NULL) && (ctx->batch.pos > 0))
+    kafka_produce(ctx, &ctx->batch);
+  json_buffer_free(&ctx->batch);
+
+#if RD_KAFKA_VERSION >= 0x00090200
+  /* Give queued messages a chance to be delivered. */
+  if (ctx->kafka != NULL)
+    rd_kafka_flush(ctx->kafka, KAFKA_FLUSH_TIMEOUT_MS);
+#endif
+
   if (ctx->topic_name != NULL)
     sfree(ctx->topic_name);
   if (ctx->topic != NULL)
@@ -251,6 +597,8 @@ static void kafka_topic_context_free(void *p) /* {{{ */
     rd_kafka_conf_destroy(ctx->kafka_conf);
   if (ctx->kafka != NULL)
     rd_kafka_destroy(ctx->kafka);
+  format_graphite_cache_destroy(ctx->graphite_cache);
+  pthread_mutex_destroy(&ctx->lock);
 
   sfree(ctx);
 } /* }}} void kafka_topic_context_free */
@@ -276,8 +624,13 @@ static void kafka_config_topic(rd_kafka_conf_t *conf,
   tctx->store_rates = true;
   tctx->format = KAFKA_FORMAT_JSON;
   tctx->key = NULL;
+  tctx->batch_linger = KAFKA_BATCH_LINGER_DEFAULT;
+  json_buffer_init(&tctx->batch);
+  C_COMPLAIN_INIT(&tctx->produce_complaint);
+  pthread_mutex_init(&tctx->lock, /* attr = */ NULL);
 
   if ((tctx->kafka_conf = rd_kafka_conf_dup(conf)) == NULL) {
+    pthread_mutex_destroy(&tctx->lock);
     sfree(tctx);
     ERROR("write_kafka plugin: cannot allocate memory for kafka config");
     return;
@@ -289,6 +642,7 @@ static void kafka_config_topic(rd_kafka_conf_t *conf,
 
   if ((tctx->conf = rd_kafka_topic_conf_new()) == NULL) {
     rd_kafka_conf_destroy(tctx->kafka_conf);
+    pthread_mutex_destroy(&tctx->lock);
     sfree(tctx);
     ERROR("write_kafka plugin: cannot create topic configuration.");
     return;
@@ -360,12 +714,31 @@ static void kafka_config_topic(rd_kafka_conf_t *conf,
       } else if (strcasecmp(key, "Json") == 0) {
         tctx->format = KAFKA_FORMAT_JSON;
 
+      } else if (strcasecmp(key, "Binary") == 0) {
+        tctx->format = KAFKA_FORMAT_BINARY;
+
       } else {
         WARNING("write_kafka plugin: Invalid format string: %s", key);
       }
 
       sfree(key);
 
+    } else if (strcasecmp("BatchMaxSize", child->key) == 0) {
+      int tmp = 0;
+      status = cf_util_get_int(child, &tmp);
+      if ((status == 0) && (tmp < 0)) {
+        WARNING("write_kafka plugin: BatchMaxSize must not be negative.");
+        status = -1;
+      }
+      if (status == 0)
+        tctx->batch_max_size = (size_t)tmp;
+
+    } else if (strcasecmp("BatchLinger", child->key) == 0) {
+      status = cf_util_get_cdtime(child, &tctx->batch_linger);
+
+    } else if (strcasecmp("ReportStats", child->key) == 0) {
+      status = cf_util_get_boolean(child, &tctx->report_stats);
+
     } else if (strcasecmp("StoreRates", child->key) == 0) {
       status = cf_util_get_boolean(child, &tctx->store_rates);
       (void)cf_util_get_flag(child, &tctx->graphite_flags,
@@ -410,6 +783,15 @@ static void kafka_config_topic(rd_kafka_conf_t *conf,
   rd_kafka_topic_conf_set_partitioner_cb(tctx->conf, kafka_partition);
   rd_kafka_topic_conf_set_opaque(tctx->conf, tctx);
 
+  if (tctx->report_stats) {
+    rd_kafka_conf_set_dr_msg_cb(tctx->kafka_conf, kafka_delivery_report);
+    rd_kafka_conf_set_opaque(tctx->kafka_conf, tctx);
+  }
+
+  /* If this fails, metric paths are simply built for every value list. */
+  if (tctx->format == KAFKA_FORMAT_GRAPHITE)
+    tctx->graphite_cache = format_graphite_cache_create();
+
   ssnprintf(callback_name, sizeof(callback_name), "write_kafka/%s",
             tctx->topic_name);
 
@@ -425,7 +807,22 @@ static void kafka_config_topic(rd_kafka_conf_t *conf,
     goto errout;
   }
 
-  pthread_mutex_init(&tctx->lock, /* attr = */ NULL);
+  /* The write callback owns `tctx'; it is unregistered after these. */
+  if (tctx->batch_max_size > 0)
+    plugin_register_flush(callback_name, kafka_flush,
+                          &(user_data_t){.data = tctx});
+
+  if ((tctx->batch_max_size > 0) || tctx->report_stats) {
+    cdtime_t interval = 0;
+    if ((tctx->batch_max_size > 0) && (tctx->batch_linger > 0))
+      interval = tctx->batch_linger;
+    if (tctx->report_stats && (interval > plugin_get_interval()))
+      interval = 0;
+
+    plugin_register_complex_read(/* group = */ "write_kafka", callback_name,
+                                 kafka_read, interval,
+                                 &(user_data_t){.data = tctx});
+  }
 
   return;
 errout:
@@ -435,6 +832,9 @@ errout:
     rd_kafka_topic_conf_destroy(tctx->conf);
   if (tctx->kafka_conf != NULL)
     rd_kafka_conf_destroy(tctx->kafka_conf);
+  format_graphite_cache_destroy(tctx->graphite_cache);
+  json_buffer_free(&tctx->batch);
+  pthread_mutex_destroy(&tctx->lock);
   sfree(tctx);
 } /* }}} int kafka_config_topic */
 
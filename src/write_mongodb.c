@@ -33,11 +33,39 @@
 #include "collectd.h"
 
 #include "plugin.h"
+#include "utils/avltree/avltree.h"
 #include "utils/common/common.h"
 #include "utils_cache.h"
 
 #include <mongoc.h>
 
+/* The series cache is cleared when it grows beyond this many entries, so
+ * series which come and go don't accumulate. */
+#ifndef WM_SERIES_MAX
+#define WM_SERIES_MAX 65536
+#endif
+
+/* Error code of the server when creating a collection which exists. */
+#define WM_NAMESPACE_EXISTS 48
+
+/* Collection of one plugin, with the bulk operation collecting its
+ * documents. */
+struct wm_collection_s {
+  char *name;
+  mongoc_collection_t *collection;
+  mongoc_bulk_operation_t *bulk;
+};
+typedef struct wm_collection_s wm_collection_t;
+
+/* The parts of a document which only depend on the identifier. */
+struct wm_series_s {
+  char *ident;
+  size_t ds_num;
+  bson_t *head; /* identifier fields or, for time series, the "meta" field */
+  bson_t *tail; /* "dstypes" and "dsnames"; NULL for time series */
+};
+typedef struct wm_series_s wm_series_t;
+
 struct wm_node_s {
   char name[DATA_MAX_NAME_LEN];
 
@@ -52,70 +80,79 @@ struct wm_node_s {
 
   bool store_rates;
   bool connected;
+  int batch_size;
+  cdtime_t batch_timeout;
+  bool time_series;
 
   mongoc_client_t *client;
   mongoc_database_t *database;
   pthread_mutex_t lock;
+
+  c_avl_tree_t *collections; /* plugin name -> wm_collection_t */
+  c_avl_tree_t *series;      /* identifier -> wm_series_t */
+  int pending;
+  cdtime_t pending_since;
 };
 typedef struct wm_node_s wm_node_t;
 
 /*
  * Functions
  */
-static bson_t *wm_create_bson(const data_set_t *ds, /* {{{ */
-                              const value_list_t *vl, bool store_rates) {
-  bson_t *ret;
-  bson_t subarray;
-  gauge_t *rates;
+static void wm_series_free(wm_series_t *series) /* {{{ */
+{
+  if (series == NULL)
+    return;
+
+  if (series->head != NULL)
+    bson_destroy(series->head);
+  if (series->tail != NULL)
+    bson_destroy(series->tail);
+  sfree(series->ident);
+  sfree(series);
+} /* }}} void wm_series_free */
+
+static void wm_series_clear(wm_node_t *node) /* {{{ */
+{
+  char *ident;
+  wm_series_t *series;
+
+  while (c_avl_pick(node->series, (void *)&ident, (void *)&series) == 0)
+    wm_series_free(series);
+} /* }}} void wm_series_clear */
+
+/* Builds the identifier dependent parts of the documents of `vl'. */
+static wm_series_t *wm_series_create(wm_node_t const *node, /* {{{ */
+                                     const data_set_t *ds,
+                                     const value_list_t *vl,
+                                     char const *ident) {
+  wm_series_t *series = calloc(1, sizeof(*series));
+  if (series == NULL)
+    return NULL;
 
-  ret = bson_new();
-  if (!ret) {
+  series->ident = strdup(ident);
+  series->ds_num = ds->ds_num;
+  series->head = bson_new();
+  if (!node->time_series)
+    series->tail = bson_new();
+  if ((series->ident == NULL) || (series->head == NULL) ||
+      (!node->time_series && (series->tail == NULL))) {
     ERROR("write_mongodb plugin: bson_new failed.");
+    wm_series_free(series);
     return NULL;
   }
 
-  if (store_rates) {
-    rates = uc_get_rate(ds, vl);
-    if (rates == NULL) {
-      ERROR("write_mongodb plugin: uc_get_rate() failed.");
-      bson_destroy(ret);
-      return NULL;
-    }
-  } else {
-    rates = NULL;
-  }
+  bson_t meta = BSON_INITIALIZER;
+  bson_t *ret = node->time_series ? &meta : series->head;
+  bson_t subarray;
 
-  BSON_APPEND_DATE_TIME(ret, "timestamp", CDTIME_T_TO_MS(vl->time));
   BSON_APPEND_UTF8(ret, "host", vl->host);
   BSON_APPEND_UTF8(ret, "plugin", vl->plugin);
   BSON_APPEND_UTF8(ret, "plugin_instance", vl->plugin_instance);
   BSON_APPEND_UTF8(ret, "type", vl->type);
   BSON_APPEND_UTF8(ret, "type_instance", vl->type_instance);
 
-  BSON_APPEND_ARRAY_BEGIN(ret, "values", &subarray); /* {{{ */
-  for (size_t i = 0; i < ds->ds_num; i++) {
-    char key[16];
-
-    snprintf(key, sizeof(key), "%" PRIsz, i);
-
-    if (ds->ds[i].type == DS_TYPE_GAUGE)
-      BSON_APPEND_DOUBLE(&subarray, key, vl->values[i].gauge);
-    else if (store_rates)
-      BSON_APPEND_DOUBLE(&subarray, key, (double)rates[i]);
-    else if (ds->ds[i].type == DS_TYPE_COUNTER)
-      BSON_APPEND_INT64(&subarray, key, vl->values[i].counter);
-    else if (ds->ds[i].type == DS_TYPE_DERIVE)
-      BSON_APPEND_INT64(&subarray, key, vl->values[i].derive);
-    else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
-      BSON_APPEND_INT64(&subarray, key, vl->values[i].absolute);
-    else {
-      ERROR("write_mongodb plugin: Unknown ds_type %d for index %" PRIsz,
-            ds->ds[i].type, i);
-      bson_destroy(ret);
-      return NULL;
-    }
-  }
-  bson_append_array_end(ret, &subarray); /* }}} values */
+  if (!node->time_series)
+    ret = series->tail;
 
   BSON_APPEND_ARRAY_BEGIN(ret, "dstypes", &subarray); /* {{{ */
   for (size_t i = 0; i < ds->ds_num; i++) {
@@ -123,7 +160,7 @@ static bson_t *wm_create_bson(const data_set_t *ds, /* {{{ */
 
     snprintf(key, sizeof(key), "%" PRIsz, i);
 
-    if (store_rates)
+    if (node->store_rates)
       BSON_APPEND_UTF8(&subarray, key, "gauge");
     else
       BSON_APPEND_UTF8(&subarray, key, DS_TYPE_TO_STRING(ds->ds[i].type));
@@ -139,19 +176,98 @@ static bson_t *wm_create_bson(const data_set_t *ds, /* {{{ */
   }
   bson_append_array_end(ret, &subarray); /* }}} dsnames */
 
-  sfree(rates);
+  if (node->time_series)
+    BSON_APPEND_DOCUMENT(series->head, "meta", &meta);
+  bson_destroy(&meta);
 
+  /* The values appended per document are numbers, so validating the parts
+   * built here once is enough. */
   size_t error_location;
-  if (!bson_validate(ret, BSON_VALIDATE_UTF8, &error_location)) {
+  if (!bson_validate(series->head, BSON_VALIDATE_UTF8, &error_location) ||
+      ((series->tail != NULL) &&
+       !bson_validate(series->tail, BSON_VALIDATE_UTF8, &error_location))) {
     ERROR("write_mongodb plugin: Error in generated BSON document "
           "at byte %" PRIsz,
           error_location);
-    bson_destroy(ret);
+    wm_series_free(series);
+    return NULL;
+  }
+
+  return series;
+} /* }}} wm_series_t *wm_series_create */
+
+/* Returns the cached document parts of `vl', creating them if necessary. */
+static wm_series_t *wm_series_get(wm_node_t *node, /* {{{ */
+                                  const data_set_t *ds,
+                                  const value_list_t *vl) {
+  char ident[6 * DATA_MAX_NAME_LEN];
+  wm_series_t *series = NULL;
+
+  if (FORMAT_VL(ident, sizeof(ident), vl) != 0)
+    return NULL;
+
+  if (c_avl_get(node->series, ident, (void *)&series) == 0) {
+    /* The number of data sources only changes if the types.db is reloaded. */
+    if (series->ds_num == ds->ds_num)
+      return series;
+
+    c_avl_remove(node->series, ident, NULL, NULL);
+    wm_series_free(series);
+  }
+
+  if (c_avl_size(node->series) >= WM_SERIES_MAX)
+    wm_series_clear(node);
+
+  series = wm_series_create(node, ds, vl, ident);
+  if (series == NULL)
+    return NULL;
+
+  if (c_avl_insert(node->series, series->ident, series) != 0) {
+    wm_series_free(series);
     return NULL;
   }
 
-  return ret;
-} /* }}} bson *wm_create_bson */
+  return series;
+} /* }}} wm_series_t *wm_series_get */
+
+static int wm_create_bson(bson_t *ret, /* {{{ */
+                          wm_node_t const *node, wm_series_t const *series,
+                          const data_set_t *ds, const value_list_t *vl,
+                          gauge_t const *rates) {
+  bson_t subarray;
+
+  BSON_APPEND_DATE_TIME(ret, "timestamp", CDTIME_T_TO_MS(vl->time));
+  bson_concat(ret, series->head);
+
+  BSON_APPEND_ARRAY_BEGIN(ret, "values", &subarray); /* {{{ */
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    char key[16];
+
+    snprintf(key, sizeof(key), "%" PRIsz, i);
+
+    if (ds->ds[i].type == DS_TYPE_GAUGE)
+      BSON_APPEND_DOUBLE(&subarray, key, vl->values[i].gauge);
+    else if (rates != NULL)
+      BSON_APPEND_DOUBLE(&subarray, key, (double)rates[i]);
+    else if (ds->ds[i].type == DS_TYPE_COUNTER)
+      BSON_APPEND_INT64(&subarray, key, vl->values[i].counter);
+    else if (ds->ds[i].type == DS_TYPE_DERIVE)
+      BSON_APPEND_INT64(&subarray, key, vl->values[i].derive);
+    else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
+      BSON_APPEND_INT64(&subarray, key, vl->values[i].absolute);
+    else {
+      ERROR("write_mongodb plugin: Unknown ds_type %d for index %" PRIsz,
+            ds->ds[i].type, i);
+      return -1;
+    }
+  }
+  bson_append_array_end(ret, &subarray); /* }}} values */
+
+  if (series->tail != NULL)
+    bson_concat(ret, series->tail);
+
+  return 0;
+} /* }}} int wm_create_bson */
 
 static int wm_initialize(wm_node_t *node) /* {{{ */
 {
@@ -218,68 +334,235 @@ static int wm_initialize(wm_node_t *node) /* {{{ */
   return 0;
 } /* }}} int wm_initialize */
 
+static void wm_collection_free(wm_collection_t *c) /* {{{ */
+{
+  if (c == NULL)
+    return;
+
+  if (c->bulk != NULL)
+    mongoc_bulk_operation_destroy(c->bulk);
+  if (c->collection != NULL)
+    mongoc_collection_destroy(c->collection);
+  sfree(c->name);
+  sfree(c);
+} /* }}} void wm_collection_free */
+
+/* Closes the connection. Documents which have not been sent are lost. */
+static void wm_disconnect(wm_node_t *node) /* {{{ */
+{
+  char *name;
+  wm_collection_t *c;
+
+  while (c_avl_pick(node->collections, (void *)&name, (void *)&c) == 0)
+    wm_collection_free(c);
+  node->pending = 0;
+
+  mongoc_database_destroy(node->database);
+  mongoc_client_destroy(node->client);
+  node->database = NULL;
+  node->client = NULL;
+  node->connected = false;
+} /* }}} void wm_disconnect */
+
+static mongoc_collection_t *wm_collection_open(wm_node_t *node, /* {{{ */
+                                               char const *name) {
+  if (!node->time_series)
+    return mongoc_client_get_collection(node->client, "collectd", name);
+
+  bson_t *opts = BCON_NEW("timeseries", "{", "timeField",
+                          BCON_UTF8("timestamp"), "metaField",
+                          BCON_UTF8("meta"), "}");
+  bson_error_t error;
+  mongoc_collection_t *collection =
+      mongoc_database_create_collection(node->database, name, opts, &error);
+  bson_destroy(opts);
+
+  if (collection != NULL)
+    return collection;
+
+  if (error.code != WM_NAMESPACE_EXISTS)
+    WARNING("write_mongodb plugin: Creating the time series collection "
+            "\"%s\" failed: %s",
+            name, error.message);
+  return mongoc_client_get_collection(node->client, "collectd", name);
+} /* }}} mongoc_collection_t *wm_collection_open */
+
+/* Returns the collection values of `plugin' are written to. */
+static wm_collection_t *wm_collection_get(wm_node_t *node, /* {{{ */
+                                          char const *plugin) {
+  wm_collection_t *c = NULL;
+
+  if (c_avl_get(node->collections, plugin, (void *)&c) == 0)
+    return c;
+
+  c = calloc(1, sizeof(*c));
+  if (c == NULL)
+    return NULL;
+
+  c->name = strdup(plugin);
+  if (c->name == NULL) {
+    sfree(c);
+    return NULL;
+  }
+
+  c->collection = wm_collection_open(node, plugin);
+  if ((c->collection == NULL) ||
+      (c_avl_insert(node->collections, c->name, c) != 0)) {
+    wm_collection_free(c);
+    return NULL;
+  }
+
+  return c;
+} /* }}} wm_collection_t *wm_collection_get */
+
+/* Executes the bulk operations of all collections. */
+static int wm_flush_nolock(wm_node_t *node) /* {{{ */
+{
+  c_avl_iterator_t *iter;
+  char *name;
+  wm_collection_t *c;
+  int status = 0;
+
+  if (node->pending == 0)
+    return 0;
+
+  iter = c_avl_get_iterator(node->collections);
+  if (iter == NULL)
+    return -1;
+
+  while (c_avl_iterator_next(iter, (void *)&name, (void *)&c) == 0) {
+    bson_t reply;
+    bson_error_t error;
+
+    if (c->bulk == NULL)
+      continue;
+
+    if (!mongoc_bulk_operation_execute(c->bulk, &reply, &error)) {
+      ERROR("write_mongodb plugin: error inserting records into \"%s\": %s",
+            c->name, error.message);
+      status = -1;
+    }
+    bson_destroy(&reply);
+    mongoc_bulk_operation_destroy(c->bulk);
+    c->bulk = NULL;
+  }
+  c_avl_iterator_destroy(iter);
+
+  node->pending = 0;
+
+  if (status != 0)
+    wm_disconnect(node);
+
+  return status;
+} /* }}} int wm_flush_nolock */
+
 static int wm_write(const data_set_t *ds, /* {{{ */
                     const value_list_t *vl, user_data_t *ud) {
   wm_node_t *node = ud->data;
-  mongoc_collection_t *collection = NULL;
-  bson_t *bson_record;
+  wm_collection_t *c;
+  wm_series_t *series;
+  gauge_t *rates = NULL;
+  bson_t bson_record = BSON_INITIALIZER;
   bson_error_t error;
   int status;
 
-  bson_record = wm_create_bson(ds, vl, node->store_rates);
-  if (!bson_record) {
+  if (node->store_rates) {
+    rates = uc_get_rate(ds, vl);
+    if (rates == NULL) {
+      ERROR("write_mongodb plugin: uc_get_rate() failed.");
+      return -1;
+    }
+  }
+
+  pthread_mutex_lock(&node->lock);
+
+  series = wm_series_get(node, ds, vl);
+  if ((series == NULL) ||
+      (wm_create_bson(&bson_record, node, series, ds, vl, rates) != 0)) {
     ERROR("write_mongodb plugin: error making insert bson");
+    pthread_mutex_unlock(&node->lock);
+    bson_destroy(&bson_record);
+    sfree(rates);
     return -1;
   }
+  sfree(rates);
 
-  pthread_mutex_lock(&node->lock);
   if (wm_initialize(node) < 0) {
     ERROR("write_mongodb plugin: error making connection to server");
     pthread_mutex_unlock(&node->lock);
-    bson_destroy(bson_record);
+    bson_destroy(&bson_record);
     return -1;
   }
 
-  collection =
-      mongoc_client_get_collection(node->client, "collectd", vl->plugin);
-  if (!collection) {
+  c = wm_collection_get(node, vl->plugin);
+  if (c == NULL) {
     ERROR("write_mongodb plugin: error creating/getting collection");
-    mongoc_database_destroy(node->database);
-    mongoc_client_destroy(node->client);
-    node->database = NULL;
-    node->client = NULL;
-    node->connected = false;
+    wm_disconnect(node);
     pthread_mutex_unlock(&node->lock);
-    bson_destroy(bson_record);
+    bson_destroy(&bson_record);
     return -1;
   }
 
-  status = mongoc_collection_insert(collection, MONGOC_INSERT_NONE, bson_record,
-                                    NULL, &error);
+  if (node->batch_size > 0) {
+    if (c->bulk == NULL)
+      c->bulk = mongoc_collection_create_bulk_operation(
+          c->collection, /* ordered = */ false, /* write_concern = */ NULL);
+    if (c->bulk == NULL) {
+      ERROR("write_mongodb plugin: error creating bulk operation");
+      pthread_mutex_unlock(&node->lock);
+      bson_destroy(&bson_record);
+      return -1;
+    }
+
+    mongoc_bulk_operation_insert(c->bulk, &bson_record);
+    bson_destroy(&bson_record);
+
+    cdtime_t now = cdtime();
+    if (node->pending == 0)
+      node->pending_since = now;
+    node->pending++;
+
+    status = 0;
+    if ((node->pending >= node->batch_size) ||
+        ((node->batch_timeout > 0) &&
+         ((now - node->pending_since) >= node->batch_timeout)))
+      status = wm_flush_nolock(node);
+
+    pthread_mutex_unlock(&node->lock);
+    return status;
+  }
+
+  status = mongoc_collection_insert(c->collection, MONGOC_INSERT_NONE,
+                                    &bson_record, NULL, &error);
+  bson_destroy(&bson_record);
 
   if (!status) {
     ERROR("write_mongodb plugin: error inserting record: %s", error.message);
-    mongoc_database_destroy(node->database);
-    mongoc_client_destroy(node->client);
-    node->database = NULL;
-    node->client = NULL;
-    node->connected = false;
+    wm_disconnect(node);
     pthread_mutex_unlock(&node->lock);
-    bson_destroy(bson_record);
-    mongoc_collection_destroy(collection);
     return -1;
   }
 
-  /* free our resource as not to leak memory */
-  mongoc_collection_destroy(collection);
-
   pthread_mutex_unlock(&node->lock);
 
-  bson_destroy(bson_record);
-
   return 0;
 } /* }}} int wm_write */
 
+static int wm_flush(cdtime_t timeout, /* {{{ */
+                    const char *identifier __attribute__((unused)),
+                    user_data_t *ud) {
+  wm_node_t *node = ud->data;
+  int status = 0;
+
+  pthread_mutex_lock(&node->lock);
+  /* timeout == 0  => flush unconditionally */
+  if ((timeout == 0) || ((node->pending_since + timeout) <= cdtime()))
+    status = wm_flush_nolock(node);
+  pthread_mutex_unlock(&node->lock);
+
+  return status;
+} /* }}} int wm_flush */
+
 static void wm_config_free(void *ptr) /* {{{ */
 {
   wm_node_t *node = ptr;
@@ -287,13 +570,24 @@ static void wm_config_free(void *ptr) /* {{{ */
   if (node == NULL)
     return;
 
-  mongoc_database_destroy(node->database);
-  mongoc_client_destroy(node->client);
-  node->database = NULL;
-  node->client = NULL;
-  node->connected = false;
+  if (node->collections != NULL) {
+    wm_flush_nolock(node);
+    wm_disconnect(node);
+    c_avl_destroy(node->collections);
+  } else {
+    mongoc_database_destroy(node->database);
+    mongoc_client_destroy(node->client);
+  }
+  if (node->series != NULL) {
+    wm_series_clear(node);
+    c_avl_destroy(node->series);
+  }
 
   sfree(node->host);
+  sfree(node->db);
+  sfree(node->user);
+  sfree(node->passwd);
+  pthread_mutex_destroy(&node->lock);
   sfree(node);
 } /* }}} void wm_config_free */
 
@@ -313,13 +607,23 @@ static int wm_config_node(oconfig_item_t *ci) /* {{{ */
   }
   node->port = MONGOC_DEFAULT_PORT;
   node->store_rates = true;
+  node->batch_size = 0;
+  node->batch_timeout = 0;
+  node->time_series = false;
   pthread_mutex_init(&node->lock, /* attr = */ NULL);
 
+  node->collections =
+      c_avl_create((int (*)(const void *, const void *))strcmp);
+  node->series = c_avl_create((int (*)(const void *, const void *))strcmp);
+  if ((node->collections == NULL) || (node->series == NULL)) {
+    wm_config_free(node);
+    return ENOMEM;
+  }
+
   status = cf_util_get_string_buffer(ci, node->name, sizeof(node->name));
 
   if (status != 0) {
-    sfree(node->host);
-    sfree(node);
+    wm_config_free(node);
     return status;
   }
 
@@ -344,6 +648,12 @@ static int wm_config_node(oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_string(child, &node->user);
     else if (strcasecmp("Password", child->key) == 0)
       status = cf_util_get_string(child, &node->passwd);
+    else if (strcasecmp("BatchSize", child->key) == 0)
+      status = cf_util_get_int(child, &node->batch_size);
+    else if (strcasecmp("BatchTimeout", child->key) == 0)
+      status = cf_util_get_cdtime(child, &node->batch_timeout);
+    else if (strcasecmp("TimeSeries", child->key) == 0)
+      status = cf_util_get_boolean(child, &node->time_series);
     else
       WARNING("write_mongodb plugin: Ignoring unknown config option \"%s\".",
               child->key);
@@ -377,6 +687,9 @@ static int wm_config_node(oconfig_item_t *ci) /* {{{ */
                                    });
     INFO("write_mongodb plugin: registered write plugin %s %d", cb_name,
          status);
+
+    if ((status == 0) && (node->batch_size > 0))
+      plugin_register_flush(cb_name, wm_flush, &(user_data_t){.data = node});
   }
 
   if (status != 0)
@@ -27,7 +27,6 @@
 #include "collectd.h"
 
 #include "plugin.h"
-#include "utils/avltree/avltree.h"
 #include "utils/common/common.h"
 #include "utils_complain.h"
 #include "utils_time.h"
@@ -40,6 +39,10 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
+
 #ifndef PROMETHEUS_DEFAULT_STALENESS_DELTA
 #define PROMETHEUS_DEFAULT_STALENESS_DELTA TIME_T_TO_CDTIME_T_STATIC(300)
 #endif
@@ -57,14 +60,151 @@
 #define MHD_RESULT int
 #endif
 
-static c_avl_tree_t *metrics;
-static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
-
 static char *httpd_host = NULL;
 static unsigned short httpd_port = 9103;
 static struct MHD_Daemon *httpd;
 
 static cdtime_t staleness_delta = PROMETHEUS_DEFAULT_STALENESS_DELTA;
+static bool report_stats;
+
+/* prom_table_t is a chained hash table. Entries are embedded in the objects
+ * they index; callers walk the bucket returned by prom_table_bucket() and
+ * compare the hash and their key themselves. */
+typedef struct prom_entry_s {
+  struct prom_entry_s *next;
+  uint64_t hash;
+} prom_entry_t;
+
+typedef struct {
+  prom_entry_t **buckets;
+  size_t buckets_num; /* zero or a power of two */
+  size_t entries_num;
+} prom_table_t;
+
+#define PROM_CONTAINER(ptr, type, member)                                      \
+  ((type *)((char *)(ptr)-offsetof(type, member)))
+
+/* Label sets are shared by all metrics with the same labels, for example the
+ * "rx" and "tx" metrics of one interface. They are interned in "label_sets"
+ * and reference counted. */
+typedef struct {
+  prom_entry_t entry;
+  size_t refs;
+  Io__Prometheus__Client__LabelPair *label[3];
+  size_t n_label;
+  char *text; /* key0="value0",key1="value1" */
+} prom_label_set_t;
+
+static prom_table_t label_sets;
+static pthread_mutex_t label_sets_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Metrics and metric families are allocated with room for their pre-rendered
+ * text exposition, so scrapes only have to copy it. The protobuf message must
+ * be the first member, so that pointers to it can be converted back. */
+typedef struct {
+  Io__Prometheus__Client__Metric pb;
+  prom_entry_t entry; /* in the family's "metrics" table */
+  prom_label_set_t *labels;
+  size_t index; /* position in the family's "metric" array */
+  char *text;   /* name{labels} value [timestamp]\n */
+  size_t text_len;
+  size_t text_size;
+  size_t prefix_len; /* length of "name{labels} " */
+} prom_metric_t;
+
+typedef struct {
+  Io__Prometheus__Client__MetricFamily pb;
+  prom_entry_t entry; /* in the shard's "families" table */
+  prom_table_t metrics;
+  size_t metric_size; /* allocated size of the "metric" array */
+  char *header;       /* "# HELP" and "# TYPE" lines */
+  size_t header_len;
+} prom_family_t;
+
+/* Metric families are spread over a fixed number of shards by the hash of
+ * their name, so that write threads updating different families rarely wait
+ * for each other. "generation" is incremented whenever the shard changes;
+ * scrapes use the sum over all shards to tell whether a cached snapshot is
+ * still current. */
+typedef struct {
+  pthread_mutex_t lock;
+  prom_table_t families;
+  uint64_t generation;
+} prom_shard_t;
+
+#define PROM_SHARDS_NUM 16
+static prom_shard_t shards[PROM_SHARDS_NUM];
+
+/* A rendered exposition, shared by all scrapes until a shard changes. */
+typedef struct {
+  uint64_t generation;
+  char *data;
+  size_t len;
+  char *gzip_data; /* compressed on the first scrape which accepts gzip */
+  size_t gzip_len;
+} prom_snapshot_t;
+
+#define SNAPSHOT_TEXT 0
+#define SNAPSHOT_PROTO 1
+static prom_snapshot_t *snapshots[2];
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Scrape statistics, guarded by snapshot_lock. */
+static derive_t stats_scrapes;
+static derive_t stats_snapshots_reused;
+static cdtime_t stats_scrape_time;
+static uint64_t stats_scrape_num;
+static cdtime_t stats_render_time;
+static uint64_t stats_render_num;
+static size_t stats_response_bytes;
+
+/* prom_buffer_t is a growable buffer for both exposition formats. It
+ * implements ProtobufCBuffer, so messages can be packed into it directly. */
+typedef struct {
+  ProtobufCBuffer base;
+  char *data;
+  size_t len;
+  size_t size;
+  bool failed;
+} prom_buffer_t;
+
+static int prom_buffer_reserve(prom_buffer_t *b, size_t size) {
+  if (size <= b->size)
+    return 0;
+
+  char *tmp = realloc(b->data, size);
+  if (tmp == NULL) {
+    b->failed = true;
+    return ENOMEM;
+  }
+  b->data = tmp;
+  b->size = size;
+  return 0;
+}
+
+static void prom_buffer_append(ProtobufCBuffer *buffer, size_t len,
+                               uint8_t const *data) {
+  prom_buffer_t *b = (prom_buffer_t *)buffer;
+
+  if (b->failed)
+    return;
+
+  if ((b->len + len) > b->size) {
+    size_t size = (b->size > 0) ? b->size : 4096;
+    while (size < (b->len + len))
+      size *= 2;
+    if (prom_buffer_reserve(b, size) != 0)
+      return;
+  }
+
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+
+#define PROM_BUFFER_INIT                                                       \
+  {                                                                            \
+    .base = {.append = prom_buffer_append }                                    \
+  }
 
 /* Unfortunately, protoc-c doesn't export its implementation of varint, so we
  * need to implement our own. */
@@ -83,30 +223,26 @@ static size_t varint(uint8_t buffer[static VARINT_UINT32_BYTES],
   return 0;
 }
 
-/* format_protobuf iterates over all metric families in "metrics" and adds them
+/* format_protobuf iterates over all metric families in a shard and adds them
  * to a buffer in ProtoBuf format. It prefixes each protobuf with its encoded
- * size, the so called "delimited" format. */
-static void format_protobuf(ProtobufCBuffer *buffer) {
-  pthread_mutex_lock(&metrics_lock);
-
-  char *unused_name;
-  Io__Prometheus__Client__MetricFamily *fam;
-  c_avl_iterator_t *iter = c_avl_get_iterator(metrics);
-  while (c_avl_iterator_next(iter, (void *)&unused_name, (void *)&fam) == 0) {
-    /* Prometheus uses a message length prefix to determine where one
-     * MetricFamily ends and the next begins. This delimiter is encoded as a
-     * "varint", which is common in Protobufs. */
-    uint8_t delim[VARINT_UINT32_BYTES] = {0};
-    size_t delim_len = varint(
-        delim,
-        (uint32_t)io__prometheus__client__metric_family__get_packed_size(fam));
-    buffer->append(buffer, delim_len, delim);
-
-    io__prometheus__client__metric_family__pack_to_buffer(fam, buffer);
+ * size, the so called "delimited" format. The shard's lock must be held. */
+static void format_protobuf(ProtobufCBuffer *buffer, prom_shard_t const *shard) {
+  for (size_t i = 0; i < shard->families.buckets_num; i++) {
+    for (prom_entry_t *e = shard->families.buckets[i]; e != NULL; e = e->next) {
+      Io__Prometheus__Client__MetricFamily *fam =
+          &PROM_CONTAINER(e, prom_family_t, entry)->pb;
+      /* Prometheus uses a message length prefix to determine where one
+       * MetricFamily ends and the next begins. This delimiter is encoded as a
+       * "varint", which is common in Protobufs. */
+      uint8_t delim[VARINT_UINT32_BYTES] = {0};
+      size_t delim_len = varint(
+          delim, (uint32_t)io__prometheus__client__metric_family__get_packed_size(
+                     fam));
+      buffer->append(buffer, delim_len, delim);
+
+      io__prometheus__client__metric_family__pack_to_buffer(fam, buffer);
+    }
   }
-  c_avl_iterator_destroy(iter);
-
-  pthread_mutex_unlock(&metrics_lock);
 }
 
 static char const *escape_label_value(char *buffer, size_t buffer_size,
@@ -152,10 +288,11 @@ static char const *escape_label_value(char *buffer, size_t buffer_size,
  *   key0="value0",key1="value1"
  */
 static char *format_labels(char *buffer, size_t buffer_size,
-                           Io__Prometheus__Client__Metric const *m) {
+                           Io__Prometheus__Client__LabelPair *const *label,
+                           size_t n_label) {
   /* our metrics always have at least one and at most three labels. */
-  assert(m->n_label >= 1);
-  assert(m->n_label <= 3);
+  assert(n_label >= 1);
+  assert(n_label <= 3);
 
 #define LABEL_KEY_SIZE DATA_MAX_NAME_LEN
 #define LABEL_VALUE_SIZE (2 * DATA_MAX_NAME_LEN - 1)
@@ -169,68 +306,157 @@ static char *format_labels(char *buffer, size_t buffer_size,
 
   /* N.B.: the label *names* are hard-coded by this plugin and therefore we
    * know that they are sane. */
-  for (size_t i = 0; i < m->n_label; i++) {
+  for (size_t i = 0; i < n_label; i++) {
     char value[LABEL_VALUE_SIZE];
-    ssnprintf(labels[i], LABEL_BUFFER_SIZE, "%s=\"%s\"", m->label[i]->name,
-              escape_label_value(value, sizeof(value), m->label[i]->value));
+    ssnprintf(labels[i], LABEL_BUFFER_SIZE, "%s=\"%s\"", label[i]->name,
+              escape_label_value(value, sizeof(value), label[i]->value));
   }
 
-  strjoin(buffer, buffer_size, labels, m->n_label, ",");
+  strjoin(buffer, buffer_size, labels, n_label, ",");
   return buffer;
 }
 
-/* format_protobuf iterates over all metric families in "metrics" and adds them
- * to a buffer in plain text format. */
-static void format_text(ProtobufCBuffer *buffer) {
-  pthread_mutex_lock(&metrics_lock);
+/* format_text iterates over all metric families in a shard and adds their
+ * pre-rendered text exposition to a buffer. The shard's lock must be held. */
+static void format_text(ProtobufCBuffer *buffer, prom_shard_t const *shard) {
+  for (size_t i = 0; i < shard->families.buckets_num; i++) {
+    for (prom_entry_t *e = shard->families.buckets[i]; e != NULL; e = e->next) {
+      prom_family_t *pf = PROM_CONTAINER(e, prom_family_t, entry);
+      buffer->append(buffer, pf->header_len, (uint8_t *)pf->header);
+
+      for (size_t j = 0; j < pf->pb.n_metric; j++) {
+        prom_metric_t *pm = (prom_metric_t *)pf->pb.metric[j];
+        buffer->append(buffer, pm->text_len, (uint8_t *)pm->text);
+      }
+    }
+  }
+}
 
-  char *unused_name;
-  Io__Prometheus__Client__MetricFamily *fam;
-  c_avl_iterator_t *iter = c_avl_get_iterator(metrics);
-  while (c_avl_iterator_next(iter, (void *)&unused_name, (void *)&fam) == 0) {
-    char line[1024]; /* 4x DATA_MAX_NAME_LEN? */
+/* prom_generation returns the sum of all shard generations. Since each of them
+ * only ever increases, the sum changes whenever any shard changes. */
+static uint64_t prom_generation(void) {
+  uint64_t generation = 0;
+  for (size_t i = 0; i < PROM_SHARDS_NUM; i++) {
+    pthread_mutex_lock(&shards[i].lock);
+    generation += shards[i].generation;
+    pthread_mutex_unlock(&shards[i].lock);
+  }
+  return generation;
+}
 
-    ssnprintf(line, sizeof(line), "# HELP %s %s\n", fam->name, fam->help);
-    buffer->append(buffer, strlen(line), (uint8_t *)line);
+static void prom_snapshot_destroy(prom_snapshot_t *s) {
+  if (s == NULL)
+    return;
 
-    ssnprintf(line, sizeof(line), "# TYPE %s %s\n", fam->name,
-              (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE)
-                  ? "gauge"
-                  : "counter");
-    buffer->append(buffer, strlen(line), (uint8_t *)line);
+  sfree(s->data);
+  sfree(s->gzip_data);
+  sfree(s);
+}
 
-    for (size_t i = 0; i < fam->n_metric; i++) {
-      Io__Prometheus__Client__Metric *m = fam->metric[i];
+/* prom_snapshot_get returns the current snapshot in the requested format,
+ * rendering a new one if any shard has changed since the last one was taken.
+ * Shards are locked one at a time and only while their pre-rendered text is
+ * copied (or their protobufs are packed). snapshot_lock must be held by the
+ * caller. */
+static prom_snapshot_t *prom_snapshot_get(bool proto, bool *ret_reused) {
+  size_t idx = proto ? SNAPSHOT_PROTO : SNAPSHOT_TEXT;
+  prom_snapshot_t *prev = snapshots[idx];
+  prom_buffer_t buffer = PROM_BUFFER_INIT;
+
+  if ((prev != NULL) && (prev->generation == prom_generation())) {
+    *ret_reused = true;
+    return prev;
+  }
 
-      char labels[1024];
+  /* Size the buffer after the previous snapshot, so that it rarely needs to
+   * grow while a lock is held. */
+  if (prev != NULL)
+    prom_buffer_reserve(&buffer, prev->len + prev->len / 8);
+
+  cdtime_t start = cdtime();
+  uint64_t generation = 0;
+  for (size_t i = 0; i < PROM_SHARDS_NUM; i++) {
+    prom_shard_t *shard = shards + i;
+
+    pthread_mutex_lock(&shard->lock);
+    generation += shard->generation;
+    if (proto)
+      format_protobuf(&buffer.base, shard);
+    else
+      format_text(&buffer.base, shard);
+    pthread_mutex_unlock(&shard->lock);
+  }
 
-      char timestamp_ms[24] = "";
-      if (m->has_timestamp_ms)
-        ssnprintf(timestamp_ms, sizeof(timestamp_ms), " %" PRIi64,
-                  m->timestamp_ms);
+  stats_render_time += cdtime() - start;
+  stats_render_num++;
 
-      if (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE)
-        ssnprintf(line, sizeof(line), "%s{%s} " GAUGE_FORMAT "%s\n", fam->name,
-                  format_labels(labels, sizeof(labels), m), m->gauge->value,
-                  timestamp_ms);
-      else /* if (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__COUNTER) */
-        ssnprintf(line, sizeof(line), "%s{%s} %.0f%s\n", fam->name,
-                  format_labels(labels, sizeof(labels), m), m->counter->value,
-                  timestamp_ms);
+  if (!proto) {
+    char server[1024];
+    ssnprintf(server, sizeof(server), "\n# collectd/write_prometheus %s at %s\n",
+              PACKAGE_VERSION, hostname_g);
+    buffer.base.append(&buffer.base, strlen(server), (uint8_t *)server);
+  }
 
-      buffer->append(buffer, strlen(line), (uint8_t *)line);
-    }
+  prom_snapshot_t *s = NULL;
+  if (!buffer.failed)
+    s = calloc(1, sizeof(*s));
+  if (s == NULL) {
+    ERROR("write_prometheus plugin: Rendering the exposition failed.");
+    sfree(buffer.data);
+    return NULL;
   }
-  c_avl_iterator_destroy(iter);
 
-  char server[1024];
-  ssnprintf(server, sizeof(server), "\n# collectd/write_prometheus %s at %s\n",
-            PACKAGE_VERSION, hostname_g);
-  buffer->append(buffer, strlen(server), (uint8_t *)server);
+  s->generation = generation;
+  s->data = buffer.data;
+  s->len = buffer.len;
 
-  pthread_mutex_unlock(&metrics_lock);
+  prom_snapshot_destroy(prev);
+  snapshots[idx] = s;
+  *ret_reused = false;
+  return s;
 }
 
+#if HAVE_LIBZ
+/* prom_snapshot_compress gzips a snapshot unless that has been done before.
+ * snapshot_lock must be held. */
+static int prom_snapshot_compress(prom_snapshot_t *s) {
+  if (s->gzip_data != NULL)
+    return 0;
+
+  z_stream z = {0};
+  /* 15 window bits, plus 16 for a gzip header and trailer. */
+  if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    ERROR("write_prometheus plugin: deflateInit2 failed.");
+    return -1;
+  }
+
+  size_t size = deflateBound(&z, s->len);
+  char *out = malloc(size);
+  if (out == NULL) {
+    deflateEnd(&z);
+    return ENOMEM;
+  }
+
+  z.next_in = (Bytef *)s->data;
+  z.avail_in = (uInt)s->len;
+  z.next_out = (Bytef *)out;
+  z.avail_out = (uInt)size;
+
+  int status = deflate(&z, Z_FINISH);
+  deflateEnd(&z);
+  if (status != Z_STREAM_END) {
+    ERROR("write_prometheus plugin: deflate failed with status %i.", status);
+    sfree(out);
+    return -1;
+  }
+
+  s->gzip_data = out;
+  s->gzip_len = (size_t)z.total_out;
+  return 0;
+}
+#endif
+
 /* http_handler is the callback called by the microhttpd library. It essentially
  * handles all HTTP request aspects and creates an HTTP response. */
 static MHD_RESULT http_handler(void *cls, struct MHD_Connection *connection,
@@ -256,38 +482,76 @@ static MHD_RESULT http_handler(void *cls, struct MHD_Connection *connection,
   bool want_proto = (accept != NULL) &&
                     (strstr(accept, "application/vnd.google.protobuf") != NULL);
 
-  uint8_t scratch[4096] = {0};
-  ProtobufCBufferSimple simple = PROTOBUF_C_BUFFER_SIMPLE_INIT(scratch);
-  ProtobufCBuffer *buffer = (ProtobufCBuffer *)&simple;
+#if HAVE_LIBZ
+  char const *accept_encoding = MHD_lookup_connection_value(
+      connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_ACCEPT_ENCODING);
+  bool want_gzip =
+      (accept_encoding != NULL) && (strstr(accept_encoding, "gzip") != NULL);
+#endif
+
+  cdtime_t start = cdtime();
+  pthread_mutex_lock(&snapshot_lock);
 
-  if (want_proto)
-    format_protobuf(buffer);
-  else
-    format_text(buffer);
+  bool reused = false;
+  prom_snapshot_t *s = prom_snapshot_get(want_proto, &reused);
+  if (s == NULL) {
+    pthread_mutex_unlock(&snapshot_lock);
+    return MHD_NO;
+  }
 
+  char *body = s->data;
+  size_t body_len = s->len;
+#if HAVE_LIBZ
+  bool gzipped = false;
+  if (want_gzip && (prom_snapshot_compress(s) == 0)) {
+    body = s->gzip_data;
+    body_len = s->gzip_len;
+    gzipped = true;
+  }
+#endif
+
+  /* The snapshot may be replaced as soon as the lock is released, so the
+   * response gets a copy. */
 #if defined(MHD_VERSION) && MHD_VERSION >= 0x00090500
-  struct MHD_Response *res = MHD_create_response_from_buffer(
-      simple.len, simple.data, MHD_RESPMEM_MUST_COPY);
+  struct MHD_Response *res =
+      MHD_create_response_from_buffer(body_len, body, MHD_RESPMEM_MUST_COPY);
 #else
   struct MHD_Response *res = MHD_create_response_from_data(
-      simple.len, simple.data, /* must_free = */ 0, /* must_copy = */ 1);
+      body_len, body, /* must_free = */ 0, /* must_copy = */ 1);
 #endif
+
+  stats_scrapes++;
+  if (reused)
+    stats_snapshots_reused++;
+  stats_response_bytes = body_len;
+  stats_scrape_time += cdtime() - start;
+  stats_scrape_num++;
+
+  pthread_mutex_unlock(&snapshot_lock);
+
+  if (res == NULL)
+    return MHD_NO;
+
   MHD_add_response_header(res, MHD_HTTP_HEADER_CONTENT_TYPE,
                           want_proto ? CONTENT_TYPE_PROTO : CONTENT_TYPE_TEXT);
+#if HAVE_LIBZ
+  MHD_add_response_header(res, MHD_HTTP_HEADER_VARY,
+                          MHD_HTTP_HEADER_ACCEPT_ENCODING);
+  if (gzipped)
+    MHD_add_response_header(res, MHD_HTTP_HEADER_CONTENT_ENCODING, "gzip");
+#endif
 
   MHD_RESULT status = MHD_queue_response(connection, MHD_HTTP_OK, res);
 
   MHD_destroy_response(res);
-  PROTOBUF_C_BUFFER_SIMPLE_CLEAR(&simple);
   return status;
 }
 
 /*
- * Functions for manipulating the global state in "metrics". This is organized
- * in two tiers: the global "metrics" tree holds "metric families", which are
- * identified by a name (a string). Each metric family has one or more
- * "metrics", which are identified by a unique set of key-value-pairs. For
- * example:
+ * Functions for manipulating the global state in "shards". This is organized
+ * in two tiers: the shards hold "metric families", which are identified by a
+ * name (a string). Each metric family has one or more "metrics", which are
+ * identified by a unique set of key-value-pairs. For example:
  *
  * collectd_cpu_total
  *   {cpu="0",type="idle"}
@@ -297,7 +561,83 @@ static MHD_RESULT http_handler(void *cls, struct MHD_Connection *connection,
  *   {memory="used"}
  *   {memory="free"}
  *   ...
+ *
+ * Both tiers are indexed by hash tables, so looking up the metric for an
+ * incoming value does not depend on the number of families or metrics.
  * {{{ */
+#define PROM_HASH_INIT UINT64_C(14695981039346656037)
+
+/* prom_hash adds a string to an FNV-1a hash. The terminating null byte is
+ * hashed, too, so that {"ab", "c"} and {"a", "bc"} hash differently. */
+static uint64_t prom_hash(uint64_t hash, char const *str) {
+  do {
+    hash ^= (uint8_t)*str;
+    hash *= UINT64_C(1099511628211);
+  } while (*str++ != 0);
+  return hash;
+}
+
+/* prom_table_bucket returns the first entry of the bucket "hash" maps to. */
+static prom_entry_t *prom_table_bucket(prom_table_t const *t, uint64_t hash) {
+  if (t->buckets_num == 0)
+    return NULL;
+  return t->buckets[hash & (t->buckets_num - 1)];
+}
+
+/* prom_table_insert adds an entry, doubling the number of buckets once there
+ * are more entries than buckets. */
+static int prom_table_insert(prom_table_t *t, prom_entry_t *e) {
+  if (t->entries_num >= t->buckets_num) {
+    size_t buckets_num = (t->buckets_num == 0) ? 8 : 2 * t->buckets_num;
+    prom_entry_t **buckets = calloc(buckets_num, sizeof(*buckets));
+    if (buckets == NULL)
+      return ENOMEM;
+
+    for (size_t i = 0; i < t->buckets_num; i++) {
+      while (t->buckets[i] != NULL) {
+        prom_entry_t *moved = t->buckets[i];
+        t->buckets[i] = moved->next;
+
+        size_t idx = moved->hash & (buckets_num - 1);
+        moved->next = buckets[idx];
+        buckets[idx] = moved;
+      }
+    }
+
+    sfree(t->buckets);
+    t->buckets = buckets;
+    t->buckets_num = buckets_num;
+  }
+
+  size_t idx = e->hash & (t->buckets_num - 1);
+  e->next = t->buckets[idx];
+  t->buckets[idx] = e;
+  t->entries_num++;
+  return 0;
+}
+
+/* prom_table_remove unlinks an entry from the table. */
+static void prom_table_remove(prom_table_t *t, prom_entry_t *e) {
+  if (t->buckets_num == 0)
+    return;
+
+  for (prom_entry_t **p = &t->buckets[e->hash & (t->buckets_num - 1)];
+       *p != NULL; p = &(*p)->next) {
+    if (*p == e) {
+      *p = e->next;
+      e->next = NULL;
+      t->entries_num--;
+      return;
+    }
+  }
+}
+
+/* prom_shard returns the shard responsible for the family with the given name
+ * hash. The upper bits are used, because the lower ones select the bucket. */
+static prom_shard_t *prom_shard(uint64_t hash) {
+  return shards + ((hash >> 32) % PROM_SHARDS_NUM);
+}
+
 /* label_pair_destroy frees the memory used by a label pair. */
 static void label_pair_destroy(Io__Prometheus__Client__LabelPair *msg) {
   if (msg == NULL)
@@ -327,72 +667,6 @@ label_pair_clone(Io__Prometheus__Client__LabelPair const *orig) {
   return copy;
 }
 
-/* metric_destroy frees the memory used by a metric. */
-static void metric_destroy(Io__Prometheus__Client__Metric *msg) {
-  if (msg == NULL)
-    return;
-
-  for (size_t i = 0; i < msg->n_label; i++) {
-    label_pair_destroy(msg->label[i]);
-  }
-  sfree(msg->label);
-
-  sfree(msg->gauge);
-  sfree(msg->counter);
-
-  sfree(msg);
-}
-
-/* metric_cmp compares two metrics. It's prototype makes it easy to use with
- * qsort(3) and bsearch(3). */
-static int metric_cmp(void const *a, void const *b) {
-  Io__Prometheus__Client__Metric const *m_a =
-      *((Io__Prometheus__Client__Metric **)a);
-  Io__Prometheus__Client__Metric const *m_b =
-      *((Io__Prometheus__Client__Metric **)b);
-
-  if (m_a->n_label < m_b->n_label)
-    return -1;
-  else if (m_a->n_label > m_b->n_label)
-    return 1;
-
-  /* Prometheus does not care about the order of labels. All labels in this
-   * plugin are created by METRIC_ADD_LABELS(), though, and therefore always
-   * appear in the same order. We take advantage of this and simplify the check
-   * by making sure all labels are the same in each position.
-   *
-   * We also only need to check the label values, because the label names are
-   * the same for all metrics in a metric family.
-   *
-   * 3 labels:
-   * [0] $plugin="$plugin_instance" => $plugin is the same within a family
-   * [1] type="$type_instance"      => "type" is a static string
-   * [2] instance="$host"           => "instance" is a static string
-   *
-   * 2 labels, variant 1:
-   * [0] $plugin="$plugin_instance" => $plugin is the same within a family
-   * [1] instance="$host"           => "instance" is a static string
-   *
-   * 2 labels, variant 2:
-   * [0] $plugin="$type_instance"   => $plugin is the same within a family
-   * [1] instance="$host"           => "instance" is a static string
-   *
-   * 1 label:
-   * [1] instance="$host"           => "instance" is a static string
-   */
-  for (size_t i = 0; i < m_a->n_label; i++) {
-    int status = strcmp(m_a->label[i]->value, m_b->label[i]->value);
-    if (status != 0)
-      return status;
-
-#if COLLECT_DEBUG
-    assert(strcmp(m_a->label[i]->name, m_b->label[i]->name) == 0);
-#endif
-  }
-
-  return 0;
-}
-
 #define METRIC_INIT                                                            \
   &(Io__Prometheus__Client__Metric) {                                          \
     .label =                                                                   \
@@ -431,30 +705,208 @@ static int metric_cmp(void const *a, void const *b) {
     (m)->n_label++;                                                            \
   } while (0)
 
-/* metric_clone allocates and initializes a new metric based on orig. */
-static Io__Prometheus__Client__Metric *
-metric_clone(Io__Prometheus__Client__Metric const *orig) {
-  Io__Prometheus__Client__Metric *copy = calloc(1, sizeof(*copy));
-  if (copy == NULL)
-    return NULL;
-  io__prometheus__client__metric__init(copy);
+/* metric_labels_hash hashes the labels of a metric created with METRIC_INIT
+ * and METRIC_ADD_LABELS(). All data sources of a value list share the same
+ * labels, so this is done once per value list. */
+static uint64_t metric_labels_hash(Io__Prometheus__Client__Metric const *m) {
+  uint64_t hash = PROM_HASH_INIT;
+  for (size_t i = 0; i < m->n_label; i++) {
+    hash = prom_hash(hash, m->label[i]->name);
+    hash = prom_hash(hash, m->label[i]->value);
+  }
+  return hash;
+}
+
+/* label_set_equal returns true if the label set has the same labels as m.
+ * Prometheus does not care about the order of labels. All labels in this
+ * plugin are created by METRIC_ADD_LABELS(), though, and therefore always
+ * appear in the same order. */
+static bool label_set_equal(prom_label_set_t const *ls,
+                            Io__Prometheus__Client__Metric const *m) {
+  if (ls->n_label != m->n_label)
+    return false;
+
+  for (size_t i = 0; i < ls->n_label; i++) {
+    if ((strcmp(ls->label[i]->value, m->label[i]->value) != 0) ||
+        (strcmp(ls->label[i]->name, m->label[i]->name) != 0))
+      return false;
+  }
+
+  return true;
+}
+
+static void label_set_destroy(prom_label_set_t *ls) {
+  if (ls == NULL)
+    return;
+
+  for (size_t i = 0; i < ls->n_label; i++)
+    label_pair_destroy(ls->label[i]);
+  sfree(ls->text);
+  sfree(ls);
+}
+
+/* label_set_get returns the interned label set with the same labels as m,
+ * creating it if necessary. The caller owns a reference and must release it
+ * with label_set_release(). */
+static prom_label_set_t *
+label_set_get(Io__Prometheus__Client__Metric const *m, uint64_t hash) {
+  pthread_mutex_lock(&label_sets_lock);
+
+  for (prom_entry_t *e = prom_table_bucket(&label_sets, hash); e != NULL;
+       e = e->next) {
+    prom_label_set_t *ls = PROM_CONTAINER(e, prom_label_set_t, entry);
+    if ((e->hash == hash) && label_set_equal(ls, m)) {
+      ls->refs++;
+      pthread_mutex_unlock(&label_sets_lock);
+      return ls;
+    }
+  }
 
-  copy->n_label = orig->n_label;
-  copy->label = calloc(copy->n_label, sizeof(*copy->label));
-  if (copy->label == NULL) {
-    sfree(copy);
+  prom_label_set_t *ls = calloc(1, sizeof(*ls));
+  if (ls == NULL) {
+    pthread_mutex_unlock(&label_sets_lock);
     return NULL;
   }
+  ls->entry.hash = hash;
+  ls->refs = 1;
 
-  for (size_t i = 0; i < copy->n_label; i++) {
-    copy->label[i] = label_pair_clone(orig->label[i]);
-    if (copy->label[i] == NULL) {
-      metric_destroy(copy);
+  for (size_t i = 0; i < m->n_label; i++) {
+    ls->label[i] = label_pair_clone(m->label[i]);
+    if (ls->label[i] == NULL) {
+      label_set_destroy(ls);
+      pthread_mutex_unlock(&label_sets_lock);
       return NULL;
     }
+    ls->n_label++;
   }
 
-  return copy;
+  char labels[1024];
+  ls->text = strdup(format_labels(labels, sizeof(labels), ls->label,
+                                  ls->n_label));
+  if ((ls->text == NULL) || (prom_table_insert(&label_sets, &ls->entry) != 0)) {
+    label_set_destroy(ls);
+    pthread_mutex_unlock(&label_sets_lock);
+    return NULL;
+  }
+
+  pthread_mutex_unlock(&label_sets_lock);
+  return ls;
+}
+
+/* label_set_release drops a reference, freeing the set with the last one. */
+static void label_set_release(prom_label_set_t *ls) {
+  if (ls == NULL)
+    return;
+
+  pthread_mutex_lock(&label_sets_lock);
+  ls->refs--;
+  if (ls->refs > 0) {
+    pthread_mutex_unlock(&label_sets_lock);
+    return;
+  }
+  prom_table_remove(&label_sets, &ls->entry);
+  pthread_mutex_unlock(&label_sets_lock);
+
+  label_set_destroy(ls);
+}
+
+/* metric_destroy frees the memory used by a metric. The labels belong to the
+ * interned label set. */
+static void metric_destroy(Io__Prometheus__Client__Metric *msg) {
+  if (msg == NULL)
+    return;
+
+  prom_metric_t *pm = (prom_metric_t *)msg;
+
+  sfree(msg->gauge);
+  sfree(msg->counter);
+
+  label_set_release(pm->labels);
+  sfree(pm->text);
+  sfree(pm);
+}
+
+/* metric_create allocates and initializes a new metric with the labels of
+ * key. */
+static Io__Prometheus__Client__Metric *
+metric_create(Io__Prometheus__Client__Metric const *key, uint64_t hash) {
+  prom_metric_t *pm = calloc(1, sizeof(*pm));
+  if (pm == NULL)
+    return NULL;
+  io__prometheus__client__metric__init(&pm->pb);
+
+  pm->labels = label_set_get(key, hash);
+  if (pm->labels == NULL) {
+    sfree(pm);
+    return NULL;
+  }
+  pm->entry.hash = hash;
+
+  pm->pb.label = pm->labels->label;
+  pm->pb.n_label = pm->labels->n_label;
+
+  return &pm->pb;
+}
+
+/* metric_render_prefix renders the part of a metric's text exposition which
+ * never changes, i.e. the family name and the labels. */
+static int metric_render_prefix(prom_metric_t *pm, char const *name) {
+  size_t name_len = strlen(name);
+  size_t labels_len = strlen(pm->labels->text);
+
+  /* name{labels}<space> */
+  size_t prefix_len = name_len + labels_len + 3;
+  size_t size = prefix_len + 64;
+  char *text = malloc(size);
+  if (text == NULL)
+    return ENOMEM;
+
+  memcpy(text, name, name_len);
+  text[name_len] = '{';
+  memcpy(text + name_len + 1, pm->labels->text, labels_len);
+  memcpy(text + name_len + 1 + labels_len, "} ", 2);
+
+  sfree(pm->text);
+  pm->text = text;
+  pm->text_size = size;
+  pm->prefix_len = prefix_len;
+  /* Not exposed until a value has been rendered. */
+  pm->text_len = 0;
+  return 0;
+}
+
+/* metric_render_value renders the metric's current value and timestamp after
+ * the prefix. */
+static int metric_render_value(prom_metric_t *pm) {
+  Io__Prometheus__Client__Metric const *m = &pm->pb;
+  /* "%.0f" prints up to 309 digits for large doubles. */
+  char value[400];
+
+  char timestamp_ms[24] = "";
+  if (m->has_timestamp_ms)
+    ssnprintf(timestamp_ms, sizeof(timestamp_ms), " %" PRIi64,
+              m->timestamp_ms);
+
+  if (m->gauge != NULL)
+    ssnprintf(value, sizeof(value), GAUGE_FORMAT "%s\n", m->gauge->value,
+              timestamp_ms);
+  else /* if (m->counter != NULL) */
+    ssnprintf(value, sizeof(value), "%.0f%s\n", m->counter->value,
+              timestamp_ms);
+
+  size_t value_len = strlen(value);
+  if ((pm->prefix_len + value_len) > pm->text_size) {
+    size_t size = pm->prefix_len + value_len;
+    char *tmp = realloc(pm->text, size);
+    if (tmp == NULL)
+      return ENOMEM;
+    pm->text = tmp;
+    pm->text_size = size;
+  }
+
+  memcpy(pm->text + pm->prefix_len, value, value_len);
+  pm->text_len = pm->prefix_len + value_len;
+  return 0;
 }
 
 /* metric_update stores the new value and timestamp in m. */
@@ -517,57 +969,72 @@ static int metric_update(Io__Prometheus__Client__Metric *m, value_t value,
   return 0;
 }
 
-/* metric_family_add_metric adds m to the metric list of fam. */
+/* metric_family_add_metric adds m to the metric list and the index of fam. */
 static int metric_family_add_metric(Io__Prometheus__Client__MetricFamily *fam,
                                     Io__Prometheus__Client__Metric *m) {
-  Io__Prometheus__Client__Metric **tmp =
-      realloc(fam->metric, (fam->n_metric + 1) * sizeof(*fam->metric));
-  if (tmp == NULL)
-    return ENOMEM;
-  fam->metric = tmp;
+  prom_family_t *pf = (prom_family_t *)fam;
+  prom_metric_t *pm = (prom_metric_t *)m;
+
+  if (fam->n_metric >= pf->metric_size) {
+    size_t size = (pf->metric_size == 0) ? 8 : 2 * pf->metric_size;
+    Io__Prometheus__Client__Metric **tmp =
+        realloc(fam->metric, size * sizeof(*fam->metric));
+    if (tmp == NULL)
+      return ENOMEM;
+    fam->metric = tmp;
+    pf->metric_size = size;
+  }
 
+  int status = prom_table_insert(&pf->metrics, &pm->entry);
+  if (status != 0)
+    return status;
+
+  pm->index = fam->n_metric;
   fam->metric[fam->n_metric] = m;
   fam->n_metric++;
 
-  /* Sort the metrics so that lookup is fast. */
-  qsort(fam->metric, fam->n_metric, sizeof(*fam->metric), metric_cmp);
-
   return 0;
 }
 
-/* metric_family_delete_metric looks up and deletes the metric corresponding to
- * vl. */
-static int
-metric_family_delete_metric(Io__Prometheus__Client__MetricFamily *fam,
-                            value_list_t const *vl) {
-  Io__Prometheus__Client__Metric *key = METRIC_INIT;
-  METRIC_ADD_LABELS(key, vl);
-
-  size_t i;
-  for (i = 0; i < fam->n_metric; i++) {
-    if (metric_cmp(&key, &fam->metric[i]) == 0)
-      break;
+/* metric_family_find looks up the metric with the labels of key. */
+static prom_metric_t *
+metric_family_find(Io__Prometheus__Client__MetricFamily const *fam,
+                   Io__Prometheus__Client__Metric const *key, uint64_t hash) {
+  prom_family_t const *pf = (prom_family_t const *)fam;
+
+  for (prom_entry_t *e = prom_table_bucket(&pf->metrics, hash); e != NULL;
+       e = e->next) {
+    prom_metric_t *pm = PROM_CONTAINER(e, prom_metric_t, entry);
+    if ((e->hash == hash) && label_set_equal(pm->labels, key))
+      return pm;
   }
 
-  if (i >= fam->n_metric)
+  return NULL;
+}
+
+/* metric_family_delete_metric looks up and deletes the metric with the labels
+ * of key. The last metric takes its place, so the order of metrics within a
+ * family is not stable. */
+static int
+metric_family_delete_metric(Io__Prometheus__Client__MetricFamily *fam,
+                            Io__Prometheus__Client__Metric const *key,
+                            uint64_t hash) {
+  prom_family_t *pf = (prom_family_t *)fam;
+  prom_metric_t *pm = metric_family_find(fam, key, hash);
+  if (pm == NULL)
     return ENOENT;
 
-  metric_destroy(fam->metric[i]);
-  if ((fam->n_metric - 1) > i)
-    memmove(&fam->metric[i], &fam->metric[i + 1],
-            ((fam->n_metric - 1) - i) * sizeof(fam->metric[i]));
-  fam->n_metric--;
+  prom_table_remove(&pf->metrics, &pm->entry);
 
-  if (fam->n_metric == 0) {
-    sfree(fam->metric);
-    return 0;
+  size_t last = fam->n_metric - 1;
+  if (pm->index != last) {
+    fam->metric[pm->index] = fam->metric[last];
+    ((prom_metric_t *)fam->metric[pm->index])->index = pm->index;
   }
+  fam->metric[last] = NULL;
+  fam->n_metric--;
 
-  Io__Prometheus__Client__Metric **tmp =
-      realloc(fam->metric, fam->n_metric * sizeof(*fam->metric));
-  if (tmp != NULL)
-    fam->metric = tmp;
-
+  metric_destroy(&pm->pb);
   return 0;
 }
 
@@ -575,23 +1042,21 @@ metric_family_delete_metric(Io__Prometheus__Client__MetricFamily *fam,
  * allocating it if necessary. */
 static Io__Prometheus__Client__Metric *
 metric_family_get_metric(Io__Prometheus__Client__MetricFamily *fam,
-                         value_list_t const *vl) {
-  Io__Prometheus__Client__Metric *key = METRIC_INIT;
-  METRIC_ADD_LABELS(key, vl);
-
-  /* Metrics are sorted in metric_family_add_metric() so that we can do a binary
-   * search here. */
-  Io__Prometheus__Client__Metric **m = bsearch(
-      &key, fam->metric, fam->n_metric, sizeof(*fam->metric), metric_cmp);
-
-  if (m != NULL) {
-    return *m;
-  }
+                         Io__Prometheus__Client__Metric const *key,
+                         uint64_t hash) {
+  prom_metric_t *pm = metric_family_find(fam, key, hash);
+  if (pm != NULL)
+    return &pm->pb;
 
-  Io__Prometheus__Client__Metric *new_metric = metric_clone(key);
+  Io__Prometheus__Client__Metric *new_metric = metric_create(key, hash);
   if (new_metric == NULL)
     return NULL;
 
+  if (metric_render_prefix((prom_metric_t *)new_metric, fam->name) != 0) {
+    metric_destroy(new_metric);
+    return NULL;
+  }
+
   DEBUG("write_prometheus plugin: created new metric in family");
   int status = metric_family_add_metric(fam, new_metric);
   if (status != 0) {
@@ -606,13 +1071,19 @@ metric_family_get_metric(Io__Prometheus__Client__MetricFamily *fam,
  * allocating it if necessary, and updates the metric to the latest value. */
 static int metric_family_update(Io__Prometheus__Client__MetricFamily *fam,
                                 data_set_t const *ds, value_list_t const *vl,
-                                size_t ds_index) {
-  Io__Prometheus__Client__Metric *m = metric_family_get_metric(fam, vl);
+                                size_t ds_index,
+                                Io__Prometheus__Client__Metric const *key,
+                                uint64_t hash) {
+  Io__Prometheus__Client__Metric *m = metric_family_get_metric(fam, key, hash);
   if (m == NULL)
     return -1;
 
-  return metric_update(m, vl->values[ds_index], ds->ds[ds_index].type, vl->time,
-                       vl->interval);
+  int status = metric_update(m, vl->values[ds_index], ds->ds[ds_index].type,
+                             vl->time, vl->interval);
+  if (status != 0)
+    return status;
+
+  return metric_render_value((prom_metric_t *)m);
 }
 
 /* metric_family_destroy frees the memory used by a metric family. */
@@ -620,6 +1091,8 @@ static void metric_family_destroy(Io__Prometheus__Client__MetricFamily *msg) {
   if (msg == NULL)
     return;
 
+  prom_family_t *pf = (prom_family_t *)msg;
+
   sfree(msg->name);
   sfree(msg->help);
 
@@ -627,17 +1100,20 @@ static void metric_family_destroy(Io__Prometheus__Client__MetricFamily *msg) {
     metric_destroy(msg->metric[i]);
   }
   sfree(msg->metric);
+  sfree(pf->metrics.buckets);
 
-  sfree(msg);
+  sfree(pf->header);
+  sfree(pf);
 }
 
 /* metric_family_create allocates and initializes a new metric family. */
 static Io__Prometheus__Client__MetricFamily *
 metric_family_create(char *name, data_set_t const *ds, value_list_t const *vl,
                      size_t ds_index) {
-  Io__Prometheus__Client__MetricFamily *msg = calloc(1, sizeof(*msg));
-  if (msg == NULL)
+  prom_family_t *pf = calloc(1, sizeof(*pf));
+  if (pf == NULL)
     return NULL;
+  Io__Prometheus__Client__MetricFamily *msg = &pf->pb;
   io__prometheus__client__metric_family__init(msg);
 
   msg->name = name;
@@ -655,6 +1131,22 @@ metric_family_create(char *name, data_set_t const *ds, value_list_t const *vl,
                   : IO__PROMETHEUS__CLIENT__METRIC_TYPE__COUNTER;
   msg->has_type = 1;
 
+  char header[2048];
+  ssnprintf(header, sizeof(header), "# HELP %s %s\n# TYPE %s %s\n", name,
+            (msg->help != NULL) ? msg->help : "",
+            name,
+            (msg->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE)
+                ? "gauge"
+                : "counter");
+  pf->header = strdup(header);
+  if ((msg->help == NULL) || (pf->header == NULL)) {
+    /* "name" is still owned by the caller. */
+    msg->name = NULL;
+    metric_family_destroy(msg);
+    return NULL;
+  }
+  pf->header_len = strlen(pf->header);
+
   return msg;
 }
 
@@ -663,7 +1155,8 @@ metric_family_create(char *name, data_set_t const *ds, value_list_t const *vl,
  * compatibility. In essence, the plugin, type and data source name go in the
  * metric family name, while hostname, plugin instance and type instance go into
  * the labels of a metric. */
-static char *metric_family_name(data_set_t const *ds, value_list_t const *vl,
+static char *metric_family_name(char *buffer, size_t buffer_size,
+                                data_set_t const *ds, value_list_t const *vl,
                                 size_t ds_index) {
   char const *fields[5] = {"collectd"};
   size_t fields_num = 1;
@@ -688,47 +1181,47 @@ static char *metric_family_name(data_set_t const *ds, value_list_t const *vl,
     fields_num++;
   }
 
-  char name[5 * DATA_MAX_NAME_LEN];
-  strjoin(name, sizeof(name), (char **)fields, fields_num, "_");
-  return strdup(name);
+  strjoin(buffer, buffer_size, (char **)fields, fields_num, "_");
+  return buffer;
 }
 
-/* metric_family_get looks up the matching metric family, allocating it if
- * necessary. */
+/* metric_family_get looks up the metric family with the given name in its
+ * shard, allocating it if necessary. The shard's lock must be held. */
 static Io__Prometheus__Client__MetricFamily *
-metric_family_get(data_set_t const *ds, value_list_t const *vl, size_t ds_index,
+metric_family_get(prom_shard_t *shard, char const *name, uint64_t hash,
+                  data_set_t const *ds, value_list_t const *vl, size_t ds_index,
                   bool allocate) {
-  char *name = metric_family_name(ds, vl, ds_index);
-  if (name == NULL) {
-    ERROR("write_prometheus plugin: Allocating metric family name failed.");
-    return NULL;
+  for (prom_entry_t *e = prom_table_bucket(&shard->families, hash); e != NULL;
+       e = e->next) {
+    prom_family_t *pf = PROM_CONTAINER(e, prom_family_t, entry);
+    if ((e->hash == hash) && (strcmp(pf->pb.name, name) == 0))
+      return &pf->pb;
   }
 
-  Io__Prometheus__Client__MetricFamily *fam = NULL;
-  if (c_avl_get(metrics, name, (void *)&fam) == 0) {
-    sfree(name);
-    assert(fam != NULL);
-    return fam;
-  }
+  if (!allocate)
+    return NULL;
 
-  if (!allocate) {
-    sfree(name);
+  char *name_copy = strdup(name);
+  if (name_copy == NULL) {
+    ERROR("write_prometheus plugin: Allocating metric family name failed.");
     return NULL;
   }
 
-  fam = metric_family_create(name, ds, vl, ds_index);
+  Io__Prometheus__Client__MetricFamily *fam =
+      metric_family_create(name_copy, ds, vl, ds_index);
   if (fam == NULL) {
     ERROR("write_prometheus plugin: Allocating metric family failed.");
-    sfree(name);
+    sfree(name_copy);
     return NULL;
   }
 
-  /* If successful, "name" is owned by "fam", i.e. don't free it here. */
+  /* If successful, "name_copy" is owned by "fam", i.e. don't free it here. */
   DEBUG("write_prometheus plugin: metric family \"%s\" has been created.",
         name);
-  name = NULL;
 
-  int status = c_avl_insert(metrics, fam->name, fam);
+  prom_family_t *pf = (prom_family_t *)fam;
+  pf->entry.hash = hash;
+  int status = prom_table_insert(&shard->families, &pf->entry);
   if (status != 0) {
     ERROR("write_prometheus plugin: Adding \"%s\" failed.", fam->name);
     metric_family_destroy(fam);
@@ -883,6 +1376,8 @@ static int prom_config(oconfig_item_t *ci) {
         httpd_port = (unsigned short)status;
     } else if (strcasecmp("StalenessDelta", child->key) == 0) {
       cf_util_get_cdtime(child, &staleness_delta);
+    } else if (strcasecmp("ReportStats", child->key) == 0) {
+      cf_util_get_boolean(child, &report_stats);
     } else {
       WARNING("write_prometheus plugin: Ignoring unknown configuration option "
               "\"%s\".",
@@ -893,15 +1388,51 @@ static int prom_config(oconfig_item_t *ci) {
   return 0;
 }
 
-static int prom_init() {
-  if (metrics == NULL) {
-    metrics = c_avl_create((void *)strcmp);
-    if (metrics == NULL) {
-      ERROR("write_prometheus plugin: c_avl_create() failed.");
-      return -1;
-    }
-  }
+static void prom_submit(char const *type, char const *type_instance,
+                        value_t value) {
+  value_list_t vl = VALUE_LIST_INIT;
+
+  vl.values = &value;
+  vl.values_len = 1;
+  sstrncpy(vl.plugin, "write_prometheus", sizeof(vl.plugin));
+  sstrncpy(vl.type, type, sizeof(vl.type));
+  sstrncpy(vl.type_instance, type_instance, sizeof(vl.type_instance));
+
+  plugin_dispatch_values(&vl);
+}
 
+/* prom_read dispatches statistics about the scrapes since the last call. */
+static int prom_read() {
+  pthread_mutex_lock(&snapshot_lock);
+  derive_t scrapes = stats_scrapes;
+  derive_t reused = stats_snapshots_reused;
+  gauge_t response_bytes = (gauge_t)stats_response_bytes;
+
+  gauge_t scrape_time = NAN;
+  if (stats_scrape_num > 0)
+    scrape_time =
+        CDTIME_T_TO_DOUBLE(stats_scrape_time) / (gauge_t)stats_scrape_num;
+  gauge_t render_time = NAN;
+  if (stats_render_num > 0)
+    render_time =
+        CDTIME_T_TO_DOUBLE(stats_render_time) / (gauge_t)stats_render_num;
+
+  stats_scrape_time = 0;
+  stats_scrape_num = 0;
+  stats_render_time = 0;
+  stats_render_num = 0;
+  pthread_mutex_unlock(&snapshot_lock);
+
+  prom_submit("total_requests", "scrapes", (value_t){.derive = scrapes});
+  prom_submit("total_requests", "snapshots_reused", (value_t){.derive = reused});
+  prom_submit("duration", "scrape", (value_t){.gauge = scrape_time});
+  prom_submit("duration", "render", (value_t){.gauge = render_time});
+  prom_submit("bytes", "response", (value_t){.gauge = response_bytes});
+
+  return 0;
+}
+
+static int prom_init() {
   if (httpd == NULL) {
     httpd = prom_start_daemon();
     if (httpd == NULL) {
@@ -909,6 +1440,9 @@ static int prom_init() {
     }
     DEBUG("write_prometheus plugin: Successfully started microhttpd %s",
           MHD_get_version());
+
+    if (report_stats)
+      plugin_register_read("write_prometheus", prom_read);
   }
 
   return 0;
@@ -916,24 +1450,36 @@ static int prom_init() {
 
 static int prom_write(data_set_t const *ds, value_list_t const *vl,
                       __attribute__((unused)) user_data_t *ud) {
-  pthread_mutex_lock(&metrics_lock);
+  /* All data sources share the labels, so they are only hashed once. */
+  Io__Prometheus__Client__Metric *key = METRIC_INIT;
+  METRIC_ADD_LABELS(key, vl);
+  uint64_t labels_hash = metric_labels_hash(key);
 
   for (size_t i = 0; i < ds->ds_num; i++) {
+    char name[5 * DATA_MAX_NAME_LEN];
+    metric_family_name(name, sizeof(name), ds, vl, i);
+    uint64_t hash = prom_hash(PROM_HASH_INIT, name);
+    prom_shard_t *shard = prom_shard(hash);
+
+    pthread_mutex_lock(&shard->lock);
+
     Io__Prometheus__Client__MetricFamily *fam =
-        metric_family_get(ds, vl, i, /* allocate = */ true);
-    if (fam == NULL)
+        metric_family_get(shard, name, hash, ds, vl, i, /* allocate = */ true);
+    if (fam == NULL) {
+      pthread_mutex_unlock(&shard->lock);
       continue;
+    }
 
-    int status = metric_family_update(fam, ds, vl, i);
-    if (status != 0) {
+    int status = metric_family_update(fam, ds, vl, i, key, labels_hash);
+    if (status != 0)
       ERROR("write_prometheus plugin: Updating metric \"%s\" failed with "
             "status %d",
             fam->name, status);
-      continue;
-    }
+
+    shard->generation++;
+    pthread_mutex_unlock(&shard->lock);
   }
 
-  pthread_mutex_unlock(&metrics_lock);
   return 0;
 }
 
@@ -943,36 +1489,43 @@ static int prom_missing(value_list_t const *vl,
   if (ds == NULL)
     return ENOENT;
 
-  pthread_mutex_lock(&metrics_lock);
+  Io__Prometheus__Client__Metric *key = METRIC_INIT;
+  METRIC_ADD_LABELS(key, vl);
+  uint64_t labels_hash = metric_labels_hash(key);
 
   for (size_t i = 0; i < ds->ds_num; i++) {
+    char name[5 * DATA_MAX_NAME_LEN];
+    metric_family_name(name, sizeof(name), ds, vl, i);
+    uint64_t hash = prom_hash(PROM_HASH_INIT, name);
+    prom_shard_t *shard = prom_shard(hash);
+
+    pthread_mutex_lock(&shard->lock);
+
     Io__Prometheus__Client__MetricFamily *fam =
-        metric_family_get(ds, vl, i, /* allocate = */ false);
-    if (fam == NULL)
+        metric_family_get(shard, name, hash, ds, vl, i, /* allocate = */ false);
+    if (fam == NULL) {
+      pthread_mutex_unlock(&shard->lock);
       continue;
+    }
 
-    int status = metric_family_delete_metric(fam, vl);
+    int status = metric_family_delete_metric(fam, key, labels_hash);
     if (status != 0) {
       ERROR("write_prometheus plugin: Deleting a metric in family \"%s\" "
             "failed with status %d",
             fam->name, status);
-
+      pthread_mutex_unlock(&shard->lock);
       continue;
     }
 
     if (fam->n_metric == 0) {
-      int status = c_avl_remove(metrics, fam->name, NULL, NULL);
-      if (status != 0) {
-        ERROR("write_prometheus plugin: Deleting metric family \"%s\" failed "
-              "with status %d",
-              fam->name, status);
-        continue;
-      }
+      prom_table_remove(&shard->families, &((prom_family_t *)fam)->entry);
       metric_family_destroy(fam);
     }
+
+    shard->generation++;
+    pthread_mutex_unlock(&shard->lock);
   }
 
-  pthread_mutex_unlock(&metrics_lock);
   return 0;
 }
 
@@ -982,20 +1535,37 @@ static int prom_shutdown() {
     httpd = NULL;
   }
 
-  pthread_mutex_lock(&metrics_lock);
-  if (metrics != NULL) {
-    char *name;
-    Io__Prometheus__Client__MetricFamily *fam;
-    while (c_avl_pick(metrics, (void *)&name, (void *)&fam) == 0) {
-      assert(name == fam->name);
-      name = NULL;
+  for (size_t i = 0; i < PROM_SHARDS_NUM; i++) {
+    prom_shard_t *shard = shards + i;
 
-      metric_family_destroy(fam);
+    pthread_mutex_lock(&shard->lock);
+    for (size_t j = 0; j < shard->families.buckets_num; j++) {
+      while (shard->families.buckets[j] != NULL) {
+        prom_family_t *pf =
+            PROM_CONTAINER(shard->families.buckets[j], prom_family_t, entry);
+        shard->families.buckets[j] = pf->entry.next;
+
+        metric_family_destroy(&pf->pb);
+      }
     }
-    c_avl_destroy(metrics);
-    metrics = NULL;
+    sfree(shard->families.buckets);
+    shard->families = (prom_table_t){0};
+    shard->generation++;
+    pthread_mutex_unlock(&shard->lock);
   }
-  pthread_mutex_unlock(&metrics_lock);
+
+  /* All label sets have been released together with their metrics. */
+  pthread_mutex_lock(&label_sets_lock);
+  sfree(label_sets.buckets);
+  label_sets = (prom_table_t){0};
+  pthread_mutex_unlock(&label_sets_lock);
+
+  pthread_mutex_lock(&snapshot_lock);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(snapshots); i++) {
+    prom_snapshot_destroy(snapshots[i]);
+    snapshots[i] = NULL;
+  }
+  pthread_mutex_unlock(&snapshot_lock);
 
   sfree(httpd_host);
 
@@ -1003,6 +1573,9 @@ static int prom_shutdown() {
 }
 
 void module_register() {
+  for (size_t i = 0; i < PROM_SHARDS_NUM; i++)
+    pthread_mutex_init(&shards[i].lock, /* attr = */ NULL);
+
   plugin_register_complex_config("write_prometheus", prom_config);
   plugin_register_init("write_prometheus", prom_init);
   plugin_register_write("write_prometheus", prom_write,
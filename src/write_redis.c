@@ -27,6 +27,7 @@
 #include "collectd.h"
 
 #include "plugin.h"
+#include "utils/avltree/avltree.h"
 #include "utils/common/common.h"
 
 #include <hiredis/hiredis.h>
@@ -47,70 +48,102 @@ struct wr_node_s {
   int max_set_size;
   int max_set_duration;
   bool store_rates;
+  int pipeline_size;
+  bool transaction;
 
   redisContext *conn;
   pthread_mutex_t lock;
+
+  /* Identifiers added to the "values" set over the current connection. */
+  c_avl_tree_t *known;
+
+  /* Pipelined mode: commands appended to `conn' but not yet sent. */
+  int pending_values;
+  int pending_replies;
+  cdtime_t pending_since;
 };
 typedef struct wr_node_s wr_node_t;
 
 /*
  * Functions
  */
-static int wr_write(const data_set_t *ds, /* {{{ */
-                    const value_list_t *vl, user_data_t *ud) {
-  wr_node_t *node = ud->data;
-  char ident[512];
-  char key[512];
-  char value[512] = {0};
-  char time[24];
-  size_t value_size;
-  char *value_ptr;
-  int status;
-  redisReply *rr;
+static char const *wr_prefix(wr_node_t const *node) {
+  return (node->prefix != NULL) ? node->prefix : REDIS_DEFAULT_PREFIX;
+}
 
-  status = FORMAT_VL(ident, sizeof(ident), vl);
-  if (status != 0)
-    return status;
-  ssnprintf(key, sizeof(key), "%s%s",
-            (node->prefix != NULL) ? node->prefix : REDIS_DEFAULT_PREFIX,
-            ident);
-  ssnprintf(time, sizeof(time), "%.9f", CDTIME_T_TO_DOUBLE(vl->time));
+static void wr_disconnect_nolock(wr_node_t *node) /* {{{ */
+{
+  void *key;
+  void *value;
 
-  value_size = sizeof(value);
-  value_ptr = &value[0];
-  status = format_values(value_ptr, value_size, ds, vl, node->store_rates);
-  if (status != 0)
-    return status;
+  if (node->conn != NULL) {
+    redisFree(node->conn);
+    node->conn = NULL;
+  }
 
-  pthread_mutex_lock(&node->lock);
+  /* The server may have lost the "values" set, e.g. if it was restarted. */
+  while (c_avl_pick(node->known, &key, &value) == 0)
+    sfree(key);
+
+  node->pending_values = 0;
+  node->pending_replies = 0;
+} /* }}} void wr_disconnect_nolock */
+
+static int wr_connect_nolock(wr_node_t *node) /* {{{ */
+{
+  redisReply *rr;
+
+  if (node->conn != NULL)
+    return 0;
 
+  node->conn =
+      redisConnectWithTimeout((char *)node->host, node->port, node->timeout);
   if (node->conn == NULL) {
-    node->conn =
-        redisConnectWithTimeout((char *)node->host, node->port, node->timeout);
-    if (node->conn == NULL) {
-      ERROR("write_redis plugin: Connecting to host \"%s\" (port %i) failed: "
-            "Unknown reason",
-            (node->host != NULL) ? node->host : "localhost",
-            (node->port != 0) ? node->port : 6379);
-      pthread_mutex_unlock(&node->lock);
-      return -1;
-    } else if (node->conn->err) {
-      ERROR(
-          "write_redis plugin: Connecting to host \"%s\" (port %i) failed: %s",
+    ERROR("write_redis plugin: Connecting to host \"%s\" (port %i) failed: "
+          "Unknown reason",
+          (node->host != NULL) ? node->host : "localhost",
+          (node->port != 0) ? node->port : 6379);
+    return -1;
+  } else if (node->conn->err) {
+    ERROR("write_redis plugin: Connecting to host \"%s\" (port %i) failed: %s",
           (node->host != NULL) ? node->host : "localhost",
           (node->port != 0) ? node->port : 6379, node->conn->errstr);
-      pthread_mutex_unlock(&node->lock);
-      return -1;
-    }
-
-    rr = redisCommand(node->conn, "SELECT %d", node->database);
-    if (rr == NULL)
-      WARNING("SELECT command error. database:%d message:%s", node->database,
-              node->conn->errstr);
-    else
-      freeReplyObject(rr);
+    wr_disconnect_nolock(node);
+    return -1;
   }
 
+  rr = redisCommand(node->conn, "SELECT %d", node->database);
+  if (rr == NULL)
+    WARNING("SELECT command error. database:%d message:%s", node->database,
+            node->conn->errstr);
+  else
+    freeReplyObject(rr);
+
+  return 0;
+} /* }}} int wr_connect_nolock */
+
+/* Returns true if `ident' has already been added to the "values" set over the
+ * current connection and remembers it otherwise. */
+static bool wr_known_nolock(wr_node_t *node, char const *ident) /* {{{ */
+{
+  if (c_avl_get(node->known, ident, NULL) == 0)
+    return true;
+
+  char *copy = strdup(ident);
+  if (copy == NULL)
+    return false;
+  if (c_avl_insert(node->known, copy, NULL) != 0)
+    sfree(copy);
+
+  return false;
+} /* }}} bool wr_known_nolock */
+
+static int wr_write_sync_nolock(wr_node_t *node, /* {{{ */
+                                const value_list_t *vl, char const *ident,
+                                char const *key, char const *time,
+                                char const *value) {
+  redisReply *rr;
+
   rr = redisCommand(node->conn, "ZADD %s %s %s", key, time, value);
   if (rr == NULL)
     WARNING("ZADD command error. key:%s message:%s", key, node->conn->errstr);
@@ -141,23 +174,178 @@ static int wr_write(const data_set_t *ds, /* {{{ */
       freeReplyObject(rr);
   }
 
-  /* TODO(octo): This is more overhead than necessary. Use the cache and
-   * metadata to determine if it is a new metric and call SADD only once for
-   * each metric. */
-  rr = redisCommand(
-      node->conn, "SADD %svalues %s",
-      (node->prefix != NULL) ? node->prefix : REDIS_DEFAULT_PREFIX, ident);
-  if (rr == NULL)
-    WARNING("SADD command error. ident:%s message:%s", ident,
+  if (!wr_known_nolock(node, ident)) {
+    rr = redisCommand(node->conn, "SADD %svalues %s", wr_prefix(node), ident);
+    if (rr == NULL)
+      WARNING("SADD command error. ident:%s message:%s", ident,
+              node->conn->errstr);
+    else
+      freeReplyObject(rr);
+  }
+
+  /* hiredis contexts can not be used after an I/O or protocol error. */
+  if (node->conn->err)
+    wr_disconnect_nolock(node);
+
+  return 0;
+} /* }}} int wr_write_sync_nolock */
+
+/* Checks a reply of a pipelined command. Returns the number of errors. */
+static int wr_check_reply(redisReply const *rr) /* {{{ */
+{
+  int errors = 0;
+
+  if (rr->type == REDIS_REPLY_ERROR) {
+    WARNING("write_redis plugin: Command failed: %s", rr->str);
+    return 1;
+  }
+
+  /* The reply to EXEC holds the replies of all queued commands. */
+  if (rr->type == REDIS_REPLY_ARRAY)
+    for (size_t i = 0; i < rr->elements; i++)
+      errors += wr_check_reply(rr->element[i]);
+
+  return errors;
+} /* }}} int wr_check_reply */
+
+/* Sends all appended commands and reads their replies. */
+static int wr_pipeline_flush_nolock(wr_node_t *node) /* {{{ */
+{
+  redisReply *rr;
+  int errors = 0;
+
+  if ((node->conn == NULL) || (node->pending_replies == 0))
+    return 0;
+
+  if (node->transaction) {
+    if (redisAppendCommand(node->conn, "EXEC") != REDIS_OK) {
+      ERROR("write_redis plugin: Appending EXEC failed: %s",
             node->conn->errstr);
-  else
+      wr_disconnect_nolock(node);
+      return -1;
+    }
+    node->pending_replies++;
+  }
+
+  for (int i = 0; i < node->pending_replies; i++) {
+    if (redisGetReply(node->conn, (void **)&rr) != REDIS_OK) {
+      ERROR("write_redis plugin: Sending %i value lists to node \"%s\" "
+            "failed: %s",
+            node->pending_values, node->name, node->conn->errstr);
+      wr_disconnect_nolock(node);
+      return -1;
+    }
+    errors += wr_check_reply(rr);
     freeReplyObject(rr);
+  }
 
-  pthread_mutex_unlock(&node->lock);
+  node->pending_values = 0;
+  node->pending_replies = 0;
+
+  return (errors == 0) ? 0 : -1;
+} /* }}} int wr_pipeline_flush_nolock */
+
+#define WR_APPEND(...)                                                         \
+  do {                                                                         \
+    if (redisAppendCommand(node->conn, __VA_ARGS__) != REDIS_OK) {             \
+      ERROR("write_redis plugin: Appending a command failed: %s",              \
+            node->conn->errstr);                                               \
+      wr_disconnect_nolock(node);                                              \
+      return -1;                                                               \
+    }                                                                          \
+    node->pending_replies++;                                                   \
+  } while (0)
+
+/* Appends the commands for one value list to the pipeline. The commands are
+ * sent once `pipeline_size' value lists have been collected or when the
+ * plugin is flushed. */
+static int wr_write_pipelined_nolock(wr_node_t *node, /* {{{ */
+                                     const value_list_t *vl, char const *ident,
+                                     char const *key, char const *time,
+                                     char const *value) {
+  if (node->pending_values == 0) {
+    node->pending_since = cdtime();
+    if (node->transaction)
+      WR_APPEND("MULTI");
+  }
+
+  WR_APPEND("ZADD %s %s %s", key, time, value);
+
+  if (node->max_set_size >= 0)
+    WR_APPEND("ZREMRANGEBYRANK %s %d %d", key, 0,
+              (-1 * node->max_set_size) - 1);
+
+  if (node->max_set_duration > 0)
+    WR_APPEND("ZREMRANGEBYSCORE %s -1 (%.9f", key,
+              (CDTIME_T_TO_DOUBLE(vl->time) - node->max_set_duration));
+
+  if (!wr_known_nolock(node, ident))
+    WR_APPEND("SADD %svalues %s", wr_prefix(node), ident);
+
+  node->pending_values++;
+  if (node->pending_values >= node->pipeline_size)
+    return wr_pipeline_flush_nolock(node);
 
   return 0;
+} /* }}} int wr_write_pipelined_nolock */
+
+#undef WR_APPEND
+
+static int wr_write(const data_set_t *ds, /* {{{ */
+                    const value_list_t *vl, user_data_t *ud) {
+  wr_node_t *node = ud->data;
+  char ident[512];
+  char key[512];
+  char value[512] = {0};
+  char time[24];
+  size_t value_size;
+  char *value_ptr;
+  int status;
+
+  status = FORMAT_VL(ident, sizeof(ident), vl);
+  if (status != 0)
+    return status;
+  ssnprintf(key, sizeof(key), "%s%s", wr_prefix(node), ident);
+  ssnprintf(time, sizeof(time), "%.9f", CDTIME_T_TO_DOUBLE(vl->time));
+
+  value_size = sizeof(value);
+  value_ptr = &value[0];
+  status = format_values(value_ptr, value_size, ds, vl, node->store_rates);
+  if (status != 0)
+    return status;
+
+  pthread_mutex_lock(&node->lock);
+
+  if (wr_connect_nolock(node) != 0) {
+    pthread_mutex_unlock(&node->lock);
+    return -1;
+  }
+
+  if (node->pipeline_size > 0)
+    status = wr_write_pipelined_nolock(node, vl, ident, key, time, value);
+  else
+    status = wr_write_sync_nolock(node, vl, ident, key, time, value);
+
+  pthread_mutex_unlock(&node->lock);
+
+  return status;
 } /* }}} int wr_write */
 
+static int wr_flush(cdtime_t timeout, /* {{{ */
+                    const char *identifier __attribute__((unused)),
+                    user_data_t *ud) {
+  wr_node_t *node = ud->data;
+  int status = 0;
+
+  pthread_mutex_lock(&node->lock);
+  /* timeout == 0  => flush unconditionally */
+  if ((timeout == 0) || ((node->pending_since + timeout) <= cdtime()))
+    status = wr_pipeline_flush_nolock(node);
+  pthread_mutex_unlock(&node->lock);
+
+  return status;
+} /* }}} int wr_flush */
+
 static void wr_config_free(void *ptr) /* {{{ */
 {
   wr_node_t *node = ptr;
@@ -165,12 +353,15 @@ static void wr_config_free(void *ptr) /* {{{ */
   if (node == NULL)
     return;
 
-  if (node->conn != NULL) {
-    redisFree(node->conn);
-    node->conn = NULL;
+  wr_pipeline_flush_nolock(node);
+  if (node->known != NULL) {
+    wr_disconnect_nolock(node);
+    c_avl_destroy(node->known);
   }
 
   sfree(node->host);
+  sfree(node->prefix);
+  pthread_mutex_destroy(&node->lock);
   sfree(node);
 } /* }}} void wr_config_free */
 
@@ -193,11 +384,19 @@ static int wr_config_node(oconfig_item_t *ci) /* {{{ */
   node->max_set_size = -1;
   node->max_set_duration = -1;
   node->store_rates = true;
+  node->pipeline_size = 0;
+  node->transaction = false;
   pthread_mutex_init(&node->lock, /* attr = */ NULL);
 
+  node->known = c_avl_create((int (*)(const void *, const void *))strcmp);
+  if (node->known == NULL) {
+    wr_config_free(node);
+    return ENOMEM;
+  }
+
   status = cf_util_get_string_buffer(ci, node->name, sizeof(node->name));
   if (status != 0) {
-    sfree(node);
+    wr_config_free(node);
     return status;
   }
 
@@ -229,6 +428,10 @@ static int wr_config_node(oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_int(child, &node->max_set_duration);
     } else if (strcasecmp("StoreRates", child->key) == 0) {
       status = cf_util_get_boolean(child, &node->store_rates);
+    } else if (strcasecmp("PipelineSize", child->key) == 0) {
+      status = cf_util_get_int(child, &node->pipeline_size);
+    } else if (strcasecmp("Transaction", child->key) == 0) {
+      status = cf_util_get_boolean(child, &node->transaction);
     } else
       WARNING("write_redis plugin: Ignoring unknown config option \"%s\".",
               child->key);
@@ -247,6 +450,8 @@ static int wr_config_node(oconfig_item_t *ci) /* {{{ */
                                        .data = node,
                                        .free_func = wr_config_free,
                                    });
+    if ((status == 0) && (node->pipeline_size > 0))
+      plugin_register_flush(cb_name, wr_flush, &(user_data_t){.data = node});
   }
 
   if (status != 0)
@@ -31,11 +31,13 @@
 #include "collectd.h"
 
 #include "plugin.h"
+#include "utils/avltree/avltree.h"
 #include "utils/common/common.h"
 #include "utils_cache.h"
 #include "utils_complain.h"
 #include "write_riemann_threshold.h"
 
+#include <poll.h>
 #include <riemann/riemann-client.h>
 
 #define RIEMANN_HOST "localhost"
@@ -43,6 +45,37 @@
 #define RIEMANN_TTL_FACTOR 2.0
 #define RIEMANN_BATCH_MAX 8192
 
+/* Number of batches the sender thread may have sent without having received
+ * their acknowledgement yet. */
+#define RIEMANN_MAX_IN_FLIGHT 8
+/* While the sender thread is busy, the next batch may grow up to this many
+ * times BatchMaxSize before it is dropped. */
+#define RIEMANN_ASYNC_BACKLOG 16
+#define RIEMANN_ASYNC_POLL_INTERVAL MS_TO_CDTIME_T(100)
+/* Upper bound for the number of cached series per node. */
+#define RIEMANN_SERIES_MAX 65536
+
+typedef struct {
+  char *plugin;
+  char *plugin_instance;
+  char *type;
+  char *type_instance;
+} wrr_series_id_t;
+
+/* Strings which only depend on the identifier and the data set of a series.
+ * They are computed once instead of for every value. */
+typedef struct {
+  char *service;
+  char *ds_type;
+  char ds_index[24];
+} wrr_series_ds_t;
+
+typedef struct {
+  wrr_series_id_t id;
+  size_t ds_num;
+  wrr_series_ds_t *ds;
+} wrr_series_t;
+
 struct riemann_host {
   c_complain_t init_complaint;
   char *name;
@@ -67,6 +100,27 @@ struct riemann_host {
   char *tls_cert_file;
   char *tls_key_file;
   struct timeval timeout;
+
+  /* Packed size of batch_msg. */
+  size_t batch_len;
+  /* Number of messages sent but not acknowledged yet. */
+  int in_flight;
+
+  /* Asynchronous mode: writers append to batch_msg under queue_lock, the
+   * sender thread takes over full batches via send_msg. host->lock protects
+   * the connection only. */
+  bool async;
+  pthread_mutex_t queue_lock;
+  pthread_cond_t queue_cond;
+  riemann_message_t *send_msg;
+  bool flush_pending;
+  pthread_t send_thread;
+  bool send_thread_running;
+  bool send_thread_shutdown;
+  c_complain_t queue_complaint;
+
+  pthread_mutex_t series_lock;
+  c_avl_tree_t *series;
 };
 
 static char **riemann_tags;
@@ -129,18 +183,60 @@ static int wrr_disconnect(struct riemann_host *host) /* {{{ */
 
   riemann_client_free(host->client);
   host->client = NULL;
+  /* Acknowledgements for anything sent on this connection are lost. */
+  host->in_flight = 0;
 
   return 0;
 } /* }}} int wrr_disconnect */
 
+/*
+ * Reads acknowledgements until at most `max_in_flight' messages are
+ * outstanding, blocking if necessary. Acknowledgements which have already
+ * arrived are read in any case.
+ *
+ * host->lock must be held when calling this function.
+ */
+static int wrr_recv_acks_nolock(struct riemann_host *host, /* {{{ */
+                                int max_in_flight) {
+  while (host->in_flight > 0) {
+    riemann_message_t *response;
+
+    if (host->in_flight <= max_in_flight) {
+      struct pollfd pfd = {
+          .fd = riemann_client_get_fd(host->client),
+          .events = POLLIN,
+      };
+
+      if (poll(&pfd, 1, /* timeout = */ 0) <= 0)
+        break;
+    }
+
+    response = riemann_client_recv_message(host->client);
+    if (response == NULL) {
+      int status = (errno != 0) ? errno : -1;
+      wrr_disconnect(host);
+      return status;
+    }
+    host->in_flight--;
+
+    if (response->has_ok && !response->ok)
+      ERROR("write_riemann plugin: Riemann rejected a message: %s",
+            (response->error != NULL) ? response->error : "unknown error");
+    riemann_message_free(response);
+  }
+
+  return 0;
+} /* }}} int wrr_recv_acks_nolock */
+
 /**
  * Function to send messages to riemann.
  *
- * Acquires the host lock, disconnects on errors.
+ * For TCP, up to `max_in_flight' messages may be left unacknowledged; their
+ * acknowledgements are read by later calls. Disconnects on errors.
  */
-static int wrr_send_nolock(struct riemann_host *host,
-                           riemann_message_t *msg) /* {{{ */
-{
+static int wrr_send_pipelined_nolock(struct riemann_host *host, /* {{{ */
+                                     riemann_message_t *msg,
+                                     int max_in_flight) {
   int status = 0;
 
   status = wrr_connect(host);
@@ -158,19 +254,17 @@ static int wrr_send_nolock(struct riemann_host *host,
    * For TCP we need to receive message acknowledgemenent.
    */
   if (host->client_type != RIEMANN_CLIENT_UDP) {
-    riemann_message_t *response;
-
-    response = riemann_client_recv_message(host->client);
-
-    if (response == NULL) {
-      wrr_disconnect(host);
-      return errno;
-    }
-    riemann_message_free(response);
+    host->in_flight++;
+    return wrr_recv_acks_nolock(host, max_in_flight);
   }
 
   return 0;
-} /* }}} int wrr_send */
+} /* }}} int wrr_send_pipelined_nolock */
+
+/* Sends a message and waits for all outstanding acknowledgements. */
+static int wrr_send_nolock(struct riemann_host *host, riemann_message_t *msg) {
+  return wrr_send_pipelined_nolock(host, msg, /* max_in_flight = */ 0);
+}
 
 static int wrr_send(struct riemann_host *host, riemann_message_t *msg) {
   int status = 0;
@@ -271,38 +365,173 @@ static riemann_message_t *wrr_notification_to_message(notification_t const *n) {
   return msg;
 }
 
-static riemann_event_t *
-wrr_value_to_event(struct riemann_host const *host, /* {{{ */
-                   data_set_t const *ds, value_list_t const *vl, size_t index,
-                   gauge_t const *rates, int status) {
-  riemann_event_t *event;
+static int wrr_series_id_compare(wrr_series_id_t const *a, /* {{{ */
+                                 wrr_series_id_t const *b) {
+  int status;
+
+  if ((status = strcmp(a->plugin, b->plugin)) != 0)
+    return status;
+  if ((status = strcmp(a->plugin_instance, b->plugin_instance)) != 0)
+    return status;
+  if ((status = strcmp(a->type, b->type)) != 0)
+    return status;
+  return strcmp(a->type_instance, b->type_instance);
+} /* }}} int wrr_series_id_compare */
+
+static void wrr_series_free(wrr_series_t *s) /* {{{ */
+{
+  if (s == NULL)
+    return;
+
+  if (s->ds != NULL) {
+    for (size_t i = 0; i < s->ds_num; i++) {
+      sfree(s->ds[i].service);
+      sfree(s->ds[i].ds_type);
+    }
+    sfree(s->ds);
+  }
+  sfree(s->id.plugin);
+  sfree(s->id.plugin_instance);
+  sfree(s->id.type);
+  sfree(s->id.type_instance);
+  sfree(s);
+} /* }}} void wrr_series_free */
+
+/* host->series_lock must be held when calling this function. */
+static void wrr_series_clear(struct riemann_host *host) /* {{{ */
+{
+  void *key;
+  void *value;
+
+  if (host->series == NULL)
+    return;
+
+  while (c_avl_pick(host->series, &key, &value) == 0)
+    wrr_series_free(value);
+} /* }}} void wrr_series_clear */
+
+static wrr_series_t *wrr_series_create(struct riemann_host const *host, /* {{{ */
+                                       data_set_t const *ds,
+                                       value_list_t const *vl) {
   char name_buffer[5 * DATA_MAX_NAME_LEN];
   char service_buffer[6 * DATA_MAX_NAME_LEN];
-  size_t i;
+  char ds_type[DATA_MAX_NAME_LEN];
+  wrr_series_t *s;
 
-  event = riemann_event_new();
-  if (event == NULL) {
-    ERROR("write_riemann plugin: riemann_event_new() failed.");
+  s = calloc(1, sizeof(*s));
+  if (s == NULL)
+    return NULL;
+
+  s->id.plugin = strdup(vl->plugin);
+  s->id.plugin_instance = strdup(vl->plugin_instance);
+  s->id.type = strdup(vl->type);
+  s->id.type_instance = strdup(vl->type_instance);
+  s->ds = calloc(ds->ds_num, sizeof(*s->ds));
+  s->ds_num = ds->ds_num;
+  if ((s->id.plugin == NULL) || (s->id.plugin_instance == NULL) ||
+      (s->id.type == NULL) || (s->id.type_instance == NULL) ||
+      (s->ds == NULL)) {
+    wrr_series_free(s);
     return NULL;
   }
 
   format_name(name_buffer, sizeof(name_buffer),
               /* host = */ "", vl->plugin, vl->plugin_instance, vl->type,
               vl->type_instance);
-  if (host->always_append_ds || (ds->ds_num > 1)) {
-    if (host->event_service_prefix == NULL)
-      ssnprintf(service_buffer, sizeof(service_buffer), "%s/%s",
-                &name_buffer[1], ds->ds[index].name);
-    else
-      ssnprintf(service_buffer, sizeof(service_buffer), "%s%s/%s",
-                host->event_service_prefix, &name_buffer[1],
-                ds->ds[index].name);
-  } else {
-    if (host->event_service_prefix == NULL)
-      sstrncpy(service_buffer, &name_buffer[1], sizeof(service_buffer));
+
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    if (host->always_append_ds || (ds->ds_num > 1)) {
+      if (host->event_service_prefix == NULL)
+        ssnprintf(service_buffer, sizeof(service_buffer), "%s/%s",
+                  &name_buffer[1], ds->ds[i].name);
+      else
+        ssnprintf(service_buffer, sizeof(service_buffer), "%s%s/%s",
+                  host->event_service_prefix, &name_buffer[1],
+                  ds->ds[i].name);
+    } else {
+      if (host->event_service_prefix == NULL)
+        sstrncpy(service_buffer, &name_buffer[1], sizeof(service_buffer));
+      else
+        ssnprintf(service_buffer, sizeof(service_buffer), "%s%s",
+                  host->event_service_prefix, &name_buffer[1]);
+    }
+
+    if ((ds->ds[i].type != DS_TYPE_GAUGE) && host->store_rates)
+      ssnprintf(ds_type, sizeof(ds_type), "%s:rate",
+                DS_TYPE_TO_STRING(ds->ds[i].type));
     else
-      ssnprintf(service_buffer, sizeof(service_buffer), "%s%s",
-                host->event_service_prefix, &name_buffer[1]);
+      sstrncpy(ds_type, DS_TYPE_TO_STRING(ds->ds[i].type), sizeof(ds_type));
+
+    ssnprintf(s->ds[i].ds_index, sizeof(s->ds[i].ds_index), "%" PRIsz, i);
+
+    s->ds[i].service = strdup(service_buffer);
+    s->ds[i].ds_type = strdup(ds_type);
+    if ((s->ds[i].service == NULL) || (s->ds[i].ds_type == NULL)) {
+      wrr_series_free(s);
+      return NULL;
+    }
+  }
+
+  return s;
+} /* }}} wrr_series_t *wrr_series_create */
+
+/*
+ * Returns the cached strings for the series of `vl', creating them if
+ * necessary.
+ *
+ * host->series_lock must be held when calling this function and while the
+ * returned entry is in use.
+ */
+static wrr_series_t *wrr_series_get(struct riemann_host *host, /* {{{ */
+                                    data_set_t const *ds,
+                                    value_list_t const *vl) {
+  wrr_series_id_t id = {
+      .plugin = (char *)vl->plugin,
+      .plugin_instance = (char *)vl->plugin_instance,
+      .type = (char *)vl->type,
+      .type_instance = (char *)vl->type_instance,
+  };
+  wrr_series_t *s = NULL;
+
+  if (c_avl_get(host->series, &id, (void *)&s) == 0) {
+    if (s->ds_num == ds->ds_num)
+      return s;
+
+    /* The data set changed, e.g. because types.db was reloaded. */
+    c_avl_remove(host->series, &id, NULL, NULL);
+    wrr_series_free(s);
+  }
+
+  if (c_avl_size(host->series) >= RIEMANN_SERIES_MAX)
+    wrr_series_clear(host);
+
+  s = wrr_series_create(host, ds, vl);
+  if (s == NULL) {
+    ERROR("write_riemann plugin: wrr_series_create failed.");
+    return NULL;
+  }
+
+  if (c_avl_insert(host->series, &s->id, s) != 0) {
+    ERROR("write_riemann plugin: c_avl_insert failed.");
+    wrr_series_free(s);
+    return NULL;
+  }
+
+  return s;
+} /* }}} wrr_series_t *wrr_series_get */
+
+static riemann_event_t *
+wrr_value_to_event(struct riemann_host const *host, /* {{{ */
+                   data_set_t const *ds, value_list_t const *vl,
+                   wrr_series_t const *series, size_t index,
+                   gauge_t const *rates, int status) {
+  riemann_event_t *event;
+  size_t i;
+
+  event = riemann_event_new();
+  if (event == NULL) {
+    ERROR("write_riemann plugin: riemann_event_new() failed.");
+    return NULL;
   }
 
   riemann_event_set(
@@ -311,7 +540,8 @@ wrr_value_to_event(struct riemann_host const *host, /* {{{ */
       (float)CDTIME_T_TO_DOUBLE(vl->interval) * host->ttl_factor,
       RIEMANN_EVENT_FIELD_STRING_ATTRIBUTES, "plugin", vl->plugin, "type",
       vl->type, "ds_name", ds->ds[index].name, NULL,
-      RIEMANN_EVENT_FIELD_SERVICE, service_buffer, RIEMANN_EVENT_FIELD_NONE);
+      RIEMANN_EVENT_FIELD_SERVICE, series->ds[index].service,
+      RIEMANN_EVENT_FIELD_NONE);
 
 #if RCC_VERSION_NUMBER >= 0x010A00
   riemann_event_set(event, RIEMANN_EVENT_FIELD_TIME_MICROS,
@@ -347,23 +577,10 @@ wrr_value_to_event(struct riemann_host const *host, /* {{{ */
     riemann_event_string_attribute_add(event, "type_instance",
                                        vl->type_instance);
 
-  if ((ds->ds[index].type != DS_TYPE_GAUGE) && (rates != NULL)) {
-    char ds_type[DATA_MAX_NAME_LEN];
-
-    ssnprintf(ds_type, sizeof(ds_type), "%s:rate",
-              DS_TYPE_TO_STRING(ds->ds[index].type));
-    riemann_event_string_attribute_add(event, "ds_type", ds_type);
-  } else {
-    riemann_event_string_attribute_add(event, "ds_type",
-                                       DS_TYPE_TO_STRING(ds->ds[index].type));
-  }
-
-  {
-    char ds_index[DATA_MAX_NAME_LEN];
-
-    ssnprintf(ds_index, sizeof(ds_index), "%" PRIsz, index);
-    riemann_event_string_attribute_add(event, "ds_index", ds_index);
-  }
+  riemann_event_string_attribute_add(event, "ds_type",
+                                     series->ds[index].ds_type);
+  riemann_event_string_attribute_add(event, "ds_index",
+                                     series->ds[index].ds_index);
 
   for (i = 0; i < riemann_attrs_num; i += 2)
     riemann_event_string_attribute_add(event, riemann_attrs[i],
@@ -418,10 +635,11 @@ wrr_value_to_event(struct riemann_host const *host, /* {{{ */
 } /* }}} riemann_event_t *wrr_value_to_event */
 
 static riemann_message_t *
-wrr_value_list_to_message(struct riemann_host const *host, /* {{{ */
+wrr_value_list_to_message(struct riemann_host *host, /* {{{ */
                           data_set_t const *ds, value_list_t const *vl,
                           int *statuses) {
   riemann_message_t *msg;
+  wrr_series_t *series;
   size_t i;
   gauge_t *rates = NULL;
 
@@ -441,17 +659,28 @@ wrr_value_list_to_message(struct riemann_host const *host, /* {{{ */
     }
   }
 
+  pthread_mutex_lock(&host->series_lock);
+  series = wrr_series_get(host, ds, vl);
+  if (series == NULL) {
+    pthread_mutex_unlock(&host->series_lock);
+    riemann_message_free(msg);
+    sfree(rates);
+    return NULL;
+  }
+
   for (i = 0; i < vl->values_len; i++) {
     riemann_event_t *event;
 
-    event = wrr_value_to_event(host, ds, vl, (int)i, rates, statuses[i]);
+    event = wrr_value_to_event(host, ds, vl, series, i, rates, statuses[i]);
     if (event == NULL) {
+      pthread_mutex_unlock(&host->series_lock);
       riemann_message_free(msg);
       sfree(rates);
       return NULL;
     }
     riemann_message_append_events(msg, event, NULL);
   }
+  pthread_mutex_unlock(&host->series_lock);
 
   sfree(rates);
   return msg;
@@ -470,14 +699,204 @@ static int wrr_batch_flush_nolock(cdtime_t timeout, struct riemann_host *host) {
       return status;
     }
   }
-  wrr_send_nolock(host, host->batch_msg);
+  if (host->batch_msg == NULL)
+    return status;
+
+  status = wrr_send_nolock(host, host->batch_msg);
   riemann_message_free(host->batch_msg);
 
   host->batch_init = now;
   host->batch_msg = NULL;
+  host->batch_len = 0;
   return status;
 }
 
+/*
+ * Appends the events of `msg' to the current batch and frees `msg'. Keeps
+ * track of the packed size, so it does not have to be recomputed for the
+ * whole batch after every append.
+ *
+ * Call while holding host->lock, or host->queue_lock in asynchronous mode.
+ */
+static int wrr_batch_append_nolock(struct riemann_host *host, /* {{{ */
+                                   riemann_message_t *msg) {
+  size_t len = riemann_message_get_packed_size(msg);
+
+  if (host->batch_msg == NULL) {
+    host->batch_msg = msg;
+  } else {
+    int status;
+
+    status = riemann_message_append_events_n(host->batch_msg, msg->n_events,
+                                             msg->events);
+    msg->n_events = 0;
+    msg->events = NULL;
+
+    riemann_message_free(msg);
+
+    if (status != 0) {
+      ERROR("write_riemann plugin: out of memory");
+      return -1;
+    }
+  }
+
+  host->batch_len += len;
+  return 0;
+} /* }}} int wrr_batch_append_nolock */
+
+/* host->queue_lock must be held when calling this function. */
+static bool wrr_batch_ready_nolock(struct riemann_host const *host, /* {{{ */
+                                   cdtime_t now) {
+  if (host->batch_msg == NULL)
+    return false;
+
+  if ((host->batch_max < 0) || (((size_t)host->batch_max) <= host->batch_len))
+    return true;
+
+  if (host->flush_pending)
+    return true;
+
+  if (host->batch_timeout > 0) {
+    cdtime_t timeout = TIME_T_TO_CDTIME_T((time_t)host->batch_timeout);
+    if ((host->batch_init + timeout) <= now)
+      return true;
+  }
+
+  return false;
+} /* }}} bool wrr_batch_ready_nolock */
+
+/*
+ * Hands the current batch over to the sender thread. If the sender is still
+ * busy with the previous batch, the current one keeps growing until it
+ * reaches the backlog limit, at which point it is dropped.
+ *
+ * host->queue_lock must be held when calling this function.
+ */
+static void wrr_batch_handoff_nolock(struct riemann_host *host) /* {{{ */
+{
+  size_t backlog_max;
+
+  if (host->batch_msg == NULL)
+    return;
+
+  if (host->send_msg == NULL) {
+    host->send_msg = host->batch_msg;
+    host->batch_msg = NULL;
+    host->batch_len = 0;
+    host->batch_init = cdtime();
+    host->flush_pending = false;
+    pthread_cond_signal(&host->queue_cond);
+    return;
+  }
+
+  backlog_max = RIEMANN_ASYNC_BACKLOG *
+                ((host->batch_max > 0) ? (size_t)host->batch_max
+                                       : (size_t)RIEMANN_BATCH_MAX);
+  if (host->batch_len < backlog_max)
+    return;
+
+  c_complain(LOG_WARNING, &host->queue_complaint,
+             "write_riemann plugin: Riemann at %s is not keeping up, "
+             "dropping %zu events.",
+             (host->node != NULL) ? host->node : RIEMANN_HOST,
+             host->batch_msg->n_events);
+  riemann_message_free(host->batch_msg);
+  host->batch_msg = NULL;
+  host->batch_len = 0;
+  host->batch_init = cdtime();
+} /* }}} void wrr_batch_handoff_nolock */
+
+static void *wrr_send_thread(void *arg) /* {{{ */
+{
+  struct riemann_host *host = arg;
+
+  pthread_mutex_lock(&host->queue_lock);
+  while (true) {
+    riemann_message_t *msg;
+    cdtime_t now = cdtime();
+    int status;
+
+    if ((host->send_msg == NULL) &&
+        (host->send_thread_shutdown || wrr_batch_ready_nolock(host, now)))
+      wrr_batch_handoff_nolock(host);
+
+    if (host->send_msg == NULL) {
+      struct timespec abstime;
+
+      if (host->send_thread_shutdown)
+        break;
+
+      abstime = CDTIME_T_TO_TIMESPEC(now + RIEMANN_ASYNC_POLL_INTERVAL);
+      pthread_cond_timedwait(&host->queue_cond, &host->queue_lock, &abstime);
+      if ((host->send_msg != NULL) || host->send_thread_shutdown)
+        continue;
+
+      /* Pick up acknowledgements which arrived in the meantime. */
+      pthread_mutex_unlock(&host->queue_lock);
+      pthread_mutex_lock(&host->lock);
+      wrr_recv_acks_nolock(host, host->in_flight);
+      pthread_mutex_unlock(&host->lock);
+      pthread_mutex_lock(&host->queue_lock);
+      continue;
+    }
+
+    /* Writers keep filling batch_msg while this batch is being sent. */
+    msg = host->send_msg;
+    pthread_mutex_unlock(&host->queue_lock);
+
+    pthread_mutex_lock(&host->lock);
+    status = wrr_send_pipelined_nolock(host, msg, RIEMANN_MAX_IN_FLIGHT - 1);
+    pthread_mutex_unlock(&host->lock);
+
+    if (status != 0)
+      c_complain(
+          LOG_ERR, &host->init_complaint,
+          "write_riemann plugin: riemann_client_send failed with status %i",
+          status);
+    else
+      c_release(LOG_DEBUG, &host->init_complaint,
+                "write_riemann plugin: batch sent.");
+    riemann_message_free(msg);
+
+    pthread_mutex_lock(&host->queue_lock);
+    host->send_msg = NULL;
+  }
+  pthread_mutex_unlock(&host->queue_lock);
+
+  /* Wait for outstanding acknowledgements before the connection is closed. */
+  pthread_mutex_lock(&host->lock);
+  wrr_recv_acks_nolock(host, /* max_in_flight = */ 0);
+  pthread_mutex_unlock(&host->lock);
+
+  return NULL;
+} /* }}} void *wrr_send_thread */
+
+/* Starts the sender thread on first use. The configuration is read before
+ * the daemon forks, so a thread started from wrr_config_node() would not
+ * exist in the daemon process. Falls back to synchronous sending if the
+ * thread cannot be started.
+ * host->queue_lock must be held when calling this function. */
+static int wrr_async_init_nolock(struct riemann_host *host) /* {{{ */
+{
+  if (!host->async)
+    return -1;
+  if (host->send_thread_running)
+    return 0;
+
+  int status = plugin_thread_create(&host->send_thread, wrr_send_thread, host,
+                                    "riemann send");
+  if (status != 0) {
+    ERROR("write_riemann plugin: Node \"%s\": Starting the sender thread "
+          "failed, sending synchronously.",
+          host->name);
+    host->async = false;
+    return status;
+  }
+
+  host->send_thread_running = true;
+  return 0;
+} /* }}} int wrr_async_init_nolock */
+
 static int wrr_batch_flush(cdtime_t timeout,
                            const char *identifier __attribute__((unused)),
                            user_data_t *user_data) {
@@ -488,6 +907,18 @@ static int wrr_batch_flush(cdtime_t timeout,
     return -EINVAL;
 
   host = user_data->data;
+
+  if (host->async) {
+    pthread_mutex_lock(&host->queue_lock);
+    if ((host->batch_msg != NULL) &&
+        ((timeout == 0) || ((host->batch_init + timeout) <= cdtime()))) {
+      host->flush_pending = true;
+      wrr_batch_handoff_nolock(host);
+    }
+    pthread_mutex_unlock(&host->queue_lock);
+    return 0;
+  }
+
   pthread_mutex_lock(&host->lock);
   status = wrr_batch_flush_nolock(timeout, host);
   if (status != 0)
@@ -507,7 +938,6 @@ static int wrr_batch_add_value_list(struct riemann_host *host, /* {{{ */
                                     data_set_t const *ds,
                                     value_list_t const *vl, int *statuses) {
   riemann_message_t *msg;
-  size_t len;
   int ret;
   cdtime_t timeout;
 
@@ -515,30 +945,27 @@ static int wrr_batch_add_value_list(struct riemann_host *host, /* {{{ */
   if (msg == NULL)
     return -1;
 
-  pthread_mutex_lock(&host->lock);
-
-  if (host->batch_msg == NULL) {
-    host->batch_msg = msg;
-  } else {
-    int status;
-
-    status = riemann_message_append_events_n(host->batch_msg, msg->n_events,
-                                             msg->events);
-    msg->n_events = 0;
-    msg->events = NULL;
+  if (host->async) {
+    pthread_mutex_lock(&host->queue_lock);
+    if (wrr_async_init_nolock(host) == 0) {
+      ret = wrr_batch_append_nolock(host, msg);
+      if ((ret == 0) && wrr_batch_ready_nolock(host, cdtime()))
+        wrr_batch_handoff_nolock(host);
+      pthread_mutex_unlock(&host->queue_lock);
+      return ret;
+    }
+    pthread_mutex_unlock(&host->queue_lock);
+  }
 
-    riemann_message_free(msg);
+  pthread_mutex_lock(&host->lock);
 
-    if (status != 0) {
-      pthread_mutex_unlock(&host->lock);
-      ERROR("write_riemann plugin: out of memory");
-      return -1;
-    }
+  ret = wrr_batch_append_nolock(host, msg);
+  if (ret != 0) {
+    pthread_mutex_unlock(&host->lock);
+    return ret;
   }
 
-  len = riemann_message_get_packed_size(host->batch_msg);
-  ret = 0;
-  if ((host->batch_max < 0) || (((size_t)host->batch_max) <= len)) {
+  if ((host->batch_max < 0) || (((size_t)host->batch_max) <= host->batch_len)) {
     ret = wrr_batch_flush_nolock(0, host);
   } else {
     if (host->batch_timeout > 0) {
@@ -624,10 +1051,40 @@ static void wrr_free(void *p) /* {{{ */
     pthread_mutex_unlock(&host->lock);
     return;
   }
+  pthread_mutex_unlock(&host->lock);
+
+  /* The sender thread sends what is left in the queue before it exits. */
+  pthread_mutex_lock(&host->queue_lock);
+  bool send_thread_running = host->send_thread_running;
+  host->send_thread_shutdown = true;
+  pthread_cond_signal(&host->queue_cond);
+  pthread_mutex_unlock(&host->queue_lock);
+
+  if (send_thread_running) {
+    pthread_join(host->send_thread, NULL);
+    host->send_thread_running = false;
+  }
 
   wrr_disconnect(host);
 
-  pthread_mutex_lock(&host->lock);
+  if (host->batch_msg != NULL)
+    riemann_message_free(host->batch_msg);
+
+  if (host->series != NULL) {
+    wrr_series_clear(host);
+    c_avl_destroy(host->series);
+  }
+
+  sfree(host->name);
+  sfree(host->node);
+  sfree(host->event_service_prefix);
+  sfree(host->tls_ca_file);
+  sfree(host->tls_cert_file);
+  sfree(host->tls_key_file);
+
+  pthread_cond_destroy(&host->queue_cond);
+  pthread_mutex_destroy(&host->queue_lock);
+  pthread_mutex_destroy(&host->series_lock);
   pthread_mutex_destroy(&host->lock);
   sfree(host);
 } /* }}} void wrr_free */
@@ -645,7 +1102,11 @@ static int wrr_config_node(oconfig_item_t *ci) /* {{{ */
     return ENOMEM;
   }
   pthread_mutex_init(&host->lock, NULL);
+  pthread_mutex_init(&host->queue_lock, NULL);
+  pthread_cond_init(&host->queue_cond, NULL);
+  pthread_mutex_init(&host->series_lock, NULL);
   C_COMPLAIN_INIT(&host->init_complaint);
+  C_COMPLAIN_INIT(&host->queue_complaint);
   host->reference_count = 1;
   host->node = NULL;
   host->port = 0;
@@ -662,6 +1123,15 @@ static int wrr_config_node(oconfig_item_t *ci) /* {{{ */
   host->client_type = RIEMANN_CLIENT_TCP;
   host->timeout.tv_sec = 0;
   host->timeout.tv_usec = 0;
+  host->async = false;
+
+  host->series = c_avl_create(
+      (int (*)(const void *, const void *))wrr_series_id_compare);
+  if (host->series == NULL) {
+    ERROR("write_riemann plugin: c_avl_create failed.");
+    wrr_free(host);
+    return ENOMEM;
+  }
 
   status = cf_util_get_string(ci, &host->name);
   if (status != 0) {
@@ -706,6 +1176,10 @@ static int wrr_config_node(oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_int(child, &host->batch_timeout);
       if (status != 0)
         break;
+    } else if (strcasecmp("Asynchronous", child->key) == 0) {
+      status = cf_util_get_boolean(child, &host->async);
+      if (status != 0)
+        break;
     } else if (strcasecmp("Timeout", child->key) == 0) {
 #if RCC_VERSION_NUMBER >= 0x010800
       status = cf_util_get_int(child, (int *)&host->timeout.tv_sec);
@@ -796,6 +1270,14 @@ static int wrr_config_node(oconfig_item_t *ci) /* {{{ */
     return status;
   }
 
+  if (host->async &&
+      ((host->client_type == RIEMANN_CLIENT_UDP) || !host->batch_mode)) {
+    WARNING("write_riemann plugin: Node \"%s\": The Asynchronous option "
+            "requires Batch mode over TCP or TLS and will be ignored.",
+            host->name);
+    host->async = false;
+  }
+
   ssnprintf(callback_name, sizeof(callback_name), "write_riemann/%s",
             host->name);
 